@@ -30,6 +30,7 @@
 #include "server.h"
 #include "bio.h"
 #include "rio.h"
+#include "aofbin.h"
 
 #include <signal.h>
 #include <fcntl.h>
@@ -42,6 +43,9 @@
 
 void aofUpdateCurrentSize(void);
 void aofClosePipes(void);
+sds aofManifestFilename(void);
+void aofFsyncedAll(void);
+void aofSealBinaryBlock(void);
 
 /* ----------------------------------------------------------------------------
  * AOF rewrite buffer implementation.
@@ -193,6 +197,370 @@ ssize_t aofRewriteBufferWrite(int fd) {
     return count;
 }
 
+/* ----------------------------------------------------------------------------
+ * Multi part AOF
+ *
+ * When aof-multi-part is enabled the AOF is not a single file, but a base
+ * file written by the latest rewrite, followed by incr files logging the
+ * writes performed since then. A small manifest, replaced atomically with
+ * rename(2), lists the files forming the AOF in loading order:
+ *
+ *   file "appendonly.aof.3.base.aof" seq 3 type b
+ *   file "appendonly.aof.7.incr.aof" seq 7 type i
+ *   file "appendonly.aof.8.incr.aof" seq 8 type i
+ *
+ * A rewrite just switches the writes to a new incr file: the child writes
+ * the new base file, while the parent no longer needs to accumulate the
+ * writes performed meanwhile in the rewrite buffer and to send them to the
+ * child, since the new incr file already logs them. When the child is done
+ * the manifest is switched to the new base file, and the files it replaces
+ * are deleted.
+ * ------------------------------------------------------------------------- */
+
+sds aofManifestFilename(void) {
+    return sdscatfmt(sdsempty(),"%s.manifest",server.aof_filename);
+}
+
+static aofPart *aofPartCreate(int type, long long seq, sds filename) {
+    aofPart *p = zmalloc(sizeof(*p));
+
+    p->type = type;
+    p->seq = seq;
+    p->filename = filename;
+    return p;
+}
+
+static void aofPartFree(aofPart *p) {
+    sdsfree(p->filename);
+    zfree(p);
+}
+
+/* Delete a file no longer referenced by the manifest. The file is opened
+ * before unlinking it, so that the blocks are actually reclaimed by the
+ * background thread closing it, without blocking the server. */
+static void aofPartDelete(aofPart *p) {
+    int fd = open(p->filename,O_RDONLY|O_NONBLOCK);
+
+    if (unlink(p->filename) == -1 && errno != ENOENT) {
+        serverLog(LL_WARNING,"Can't remove the old AOF file %s: %s",
+            p->filename, strerror(errno));
+    }
+    if (fd != -1) bioCreateBackgroundJob(BIO_CLOSE_FILE,(void*)(long)fd,NULL,NULL);
+    aofPartFree(p);
+}
+
+/* Forget the base and incr files of the in memory manifest. */
+static void aofManifestReset(void) {
+    if (server.aof_base) aofPartFree(server.aof_base);
+    server.aof_base = NULL;
+    while(listLength(server.aof_incrs)) {
+        listNode *ln = listFirst(server.aof_incrs);
+
+        aofPartFree(listNodeValue(ln));
+        listDelNode(server.aof_incrs,ln);
+    }
+}
+
+/* Load the manifest into server.aof_base and server.aof_incrs. When there
+ * is no manifest, but an AOF written with aof-multi-part disabled exists,
+ * it is adopted as the base file, so that the dataset is not lost when the
+ * option is enabled on an existing instance. Returns C_ERR if the manifest
+ * can't be read or is malformed. */
+static int aofLoadManifest(void) {
+    sds manifest = aofManifestFilename();
+    char buf[1024];
+    int linenum = 0;
+    FILE *fp;
+
+    aofManifestReset();
+    server.aof_base_seq = 0;
+    server.aof_incr_seq = 0;
+    if ((fp = fopen(manifest,"r")) == NULL) {
+        if (errno != ENOENT) {
+            serverLog(LL_WARNING,"Can't open the AOF manifest %s: %s",
+                manifest, strerror(errno));
+            sdsfree(manifest);
+            return C_ERR;
+        }
+        if (access(server.aof_filename,F_OK) == 0) {
+            serverLog(LL_NOTICE,"No AOF manifest found, using %s as base file",
+                server.aof_filename);
+            server.aof_base = aofPartCreate(AOF_PART_BASE,0,
+                sdsnew(server.aof_filename));
+        }
+        sdsfree(manifest);
+        return C_OK;
+    }
+
+    while(fgets(buf,sizeof(buf),fp) != NULL) {
+        sds line, *argv;
+        int argc, type;
+        long long seq;
+        aofPart *p;
+
+        linenum++;
+        line = sdstrim(sdsnew(buf)," \t\r\n");
+        if (line[0] == '\0' || line[0] == '#') {
+            sdsfree(line);
+            continue;
+        }
+        argv = sdssplitargs(line,&argc);
+        sdsfree(line);
+        if (argv == NULL) goto fmterr;
+        if (argc != 6 || strcasecmp(argv[0],"file") ||
+            strcasecmp(argv[2],"seq") || strcasecmp(argv[4],"type") ||
+            !string2ll(argv[3],sdslen(argv[3]),&seq) || seq < 0 ||
+            sdslen(argv[5]) != 1)
+        {
+            sdsfreesplitres(argv,argc);
+            goto fmterr;
+        }
+        type = argv[5][0];
+        if ((type != AOF_PART_BASE && type != AOF_PART_INCR) ||
+            (type == AOF_PART_BASE && server.aof_base != NULL))
+        {
+            sdsfreesplitres(argv,argc);
+            goto fmterr;
+        }
+        p = aofPartCreate(type,seq,sdsdup(argv[1]));
+        sdsfreesplitres(argv,argc);
+        if (type == AOF_PART_BASE) {
+            server.aof_base = p;
+            if (seq > server.aof_base_seq) server.aof_base_seq = seq;
+        } else {
+            listAddNodeTail(server.aof_incrs,p);
+            if (seq > server.aof_incr_seq) server.aof_incr_seq = seq;
+        }
+    }
+    if (ferror(fp)) {
+        serverLog(LL_WARNING,"Error reading the AOF manifest %s: %s",
+            manifest, strerror(errno));
+        goto err;
+    }
+    fclose(fp);
+    sdsfree(manifest);
+    return C_OK;
+
+fmterr:
+    serverLog(LL_WARNING,"Bad format of the AOF manifest %s at line %d",
+        manifest, linenum);
+err:
+    aofManifestReset();
+    fclose(fp);
+    sdsfree(manifest);
+    return C_ERR;
+}
+
+static sds aofManifestCatPart(sds buf, aofPart *p) {
+    buf = sdscat(buf,"file ");
+    buf = sdscatrepr(buf,p->filename,sdslen(p->filename));
+    return sdscatprintf(buf," seq %lld type %c\n",p->seq,p->type);
+}
+
+/* Replace atomically the manifest on disk with one listing 'base', if not
+ * NULL, followed by the incr files with a sequence number >= 'minseq'. */
+static int aofPersistManifest(aofPart *base, long long minseq) {
+    sds manifest = aofManifestFilename();
+    sds buf = sdsempty();
+    char tmpfile[256];
+    listIter li;
+    listNode *ln;
+    int fd, retval = C_ERR;
+
+    if (base) buf = aofManifestCatPart(buf,base);
+    listRewind(server.aof_incrs,&li);
+    while((ln = listNext(&li)) != NULL) {
+        aofPart *p = listNodeValue(ln);
+
+        if (p->seq >= minseq) buf = aofManifestCatPart(buf,p);
+    }
+
+    snprintf(tmpfile,256,"temp-%d.manifest",(int) getpid());
+    fd = open(tmpfile,O_WRONLY|O_CREAT|O_TRUNC,0644);
+    if (fd == -1 || write(fd,buf,sdslen(buf)) != (ssize_t)sdslen(buf) ||
+        fsync(fd) == -1)
+    {
+        serverLog(LL_WARNING,"Error writing the AOF manifest: %s",
+            strerror(errno));
+        if (fd != -1) {
+            close(fd);
+            unlink(tmpfile);
+        }
+        goto cleanup;
+    }
+    close(fd);
+    if (rename(tmpfile,manifest) == -1) {
+        serverLog(LL_WARNING,"Error moving the temp AOF manifest on the "
+                             "final destination: %s", strerror(errno));
+        unlink(tmpfile);
+        goto cleanup;
+    }
+    retval = C_OK;
+
+cleanup:
+    sdsfree(manifest);
+    sdsfree(buf);
+    return retval;
+}
+
+/* Create a new incr file and switch the AOF writes to it. The previous incr
+ * file is fsynced and closed in background. If 'persist' is true the new
+ * file is added to the manifest on disk before switching, so that no write
+ * can go to a file that would not be loaded on restart. */
+static int aofOpenNewIncr(int persist) {
+    long long seq = server.aof_incr_seq+1;
+    sds filename = sdscatfmt(sdsempty(),"%s.%I.incr.aof",
+        server.aof_filename,seq);
+    int fd = open(filename,O_WRONLY|O_APPEND|O_CREAT|O_TRUNC,0644);
+
+    if (fd == -1) {
+        serverLog(LL_WARNING,"Can't create the AOF incr file %s: %s",
+            filename, strerror(errno));
+        sdsfree(filename);
+        return C_ERR;
+    }
+    listAddNodeTail(server.aof_incrs,aofPartCreate(AOF_PART_INCR,seq,filename));
+    if (persist && aofPersistManifest(server.aof_base,0) == C_ERR) {
+        listNode *ln = listLast(server.aof_incrs);
+
+        close(fd);
+        unlink(filename);
+        aofPartFree(listNodeValue(ln));
+        listDelNode(server.aof_incrs,ln);
+        return C_ERR;
+    }
+    server.aof_incr_seq = seq;
+    if (server.aof_fd != -1 && aofGroupCommitEnabled()) {
+        /* Replies waiting for the group fsync can't wait for the close. */
+        aof_fsync(server.aof_fd);
+        aofFsyncedAll();
+    }
+    if (server.aof_fd != -1) {
+        aofWriterDrain();
+        bioCreateBackgroundJob(BIO_CLOSE_FILE,(void*)(long)server.aof_fd,
+            (void*)1,NULL);
+    }
+    server.aof_fd = fd;
+    server.aof_last_incr_size = 0;
+    server.aof_selected_db = -1; /* Every file starts with a SELECT. */
+    server.aof_cur_timestamp = 0;
+    return C_OK;
+}
+
+/* Called at startup when the AOF is enabled with aof-multi-part: load the
+ * manifest and open the last incr file for appending, or create the first
+ * one. Errors are fatal. */
+void aofOpenMultiPart(void) {
+    if (aofLoadManifest() == C_ERR) exit(1);
+    if (listLength(server.aof_incrs) == 0) {
+        if (aofOpenNewIncr(1) == C_ERR) exit(1);
+    } else {
+        aofPart *last = listNodeValue(listLast(server.aof_incrs));
+
+        server.aof_fd = open(last->filename,O_WRONLY|O_APPEND);
+        if (server.aof_fd == -1) {
+            serverLog(LL_WARNING,"Can't open the append-only file %s: %s",
+                last->filename, strerror(errno));
+            exit(1);
+        }
+    }
+}
+
+/* Called when a rewrite starts: the writes performed from now on go to a
+ * new incr file, that is kept together with the base file written by the
+ * child, while the previous files will be replaced by it. */
+static int aofRewriteStartMultiPart(void) {
+    if (server.aof_base == NULL && listLength(server.aof_incrs) == 0 &&
+        aofLoadManifest() == C_ERR) return C_ERR;
+    server.aof_rewrite_incr_seq = server.aof_incr_seq+1;
+    if (server.aof_state == AOF_OFF) return C_OK;
+
+    /* What is still in the AOF buffer was already applied to the dataset
+     * the child is going to write, so it must go to the previous file. */
+    flushAppendOnlyFile(1);
+    if (sdslen(server.aof_buf)) {
+        serverLog(LL_WARNING,"Can't switch to a new AOF incr file while "
+                             "the AOF buffer can't be written");
+        return C_ERR;
+    }
+    /* While switching the AOF on, the files are not a valid AOF until the
+     * rewrite terminates, so the manifest is left untouched. */
+    return aofOpenNewIncr(server.aof_state == AOF_ON);
+}
+
+/* Called when a rewrite started to switch the AOF on did not complete: the
+ * incr files created for it are not in the manifest, so they would never be
+ * loaded, and are deleted. The next rewrite creates a new one. */
+static void aofRewriteFailedMultiPart(void) {
+    listIter li;
+    listNode *ln;
+
+    if (server.aof_fd != -1) {
+        bioCreateBackgroundJob(BIO_CLOSE_FILE,(void*)(long)server.aof_fd,
+            NULL,NULL);
+        server.aof_fd = -1;
+    }
+    listRewind(server.aof_incrs,&li);
+    while((ln = listNext(&li)) != NULL) {
+        aofPart *p = listNodeValue(ln);
+
+        if (p->seq < server.aof_rewrite_incr_seq) continue;
+        aofPartDelete(p);
+        listDelNode(server.aof_incrs,ln);
+    }
+}
+
+/* Called when the rewrite child terminated with success: the temp file
+ * becomes the new base file, replacing in the manifest the previous base
+ * file and the incr files created before the rewrite started. */
+static int aofRewriteDoneMultiPart(void) {
+    char tmpfile[256];
+    long long seq = server.aof_base_seq+1;
+    sds filename = sdscatfmt(sdsempty(),"%s.%I.base.aof",
+        server.aof_filename,seq);
+    aofPart *base;
+    listIter li;
+    listNode *ln;
+    mstime_t latency;
+
+    snprintf(tmpfile,256,"temp-rewriteaof-bg-%d.aof",
+        (int)server.aof_child_pid);
+    latencyStartMonitor(latency);
+    if (rename(tmpfile,filename) == -1) {
+        serverLog(LL_WARNING,
+            "Error trying to rename the temporary AOF file %s into %s: %s",
+            tmpfile, filename, strerror(errno));
+        sdsfree(filename);
+        return C_ERR;
+    }
+    latencyEndMonitor(latency);
+    latencyAddSampleIfNeeded("aof-rename",latency);
+
+    base = aofPartCreate(AOF_PART_BASE,seq,filename);
+    if (aofPersistManifest(base,server.aof_rewrite_incr_seq) == C_ERR) {
+        unlink(filename);
+        aofPartFree(base);
+        return C_ERR;
+    }
+
+    /* The manifest now references the new base file: delete the files it
+     * replaces. */
+    server.aof_base_seq = seq;
+    if (server.aof_base) aofPartDelete(server.aof_base);
+    server.aof_base = base;
+    listRewind(server.aof_incrs,&li);
+    while((ln = listNext(&li)) != NULL) {
+        aofPart *p = listNodeValue(ln);
+
+        if (p->seq >= server.aof_rewrite_incr_seq) continue;
+        aofPartDelete(p);
+        listDelNode(server.aof_incrs,ln);
+    }
+    aofUpdateCurrentSize();
+    server.aof_rewrite_base_size = server.aof_current_size;
+    return C_OK;
+}
+
 /* ----------------------------------------------------------------------------
  * AOF file implementation
  * ------------------------------------------------------------------------- */
@@ -203,16 +571,139 @@ void aof_background_fsync(int fd) {
     bioCreateBackgroundJob(BIO_AOF_FSYNC,(void*)(long)fd,NULL,NULL);
 }
 
+/* ----------------------------------------------------------------------------
+ * AOF group commit
+ *
+ * With "appendfsync always" and aof-group-commit enabled the fsync is not
+ * performed by flushAppendOnlyFile() before the replies are sent. Instead
+ * the clients that performed writes are flagged CLIENT_AOF_FSYNC_WAIT, and
+ * their replies are held until a background fsync covering the AOF offset
+ * of their writes completes. Only one fsync is in flight at a given time:
+ * the writes performed meanwhile, by any number of clients and event loop
+ * cycles, are covered by the next one, started as soon as it completes.
+ *
+ * The bio thread reports the fsynced offset writing it into a pipe, so that
+ * the main thread wakes up to release the replies.
+ * ------------------------------------------------------------------------- */
+
+void aofGroupFsyncDoneHandler(aeEventLoop *el, int fd, void *privdata, int mask);
+
+/* Create the pipe used by the bio thread to notify completed group fsyncs. */
+void aofCreateFsyncPipe(void) {
+    if (pipe(server.aof_fsync_pipe) == -1 ||
+        anetNonBlock(NULL,server.aof_fsync_pipe[0]) != ANET_OK ||
+        aeCreateFileEvent(server.el,server.aof_fsync_pipe[0],AE_READABLE,
+            aofGroupFsyncDoneHandler,NULL) == AE_ERR)
+    {
+        serverPanic("Can't create the AOF group commit pipe.");
+    }
+}
+
+int aofGroupCommitEnabled(void) {
+    return server.aof_group_commit && server.aof_fsync == AOF_FSYNC_ALWAYS &&
+           server.aof_state == AOF_ON;
+}
+
+/* Hold the replies of the client until the AOF is fsynced up to the data
+ * appended so far to the AOF buffer. */
+void aofClientWaitFsync(client *c) {
+    if (c->fd == -1 || c->flags & CLIENT_MASTER) return;
+    c->aof_fsync_offset = server.aof_fed_offset;
+    if (!(c->flags & CLIENT_AOF_FSYNC_WAIT)) {
+        c->flags |= CLIENT_AOF_FSYNC_WAIT;
+        listAddNodeTail(server.aof_fsync_waiting,c);
+    }
+}
+
+/* Release the replies of the clients waiting for an AOF offset <= 'offset',
+ * scheduling them to be written before re-entering the event loop. Called
+ * with LLONG_MAX to release all the clients when the AOF is turned off or
+ * group commit is disabled. */
+void aofReleaseFsyncWaiters(long long offset) {
+    listIter li;
+    listNode *ln;
+
+    listRewind(server.aof_fsync_waiting,&li);
+    while((ln = listNext(&li)) != NULL) {
+        client *c = listNodeValue(ln);
+
+        if (c->aof_fsync_offset > offset) continue;
+        c->flags &= ~CLIENT_AOF_FSYNC_WAIT;
+        listDelNode(server.aof_fsync_waiting,ln);
+        if (clientHasPendingReplies(c) && !(c->flags & CLIENT_PENDING_WRITE)) {
+            c->flags |= CLIENT_PENDING_WRITE;
+            listAddNodeHead(server.clients_pending_write,c);
+        }
+    }
+}
+
+/* Start a background fsync of the data written so far, unless one is already
+ * in progress: in that case the next one is started when it completes. */
+void aofGroupFsync(void) {
+    long long *offset;
+
+    if (server.aof_group_fsync_in_progress || server.aof_fd == -1 ||
+        server.aof_written_offset <= server.aof_fsynced_offset) return;
+    offset = zmalloc(sizeof(*offset));
+    *offset = server.aof_written_offset;
+    server.aof_group_fsync_in_progress = 1;
+    server.stat_aof_group_fsyncs++;
+    /* Clients are waiting for this fsync: don't queue it after the
+     * background fsyncs of "everysec". */
+    bioCreatePriorityJob(BIO_AOF_FSYNC,(void*)(long)server.aof_fd,offset,NULL);
+}
+
+/* Called by the bio thread once a group fsync terminated: 'offset' is the
+ * AOF offset it covered. Like the fsync performed by flushAppendOnlyFile()
+ * with "appendfsync always", errors are not reported. */
+void aofGroupFsyncDone(long long offset) {
+    if (write(server.aof_fsync_pipe[1],&offset,sizeof(offset)) != sizeof(offset)) {
+        /* Nothing to do, the pipe can't be full with a single fsync in
+         * flight. */
+    }
+}
+
+void aofGroupFsyncDoneHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    long long offset;
+    int done = 0;
+    UNUSED(el);
+    UNUSED(privdata);
+    UNUSED(mask);
+
+    while(read(fd,&offset,sizeof(offset)) == sizeof(offset)) {
+        if (offset > server.aof_fsynced_offset)
+            server.aof_fsynced_offset = offset;
+        done = 1;
+    }
+    if (!done) return;
+    server.aof_group_fsync_in_progress = 0;
+    server.aof_last_fsync = server.unixtime;
+    aofReleaseFsyncWaiters(server.aof_fsynced_offset);
+    if (aofGroupCommitEnabled()) aofGroupFsync();
+}
+
+/* Called after fsyncing synchronously the current AOF file, that contains all
+ * the data appended to the AOF buffer so far. */
+void aofFsyncedAll(void) {
+    server.aof_written_offset = server.aof_fed_offset;
+    server.aof_fsynced_offset = server.aof_fed_offset;
+    aofReleaseFsyncWaiters(server.aof_fsynced_offset);
+}
+
 /* Called when the user switches from "appendonly yes" to "appendonly no"
  * at runtime using the CONFIG command. */
 void stopAppendOnly(void) {
+    int switching_on = server.aof_state == AOF_WAIT_REWRITE;
+
     serverAssert(server.aof_state != AOF_OFF);
     flushAppendOnlyFile(1);
     aof_fsync(server.aof_fd);
+    aofFsyncedAll();
     close(server.aof_fd);
 
     server.aof_fd = -1;
     server.aof_selected_db = -1;
+    server.aof_cur_timestamp = 0;
     server.aof_state = AOF_OFF;
     /* rewrite operation in progress? kill it, wait child exit */
     if (server.aof_child_pid != -1) {
@@ -223,13 +714,17 @@ void stopAppendOnly(void) {
         if (kill(server.aof_child_pid,SIGUSR1) != -1) {
             while(wait3(&statloc,0,NULL) != server.aof_child_pid);
         }
+        /* The child was killed: there is no info to receive. */
+        closeChildInfoPipe();
         /* reset the buffer accumulating changes while the child saves */
         aofRewriteBufferReset();
         aofRemoveTempFile(server.aof_child_pid);
         server.aof_child_pid = -1;
         server.aof_rewrite_time_start = -1;
         /* close pipes used for IPC between the two processes. */
-        aofClosePipes();
+        if (!server.aof_multi_part) aofClosePipes();
+        if (server.aof_multi_part && switching_on)
+            aofRewriteFailedMultiPart();
     }
 }
 
@@ -239,9 +734,11 @@ int startAppendOnly(void) {
     char cwd[MAXPATHLEN]; /* Current working dir path for error messages. */
 
     server.aof_last_fsync = server.unixtime;
-    server.aof_fd = open(server.aof_filename,O_WRONLY|O_APPEND|O_CREAT,0644);
     serverAssert(server.aof_state == AOF_OFF);
-    if (server.aof_fd == -1) {
+    /* With a multi part AOF the rewrite opens the new incr file itself. */
+    if (!server.aof_multi_part)
+        server.aof_fd = open(server.aof_filename,O_WRONLY|O_APPEND|O_CREAT,0644);
+    if (!server.aof_multi_part && server.aof_fd == -1) {
         char *cwdp = getcwd(cwd,MAXPATHLEN);
 
         serverLog(LL_WARNING,
@@ -252,20 +749,283 @@ int startAppendOnly(void) {
             strerror(errno));
         return C_ERR;
     }
+    /* The state is set before starting the rewrite, so that a multi part
+     * AOF starts logging the writes into a new incr file. */
+    server.aof_state = AOF_WAIT_REWRITE;
     if (server.rdb_child_pid != -1) {
         server.aof_rewrite_scheduled = 1;
         serverLog(LL_WARNING,"AOF was enabled but there is already a child process saving an RDB file on disk. An AOF background was scheduled to start when possible.");
     } else if (rewriteAppendOnlyFileBackground() == C_ERR) {
-        close(server.aof_fd);
+        if (server.aof_fd != -1) close(server.aof_fd);
+        server.aof_fd = -1;
+        server.aof_state = AOF_OFF;
         serverLog(LL_WARNING,"Redis needs to enable the AOF but can't trigger a background AOF rewrite operation. Check the above logs for more info about the error.");
         return C_ERR;
     }
     /* We correctly switched on AOF, now wait for the rewrite to be complete
      * in order to append data on disk. */
-    server.aof_state = AOF_WAIT_REWRITE;
     return C_OK;
 }
 
+/* ----------------------------------------------------------------------------
+ * AOF writer thread
+ *
+ * With aof-writer-thread enabled and an fsync policy other than "always",
+ * flushAppendOnlyFile() does not write(2) the AOF buffer itself: the buffer
+ * is queued as a job for a writer thread, so that a slow disk no longer
+ * blocks the event loop. The data queued and not yet written is bounded by
+ * aof-writer-max-pending: past it the main thread waits for the writer, that
+ * is, the disk latency is again reflected into the command latency.
+ *
+ * The writer stops at the first error, leaving the job that failed and the
+ * following ones in the queue. The main thread then moves the data back in
+ * front of the AOF buffer, and writes it itself, so that the usual error
+ * handling applies, before handing the buffer to the writer again.
+ *
+ * The main thread waits for the queue to be empty before closing or
+ * replacing the AOF file descriptor.
+ * ------------------------------------------------------------------------- */
+
+typedef struct aofWriterJob {
+    int fd;
+    sds buf;
+    long long offset;       /* AOF offset once the job is written. */
+} aofWriterJob;
+
+static struct aofWriter {
+    int started;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t job_cond;    /* Signaled when a job is queued. */
+    pthread_cond_t done_cond;   /* Signaled when a job is done or failed. */
+    list *jobs;                 /* Jobs to write, oldest first. */
+    size_t pending;             /* Bytes in the jobs. */
+    off_t written;              /* Bytes written not yet accounted. */
+    long long written_offset;   /* AOF offset written so far. */
+    int failed;                 /* The first job can't be written. */
+    mstime_t write_latency;     /* Slowest write not yet accounted. */
+    long long fsync_offset;     /* AOF offset of the last fsync started. */
+} aofWriter;
+
+/* Replies can't be sent before the AOF is written with "appendfsync always",
+ * and after a write error the main thread writes the AOF itself until the
+ * error is solved. */
+int aofWriterEnabled(void) {
+    return server.aof_writer_thread && server.aof_fsync != AOF_FSYNC_ALWAYS &&
+           server.aof_last_write_status == C_OK;
+}
+
+static void *aofWriterMain(void *arg) {
+    UNUSED(arg);
+
+    pthread_mutex_lock(&aofWriter.mutex);
+    while(1) {
+        aofWriterJob *job;
+        ssize_t nwritten;
+        size_t len;
+        mstime_t latency;
+
+        while (listLength(aofWriter.jobs) == 0 || aofWriter.failed)
+            pthread_cond_wait(&aofWriter.job_cond,&aofWriter.mutex);
+        job = listNodeValue(listFirst(aofWriter.jobs));
+        len = sdslen(job->buf);
+        pthread_mutex_unlock(&aofWriter.mutex);
+
+        latency = mstime();
+        nwritten = write(job->fd,job->buf,len);
+        latency = mstime()-latency;
+        if (nwritten > 0 && (size_t)nwritten != len) {
+            /* Remove the short write like flushAppendOnlyFile() does. */
+            struct redis_stat sb;
+
+            if (redis_fstat(job->fd,&sb) != -1 &&
+                ftruncate(job->fd,sb.st_size-nwritten) != -1) nwritten = -1;
+        }
+
+        pthread_mutex_lock(&aofWriter.mutex);
+        if (latency > aofWriter.write_latency)
+            aofWriter.write_latency = latency;
+        if (nwritten > 0) {
+            aofWriter.written += nwritten;
+            aofWriter.pending -= nwritten;
+        }
+        if ((size_t)nwritten == len) {
+            aofWriter.written_offset = job->offset;
+            sdsfree(job->buf);
+            zfree(job);
+            listDelNode(aofWriter.jobs,listFirst(aofWriter.jobs));
+        } else {
+            if (nwritten > 0) sdsrange(job->buf,nwritten,-1);
+            aofWriter.failed = 1;
+        }
+        pthread_cond_broadcast(&aofWriter.done_cond);
+    }
+    return NULL;
+}
+
+static int aofWriterStart(void) {
+    aofWriter.jobs = listCreate();
+    pthread_mutex_init(&aofWriter.mutex,NULL);
+    pthread_cond_init(&aofWriter.job_cond,NULL);
+    pthread_cond_init(&aofWriter.done_cond,NULL);
+    if (pthread_create(&aofWriter.thread,NULL,aofWriterMain,NULL) != 0) {
+        serverLog(LL_WARNING,"Can't create the AOF writer thread, "
+                             "writing the AOF from the main thread.");
+        pthread_cond_destroy(&aofWriter.done_cond);
+        pthread_cond_destroy(&aofWriter.job_cond);
+        pthread_mutex_destroy(&aofWriter.mutex);
+        listRelease(aofWriter.jobs);
+        server.aof_writer_thread = 0;
+        return C_ERR;
+    }
+    aofWriter.started = 1;
+    return C_OK;
+}
+
+/* Account the data written by the writer thread. If it failed, move the data
+ * of its jobs back in front of the AOF buffer and return 1, otherwise return
+ * 0. Called with the mutex held. */
+static int aofWriterCollect(void) {
+    /* The latency of the writes is not seen by the clients, but it is
+     * still useful to monitor the disk. */
+    latencyAddSampleIfNeeded("aof-writer-write",aofWriter.write_latency);
+    aofWriter.write_latency = 0;
+    server.aof_current_size += aofWriter.written;
+    server.aof_last_incr_size += aofWriter.written;
+    aofWriter.written = 0;
+    if (aofWriter.written_offset > server.aof_written_offset)
+        server.aof_written_offset = aofWriter.written_offset;
+
+    if (aofWriter.failed) {
+        sds buf = sdsempty();
+        listNode *ln;
+
+        while ((ln = listFirst(aofWriter.jobs)) != NULL) {
+            aofWriterJob *job = listNodeValue(ln);
+
+            buf = sdscatsds(buf,job->buf);
+            sdsfree(job->buf);
+            zfree(job);
+            listDelNode(aofWriter.jobs,ln);
+        }
+        if (server.aof_bin_block_start != -1)
+            server.aof_bin_block_start += sdslen(buf);
+        buf = sdscatsds(buf,server.aof_buf);
+        sdsfree(server.aof_buf);
+        server.aof_buf = buf;
+        aofWriter.pending = 0;
+        aofWriter.failed = 0;
+        return 1;
+    }
+    return 0;
+}
+
+/* Wait for the writer thread to write all its jobs, or to fail. Called with
+ * the mutex held. */
+static int aofWriterWait(void) {
+    while (listLength(aofWriter.jobs) && !aofWriter.failed)
+        pthread_cond_wait(&aofWriter.done_cond,&aofWriter.mutex);
+    return aofWriterCollect();
+}
+
+/* Queue the AOF buffer for the writer thread, waiting for the queued jobs to
+ * be written if 'force' is true. Returns C_ERR if the caller has to write
+ * the AOF buffer itself: this happens when the writer is disabled, or when
+ * it failed and its data was moved back into the AOF buffer. */
+int aofWriterFlush(int force) {
+    int enabled = aofWriterEnabled(), retval = C_OK;
+    mstime_t latency;
+
+    if (!aofWriter.started && (!enabled || aofWriterStart() == C_ERR))
+        return C_ERR;
+
+    pthread_mutex_lock(&aofWriter.mutex);
+    if (aofWriterCollect() || !enabled) {
+        aofWriterWait();
+        retval = C_ERR;
+    } else if (sdslen(server.aof_buf)) {
+        aofWriterJob *job;
+        size_t len;
+
+        /* Seal the binary block still open, that is part of the write. */
+        aofSealBinaryBlock();
+        len = sdslen(server.aof_buf);
+
+        /* Backpressure: wait for the writer to catch up. */
+        if (aofWriter.pending &&
+            aofWriter.pending+len > (size_t)server.aof_writer_max_pending)
+        {
+            latencyStartMonitor(latency);
+            while (aofWriter.pending &&
+                   aofWriter.pending+len >
+                   (size_t)server.aof_writer_max_pending &&
+                   !aofWriter.failed)
+            {
+                pthread_cond_wait(&aofWriter.done_cond,&aofWriter.mutex);
+            }
+            latencyEndMonitor(latency);
+            latencyAddSampleIfNeeded("aof-writer-backpressure",latency);
+            server.stat_aof_writer_waits++;
+            if (aofWriterCollect()) goto failed;
+        }
+
+        job = zmalloc(sizeof(*job));
+        job->fd = server.aof_fd;
+        job->buf = server.aof_buf;
+        job->offset = server.aof_fed_offset;
+        listAddNodeTail(aofWriter.jobs,job);
+        aofWriter.pending += len;
+        server.aof_buf = sdsempty();
+        server.aof_flush_postponed_start = 0;
+        pthread_cond_signal(&aofWriter.job_cond);
+    }
+    if (force) aofWriterWait();
+
+failed:
+    if (sdslen(server.aof_buf)) retval = C_ERR;
+    pthread_mutex_unlock(&aofWriter.mutex);
+    return retval;
+}
+
+/* Start the background fsync of "appendfsync everysec" for the data written
+ * by the writer thread since the last one. */
+static void aofWriterFsync(void) {
+    if (server.aof_fsync != AOF_FSYNC_EVERYSEC ||
+        server.unixtime <= server.aof_last_fsync ||
+        server.aof_written_offset == aofWriter.fsync_offset) return;
+
+    /* Don't fsync if no-appendfsync-on-rewrite is set to yes and there are
+     * children doing I/O in the background. */
+    if (server.aof_no_fsync_on_rewrite &&
+        (server.aof_child_pid != -1 || server.rdb_child_pid != -1)) return;
+
+    if (bioPendingJobsOfType(BIO_AOF_FSYNC) == 0) {
+        aof_background_fsync(server.aof_fd);
+        aofWriter.fsync_offset = server.aof_written_offset;
+    }
+    server.aof_last_fsync = server.unixtime;
+}
+
+/* Wait for the writer thread to write all the queued jobs. Called before
+ * the AOF file descriptor is closed or replaced. */
+void aofWriterDrain(void) {
+    if (!aofWriter.started) return;
+    pthread_mutex_lock(&aofWriter.mutex);
+    aofWriterWait();
+    pthread_mutex_unlock(&aofWriter.mutex);
+}
+
+/* Return the bytes queued for the writer thread and not yet written. */
+size_t aofWriterPendingBytes(void) {
+    size_t pending;
+
+    if (!aofWriter.started) return 0;
+    pthread_mutex_lock(&aofWriter.mutex);
+    pending = aofWriter.pending;
+    pthread_mutex_unlock(&aofWriter.mutex);
+    return pending;
+}
+
 /* Write the append only file buffer on disk.
  *
  * Since we are required to write the AOF before replying to the client,
@@ -290,6 +1050,12 @@ void flushAppendOnlyFile(int force) {
     int sync_in_progress = 0;
     mstime_t latency;
 
+    /* With aof-writer-thread the buffer is written by the writer thread. */
+    if (aofWriterFlush(force) == C_OK) {
+        aofWriterFsync();
+        return;
+    }
+
     if (sdslen(server.aof_buf) == 0) return;
 
     if (server.aof_fsync == AOF_FSYNC_EVERYSEC)
@@ -316,6 +1082,9 @@ void flushAppendOnlyFile(int force) {
             serverLog(LL_NOTICE,"Asynchronous AOF fsync is taking too long (disk is busy?). Writing the AOF buffer without waiting for fsync to complete, this may slow down Redis.");
         }
     }
+    /* Seal the binary block still open, that is part of the write. */
+    aofSealBinaryBlock();
+
     /* We want to perform a single write. This should be guaranteed atomic
      * at least if the filesystem we are writing is a real physical one.
      * While this will save us against the server being killed I don't think
@@ -368,7 +1137,9 @@ void flushAppendOnlyFile(int force) {
                                        (long long)sdslen(server.aof_buf));
             }
 
-            if (ftruncate(server.aof_fd, server.aof_current_size) == -1) {
+            off_t validsize = server.aof_multi_part ?
+                server.aof_last_incr_size : server.aof_current_size;
+            if (ftruncate(server.aof_fd, validsize) == -1) {
                 if (can_log) {
                     serverLog(LL_WARNING, "Could not remove short write "
                              "from the append-only file.  Redis may refuse "
@@ -401,6 +1172,7 @@ void flushAppendOnlyFile(int force) {
              * was no way to undo it with ftruncate(2). */
             if (nwritten > 0) {
                 server.aof_current_size += nwritten;
+                server.aof_last_incr_size += nwritten;
                 sdsrange(server.aof_buf,nwritten,-1);
             }
             return; /* We'll try again on the next call... */
@@ -415,6 +1187,8 @@ void flushAppendOnlyFile(int force) {
         }
     }
     server.aof_current_size += nwritten;
+    server.aof_last_incr_size += nwritten;
+    server.aof_written_offset = server.aof_fed_offset;
 
     /* Re-use AOF buffer when it is small enough. The maximum comes from the
      * arena size of 4k minus some overhead (but is otherwise arbitrary). */
@@ -429,10 +1203,17 @@ void flushAppendOnlyFile(int force) {
      * children doing I/O in the background. */
     if (server.aof_no_fsync_on_rewrite &&
         (server.aof_child_pid != -1 || server.rdb_child_pid != -1))
-            return;
+    {
+        /* Replies waiting for the group fsync can't wait for the child. */
+        aofReleaseFsyncWaiters(server.aof_written_offset);
+        return;
+    }
 
     /* Perform the fsync if needed. */
-    if (server.aof_fsync == AOF_FSYNC_ALWAYS) {
+    if (server.aof_fsync == AOF_FSYNC_ALWAYS && server.aof_group_commit) {
+        /* Group commit: the replies wait for the background fsync. */
+        aofGroupFsync();
+    } else if (server.aof_fsync == AOF_FSYNC_ALWAYS) {
         /* aof_fsync is defined as fdatasync() for Linux in order to avoid
          * flushing metadata. */
         latencyStartMonitor(latency);
@@ -447,11 +1228,64 @@ void flushAppendOnlyFile(int force) {
     }
 }
 
-sds catAppendOnlyGenericCommand(sds dst, int argc, robj **argv) {
+/* Return the ID of the command 'name' in binary records, or 0 if the
+ * command has no ID and is stored by name. */
+static int aofBinaryCommandId(sds name) {
+    static dict *ids = NULL;
+    dictEntry *de;
+
+    if (ids == NULL) {
+        const char *cmdname;
+        long id;
+
+        ids = dictCreate(&commandTableDictType,NULL);
+        for (id = 1; (cmdname = aofBinCommandName(id)) != NULL; id++)
+            dictAdd(ids,sdsnew(cmdname),(void*)id);
+    }
+    de = dictFind(ids,name);
+    return de ? (long)dictGetVal(de) : 0;
+}
+
+/* Append the binary record of the command to 'dst'. */
+sds catAppendOnlyBinaryCommand(sds dst, int argc, robj **argv) {
+    unsigned char buf[AOF_BIN_VARINT_MAX_LEN+LONG_STR_SIZE];
+    int j, id;
+
+    dst = sdscatlen(dst,buf,aofBinEncodeVarint(buf,argc));
+    for (j = 0; j < argc; j++) {
+        robj *o = argv[j];
+        char *ptr;
+        size_t len;
+
+        if (sdsEncodedObject(o)) {
+            ptr = o->ptr;
+            len = sdslen(o->ptr);
+        } else {
+            ptr = (char*)buf+AOF_BIN_VARINT_MAX_LEN;
+            len = ll2string(ptr,LONG_STR_SIZE,(long)o->ptr);
+        }
+        if (j == 0) {
+            id = sdsEncodedObject(o) ? aofBinaryCommandId(o->ptr) : 0;
+            if (id) {
+                dst = sdscatlen(dst,buf,aofBinEncodeVarint(buf,id));
+                continue;
+            }
+            dst = sdscatlen(dst,"\0",1); /* Command name follows. */
+        }
+        dst = sdscatlen(dst,buf,aofBinEncodeVarint(buf,len));
+        dst = sdscatlen(dst,ptr,len);
+    }
+    return dst;
+}
+
+/* Append the command to 'dst' as a binary record or as RESP. */
+sds catAppendOnlyGenericCommand(sds dst, int binary, int argc, robj **argv) {
     char buf[32];
     int len, j;
     robj *o;
 
+    if (binary) return catAppendOnlyBinaryCommand(dst,argc,argv);
+
     buf[0] = '*';
     len = 1+ll2string(buf+1,sizeof(buf)-1,argc);
     buf[len++] = '\r';
@@ -479,7 +1313,7 @@ sds catAppendOnlyGenericCommand(sds dst, int argc, robj **argv) {
  * This command is used in order to translate EXPIRE and PEXPIRE commands
  * into PEXPIREAT command so that we retain precision in the append only
  * file, and the time is always absolute and not relative. */
-sds catAppendOnlyExpireAtCommand(sds buf, struct redisCommand *cmd, robj *key, robj *seconds) {
+sds catAppendOnlyExpireAtCommand(sds buf, int binary, struct redisCommand *cmd, robj *key, robj *seconds) {
     long long when;
     robj *argv[3];
 
@@ -503,75 +1337,171 @@ sds catAppendOnlyExpireAtCommand(sds buf, struct redisCommand *cmd, robj *key, r
     argv[0] = createStringObject("PEXPIREAT",9);
     argv[1] = key;
     argv[2] = createStringObjectFromLongLong(when);
-    buf = catAppendOnlyGenericCommand(buf, 3, argv);
+    buf = catAppendOnlyGenericCommand(buf, binary, 3, argv);
     decrRefCount(argv[0]);
     decrRefCount(argv[2]);
     return buf;
 }
 
+/* Return the "#TS:<unix time>" annotation line to append before the next
+ * command with aof-timestamp-enabled, or NULL if the time did not change
+ * since the last annotation. Timestamps have a one second resolution, so
+ * the cost is one line per second at most. */
+static sds aofTimestampAnnotation(void) {
+    if (!server.aof_timestamp_enabled ||
+        server.aof_cur_timestamp == server.unixtime) return NULL;
+    server.aof_cur_timestamp = server.unixtime;
+    return sdscatprintf(sdsempty(),"#TS:%lld\r\n",
+                        (long long)server.aof_cur_timestamp);
+}
+
+/* Return true if the command should be appended as a binary record. Huge
+ * commands are appended as RESP, that is always allowed, since they may
+ * not fit in a binary block. */
+static int aofUseBinaryFormat(robj **argv, int argc) {
+    size_t len = 0;
+    int j;
+
+    if (server.aof_format != AOF_FORMAT_BINARY) return 0;
+    for (j = 0; j < argc; j++)
+        len += sdsEncodedObject(argv[j]) ? sdslen(argv[j]->ptr) : LONG_STR_SIZE;
+    return len < AOF_BIN_MAX_PAYLOAD/4;
+}
+
+/* Append the block of binary records 'records' to 'dst'. */
+static sds aofCatBinaryBlock(sds dst, sds records) {
+    size_t start = sdslen(dst), rawlen = sdslen(records), len;
+    unsigned char *tmp = NULL;
+
+    if (server.aof_binary_compression != AOF_BIN_CODEC_NONE &&
+        rawlen >= AOF_BIN_MIN_COMPRESS) tmp = zmalloc(rawlen);
+    dst = sdsMakeRoomFor(dst,AOF_BIN_HDR_LEN+rawlen);
+    memcpy(dst+start+AOF_BIN_HDR_LEN,records,rawlen);
+    len = aofBinSealBlock((unsigned char*)dst+start,rawlen,
+                          tmp ? server.aof_binary_compression :
+                                AOF_BIN_CODEC_NONE, tmp);
+    sdsIncrLen(dst,len);
+    zfree(tmp);
+    return dst;
+}
+
+/* Seal the binary block open at the end of the AOF buffer, if any, so that
+ * the buffer can be written or RESP can be appended. */
+void aofSealBinaryBlock(void) {
+    sds records;
+
+    if (server.aof_bin_block_start == -1) return;
+    records = sdsnewlen(server.aof_buf+server.aof_bin_block_start,
+                sdslen(server.aof_buf)-server.aof_bin_block_start);
+    sdsIncrLen(server.aof_buf,
+        -(ssize_t)(sdslen(server.aof_buf)-server.aof_bin_block_start));
+    server.aof_buf = aofCatBinaryBlock(server.aof_buf,records);
+    sdsfree(records);
+    server.aof_bin_block_start = -1;
+}
+
+/* Append binary records to the block open at the end of the AOF buffer,
+ * opening a new one when needed. The block is sealed when the buffer is
+ * flushed, so that all the commands of an event loop iteration are
+ * compressed together. */
+static void aofBufCatBinaryRecords(sds records) {
+    if (server.aof_bin_block_start != -1 &&
+        sdslen(server.aof_buf)-server.aof_bin_block_start >= AOF_BIN_BLOCK_LEN)
+        aofSealBinaryBlock();
+    if (server.aof_bin_block_start == -1)
+        server.aof_bin_block_start = sdslen(server.aof_buf);
+    server.aof_buf = sdscatlen(server.aof_buf,records,sdslen(records));
+}
+
 void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc) {
-    sds buf = sdsempty();
+    sds buf = sdsempty(), ts = aofTimestampAnnotation();
     robj *tmpargv[3];
+    int binary = aofUseBinaryFormat(argv,argc);
 
     /* The DB this command was targeting is not the same as the last command
      * we appended. To issue a SELECT command is needed. */
     if (dictid != server.aof_selected_db) {
-        char seldb[64];
-
-        snprintf(seldb,sizeof(seldb),"%d",dictid);
-        buf = sdscatprintf(buf,"*2\r\n$6\r\nSELECT\r\n$%lu\r\n%s\r\n",
-            (unsigned long)strlen(seldb),seldb);
+        tmpargv[0] = createStringObject("SELECT",6);
+        tmpargv[1] = createStringObjectFromLongLong(dictid);
+        buf = catAppendOnlyGenericCommand(buf,binary,2,tmpargv);
+        decrRefCount(tmpargv[0]);
+        decrRefCount(tmpargv[1]);
         server.aof_selected_db = dictid;
     }
 
     if (cmd->proc == expireCommand || cmd->proc == pexpireCommand ||
         cmd->proc == expireatCommand) {
         /* Translate EXPIRE/PEXPIRE/EXPIREAT into PEXPIREAT */
-        buf = catAppendOnlyExpireAtCommand(buf,cmd,argv[1],argv[2]);
+        buf = catAppendOnlyExpireAtCommand(buf,binary,cmd,argv[1],argv[2]);
     } else if (cmd->proc == setexCommand || cmd->proc == psetexCommand) {
         /* Translate SETEX/PSETEX to SET and PEXPIREAT */
         tmpargv[0] = createStringObject("SET",3);
         tmpargv[1] = argv[1];
         tmpargv[2] = argv[3];
-        buf = catAppendOnlyGenericCommand(buf,3,tmpargv);
+        buf = catAppendOnlyGenericCommand(buf,binary,3,tmpargv);
         decrRefCount(tmpargv[0]);
-        buf = catAppendOnlyExpireAtCommand(buf,cmd,argv[1],argv[2]);
+        buf = catAppendOnlyExpireAtCommand(buf,binary,cmd,argv[1],argv[2]);
     } else if (cmd->proc == setCommand && argc > 3) {
         int i;
         robj *exarg = NULL, *pxarg = NULL;
         /* Translate SET [EX seconds][PX milliseconds] to SET and PEXPIREAT */
-        buf = catAppendOnlyGenericCommand(buf,3,argv);
+        buf = catAppendOnlyGenericCommand(buf,binary,3,argv);
         for (i = 3; i < argc; i ++) {
             if (!strcasecmp(argv[i]->ptr, "ex")) exarg = argv[i+1];
             if (!strcasecmp(argv[i]->ptr, "px")) pxarg = argv[i+1];
         }
         serverAssert(!(exarg && pxarg));
         if (exarg)
-            buf = catAppendOnlyExpireAtCommand(buf,server.expireCommand,argv[1],
-                                               exarg);
+            buf = catAppendOnlyExpireAtCommand(buf,binary,server.expireCommand,
+                                               argv[1],exarg);
         if (pxarg)
-            buf = catAppendOnlyExpireAtCommand(buf,server.pexpireCommand,argv[1],
-                                               pxarg);
+            buf = catAppendOnlyExpireAtCommand(buf,binary,server.pexpireCommand,
+                                               argv[1],pxarg);
     } else {
         /* All the other commands don't need translation or need the
          * same translation already operated in the command vector
          * for the replication itself. */
-        buf = catAppendOnlyGenericCommand(buf,argc,argv);
+        buf = catAppendOnlyGenericCommand(buf,binary,argc,argv);
     }
 
     /* Append to the AOF buffer. This will be flushed on disk just before
      * of re-entering the event loop, so before the client will get a
      * positive reply about the operation performed. */
-    if (server.aof_state == AOF_ON)
-        server.aof_buf = sdscatlen(server.aof_buf,buf,sdslen(buf));
+    if (server.aof_state == AOF_ON ||
+        (server.aof_multi_part && server.aof_child_pid != -1))
+    {
+        if (ts) {
+            aofSealBinaryBlock();
+            server.aof_buf = sdscatsds(server.aof_buf,ts);
+            server.aof_fed_offset += sdslen(ts);
+        }
+        if (binary) {
+            aofBufCatBinaryRecords(buf);
+        } else {
+            aofSealBinaryBlock();
+            server.aof_buf = sdscatlen(server.aof_buf,buf,sdslen(buf));
+        }
+        server.aof_fed_offset += sdslen(buf);
+    }
 
     /* If a background append only file rewriting is in progress we want to
      * accumulate the differences between the child DB and the current one
      * in a buffer, so that when the child process will do its work we
-     * can append the differences to the new append only file. */
-    if (server.aof_child_pid != -1)
-        aofRewriteBufferAppend((unsigned char*)buf,sdslen(buf));
+     * can append the differences to the new append only file. With a multi
+     * part AOF the differences are already in the new incr file. */
+    if (server.aof_child_pid != -1 && !server.aof_multi_part) {
+        if (ts) aofRewriteBufferAppend((unsigned char*)ts,sdslen(ts));
+        if (binary) {
+            sds block = aofCatBinaryBlock(sdsempty(),buf);
+
+            aofRewriteBufferAppend((unsigned char*)block,sdslen(block));
+            sdsfree(block);
+        } else {
+            aofRewriteBufferAppend((unsigned char*)buf,sdslen(buf));
+        }
+    }
 
+    sdsfree(ts);
     sdsfree(buf);
 }
 
@@ -624,6 +1554,472 @@ void freeFakeClient(struct client *c) {
     zfree(c);
 }
 
+/* ----------------------------------------------------------------------------
+ * Binary AOF blocks loading
+ *
+ * Blocks of binary records (see aofbin.h) can be found anywhere a RESP
+ * command can. The records of a block are executed only once the whole
+ * block is read and its CRC checked, so a block is either loaded as a whole
+ * or truncated as a whole with aof-load-truncated.
+ * -------------------------------------------------------------------------- */
+
+/* How the file continues after the commands read. */
+#define AOF_LOAD_MORE 0         /* More commands follow. */
+#define AOF_LOAD_EOF 1          /* End of file. */
+#define AOF_LOAD_UXEOF 2        /* End of file in the middle of a command. */
+#define AOF_LOAD_FMTERR 3       /* Bad file format. */
+#define AOF_LOAD_READERR 4      /* Read error. */
+
+/* Check and decompress the binary block with header 'hdr' and 'payload'.
+ * Returns the records, to free with zfree(), or NULL if the block is
+ * corrupted. */
+static unsigned char *aofDecodeBinaryBlock(unsigned char *hdr,
+                                           unsigned char *payload)
+{
+    aofBinHeader h;
+    unsigned char *records;
+
+    if (!aofBinCheckPayload(hdr,payload)) return NULL;
+    aofBinParseHeader(hdr,&h);
+    records = zmalloc(h.rawlen);
+    if (!aofBinDecodePayload(hdr,payload,records)) {
+        zfree(records);
+        return NULL;
+    }
+    return records;
+}
+
+/* Read the binary block at the current position of 'fp', just after its
+ * marker byte, 'size' being the size of the file. On success AOF_LOAD_MORE
+ * is returned, with the records in '*records', to free with zfree(), and
+ * their length in '*len'. */
+static int aofReadBinaryBlock(FILE *fp, off_t size, unsigned char **records,
+                              size_t *len)
+{
+    unsigned char hdr[AOF_BIN_HDR_LEN], *payload;
+    aofBinHeader h;
+
+    hdr[0] = AOF_BIN_MARKER;
+    if (fread(hdr+1,AOF_BIN_HDR_LEN-1,1,fp) == 0)
+        return feof(fp) ? AOF_LOAD_UXEOF : AOF_LOAD_READERR;
+    if (!aofBinParseHeader(hdr,&h)) return AOF_LOAD_FMTERR;
+    if ((off_t)h.len > size-ftello(fp)) return AOF_LOAD_UXEOF;
+
+    payload = zmalloc(h.len);
+    if (h.len && fread(payload,h.len,1,fp) == 0) {
+        zfree(payload);
+        return feof(fp) ? AOF_LOAD_UXEOF : AOF_LOAD_READERR;
+    }
+    *records = aofDecodeBinaryBlock(hdr,payload);
+    zfree(payload);
+    if (*records == NULL) return AOF_LOAD_FMTERR;
+    *len = h.rawlen;
+    return AOF_LOAD_MORE;
+}
+
+/* Create the argument vector of the binary record at '*p', advancing the
+ * pointer. Returns NULL if the record is malformed. */
+static robj **aofBinaryRecordArgv(const unsigned char **p,
+                                  const unsigned char *end, int *argc)
+{
+    long count, j;
+    robj **argv;
+
+    if (!aofBinReadArgc(p,end,&count) || count > INT_MAX) return NULL;
+    argv = zmalloc(sizeof(robj*)*count);
+    for (j = 0; j < count; j++) {
+        const char *arg;
+        size_t len;
+
+        if (!aofBinReadArg(p,end,j == 0,&arg,&len)) {
+            while (j--) decrRefCount(argv[j]);
+            zfree(argv);
+            return NULL;
+        }
+        argv[j] = createStringObject(arg,len);
+    }
+    *argc = count;
+    return argv;
+}
+
+/* ----------------------------------------------------------------------------
+ * Threaded AOF loading
+ *
+ * When aof-load-threaded is enabled, a reader thread reads the AOF in large
+ * chunks and parses the commands, passing batches of ready to use argument
+ * vectors to the main thread, that just has to execute them. The arguments
+ * are created by the reader thread with createStringObject(), so that the
+ * small ones cost a single allocation. The parsing follows the same rules
+ * of the serial loading loop in loadAppendOnlyFile(), so the two ways of
+ * loading accept and reject exactly the same files.
+ * -------------------------------------------------------------------------- */
+
+/* The reader thread is kept just a few batches ahead of the main thread, so
+ * that the parsed arguments are still in the CPU caches when executed. */
+#define AOF_LOAD_CHUNK_BYTES (1024*1024*4)  /* Read buffer of the thread. */
+#define AOF_LOAD_BATCH_CMDS 256             /* Max commands in a batch. */
+#define AOF_LOAD_MAX_BATCHES 4              /* Parsed batches not executed. */
+
+typedef struct aofLoadCommand {
+    int argc;
+    robj **argv;
+    off_t end;              /* Offset of the end of the command. */
+} aofLoadCommand;
+
+typedef struct aofLoadBatch {
+    aofLoadCommand cmds[AOF_LOAD_BATCH_CMDS];
+    int count;              /* Number of used commands. */
+    int status;             /* AOF_LOAD_* */
+    int err;                /* errno of the AOF_LOAD_READERR status. */
+} aofLoadBatch;
+
+typedef struct aofReader {
+    FILE *fp;
+    char *buf;              /* Read buffer, AOF_LOAD_CHUNK_BYTES long. */
+    size_t len, pos;        /* Bytes in the buffer and parsing position. */
+    off_t offset;           /* File offset of buf+pos. */
+    off_t size;             /* File size. */
+    unsigned char *records; /* Records of the binary block being parsed. */
+    size_t records_len, records_pos;
+    int eof;                /* No more data to read. */
+    int err;                /* errno of the last read error, or 0. */
+    pthread_t thread;
+    pthread_mutex_t mutex;  /* Protects 'batches' and 'exiting'. */
+    pthread_cond_t cond;    /* Signaled when 'batches' changes. */
+    list *batches;          /* Parsed batches, oldest first. */
+    int exiting;            /* The main thread stopped consuming batches. */
+} aofReader;
+
+/* Make sure at least 'need' bytes (up to the buffer size) are buffered,
+ * unless the file is shorter. Returns the number of buffered bytes. */
+static size_t aofReaderFill(aofReader *r, size_t need) {
+    if (r->len-r->pos >= need || r->eof || r->err) return r->len-r->pos;
+    memmove(r->buf,r->buf+r->pos,r->len-r->pos);
+    r->len -= r->pos;
+    r->pos = 0;
+    while (r->len < need) {
+        size_t nread = fread(r->buf+r->len,1,AOF_LOAD_CHUNK_BYTES-r->len,
+                             r->fp);
+        r->len += nread;
+        if (nread == 0) {
+            if (ferror(r->fp)) r->err = errno ? errno : EIO;
+            else r->eof = 1;
+            break;
+        }
+    }
+    return r->len;
+}
+
+/* Read a line like fgets() does with a 128 bytes buffer. Returns the length
+ * of the line, that is zero at the end of the file. */
+static size_t aofReaderLine(aofReader *r, char *line) {
+    size_t avail = aofReaderFill(r,127), len;
+    char *p = r->buf+r->pos, *nl;
+
+    if (avail > 127) avail = 127;
+    nl = memchr(p,'\n',avail);
+    len = nl ? (size_t)(nl-p)+1 : avail;
+    memcpy(line,p,len);
+    line[len] = '\0';
+    r->pos += len;
+    r->offset += len;
+    return len;
+}
+
+/* Read 'len' bytes at 'dst'. Returns 0 on short read. */
+static int aofReaderRead(aofReader *r, char *dst, size_t len) {
+    if (len <= AOF_LOAD_CHUNK_BYTES) {
+        if (aofReaderFill(r,len) < len) return 0;
+        memcpy(dst,r->buf+r->pos,len);
+        r->pos += len;
+    } else {
+        /* Too big for the buffer: read the missing part directly. */
+        size_t buffered = r->len-r->pos;
+
+        memcpy(dst,r->buf+r->pos,buffered);
+        r->pos = r->len = 0;
+        if (fread(dst+buffered,len-buffered,1,r->fp) == 0) {
+            if (ferror(r->fp)) r->err = errno ? errno : EIO;
+            return 0;
+        }
+    }
+    r->offset += len;
+    return 1;
+}
+
+/* Skip 'len' bytes. Returns 0 on short read. */
+static int aofReaderSkip(aofReader *r, size_t len) {
+    if (aofReaderFill(r,len) < len) return 0;
+    r->pos += len;
+    r->offset += len;
+    return 1;
+}
+
+/* Read a 'len' bytes string object. Returns NULL on short read. */
+static robj *aofReaderString(aofReader *r, size_t len) {
+    robj *o;
+
+    if (len <= AOF_LOAD_CHUNK_BYTES) {
+        if (aofReaderFill(r,len) < len) return NULL;
+        o = createStringObject(r->buf+r->pos,len);
+        r->pos += len;
+        r->offset += len;
+    } else {
+        sds s = sdsnewlen(NULL,len);
+
+        if (!aofReaderRead(r,s,len)) {
+            sdsfree(s);
+            return NULL;
+        }
+        o = createObject(OBJ_STRING,s);
+    }
+    return o;
+}
+
+/* Status to report when the file ends in the middle of a command. */
+static int aofReaderShortRead(aofReader *r) {
+    return r->err ? AOF_LOAD_READERR : AOF_LOAD_UXEOF;
+}
+
+/* Read the binary block at the current position, replacing the records of
+ * the previous one. Returns AOF_LOAD_MORE on success. */
+static int aofReaderBinaryBlock(aofReader *r) {
+    unsigned char hdr[AOF_BIN_HDR_LEN], *payload;
+    aofBinHeader h;
+
+    zfree(r->records);
+    r->records = NULL;
+    r->records_len = r->records_pos = 0;
+    if (!aofReaderRead(r,(char*)hdr,AOF_BIN_HDR_LEN))
+        return aofReaderShortRead(r);
+    if (!aofBinParseHeader(hdr,&h)) return AOF_LOAD_FMTERR;
+    if ((off_t)h.len > r->size-r->offset) return AOF_LOAD_UXEOF;
+
+    payload = zmalloc(h.len);
+    if (!aofReaderRead(r,(char*)payload,h.len)) {
+        zfree(payload);
+        return aofReaderShortRead(r);
+    }
+    r->records = aofDecodeBinaryBlock(hdr,payload);
+    zfree(payload);
+    if (r->records == NULL) return AOF_LOAD_FMTERR;
+    r->records_len = h.rawlen;
+    return AOF_LOAD_MORE;
+}
+
+/* Parse the next command into 'cmd'. Returns AOF_LOAD_MORE on success,
+ * otherwise the status of the file, and 'cmd' is not filled. */
+static int aofReaderParseCommand(aofReader *r, aofLoadCommand *cmd) {
+    char line[128];
+    int argc, j, status;
+    long len;
+    robj **argv;
+
+    /* The records of the current binary block come first, then the
+     * following blocks, if any. */
+    while (1) {
+        if (r->records_pos < r->records_len) {
+            const unsigned char *p = r->records+r->records_pos;
+
+            cmd->argv = aofBinaryRecordArgv(&p,r->records+r->records_len,
+                                            &cmd->argc);
+            if (cmd->argv == NULL) return AOF_LOAD_FMTERR;
+            r->records_pos = p-r->records;
+            cmd->end = r->offset;
+            return AOF_LOAD_MORE;
+        }
+        if (aofReaderFill(r,1) == 0) break;
+        if (r->buf[r->pos] == '#') {
+            /* Skip annotations, like the timestamps. */
+            size_t n;
+
+            do {
+                if ((n = aofReaderLine(r,line)) == 0)
+                    return aofReaderShortRead(r);
+            } while (line[n-1] != '\n');
+            continue;
+        }
+        if ((unsigned char)r->buf[r->pos] != AOF_BIN_MARKER) break;
+        if ((status = aofReaderBinaryBlock(r)) != AOF_LOAD_MORE)
+            return status;
+    }
+
+    if (aofReaderLine(r,line) == 0)
+        return r->err ? AOF_LOAD_READERR : AOF_LOAD_EOF;
+    if (line[0] != '*') return AOF_LOAD_FMTERR;
+    if (line[1] == '\0') return aofReaderShortRead(r);
+    argc = atoi(line+1);
+    if (argc < 1) return AOF_LOAD_FMTERR;
+
+    argv = zmalloc(sizeof(robj*)*argc);
+    for (j = 0; j < argc; j++) {
+        if (aofReaderLine(r,line) == 0) {
+            status = aofReaderShortRead(r);
+            goto err;
+        }
+        if (line[0] != '$') {
+            status = AOF_LOAD_FMTERR;
+            goto err;
+        }
+        len = strtol(line+1,NULL,10);
+        if (len < 0) {
+            status = AOF_LOAD_FMTERR;
+            goto err;
+        }
+        if ((argv[j] = aofReaderString(r,len)) == NULL) {
+            status = aofReaderShortRead(r);
+            goto err;
+        }
+        if (!aofReaderSkip(r,2)) { /* CRLF */
+            j++;
+            status = aofReaderShortRead(r);
+            goto err;
+        }
+    }
+    cmd->argc = argc;
+    cmd->argv = argv;
+    cmd->end = r->offset;
+    return AOF_LOAD_MORE;
+
+err:
+    while (j--) decrRefCount(argv[j]);
+    zfree(argv);
+    return status;
+}
+
+/* Release a batch and the commands not yet executed. */
+static void aofFreeLoadBatch(aofLoadBatch *batch, int first) {
+    int i, j;
+
+    for (i = first; i < batch->count; i++) {
+        for (j = 0; j < batch->cmds[i].argc; j++)
+            decrRefCount(batch->cmds[i].argv[j]);
+        zfree(batch->cmds[i].argv);
+    }
+    zfree(batch);
+}
+
+static void *aofReaderMain(void *arg) {
+    aofReader *r = arg;
+    int status = AOF_LOAD_MORE;
+
+    objectSharingDisabled = 1;
+    while (status == AOF_LOAD_MORE) {
+        aofLoadBatch *batch = zmalloc(sizeof(*batch));
+
+        batch->count = 0;
+        while (batch->count < AOF_LOAD_BATCH_CMDS) {
+            status = aofReaderParseCommand(r,batch->cmds+batch->count);
+            if (status != AOF_LOAD_MORE) break;
+            batch->count++;
+        }
+        batch->status = status;
+        batch->err = r->err;
+
+        pthread_mutex_lock(&r->mutex);
+        while (listLength(r->batches) >= AOF_LOAD_MAX_BATCHES && !r->exiting)
+            pthread_cond_wait(&r->cond,&r->mutex);
+        if (r->exiting) {
+            pthread_mutex_unlock(&r->mutex);
+            aofFreeLoadBatch(batch,0);
+            break;
+        }
+        listAddNodeTail(r->batches,batch);
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->mutex);
+    }
+    return NULL;
+}
+
+/* Stop the reader thread and release the reader. The file is not closed. */
+static void aofReleaseReader(aofReader *r) {
+    listIter li;
+    listNode *ln;
+
+    pthread_mutex_lock(&r->mutex);
+    r->exiting = 1;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->mutex);
+    pthread_join(r->thread,NULL);
+    listRewind(r->batches,&li);
+    while((ln = listNext(&li)) != NULL) aofFreeLoadBatch(ln->value,0);
+    listRelease(r->batches);
+    pthread_mutex_destroy(&r->mutex);
+    pthread_cond_destroy(&r->cond);
+    zfree(r->records);
+    zfree(r->buf);
+    zfree(r);
+}
+
+/* Start a reader thread parsing 'fp' from its current position. On error
+ * NULL is returned and the caller should load the file serially. */
+static aofReader *aofCreateReader(FILE *fp, off_t size) {
+    aofReader *r = zcalloc(sizeof(*r));
+
+    r->fp = fp;
+    r->offset = ftello(fp);
+    r->size = size;
+    r->buf = zmalloc(AOF_LOAD_CHUNK_BYTES);
+    r->batches = listCreate();
+    pthread_mutex_init(&r->mutex,NULL);
+    pthread_cond_init(&r->cond,NULL);
+    if (r->offset == -1 ||
+        pthread_create(&r->thread,NULL,aofReaderMain,r) != 0)
+    {
+        serverLog(LL_WARNING,
+            "Can't create the AOF reader thread, loading serially.");
+        listRelease(r->batches);
+        pthread_mutex_destroy(&r->mutex);
+        pthread_cond_destroy(&r->cond);
+        zfree(r->buf);
+        zfree(r);
+        return NULL;
+    }
+    return r;
+}
+
+/* Wait for the next parsed batch. */
+static aofLoadBatch *aofReaderNextBatch(aofReader *r) {
+    listNode *ln;
+    aofLoadBatch *batch;
+
+    pthread_mutex_lock(&r->mutex);
+    while (listLength(r->batches) == 0)
+        pthread_cond_wait(&r->cond,&r->mutex);
+    ln = listFirst(r->batches);
+    batch = ln->value;
+    listDelNode(r->batches,ln);
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->mutex);
+    return batch;
+}
+
+/* Execute the command in the argument vector of the fake client, then
+ * release the arguments. Exits on unknown commands. */
+static void aofLoadExecCommand(client *fakeClient) {
+    struct redisCommand *cmd;
+
+    /* Command lookup. Commands of binary records are stored with their
+     * original name, that may have been renamed. */
+    cmd = lookupCommandOrOriginal(fakeClient->argv[0]->ptr);
+    if (!cmd) {
+        serverLog(LL_WARNING,"Unknown command '%s' reading the append only file", (char*)fakeClient->argv[0]->ptr);
+        exit(1);
+    }
+
+    /* Run the command in the context of a fake client */
+    cmd->proc(fakeClient);
+
+    /* The fake client should not have a reply */
+    serverAssert(fakeClient->bufpos == 0 && listLength(fakeClient->reply) == 0);
+    /* The fake client should never get blocked */
+    serverAssert((fakeClient->flags & CLIENT_BLOCKED) == 0);
+
+    /* Clean up. Command code may have changed argv/argc so we use the
+     * argv/argc of the client instead of the local variables. */
+    freeFakeClientArgv(fakeClient);
+}
+
 /* Replay the append log file. On success C_OK is returned. On non fatal
  * error (the append only file is zero-length) C_ERR is returned. On
  * fatal error an error message is logged and the program exists. */
@@ -634,6 +2030,7 @@ int loadAppendOnlyFile(char *filename) {
     int old_aof_state = server.aof_state;
     long loops = 0;
     off_t valid_up_to = 0; /* Offset of the latest well-formed command loaded. */
+    aofReader *reader;
 
     if (fp && redis_fstat(fileno(fp),&sb) != -1 && sb.st_size == 0) {
         server.aof_current_size = 0;
@@ -653,13 +2050,72 @@ int loadAppendOnlyFile(char *filename) {
     fakeClient = createFakeClient();
     startLoading(fp);
 
-    while(1) {
-        int argc, j;
+    /* Check if this AOF file has an RDB preamble. In that case we need to
+     * load the RDB file and later continue loading the AOF tail. */
+    char sig[5]; /* "REDIS" */
+    if (fread(sig,1,5,fp) != 5 || memcmp(sig,"REDIS",5) != 0) {
+        /* No RDB preamble, seek back at 0 offset. */
+        if (fseek(fp,0,SEEK_SET) == -1) goto readerr;
+    } else {
+        /* RDB preamble. Pass loading the RDB functions. */
+        rio rdb;
+
+        serverLog(LL_NOTICE,"Reading RDB preamble from AOF file...");
+        if (fseek(fp,0,SEEK_SET) == -1) goto readerr;
+        rioInitWithFile(&rdb,fp);
+        if (rdbLoadRio(&rdb,0) != C_OK) {
+            serverLog(LL_WARNING,"Error reading the RDB preamble of the AOF file, AOF loading aborted");
+            goto readerr;
+        } else {
+            serverLog(LL_NOTICE,"Reading the remaining AOF tail...");
+        }
+        if (server.aof_load_truncated) valid_up_to = ftello(fp);
+    }
+
+    /* Load the commands parsed by the reader thread, if enabled. */
+    if (server.aof_load_threaded &&
+        (reader = aofCreateReader(fp,sb.st_size)) != NULL)
+    {
+        int status;
+
+        while(1) {
+            aofLoadBatch *batch = aofReaderNextBatch(reader);
+            int i;
+
+            for (i = 0; i < batch->count; i++) {
+                aofLoadCommand *cmd = batch->cmds+i;
+
+                /* Serve the clients from time to time */
+                if (!(loops++ % 1000)) {
+                    loadingProgress(cmd->end);
+                    processEventsWhileBlocked();
+                }
+
+                fakeClient->argc = cmd->argc;
+                fakeClient->argv = cmd->argv;
+                aofLoadExecCommand(fakeClient);
+                if (server.aof_load_truncated) valid_up_to = cmd->end;
+            }
+            status = batch->status;
+            errno = batch->err;
+            aofFreeLoadBatch(batch,batch->count);
+            if (status != AOF_LOAD_MORE) break;
+        }
+        aofReleaseReader(reader);
+
+        if (status == AOF_LOAD_READERR) {
+            freeFakeClient(fakeClient); /* avoid valgrind warning */
+            serverLog(LL_WARNING,"Unrecoverable error reading the append only file: %s", strerror(errno));
+            exit(1);
+        }
+        if (status == AOF_LOAD_UXEOF) goto uxeof;
+        if (status == AOF_LOAD_FMTERR) goto fmterr;
+    } else while(1) {
+        int argc, j, c;
         unsigned long len;
         robj **argv;
         char buf[128];
         sds argsds;
-        struct redisCommand *cmd;
 
         /* Serve the clients from time to time */
         if (!(loops++ % 1000)) {
@@ -667,6 +2123,48 @@ int loadAppendOnlyFile(char *filename) {
             processEventsWhileBlocked();
         }
 
+        /* Execute all the records of a binary block. */
+        if ((c = getc(fp)) == AOF_BIN_MARKER) {
+            const unsigned char *p, *end;
+            unsigned char *records;
+            size_t rawlen;
+            int status = aofReadBinaryBlock(fp,sb.st_size,&records,&rawlen);
+
+            if (status == AOF_LOAD_UXEOF) goto uxeof;
+            if (status == AOF_LOAD_FMTERR) goto fmterr;
+            if (status == AOF_LOAD_READERR) goto readerr;
+            p = records;
+            end = records+rawlen;
+            while (p < end) {
+                if (!(loops++ % 1000)) {
+                    loadingProgress(ftello(fp));
+                    processEventsWhileBlocked();
+                }
+                if ((argv = aofBinaryRecordArgv(&p,end,&argc)) == NULL) {
+                    zfree(records);
+                    goto fmterr;
+                }
+                fakeClient->argc = argc;
+                fakeClient->argv = argv;
+                aofLoadExecCommand(fakeClient);
+            }
+            zfree(records);
+            if (server.aof_load_truncated) valid_up_to = ftello(fp);
+            continue;
+        }
+
+        /* Skip annotations, like the timestamps of aof-timestamp-enabled. */
+        if (c == '#') {
+            do {
+                if (fgets(buf,sizeof(buf),fp) == NULL) {
+                    if (feof(fp)) goto uxeof;
+                    goto readerr;
+                }
+            } while (buf[strlen(buf)-1] != '\n');
+            continue;
+        }
+        if (c != EOF) ungetc(c,fp);
+
         if (fgets(buf,sizeof(buf),fp) == NULL) {
             if (feof(fp))
                 break;
@@ -705,24 +2203,7 @@ int loadAppendOnlyFile(char *filename) {
             }
         }
 
-        /* Command lookup */
-        cmd = lookupCommand(argv[0]->ptr);
-        if (!cmd) {
-            serverLog(LL_WARNING,"Unknown command '%s' reading the append only file", (char*)argv[0]->ptr);
-            exit(1);
-        }
-
-        /* Run the command in the context of a fake client */
-        cmd->proc(fakeClient);
-
-        /* The fake client should not have a reply */
-        serverAssert(fakeClient->bufpos == 0 && listLength(fakeClient->reply) == 0);
-        /* The fake client should never get blocked */
-        serverAssert((fakeClient->flags & CLIENT_BLOCKED) == 0);
-
-        /* Clean up. Command code may have changed argv/argc so we use the
-         * argv/argc of the client instead of the local variables. */
-        freeFakeClientArgv(fakeClient);
+        aofLoadExecCommand(fakeClient);
         if (server.aof_load_truncated) valid_up_to = ftello(fp);
     }
 
@@ -781,6 +2262,137 @@ fmterr: /* Format error. */
     exit(1);
 }
 
+/* Load the AOF: the append only file, or all the files of the multi part
+ * AOF in the order listed by the manifest. Only the last file may be
+ * truncated, since the following files log writes performed after the ones
+ * lost. Returns C_OK if some command was loaded, otherwise C_ERR. */
+int loadAppendOnlyFiles(void) {
+    int loaded = 0, truncated = server.aof_load_truncated;
+    listIter li;
+    listNode *ln;
+
+    if (!server.aof_multi_part) {
+        sds manifest = aofManifestFilename();
+
+        /* The files listed by the manifest are the AOF: the single file, if
+         * any, is an empty one created at startup or a stale one. */
+        if (access(manifest,F_OK) == 0) {
+            serverLog(LL_WARNING,"The AOF manifest %s exists but "
+                "aof-multi-part is disabled. Enable aof-multi-part, or "
+                "convert the AOF concatenating the files listed in the "
+                "manifest, in order, into %s and removing the manifest.",
+                manifest, server.aof_filename);
+            exit(1);
+        }
+        sdsfree(manifest);
+        return loadAppendOnlyFile(server.aof_filename);
+    }
+
+    if (server.aof_base == NULL && listLength(server.aof_incrs) == 0 &&
+        aofLoadManifest() == C_ERR) return C_ERR;
+    if (server.aof_base) {
+        server.aof_load_truncated =
+            truncated && listLength(server.aof_incrs) == 0;
+        if (loadAppendOnlyFile(server.aof_base->filename) == C_OK)
+            loaded = 1;
+    }
+    listRewind(server.aof_incrs,&li);
+    while((ln = listNext(&li)) != NULL) {
+        aofPart *p = listNodeValue(ln);
+
+        server.aof_load_truncated = truncated && ln == listLast(server.aof_incrs);
+        if (loadAppendOnlyFile(p->filename) == C_OK) loaded = 1;
+    }
+    server.aof_load_truncated = truncated;
+
+    /* An empty file resets the size, compute it again for all the files. */
+    aofUpdateCurrentSize();
+    server.aof_rewrite_base_size = server.aof_current_size;
+    return loaded ? C_OK : C_ERR;
+}
+
+/* ----------------------------------------------------------------------------
+ * AOF dead bytes estimate
+ *
+ * The AOF is made of live bytes, the ones a rewrite would produce for the
+ * current dataset, and of dead bytes, written for keys overwritten or
+ * deleted since then. The live bytes are estimated as the memory used by the
+ * dataset, sampled every second, times the ratio between the size of the
+ * last rewritten AOF and the memory used by the dataset it was produced from.
+ * The ratio accounts for the RDB preamble, the binary format and so forth.
+ * It is not known before the first rewrite.
+ *
+ * Sampling the dataset has a cost, so nothing is estimated while
+ * auto-aof-rewrite-dead-percentage is zero.
+ * ------------------------------------------------------------------------- */
+
+#define AOF_DATASET_SAMPLES 64      /* Keys sampled per DB every second. */
+#define AOF_DATASET_ELE_SAMPLES 5   /* Elements sampled per aggregate. */
+
+/* Estimate the memory used by the dataset sampling 'samples' keys per DB. */
+static double aofEstimateDatasetSize(int samples) {
+    double total = 0;
+    int j, i;
+
+    for (j = 0; j < server.dbnum; j++) {
+        dict *d = server.db[j].dict;
+        size_t sum = 0;
+
+        if (dictSize(d) == 0) continue;
+        for (i = 0; i < samples; i++) {
+            dictEntry *de = dictGetRandomKey(d);
+
+            sum += sdsZmallocSize(dictGetKey(de))+
+                   objectComputeSize(dictGetVal(de),AOF_DATASET_ELE_SAMPLES);
+        }
+        total += (double)sum/samples*dictSize(d);
+    }
+    return total;
+}
+
+/* Called every second by serverCron(): the estimate is smoothed, since a
+ * single sample is noisy. */
+void aofSampleDataset(void) {
+    double size = aofEstimateDatasetSize(AOF_DATASET_SAMPLES);
+
+    server.aof_dataset_estimate = server.aof_dataset_estimate ?
+        (server.aof_dataset_estimate*3+size)/4 : size;
+}
+
+/* Called when a rewrite starts. */
+static void aofRewriteSampleDataset(void) {
+    server.aof_rewrite_dataset_estimate = server.aof_rewrite_dead_perc ?
+        aofEstimateDatasetSize(AOF_DATASET_SAMPLES*4) : 0;
+}
+
+/* Called when a rewrite terminated and aof_rewrite_base_size is the size of
+ * the new AOF: the live bytes are the whole file at this point. */
+static void aofCalibrateLiveRatio(void) {
+    if (server.aof_rewrite_dataset_estimate == 0) return;
+    server.aof_live_ratio = (double)server.aof_rewrite_base_size/
+                            server.aof_rewrite_dataset_estimate;
+    server.aof_dataset_estimate = server.aof_rewrite_dataset_estimate;
+}
+
+/* Return the estimated live bytes of the AOF, or -1 if unknown. */
+long long aofLiveBytesEstimate(void) {
+    long long live;
+
+    if (server.aof_rewrite_dead_perc == 0 || server.aof_live_ratio == 0)
+        return -1;
+    live = server.aof_dataset_estimate*server.aof_live_ratio;
+    return live < server.aof_current_size ? live : server.aof_current_size;
+}
+
+/* Return the estimated percentage of dead bytes in the AOF, or -1 if
+ * unknown. */
+int aofDeadPercentage(void) {
+    long long live = aofLiveBytesEstimate();
+
+    if (live == -1 || server.aof_current_size == 0) return -1;
+    return (server.aof_current_size-live)*100/server.aof_current_size;
+}
+
 /* ----------------------------------------------------------------------------
  * AOF rewrite
  * ------------------------------------------------------------------------- */
@@ -1014,6 +2626,7 @@ ssize_t aofReadDiffFromParent(void) {
     char buf[65536]; /* Default pipe buffer size on most Linux systems. */
     ssize_t nread, total = 0;
 
+    if (server.aof_multi_part) return 0; /* No diffs, see aof_incrs. */
     while ((nread =
             read(server.aof_pipe_read_data_from_parent,buf,sizeof(buf))) > 0) {
         server.aof_child_diff = sdscatlen(server.aof_child_diff,buf,nread);
@@ -1022,51 +2635,32 @@ ssize_t aofReadDiffFromParent(void) {
     return total;
 }
 
-/* Write a sequence of commands able to fully rebuild the dataset into
- * "filename". Used both by REWRITEAOF and BGREWRITEAOF.
+/* Write a sequence of commands able to fully rebuild the dataset to the
+ * rio 'aof'. Used by rewriteAppendOnlyFile() when the AOF is not rewritten
+ * with an RDB preamble.
  *
  * In order to minimize the number of commands needed in the rewritten
  * log Redis uses variadic commands when possible, such as RPUSH, SADD
  * and ZADD. However at max AOF_REWRITE_ITEMS_PER_CMD items per time
  * are inserted using a single command. */
-int rewriteAppendOnlyFile(char *filename) {
+int rewriteAppendOnlyFileRio(rio *aof) {
     dictIterator *di = NULL;
     dictEntry *de;
-    rio aof;
-    FILE *fp;
-    char tmpfile[256];
     int j;
     long long now = mstime();
-    char byte;
     size_t processed = 0;
 
-    /* Note that we have to use a different temp name here compared to the
-     * one used by rewriteAppendOnlyFileBackground() function. */
-    snprintf(tmpfile,256,"temp-rewriteaof-%d.aof", (int) getpid());
-    fp = fopen(tmpfile,"w");
-    if (!fp) {
-        serverLog(LL_WARNING, "Opening the temp file for AOF rewrite in rewriteAppendOnlyFile(): %s", strerror(errno));
-        return C_ERR;
-    }
-
-    server.aof_child_diff = sdsempty();
-    rioInitWithFile(&aof,fp);
-    if (server.aof_rewrite_incremental_fsync)
-        rioSetAutoSync(&aof,AOF_AUTOSYNC_BYTES);
     for (j = 0; j < server.dbnum; j++) {
         char selectcmd[] = "*2\r\n$6\r\nSELECT\r\n";
         redisDb *db = server.db+j;
         dict *d = db->dict;
         if (dictSize(d) == 0) continue;
         di = dictGetSafeIterator(d);
-        if (!di) {
-            fclose(fp);
-            return C_ERR;
-        }
+        if (!di) return C_ERR;
 
         /* SELECT the new DB */
-        if (rioWrite(&aof,selectcmd,sizeof(selectcmd)-1) == 0) goto werr;
-        if (rioWriteBulkLongLong(&aof,j) == 0) goto werr;
+        if (rioWrite(aof,selectcmd,sizeof(selectcmd)-1) == 0) goto werr;
+        if (rioWriteBulkLongLong(aof,j) == 0) goto werr;
 
         /* Iterate this DB writing every entry */
         while((de = dictNext(di)) != NULL) {
@@ -1087,43 +2681,96 @@ int rewriteAppendOnlyFile(char *filename) {
             if (o->type == OBJ_STRING) {
                 /* Emit a SET command */
                 char cmd[]="*3\r\n$3\r\nSET\r\n";
-                if (rioWrite(&aof,cmd,sizeof(cmd)-1) == 0) goto werr;
+                if (rioWrite(aof,cmd,sizeof(cmd)-1) == 0) goto werr;
                 /* Key and value */
-                if (rioWriteBulkObject(&aof,&key) == 0) goto werr;
-                if (rioWriteBulkObject(&aof,o) == 0) goto werr;
+                if (rioWriteBulkObject(aof,&key) == 0) goto werr;
+                if (rioWriteBulkObject(aof,o) == 0) goto werr;
             } else if (o->type == OBJ_LIST) {
-                if (rewriteListObject(&aof,&key,o) == 0) goto werr;
+                if (rewriteListObject(aof,&key,o) == 0) goto werr;
             } else if (o->type == OBJ_SET) {
-                if (rewriteSetObject(&aof,&key,o) == 0) goto werr;
+                if (rewriteSetObject(aof,&key,o) == 0) goto werr;
             } else if (o->type == OBJ_ZSET) {
-                if (rewriteSortedSetObject(&aof,&key,o) == 0) goto werr;
+                if (rewriteSortedSetObject(aof,&key,o) == 0) goto werr;
             } else if (o->type == OBJ_HASH) {
-                if (rewriteHashObject(&aof,&key,o) == 0) goto werr;
+                if (rewriteHashObject(aof,&key,o) == 0) goto werr;
             } else {
                 serverPanic("Unknown object type");
             }
             /* Save the expire time */
             if (expiretime != -1) {
                 char cmd[]="*3\r\n$9\r\nPEXPIREAT\r\n";
-                if (rioWrite(&aof,cmd,sizeof(cmd)-1) == 0) goto werr;
-                if (rioWriteBulkObject(&aof,&key) == 0) goto werr;
-                if (rioWriteBulkLongLong(&aof,expiretime) == 0) goto werr;
+                if (rioWrite(aof,cmd,sizeof(cmd)-1) == 0) goto werr;
+                if (rioWriteBulkObject(aof,&key) == 0) goto werr;
+                if (rioWriteBulkLongLong(aof,expiretime) == 0) goto werr;
             }
             /* Read some diff from the parent process from time to time. */
-            if (aof.processed_bytes > processed+1024*10) {
-                processed = aof.processed_bytes;
+            if (aof->processed_bytes > processed+AOF_READ_DIFF_INTERVAL_BYTES) {
+                processed = aof->processed_bytes;
                 aofReadDiffFromParent();
             }
         }
         dictReleaseIterator(di);
         di = NULL;
     }
+    return C_OK;
+
+werr:
+    if (di) dictReleaseIterator(di);
+    return C_ERR;
+}
+
+/* Write a file able to fully rebuild the dataset into "filename": an RDB
+ * preamble if aof-use-rdb-preamble is enabled, otherwise a sequence of
+ * commands, followed by the diffs accumulated by the parent meanwhile.
+ * Used both by REWRITEAOF and BGREWRITEAOF. */
+int rewriteAppendOnlyFile(char *filename) {
+    rio aof;
+    FILE *fp;
+    char tmpfile[256];
+    char byte;
+
+    /* Note that we have to use a different temp name here compared to the
+     * one used by rewriteAppendOnlyFileBackground() function. */
+    snprintf(tmpfile,256,"temp-rewriteaof-%d.aof", (int) getpid());
+    fp = fopen(tmpfile,"w");
+    if (!fp) {
+        serverLog(LL_WARNING, "Opening the temp file for AOF rewrite in rewriteAppendOnlyFile(): %s", strerror(errno));
+        return C_ERR;
+    }
+
+    server.aof_child_diff = sdsempty();
+    rioInitWithFile(&aof,fp);
+    if (server.aof_rewrite_incremental_fsync)
+        rioSetAutoSync(&aof,AOF_AUTOSYNC_BYTES);
+    if (server.aof_use_rdb_preamble) {
+        int error;
+
+        if (rdbSaveRio(&aof,&error,RDB_SAVE_AOF_PREAMBLE) == C_ERR) {
+            errno = error;
+            goto werr;
+        }
+    } else {
+        /* The rewritten commands recreate the dataset as it was when the
+         * child was forked. */
+        if (server.aof_timestamp_enabled) {
+            char ts[64];
+            int len = snprintf(ts,sizeof(ts),"#TS:%lld\r\n",
+                               (long long)server.unixtime);
+
+            if (rioWrite(&aof,ts,len) == 0) goto werr;
+        }
+        if (rewriteAppendOnlyFileRio(&aof) == C_ERR) goto werr;
+    }
 
     /* Do an initial slow fsync here while the parent is still sending
      * data, in order to make the next final fsync faster. */
     if (fflush(fp) == EOF) goto werr;
     if (fsync(fileno(fp)) == -1) goto werr;
 
+    /* A multi part AOF gets no diffs from the parent, that logs the writes
+     * performed meanwhile into a new incr file. */
+    if (server.aof_multi_part) goto done;
+
     /* Read again a few times to get more data from the parent.
      * We can't read forever (the server may receive data from clients
      * faster than it is able to send data to the child), so we try to read
@@ -1164,6 +2811,7 @@ int rewriteAppendOnlyFile(char *filename) {
     if (rioWrite(&aof,server.aof_child_diff,sdslen(server.aof_child_diff)) == 0)
         goto werr;
 
+done:
     /* Make sure data will not remain on the OS's output buffers */
     if (fflush(fp) == EOF) goto werr;
     if (fsync(fileno(fp)) == -1) goto werr;
@@ -1183,7 +2831,6 @@ werr:
     serverLog(LL_WARNING,"Write error writing append only file on disk: %s", strerror(errno));
     fclose(fp);
     unlink(tmpfile);
-    if (di) dictReleaseIterator(di);
     return C_ERR;
 }
 
@@ -1282,7 +2929,12 @@ int rewriteAppendOnlyFileBackground(void) {
     long long start;
 
     if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
-    if (aofCreatePipes() != C_OK) return C_ERR;
+    if (server.aof_multi_part) {
+        if (aofRewriteStartMultiPart() != C_OK) return C_ERR;
+    } else if (aofCreatePipes() != C_OK) {
+        return C_ERR;
+    }
+    openChildInfoPipe();
     start = ustime();
     if ((childpid = fork()) == 0) {
         char tmpfile[256];
@@ -1299,6 +2951,9 @@ int rewriteAppendOnlyFileBackground(void) {
                     "AOF rewrite: %zu MB of memory used by copy-on-write",
                     private_dirty/(1024*1024));
             }
+
+            server.child_info_data.cow_size = private_dirty;
+            sendChildInfo(CHILD_INFO_TYPE_AOF);
             exitFromChild(0);
         } else {
             exitFromChild(1);
@@ -1312,11 +2967,15 @@ int rewriteAppendOnlyFileBackground(void) {
             serverLog(LL_WARNING,
                 "Can't rewrite append only file in background: fork: %s",
                 strerror(errno));
-            aofClosePipes();
+            if (!server.aof_multi_part) aofClosePipes();
+            else if (server.aof_state == AOF_WAIT_REWRITE)
+                aofRewriteFailedMultiPart();
+            closeChildInfoPipe();
             return C_ERR;
         }
         serverLog(LL_NOTICE,
             "Background append only file rewriting started by pid %d",childpid);
+        aofRewriteSampleDataset();
         server.aof_rewrite_scheduled = 0;
         server.aof_rewrite_time_start = time(NULL);
         server.aof_child_pid = childpid;
@@ -1324,8 +2983,10 @@ int rewriteAppendOnlyFileBackground(void) {
         /* We set appendseldb to -1 in order to force the next call to the
          * feedAppendOnlyFile() to issue a SELECT command, so the differences
          * accumulated by the parent into server.aof_rewrite_buf will start
-         * with a SELECT statement and it will be safe to merge. */
+         * with a SELECT statement and it will be safe to merge. The same
+         * goes for the timestamp annotation. */
         server.aof_selected_db = -1;
+        server.aof_cur_timestamp = 0;
         replicationScriptCacheFlush();
         return C_OK;
     }
@@ -1335,7 +2996,14 @@ int rewriteAppendOnlyFileBackground(void) {
 void bgrewriteaofCommand(client *c) {
     if (server.aof_child_pid != -1) {
         addReplyError(c,"Background append only file rewriting already in progress");
-    } else if (server.rdb_child_pid != -1) {
+    } else if (server.rdb_child_pid != -1 ||
+               (server.aof_multi_part && c->flags & CLIENT_MULTI &&
+                sdslen(server.aof_buf)))
+    {
+        /* A multi part AOF switches to a new incr file when the rewrite
+         * starts: don't split the transaction we are executing across two
+         * files if it already logged some write, start the rewrite from
+         * serverCron() instead. */
         server.aof_rewrite_scheduled = 1;
         addReplyStatus(c,"Background append only file rewriting scheduled");
     } else if (rewriteAppendOnlyFileBackground() == C_OK) {
@@ -1355,13 +3023,31 @@ void aofRemoveTempFile(pid_t childpid) {
 /* Update the server.aof_current_size field explicitly using stat(2)
  * to check the size of the file. This is useful after a rewrite or after
  * a restart, normally the size is updated just adding the write length
- * to the current length, that is much faster. */
+ * to the current length, that is much faster. The size of a multi part AOF
+ * is the sum of the sizes of all its files. */
 void aofUpdateCurrentSize(void) {
     struct redis_stat sb;
     mstime_t latency;
 
     latencyStartMonitor(latency);
-    if (redis_fstat(server.aof_fd,&sb) == -1) {
+    if (server.aof_multi_part) {
+        off_t size = 0;
+        listIter li;
+        listNode *ln;
+
+        if (server.aof_base && redis_stat(server.aof_base->filename,&sb) != -1)
+            size += sb.st_size;
+        listRewind(server.aof_incrs,&li);
+        while((ln = listNext(&li)) != NULL) {
+            aofPart *p = listNodeValue(ln);
+
+            if (redis_stat(p->filename,&sb) != -1) size += sb.st_size;
+        }
+        server.aof_current_size = size;
+        server.aof_last_incr_size = 0;
+        if (server.aof_fd != -1 && redis_fstat(server.aof_fd,&sb) != -1)
+            server.aof_last_incr_size = sb.st_size;
+    } else if (redis_fstat(server.aof_fd,&sb) == -1) {
         serverLog(LL_WARNING,"Unable to obtain the AOF file length. stat: %s",
             strerror(errno));
     } else {
@@ -1374,7 +3060,16 @@ void aofUpdateCurrentSize(void) {
 /* A background append only file rewriting (BGREWRITEAOF) terminated its work.
  * Handle this. */
 void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
-    if (!bysignal && exitcode == 0) {
+    if (!bysignal && exitcode == 0 && server.aof_multi_part) {
+        serverLog(LL_NOTICE,
+            "Background AOF rewrite terminated with success");
+        if (aofRewriteDoneMultiPart() == C_ERR) goto cleanup;
+        server.aof_lastbgrewrite_status = C_OK;
+        if (server.aof_state != AOF_OFF) aofCalibrateLiveRatio();
+        serverLog(LL_NOTICE, "Background AOF rewrite finished successfully");
+        if (server.aof_state == AOF_WAIT_REWRITE)
+            server.aof_state = AOF_ON;
+    } else if (!bysignal && exitcode == 0) {
         int newfd, oldfd;
         char tmpfile[256];
         long long now = ustime();
@@ -1468,13 +3163,18 @@ void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
             close(newfd);
         } else {
             /* AOF enabled, replace the old fd with the new one. */
+            aofWriterDrain();
             oldfd = server.aof_fd;
             server.aof_fd = newfd;
-            if (server.aof_fsync == AOF_FSYNC_ALWAYS)
+            if (server.aof_fsync == AOF_FSYNC_ALWAYS) {
                 aof_fsync(newfd);
-            else if (server.aof_fsync == AOF_FSYNC_EVERYSEC)
+                /* The new file has all the writes, since the rewrite
+                 * buffer accumulated them as well. */
+                aofFsyncedAll();
+            } else if (server.aof_fsync == AOF_FSYNC_EVERYSEC)
                 aof_background_fsync(newfd);
             server.aof_selected_db = -1; /* Make sure SELECT is re-issued */
+            server.aof_cur_timestamp = 0;
             aofUpdateCurrentSize();
             server.aof_rewrite_base_size = server.aof_current_size;
 
@@ -1482,9 +3182,11 @@ void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
              * the new AOF from the background rewrite buffer. */
             sdsfree(server.aof_buf);
             server.aof_buf = sdsempty();
+            server.aof_bin_block_start = -1;
         }
 
         server.aof_lastbgrewrite_status = C_OK;
+        if (server.aof_state != AOF_OFF) aofCalibrateLiveRatio();
 
         serverLog(LL_NOTICE, "Background AOF rewrite finished successfully");
         /* Change state from WAIT_REWRITE to ON if needed */
@@ -1511,13 +3213,15 @@ void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
     }
 
 cleanup:
-    aofClosePipes();
+    if (!server.aof_multi_part) aofClosePipes();
     aofRewriteBufferReset();
     aofRemoveTempFile(server.aof_child_pid);
     server.aof_child_pid = -1;
     server.aof_rewrite_time_last = time(NULL)-server.aof_rewrite_time_start;
     server.aof_rewrite_time_start = -1;
     /* Schedule a new rewrite if we are waiting for it to switch the AOF ON. */
-    if (server.aof_state == AOF_WAIT_REWRITE)
+    if (server.aof_state == AOF_WAIT_REWRITE) {
+        if (server.aof_multi_part) aofRewriteFailedMultiPart();
         server.aof_rewrite_scheduled = 1;
+    }
 }
@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2026, the Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "aofbin.h"
+#include "lzf.h"
+#include "lz4.h"
+#include "crc64.h"
+
+#include <string.h>
+#include <strings.h>
+
+/* Commands encoded as a numerical ID in the records. The ID is the index in
+ * the table: since it is stored in the AOF files, new commands can only be
+ * appended at the end, and the existing entries can never be changed. Any
+ * other command is stored by name. */
+static const char *aofBinCommands[] = {
+    NULL,   /* 0: the command name follows. */
+    "SELECT", "SET", "PEXPIREAT", "DEL", "MULTI", "EXEC", "INCR", "DECR",
+    "INCRBY", "DECRBY", "INCRBYFLOAT", "APPEND", "SETRANGE", "SETBIT",
+    "GETSET", "MSET", "SETNX", "MSETNX", "PERSIST", "RENAME", "RENAMENX",
+    "MOVE", "LPUSH", "RPUSH", "LPUSHX", "RPUSHX", "LPOP", "RPOP", "LINSERT",
+    "LSET", "LREM", "LTRIM", "RPOPLPUSH", "SADD", "SREM", "SMOVE",
+    "SINTERSTORE", "SUNIONSTORE", "SDIFFSTORE", "ZADD", "ZINCRBY", "ZREM",
+    "ZREMRANGEBYSCORE", "ZREMRANGEBYRANK", "ZREMRANGEBYLEX", "ZUNIONSTORE",
+    "ZINTERSTORE", "HSET", "HSETNX", "HMSET", "HDEL", "HINCRBY",
+    "HINCRBYFLOAT", "PFADD", "PFMERGE", "FLUSHDB", "FLUSHALL", "EVAL",
+    "EVALSHA", "SCRIPT", "RESTORE", "GEOADD", "BITOP", "BITFIELD"
+};
+
+#define AOF_BIN_COMMANDS (sizeof(aofBinCommands)/sizeof(aofBinCommands[0]))
+
+/* Compression codecs, indexed by AOF_BIN_CODEC_*. */
+typedef struct aofBinCodec {
+    size_t (*compress)(const void *in, size_t in_len, void *out,
+                       size_t out_len);
+    size_t (*decompress)(const void *in, size_t in_len, void *out,
+                         size_t out_len);
+} aofBinCodec;
+
+static size_t aofBinLzfCompress(const void *in, size_t in_len, void *out,
+                                size_t out_len)
+{
+    return lzf_compress(in,in_len,out,out_len);
+}
+
+static size_t aofBinLzfDecompress(const void *in, size_t in_len, void *out,
+                                  size_t out_len)
+{
+    return lzf_decompress(in,in_len,out,out_len);
+}
+
+static aofBinCodec aofBinCodecs[] = {
+    {NULL,NULL},                                /* AOF_BIN_CODEC_NONE */
+    {aofBinLzfCompress,aofBinLzfDecompress},    /* AOF_BIN_CODEC_LZF */
+    {lz4_compress,lz4_decompress}               /* AOF_BIN_CODEC_LZ4 */
+};
+
+static void aofBinWrite32(unsigned char *p, uint32_t v) {
+    int j;
+
+    for (j = 0; j < 4; j++) p[j] = (v >> (j*8)) & 0xff;
+}
+
+static void aofBinWrite64(unsigned char *p, uint64_t v) {
+    int j;
+
+    for (j = 0; j < 8; j++) p[j] = (v >> (j*8)) & 0xff;
+}
+
+static uint32_t aofBinRead32(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t aofBinRead64(const unsigned char *p) {
+    return (uint64_t)aofBinRead32(p) | ((uint64_t)aofBinRead32(p+4) << 32);
+}
+
+/* Store 'v' at 'buf', that must have room for AOF_BIN_VARINT_MAX_LEN bytes,
+ * 7 bits per byte starting from the least significant ones. Returns the
+ * number of bytes used. */
+int aofBinEncodeVarint(unsigned char *buf, uint64_t v) {
+    int len = 0;
+
+    while (v >= 0x80) {
+        buf[len++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    buf[len++] = v;
+    return len;
+}
+
+/* Read a varint at '*p', advancing the pointer. Returns 0 if the varint is
+ * truncated or malformed, otherwise 1. */
+static int aofBinReadVarint(const unsigned char **p, const unsigned char *end,
+                            uint64_t *v)
+{
+    uint64_t val = 0;
+    int shift = 0;
+
+    while (*p < end && shift < 64) {
+        unsigned char c = *(*p)++;
+
+        val |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            *v = val;
+            return 1;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+/* Return the ID of the command 'name', or 0 if it has no ID. */
+int aofBinCommandId(const char *name, size_t len) {
+    size_t j;
+
+    for (j = 1; j < AOF_BIN_COMMANDS; j++) {
+        if (strlen(aofBinCommands[j]) == len &&
+            !strncasecmp(aofBinCommands[j],name,len)) return j;
+    }
+    return 0;
+}
+
+/* Return the name of the command with ID 'id', or NULL if there is no
+ * such ID. */
+const char *aofBinCommandName(int id) {
+    if (id < 1 || (size_t)id >= AOF_BIN_COMMANDS) return NULL;
+    return aofBinCommands[id];
+}
+
+/* Seal a block: 'block' holds AOF_BIN_HDR_LEN free bytes followed by
+ * 'rawlen' bytes of records. The records are compressed in place with
+ * 'codec' if that saves space, using 'tmp' that must have room for 'rawlen'
+ * bytes, and the header is filled. Returns the length of the block. */
+size_t aofBinSealBlock(unsigned char *block, size_t rawlen, int codec,
+                       unsigned char *tmp)
+{
+    unsigned char *payload = block+AOF_BIN_HDR_LEN;
+    size_t len = 0;
+    uint64_t crc;
+
+    if (codec != AOF_BIN_CODEC_NONE && rawlen >= AOF_BIN_MIN_COMPRESS)
+        len = aofBinCodecs[codec].compress(payload,rawlen,tmp,rawlen-1);
+    if (len) {
+        memcpy(payload,tmp,len);
+    } else {
+        codec = AOF_BIN_CODEC_NONE;
+        len = rawlen;
+    }
+    block[0] = AOF_BIN_MARKER;
+    block[1] = codec;
+    aofBinWrite32(block+2,rawlen);
+    aofBinWrite32(block+6,len);
+    crc = crc64(0,block,10);
+    crc = crc64(crc,payload,len);
+    aofBinWrite64(block+10,crc);
+    return AOF_BIN_HDR_LEN+len;
+}
+
+/* Parse the AOF_BIN_HDR_LEN bytes of a block header. Returns 0 if it is not
+ * a valid header, otherwise 1. */
+int aofBinParseHeader(const unsigned char *hdr, aofBinHeader *h) {
+    if (hdr[0] != AOF_BIN_MARKER || hdr[1] > AOF_BIN_CODEC_LZ4) return 0;
+    h->codec = hdr[1];
+    h->rawlen = aofBinRead32(hdr+2);
+    h->len = aofBinRead32(hdr+6);
+    h->crc = aofBinRead64(hdr+10);
+    if (h->codec == AOF_BIN_CODEC_NONE && h->rawlen != h->len) return 0;
+    if (h->codec != AOF_BIN_CODEC_NONE && h->rawlen <= h->len) return 0;
+    return 1;
+}
+
+/* Check the CRC of the block with header 'hdr' and 'payload'. Returns 0 if
+ * the block is corrupted, otherwise 1. */
+int aofBinCheckPayload(const unsigned char *hdr, const unsigned char *payload) {
+    aofBinHeader h;
+    uint64_t crc;
+
+    if (!aofBinParseHeader(hdr,&h)) return 0;
+    crc = crc64(0,hdr,10);
+    crc = crc64(crc,payload,h.len);
+    return crc == h.crc;
+}
+
+/* Store the records of a block already checked with aofBinCheckPayload() at
+ * 'raw', that must have room for the 'rawlen' bytes of the header. Returns
+ * 0 if the payload can't be decompressed, otherwise 1. */
+int aofBinDecodePayload(const unsigned char *hdr, const unsigned char *payload,
+                        unsigned char *raw)
+{
+    aofBinHeader h;
+
+    if (!aofBinParseHeader(hdr,&h)) return 0;
+    if (h.codec == AOF_BIN_CODEC_NONE) {
+        memcpy(raw,payload,h.len);
+        return 1;
+    }
+    return aofBinCodecs[h.codec].decompress(payload,h.len,raw,h.rawlen) ==
+           h.rawlen;
+}
+
+/* Read the number of arguments of the record at '*p', advancing the
+ * pointer. Returns 0 if the record is malformed, otherwise 1. */
+int aofBinReadArgc(const unsigned char **p, const unsigned char *end,
+                   long *argc)
+{
+    uint64_t v;
+
+    /* Every argument takes at least one byte. */
+    if (!aofBinReadVarint(p,end,&v) || v < 1 || v > (uint64_t)(end-*p))
+        return 0;
+    *argc = v;
+    return 1;
+}
+
+/* Read the next argument of the record at '*p', advancing the pointer.
+ * 'first' tells if it's the command name, that may be stored as an ID.
+ * On success 1 is returned, and 'arg' and 'len' point to the argument,
+ * otherwise 0 is returned. */
+int aofBinReadArg(const unsigned char **p, const unsigned char *end,
+                  int first, const char **arg, size_t *len)
+{
+    uint64_t v;
+
+    if (first) {
+        if (!aofBinReadVarint(p,end,&v) || v >= AOF_BIN_COMMANDS) return 0;
+        if (v) {
+            *arg = aofBinCommands[v];
+            *len = strlen(*arg);
+            return 1;
+        }
+    }
+    if (!aofBinReadVarint(p,end,&v) || v > (uint64_t)(end-*p)) return 0;
+    *arg = (const char*)*p;
+    *len = v;
+    *p += v;
+    return 1;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2026, the Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __AOFBIN_H
+#define __AOFBIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Binary AOF records (see the aof-format option).
+ *
+ * With "aof-format binary" commands are appended to the AOF as blocks of
+ * binary records instead of RESP text. A block starts with a fixed size
+ * header:
+ *
+ *   marker   1 byte   AOF_BIN_MARKER, a byte no RESP command starts with.
+ *   codec    1 byte   AOF_BIN_CODEC_* used to compress the payload.
+ *   rawlen   4 bytes  Payload length once decompressed, little endian.
+ *   len      4 bytes  Length of the payload following the header.
+ *   crc      8 bytes  CRC64 of the first 10 bytes of the header and of
+ *                     the payload, little endian.
+ *
+ * The decompressed payload is a sequence of records, one per command:
+ *
+ *   argc                    varint
+ *   command id              varint, AOF_BIN_CMD_* or 0 followed by the
+ *                           command name as a varint length and bytes.
+ *   argc-1 arguments        varint length and bytes each.
+ *
+ * Blocks can be mixed with RESP commands and with an RDB preamble in the
+ * same file: the loader looks at the first byte to tell them apart. */
+
+#define AOF_BIN_MARKER 0xAB
+#define AOF_BIN_HDR_LEN 18
+#define AOF_BIN_VARINT_MAX_LEN 10
+
+/* Blocks are sealed once the payload reaches AOF_BIN_BLOCK_LEN bytes, and
+ * can't be bigger than AOF_BIN_MAX_PAYLOAD. */
+#define AOF_BIN_BLOCK_LEN (1024*1024)
+#define AOF_BIN_MAX_PAYLOAD ((size_t)0xffffffff - AOF_BIN_BLOCK_LEN)
+
+/* Payloads smaller than this are not worth compressing. */
+#define AOF_BIN_MIN_COMPRESS 64
+
+#define AOF_BIN_CODEC_NONE 0
+#define AOF_BIN_CODEC_LZF 1
+#define AOF_BIN_CODEC_LZ4 2
+
+typedef struct aofBinHeader {
+    int codec;
+    uint32_t rawlen;
+    uint32_t len;
+    uint64_t crc;
+} aofBinHeader;
+
+int aofBinEncodeVarint(unsigned char *buf, uint64_t v);
+int aofBinCommandId(const char *name, size_t len);
+const char *aofBinCommandName(int id);
+size_t aofBinSealBlock(unsigned char *block, size_t rawlen, int codec,
+                       unsigned char *tmp);
+int aofBinParseHeader(const unsigned char *hdr, aofBinHeader *h);
+int aofBinCheckPayload(const unsigned char *hdr, const unsigned char *payload);
+int aofBinDecodePayload(const unsigned char *hdr, const unsigned char *payload,
+                        unsigned char *raw);
+int aofBinReadArgc(const unsigned char **p, const unsigned char *end,
+                   long *argc);
+int aofBinReadArg(const unsigned char **p, const unsigned char *end,
+                  int first, const char **arg, size_t *len);
+
+#endif
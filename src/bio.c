@@ -1,10 +1,10 @@
 /* Background I/O service for Redis.
  *
  * This file implements operations that we need to perform in the background.
- * Currently there is only a single operation, that is a background close(2)
- * system call. This is needed as when the process is the last owner of a
- * reference to a file closing it means unlinking it, and the deletion of the
- * file is slow, blocking the server.
+ * Currently there are two operations: a background close(2) system call and
+ * a background fsync(2) of the AOF. The close(2) is needed as when the
+ * process is the last owner of a reference to a file closing it means
+ * unlinking it, and the deletion of the file is slow, blocking the server.
  *
  * In the future we'll either continue implementing new things we need or
  * we'll switch to libeio. However there are probably long term uses for this
@@ -15,14 +15,20 @@
  * DESIGN
  * ------
  *
- * The design is trivial, we have a structure representing a job to perform
- * and a different thread and job queue for every job type.
- * Every thread wait for new jobs in its queue, and process every job
- * sequentially.
+ * We have a structure representing a job to perform and a different job
+ * queue for every job type, served by a pool of worker threads of its own
+ * (one thread by default, see the bio-*-workers options), so that a slow job
+ * of a given type never delays the jobs of the other types.
  *
- * Jobs of the same type are guaranteed to be processed from the least
+ * Every queue has two priorities: high priority jobs are always picked
+ * before normal priority jobs, but a job already in progress is never
+ * interrupted. Jobs of the same type and priority are picked from the least
  * recently inserted to the most recently inserted (older jobs processed
- * first).
+ * first), so with a single worker they are also completed in this order.
+ * With more workers jobs of the same type may run concurrently.
+ *
+ * Adding a job type only requires a new opcode in bio.h and an entry in the
+ * bio_types table below with the function processing the job.
  *
  * Currently there is no way for the creator of the job to be notified about
  * the completion of the operation, this will only be added when/if needed.
@@ -61,46 +67,135 @@
 #include "server.h"
 #include "bio.h"
 
-static pthread_t bio_threads[BIO_NUM_OPS];
-static pthread_mutex_t bio_mutex[BIO_NUM_OPS];
-static pthread_cond_t bio_condvar[BIO_NUM_OPS];
-static list *bio_jobs[BIO_NUM_OPS];
-/* The following array is used to hold the number of pending jobs for every
- * OP type. This allows us to export the bioPendingJobsOfType() API that is
- * useful when the main thread wants to perform some operation that may involve
- * objects shared with the background thread. The main thread will just wait
- * that there are no longer jobs of this type to be executed before performing
- * the sensible operation. This data is also useful for reporting. */
-static unsigned long long bio_pending[BIO_NUM_OPS];
-
 /* This structure represents a background Job. It is only used locally to this
  * file as the API does not expose the internals at all. */
 struct bio_job {
-    time_t time; /* Time at which the job was created. */
+    long long time; /* Time at which the job was created, in microseconds. */
     /* Job specific arguments pointers. If we need to pass more than three
      * arguments we can just pass a pointer to a structure or alike. */
     void *arg1, *arg2, *arg3;
 };
 
+/* Job latency histogram: the bucket j counts the jobs completed in less than
+ * 10^(j+1) microseconds since their creation, the last bucket counts all the
+ * slower jobs. */
+#define BIO_LATENCY_BUCKETS 7
+static char *bio_latency_buckets[BIO_LATENCY_BUCKETS] = {
+    "lt_10us","lt_100us","lt_1ms","lt_10ms","lt_100ms","lt_1s","ge_1s"
+};
+
+/* The queue of a job type with its worker threads. All the fields but the
+ * threads array are protected by the mutex. */
+static struct bio_queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t condvar;
+    list *jobs[BIO_NUM_PRIOS];
+    pthread_t threads[BIO_MAX_WORKERS];
+    int workers;
+    /* The number of pending jobs, queued or in progress. This allows us to
+     * export the bioPendingJobsOfType() API that is useful when the main
+     * thread wants to perform some operation that may involve objects shared
+     * with the background threads. The main thread will just wait that there
+     * are no longer jobs of this type to be executed before performing the
+     * sensible operation. This data is also useful for reporting. */
+    unsigned long long pending;
+    unsigned long long active;      /* Jobs in progress. */
+    unsigned long long max_queued;  /* Max queue depth observed. */
+    unsigned long long processed;   /* Jobs completed. */
+    long long usec;                 /* Total time spent processing jobs. */
+    unsigned long long latency[BIO_LATENCY_BUCKETS];
+} bio_queues[BIO_NUM_OPS];
+
+static void bioCloseFile(struct bio_job *job) {
+    bioCloseResult *res = job->arg3;
+    int err = 0;
+
+    /* A non NULL arg2 asks to fsync the file before closing it, used when
+     * switching the multi part AOF to a new file. */
+    if (job->arg2 && aof_fsync((long)job->arg1) == -1) err = errno;
+    if (close((long)job->arg1) == -1 && !err) err = errno;
+    /* A non NULL arg3 is where the outcome is reported to the caller. */
+    if (res) {
+        res->err = err;
+        __atomic_store_n(&res->done,1,__ATOMIC_RELEASE);
+        bioReleaseCloseResult(res);
+    }
+}
+
+/* Create the result of a BIO_CLOSE_FILE job. It is shared by the job and
+ * the caller, and freed by the last of the two calling
+ * bioReleaseCloseResult(), so the caller can stop waiting at any time. */
+bioCloseResult *bioCreateCloseResult(void) {
+    bioCloseResult *res = zmalloc(sizeof(*res));
+
+    res->done = 0;
+    res->err = 0;
+    res->refcount = 2;
+    return res;
+}
+
+void bioReleaseCloseResult(bioCloseResult *res) {
+    if (__atomic_sub_fetch(&res->refcount,1,__ATOMIC_ACQ_REL) == 0)
+        zfree(res);
+}
+
+/* Return true if the job reporting to 'res' is done. Its error, if any, is
+ * then in res->err. */
+int bioCloseResultDone(bioCloseResult *res) {
+    return __atomic_load_n(&res->done,__ATOMIC_ACQUIRE);
+}
+
+static void bioAofFsync(struct bio_job *job) {
+    aof_fsync((long)job->arg1);
+    /* A non NULL arg2 is the AOF offset covered by a group commit fsync,
+     * that must be reported to the main thread. */
+    if (job->arg2) {
+        aofGroupFsyncDone(*(long long*)job->arg2);
+        zfree(job->arg2);
+    }
+}
+
+/* The job types, indexed by opcode. The name is used by INFO. */
+static struct bio_type {
+    char *name;
+    void (*proc)(struct bio_job *job);
+} bio_types[BIO_NUM_OPS] = {
+    [BIO_CLOSE_FILE] = {"close_file",bioCloseFile},
+    [BIO_AOF_FSYNC] = {"aof_fsync",bioAofFsync}
+};
+
 void *bioProcessBackgroundJobs(void *arg);
 
 /* Make sure we have enough stack to perform all the things we do in the
  * main thread. */
 #define REDIS_THREAD_STACK_SIZE (1024*1024*4)
 
-/* Initialize the background system, spawning the thread. */
+/* Return the number of worker threads configured for the job type. */
+static int bioConfiguredWorkers(int type) {
+    int workers = 1;
+
+    if (type == BIO_CLOSE_FILE) workers = server.bio_close_file_workers;
+    else if (type == BIO_AOF_FSYNC) workers = server.bio_aof_fsync_workers;
+    if (workers < 1) workers = 1;
+    if (workers > BIO_MAX_WORKERS) workers = BIO_MAX_WORKERS;
+    return workers;
+}
+
+/* Initialize the background system, spawning the threads. */
 void bioInit(void) {
     pthread_attr_t attr;
     pthread_t thread;
     size_t stacksize;
-    int j;
+    int j, i;
 
     /* Initialization of state vars and objects */
     for (j = 0; j < BIO_NUM_OPS; j++) {
-        pthread_mutex_init(&bio_mutex[j],NULL);
-        pthread_cond_init(&bio_condvar[j],NULL);
-        bio_jobs[j] = listCreate();
-        bio_pending[j] = 0;
+        struct bio_queue *q = bio_queues+j;
+
+        memset(q,0,sizeof(*q));
+        pthread_mutex_init(&q->mutex,NULL);
+        pthread_cond_init(&q->condvar,NULL);
+        for (i = 0; i < BIO_NUM_PRIOS; i++) q->jobs[i] = listCreate();
     }
 
     /* Set the stack size as by default it may be small in some system */
@@ -115,31 +210,51 @@ void bioInit(void) {
      * responsible of. */
     for (j = 0; j < BIO_NUM_OPS; j++) {
         void *arg = (void*)(unsigned long) j;
-        if (pthread_create(&thread,&attr,bioProcessBackgroundJobs,arg) != 0) {
-            serverLog(LL_WARNING,"Fatal: Can't initialize Background Jobs.");
-            exit(1);
+        int workers = bioConfiguredWorkers(j);
+
+        for (i = 0; i < workers; i++) {
+            if (pthread_create(&thread,&attr,bioProcessBackgroundJobs,arg) != 0) {
+                serverLog(LL_WARNING,"Fatal: Can't initialize Background Jobs.");
+                exit(1);
+            }
+            bio_queues[j].threads[i] = thread;
+            bio_queues[j].workers++;
         }
-        bio_threads[j] = thread;
     }
 }
 
-void bioCreateBackgroundJob(int type, void *arg1, void *arg2, void *arg3) {
+static void bioQueueJob(int type, int prio, void *arg1, void *arg2, void *arg3) {
+    struct bio_queue *q = bio_queues+type;
     struct bio_job *job = zmalloc(sizeof(*job));
+    unsigned long long queued;
 
-    job->time = time(NULL);
+    job->time = ustime();
     job->arg1 = arg1;
     job->arg2 = arg2;
     job->arg3 = arg3;
-    pthread_mutex_lock(&bio_mutex[type]);
-    listAddNodeTail(bio_jobs[type],job);
-    bio_pending[type]++;
-    pthread_cond_signal(&bio_condvar[type]);
-    pthread_mutex_unlock(&bio_mutex[type]);
+    pthread_mutex_lock(&q->mutex);
+    listAddNodeTail(q->jobs[prio],job);
+    q->pending++;
+    queued = q->pending-q->active;
+    if (queued > q->max_queued) q->max_queued = queued;
+    pthread_cond_signal(&q->condvar);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+void bioCreateBackgroundJob(int type, void *arg1, void *arg2, void *arg3) {
+    bioQueueJob(type,BIO_PRIO_NORMAL,arg1,arg2,arg3);
+}
+
+/* Like bioCreateBackgroundJob() but the job is processed before the normal
+ * priority jobs of the same type still in the queue. */
+void bioCreatePriorityJob(int type, void *arg1, void *arg2, void *arg3) {
+    bioQueueJob(type,BIO_PRIO_HIGH,arg1,arg2,arg3);
 }
 
 void *bioProcessBackgroundJobs(void *arg) {
     struct bio_job *job;
     unsigned long type = (unsigned long) arg;
+    struct bio_queue *q;
     sigset_t sigset;
 
     /* Check that the type is within the right interval. */
@@ -148,13 +263,14 @@ void *bioProcessBackgroundJobs(void *arg) {
             "Warning: bio thread started with wrong type %lu",type);
         return NULL;
     }
+    q = bio_queues+type;
 
     /* Make the thread killable at any time, so that bioKillThreads()
      * can work reliably. */
     pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
     pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
 
-    pthread_mutex_lock(&bio_mutex[type]);
+    pthread_mutex_lock(&q->mutex);
     /* Block SIGALRM so we are sure that only the main thread will
      * receive the watchdog signal. */
     sigemptyset(&sigset);
@@ -165,62 +281,101 @@ void *bioProcessBackgroundJobs(void *arg) {
 
     while(1) {
         listNode *ln;
+        long long start, end, latency;
+        int prio, bucket;
 
-        /* The loop always starts with the lock hold. */
-        if (listLength(bio_jobs[type]) == 0) {
-            pthread_cond_wait(&bio_condvar[type],&bio_mutex[type]);
+        /* The loop always starts with the lock hold. Pop the job from the
+         * queue with the highest priority that is not empty. */
+        for (prio = BIO_NUM_PRIOS-1; prio >= 0; prio--)
+            if (listLength(q->jobs[prio])) break;
+        if (prio < 0) {
+            pthread_cond_wait(&q->condvar,&q->mutex);
             continue;
         }
-        /* Pop the job from the queue. */
-        ln = listFirst(bio_jobs[type]);
+        ln = listFirst(q->jobs[prio]);
         job = ln->value;
+        listDelNode(q->jobs[prio],ln);
+        q->active++;
         /* It is now possible to unlock the background system as we know have
          * a stand alone job structure to process.*/
-        pthread_mutex_unlock(&bio_mutex[type]);
+        pthread_mutex_unlock(&q->mutex);
 
         /* Process the job accordingly to its type. */
-        if (type == BIO_CLOSE_FILE) {
-            close((long)job->arg1);
-        } else if (type == BIO_AOF_FSYNC) {
-            aof_fsync((long)job->arg1);
-        } else {
-            serverPanic("Wrong job type in bioProcessBackgroundJobs().");
-        }
+        start = ustime();
+        bio_types[type].proc(job);
+        end = ustime();
+        latency = end-job->time;
+        for (bucket = 0; bucket < BIO_LATENCY_BUCKETS-1 && latency >= 10;
+             bucket++) latency /= 10;
         zfree(job);
 
         /* Lock again before reiterating the loop, if there are no longer
          * jobs to process we'll block again in pthread_cond_wait(). */
-        pthread_mutex_lock(&bio_mutex[type]);
-        listDelNode(bio_jobs[type],ln);
-        bio_pending[type]--;
+        pthread_mutex_lock(&q->mutex);
+        q->active--;
+        q->pending--;
+        q->processed++;
+        q->usec += end-start;
+        q->latency[bucket]++;
     }
 }
 
 /* Return the number of pending jobs of the specified type. */
 unsigned long long bioPendingJobsOfType(int type) {
     unsigned long long val;
-    pthread_mutex_lock(&bio_mutex[type]);
-    val = bio_pending[type];
-    pthread_mutex_unlock(&bio_mutex[type]);
+    pthread_mutex_lock(&bio_queues[type].mutex);
+    val = bio_queues[type].pending;
+    pthread_mutex_unlock(&bio_queues[type].mutex);
     return val;
 }
 
+/* Append the "Bio" section of INFO to 'info'. */
+sds bioGenInfoString(sds info) {
+    int j, i;
+
+    for (j = 0; j < BIO_NUM_OPS; j++) {
+        struct bio_queue *q = bio_queues+j;
+        char *name = bio_types[j].name;
+
+        pthread_mutex_lock(&q->mutex);
+        info = sdscatprintf(info,
+            "bio_%s:workers=%d,queued=%llu,queued_high=%lu,active=%llu,"
+            "max_queued=%llu,processed=%llu,usec=%lld,usec_per_job=%.2f\r\n",
+            name, q->workers, q->pending-q->active,
+            listLength(q->jobs[BIO_PRIO_HIGH]), q->active,
+            q->max_queued, q->processed, q->usec,
+            q->processed ? (float)q->usec/q->processed : 0);
+        info = sdscatprintf(info,"bio_%s_latency:",name);
+        for (i = 0; i < BIO_LATENCY_BUCKETS; i++) {
+            info = sdscatprintf(info,"%s%s=%llu", i ? "," : "",
+                bio_latency_buckets[i], q->latency[i]);
+        }
+        info = sdscatlen(info,"\r\n",2);
+        pthread_mutex_unlock(&q->mutex);
+    }
+    return info;
+}
+
 /* Kill the running bio threads in an unclean way. This function should be
  * used only when it's critical to stop the threads for some reason.
  * Currently Redis does this only on crash (for instance on SIGSEGV) in order
  * to perform a fast memory check without other threads messing with memory. */
 void bioKillThreads(void) {
-    int err, j;
+    int err, j, i;
 
     for (j = 0; j < BIO_NUM_OPS; j++) {
-        if (pthread_cancel(bio_threads[j]) == 0) {
-            if ((err = pthread_join(bio_threads[j],NULL)) != 0) {
-                serverLog(LL_WARNING,
-                    "Bio thread for job type #%d can be joined: %s",
-                        j, strerror(err));
-            } else {
-                serverLog(LL_WARNING,
-                    "Bio thread for job type #%d terminated",j);
+        for (i = 0; i < bio_queues[j].workers; i++) {
+            pthread_t thread = bio_queues[j].threads[i];
+
+            if (pthread_cancel(thread) == 0) {
+                if ((err = pthread_join(thread,NULL)) != 0) {
+                    serverLog(LL_WARNING,
+                        "Bio thread for job type #%d can be joined: %s",
+                            j, strerror(err));
+                } else {
+                    serverLog(LL_WARNING,
+                        "Bio thread for job type #%d terminated",j);
+                }
             }
         }
     }
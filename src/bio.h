@@ -27,15 +27,35 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+/* Outcome of a BIO_CLOSE_FILE job, see bioCreateCloseResult(). */
+typedef struct bioCloseResult {
+    int done;       /* Set once the file is closed. */
+    int err;        /* errno of the failed fsync or close, or zero. */
+    int refcount;   /* Owners: the job and the caller. */
+} bioCloseResult;
+
 /* Exported API */
 void bioInit(void);
 void bioCreateBackgroundJob(int type, void *arg1, void *arg2, void *arg3);
+void bioCreatePriorityJob(int type, void *arg1, void *arg2, void *arg3);
 unsigned long long bioPendingJobsOfType(int type);
 void bioWaitPendingJobsLE(int type, unsigned long long num);
 time_t bioOlderJobOfType(int type);
 void bioKillThreads(void);
+sds bioGenInfoString(sds info);
+bioCloseResult *bioCreateCloseResult(void);
+void bioReleaseCloseResult(bioCloseResult *res);
+int bioCloseResultDone(bioCloseResult *res);
 
 /* Background job opcodes */
 #define BIO_CLOSE_FILE    0 /* Deferred close(2) syscall. */
 #define BIO_AOF_FSYNC     1 /* Deferred AOF fsync. */
 #define BIO_NUM_OPS       2
+
+/* Background job priorities */
+#define BIO_PRIO_NORMAL   0
+#define BIO_PRIO_HIGH     1
+#define BIO_NUM_PRIOS     2
+
+/* Max worker threads for a job type. */
+#define BIO_MAX_WORKERS   16
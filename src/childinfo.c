@@ -0,0 +1,99 @@
+/* Child info pipe: statistics reported by the saving children.
+ *
+ * Before forking a child that saves the dataset (BGSAVE, diskless
+ * replication or BGREWRITEAOF) the parent opens a pipe. Before exiting, the
+ * child writes on it a small fixed size structure, and the parent reads it
+ * when the child terminates, in order to update the stats reported by INFO.
+ *
+ * Currently the only information sent is the amount of memory the child
+ * duplicated by copy-on-write, that is, the private dirty memory of the
+ * child: pages modified by the parent while the child is running are
+ * copied, and this is the real memory cost of a snapshot.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include <unistd.h>
+
+/* Open the pipe used by the next child to report its info. On error the
+ * file descriptors are left to -1, and the child will just not report. */
+void openChildInfoPipe(void) {
+    if (pipe(server.child_info_pipe) == -1) {
+        closeChildInfoPipe();
+    } else if (anetNonBlock(NULL,server.child_info_pipe[0]) != ANET_OK) {
+        closeChildInfoPipe();
+    } else {
+        memset(&server.child_info_data,0,sizeof(server.child_info_data));
+    }
+}
+
+/* Close the pipe, if open. */
+void closeChildInfoPipe(void) {
+    if (server.child_info_pipe[0] != -1 ||
+        server.child_info_pipe[1] != -1)
+    {
+        close(server.child_info_pipe[0]);
+        close(server.child_info_pipe[1]);
+        server.child_info_pipe[0] = -1;
+        server.child_info_pipe[1] = -1;
+    }
+}
+
+/* Called by the child before exiting: send the info filled in
+ * server.child_info_data to the parent, tagged with the child type. */
+void sendChildInfo(int ptype) {
+    ssize_t wlen = sizeof(server.child_info_data);
+
+    if (server.child_info_pipe[1] == -1) return;
+    server.child_info_data.magic = CHILD_INFO_MAGIC;
+    server.child_info_data.process_type = ptype;
+    if (write(server.child_info_pipe[1],&server.child_info_data,wlen) != wlen) {
+        /* Nothing to do on error, the parent will find nothing to read. */
+    }
+}
+
+/* Called by the parent once the child terminated: read the info the child
+ * sent, if any (the child may have failed or may have been killed), and
+ * update the related stats. */
+void receiveChildInfo(void) {
+    ssize_t rlen = sizeof(server.child_info_data);
+
+    if (server.child_info_pipe[0] == -1) return;
+    if (read(server.child_info_pipe[0],&server.child_info_data,rlen) == rlen &&
+        server.child_info_data.magic == CHILD_INFO_MAGIC)
+    {
+        if (server.child_info_data.process_type == CHILD_INFO_TYPE_RDB) {
+            server.stat_rdb_cow_bytes = server.child_info_data.cow_size;
+        } else if (server.child_info_data.process_type == CHILD_INFO_TYPE_AOF) {
+            server.stat_aof_cow_bytes = server.child_info_data.cow_size;
+        }
+    }
+}
@@ -4398,6 +4398,7 @@ void clusterCommand(client *c) {
 void createDumpPayload(rio *payload, robj *o) {
     unsigned char buf[2];
     uint64_t crc;
+    int rdbver;
 
     /* Serialize the object in a RDB-like format. It consist of an object type
      * byte followed by the serialized object. This is understood by RESTORE. */
@@ -4413,8 +4414,9 @@ void createDumpPayload(rio *payload, robj *o) {
      */
 
     /* RDB version */
-    buf[0] = RDB_VERSION & 0xff;
-    buf[1] = (RDB_VERSION >> 8) & 0xff;
+    rdbver = rdbVersionToSave(0);
+    buf[0] = rdbver & 0xff;
+    buf[1] = (rdbver >> 8) & 0xff;
     payload->io.buffer.ptr = sdscatlen(payload->io.buffer.ptr,buf,2);
 
     /* CRC64 */
@@ -4439,7 +4441,7 @@ int verifyDumpPayload(unsigned char *p, size_t len) {
 
     /* Verify RDB version */
     rdbver = (footer[1] << 8) | footer[0];
-    if (rdbver > RDB_VERSION) return C_ERR;
+    if (rdbver > RDB_EXTENDED_VERSION) return C_ERR;
 
     /* Verify CRC64 */
     crc = crc64(0,p,len-8);
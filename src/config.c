@@ -30,6 +30,8 @@
 
 #include "server.h"
 #include "cluster.h"
+#include "aofbin.h"
+#include "bio.h"
 
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -89,6 +91,32 @@ configEnum aof_fsync_enum[] = {
     {NULL, 0}
 };
 
+configEnum rdb_compression_codec_enum[] = {
+    {"lzf", RDB_CODEC_LZF},
+    {"lz4", RDB_CODEC_LZ4},
+    {NULL, 0}
+};
+
+configEnum aof_format_enum[] = {
+    {"resp", AOF_FORMAT_RESP},
+    {"binary", AOF_FORMAT_BINARY},
+    {NULL, 0}
+};
+
+configEnum aof_binary_compression_enum[] = {
+    {"no", AOF_BIN_CODEC_NONE},
+    {"lzf", AOF_BIN_CODEC_LZF},
+    {"lz4", AOF_BIN_CODEC_LZ4},
+    {NULL, 0}
+};
+
+configEnum repl_diskless_load_enum[] = {
+    {"disabled", REPL_DISKLESS_LOAD_DISABLED},
+    {"on-empty-db", REPL_DISKLESS_LOAD_WHEN_DB_EMPTY},
+    {"swapdb", REPL_DISKLESS_LOAD_SWAPDB},
+    {NULL, 0}
+};
+
 /* Output buffer limits presets. */
 clientBufferLimitsConfig clientBufferLimitsDefaults[CLIENT_TYPE_OBUF_COUNT] = {
     {0, 0, 0}, /* normal */
@@ -286,6 +314,24 @@ void loadServerConfigFromString(char *config) {
             if (server.dbnum < 1) {
                 err = "Invalid number of databases"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"bio-close-file-workers") &&
+                   argc == 2)
+        {
+            server.bio_close_file_workers = atoi(argv[1]);
+            if (server.bio_close_file_workers < 1 ||
+                server.bio_close_file_workers > BIO_MAX_WORKERS)
+            {
+                err = "Invalid number of bio close file workers";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"bio-aof-fsync-workers") && argc == 2) {
+            server.bio_aof_fsync_workers = atoi(argv[1]);
+            if (server.bio_aof_fsync_workers < 1 ||
+                server.bio_aof_fsync_workers > BIO_MAX_WORKERS)
+            {
+                err = "Invalid number of bio AOF fsync workers";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"include") && argc == 2) {
             loadServerConfig(argv[1],NULL);
         } else if (!strcasecmp(argv[0],"maxclients") && argc == 2) {
@@ -295,6 +341,18 @@ void loadServerConfigFromString(char *config) {
             }
         } else if (!strcasecmp(argv[0],"maxmemory") && argc == 2) {
             server.maxmemory = memtoll(argv[1],NULL);
+        } else if (!strcasecmp(argv[0],"maxmemory-clients") && argc == 2) {
+            server.maxmemory_clients = memtoll(argv[1],NULL);
+        } else if (!strcasecmp(argv[0],"small-objects-arena-size") && argc == 2) {
+            server.small_objects_arena_size = memtoll(argv[1],NULL);
+        } else if (!strcasecmp(argv[0],"intern-max-entries") && argc == 2) {
+            long long entries = strtoll(argv[1],NULL,10);
+            if (entries < 0 || entries > CONFIG_MAX_INTERN_MAX_ENTRIES) {
+                err = "Invalid max number of interned values"; goto loaderr;
+            }
+            server.intern_max_entries = entries;
+        } else if (!strcasecmp(argv[0],"intern-max-len") && argc == 2) {
+            server.intern_max_len = strtoul(argv[1],NULL,10);
         } else if (!strcasecmp(argv[0],"maxmemory-policy") && argc == 2) {
             server.maxmemory_policy =
                 configEnumGetValue(maxmemory_policy_enum,argv[1]);
@@ -333,6 +391,13 @@ void loadServerConfigFromString(char *config) {
             if ((server.repl_diskless_sync = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"repl-diskless-load") && argc==2) {
+            server.repl_diskless_load =
+                configEnumGetValue(repl_diskless_load_enum,argv[1]);
+            if (server.repl_diskless_load == INT_MIN) {
+                err = "argument must be 'disabled', 'on-empty-db' or 'swapdb'";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"repl-diskless-sync-delay") && argc==2) {
             server.repl_diskless_sync_delay = atoi(argv[1]);
             if (server.repl_diskless_sync_delay < 0) {
@@ -367,10 +432,62 @@ void loadServerConfigFromString(char *config) {
             if ((server.rdb_compression = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"rdb-compression-codec") && argc == 2) {
+            server.rdb_compression_codec =
+                configEnumGetValue(rdb_compression_codec_enum,argv[1]);
+            if (server.rdb_compression_codec == INT_MIN) {
+                err = "argument must be 'lzf' or 'lz4'";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"rdbchecksum") && argc == 2) {
             if ((server.rdb_checksum = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"rdb-chunked") && argc == 2) {
+            if ((server.rdb_chunked = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-list-compressed-nodes") &&
+                   argc == 2)
+        {
+            if ((server.rdb_list_compressed_nodes = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"bgsave-minimize-cow") && argc == 2) {
+            if ((server.bgsave_minimize_cow = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-save-drop-cache") && argc == 2) {
+            if ((server.rdb_save_drop_cache = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-save-max-rate") && argc == 2) {
+            server.rdb_save_max_rate = memtoll(argv[1],NULL);
+            if (server.rdb_save_max_rate < 0) {
+                err = "rdb-save-max-rate can't be negative"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-forkless-snapshot") && argc == 2) {
+            if ((server.rdb_forkless_snapshot = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-delta-snapshots") && argc == 2) {
+            if ((server.rdb_delta_snapshots = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-delta-max-chain") && argc == 2) {
+            server.rdb_delta_max_chain = atoi(argv[1]);
+            if (server.rdb_delta_max_chain < 1 ||
+                server.rdb_delta_max_chain > CONFIG_MAX_RDB_DELTA_MAX_CHAIN)
+            {
+                err = "Invalid rdb-delta-max-chain value"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-load-threads") && argc == 2) {
+            server.rdb_load_threads = atoi(argv[1]);
+            if (server.rdb_load_threads < 0 ||
+                server.rdb_load_threads > CONFIG_MAX_RDB_LOAD_THREADS)
+            {
+                err = "Invalid number of RDB load threads"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"activerehashing") && argc == 2) {
             if ((server.activerehashing = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
@@ -416,6 +533,16 @@ void loadServerConfigFromString(char *config) {
                 err = "Invalid negative percentage for AOF auto rewrite";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"auto-aof-rewrite-dead-percentage") &&
+                   argc == 2)
+        {
+            server.aof_rewrite_dead_perc = atoi(argv[1]);
+            if (server.aof_rewrite_dead_perc < 0 ||
+                server.aof_rewrite_dead_perc > 100)
+            {
+                err = "Invalid dead bytes percentage for AOF auto rewrite";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"auto-aof-rewrite-min-size") &&
                    argc == 2)
         {
@@ -431,6 +558,51 @@ void loadServerConfigFromString(char *config) {
             if ((server.aof_load_truncated = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"aof-use-rdb-preamble") && argc == 2) {
+            if ((server.aof_use_rdb_preamble = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"aof-group-commit") && argc == 2) {
+            if ((server.aof_group_commit = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"aof-load-threaded") && argc == 2) {
+            if ((server.aof_load_threaded = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"aof-timestamp-enabled") && argc == 2) {
+            if ((server.aof_timestamp_enabled = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"aof-writer-thread") && argc == 2) {
+            if ((server.aof_writer_thread = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"aof-writer-max-pending") &&
+                   argc == 2)
+        {
+            server.aof_writer_max_pending = memtoll(argv[1],NULL);
+            if (server.aof_writer_max_pending < 0) {
+                err = "aof-writer-max-pending can't be negative";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"aof-format") && argc == 2) {
+            server.aof_format = configEnumGetValue(aof_format_enum,argv[1]);
+            if (server.aof_format == INT_MIN) {
+                err = "argument must be 'resp' or 'binary'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"aof-binary-compression") && argc == 2) {
+            server.aof_binary_compression =
+                configEnumGetValue(aof_binary_compression_enum,argv[1]);
+            if (server.aof_binary_compression == INT_MIN) {
+                err = "argument must be 'no', 'lzf' or 'lz4'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"aof-multi-part") && argc == 2) {
+            if ((server.aof_multi_part = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"requirepass") && argc == 2) {
             if (strlen(argv[1]) > CONFIG_AUTHPASS_MAX_LEN) {
                 err = "Password is longer than CONFIG_AUTHPASS_MAX_LEN";
@@ -877,6 +1049,23 @@ void configSetCommand(client *c) {
      * config_set_bool_field(name,var). */
     } config_set_bool_field(
       "rdbcompression", server.rdb_compression) {
+    } config_set_bool_field(
+      "rdb-chunked", server.rdb_chunked) {
+    } config_set_bool_field(
+      "rdb-list-compressed-nodes", server.rdb_list_compressed_nodes) {
+    } config_set_bool_field(
+      "rdb-forkless-snapshot", server.rdb_forkless_snapshot) {
+    } config_set_bool_field(
+      "rdb-delta-snapshots", server.rdb_delta_snapshots) {
+        if (server.rdb_delta_snapshots)
+            rdbDeltaEnable();
+        else
+            rdbDeltaDisable();
+    } config_set_bool_field(
+      "rdb-save-drop-cache", server.rdb_save_drop_cache) {
+    } config_set_bool_field(
+      "bgsave-minimize-cow", server.bgsave_minimize_cow) {
+        updateDictResizePolicy();
     } config_set_bool_field(
       "repl-disable-tcp-nodelay",server.repl_disable_tcp_nodelay) {
     } config_set_bool_field(
@@ -887,6 +1076,18 @@ void configSetCommand(client *c) {
       "aof-rewrite-incremental-fsync",server.aof_rewrite_incremental_fsync) {
     } config_set_bool_field(
       "aof-load-truncated",server.aof_load_truncated) {
+    } config_set_bool_field(
+      "aof-use-rdb-preamble",server.aof_use_rdb_preamble) {
+    } config_set_bool_field(
+      "aof-group-commit",server.aof_group_commit) {
+        if (!aofGroupCommitEnabled()) aofReleaseFsyncWaiters(LLONG_MAX);
+    } config_set_bool_field(
+      "aof-load-threaded",server.aof_load_threaded) {
+    } config_set_bool_field(
+      "aof-timestamp-enabled",server.aof_timestamp_enabled) {
+        server.aof_cur_timestamp = 0;
+    } config_set_bool_field(
+      "aof-writer-thread",server.aof_writer_thread) {
     } config_set_bool_field(
       "slave-serve-stale-data",server.repl_serve_stale_data) {
     } config_set_bool_field(
@@ -906,10 +1107,29 @@ void configSetCommand(client *c) {
       "tcp-keepalive",server.tcpkeepalive,0,LLONG_MAX) {
     } config_set_numerical_field(
       "maxmemory-samples",server.maxmemory_samples,1,LLONG_MAX) {
+    } config_set_numerical_field(
+      "rdb-load-threads",server.rdb_load_threads,0,CONFIG_MAX_RDB_LOAD_THREADS) {
+    } config_set_numerical_field(
+      "rdb-delta-max-chain",server.rdb_delta_max_chain,1,CONFIG_MAX_RDB_DELTA_MAX_CHAIN) {
+    } config_set_numerical_field(
+      "intern-max-entries",server.intern_max_entries,0,CONFIG_MAX_INTERN_MAX_ENTRIES) {
+        if (dictSize(server.interned_strings) > server.intern_max_entries ||
+            dictSize(server.intern_candidates) >
+            server.intern_max_entries*OBJ_INTERN_CANDIDATES_RATIO)
+            resetInternedStrings();
+    } config_set_numerical_field(
+      "intern-max-len",server.intern_max_len,0,LLONG_MAX) {
+        resetInternedStrings();
     } config_set_numerical_field(
       "timeout",server.maxidletime,0,LONG_MAX) {
     } config_set_numerical_field(
       "auto-aof-rewrite-percentage",server.aof_rewrite_perc,0,LLONG_MAX){
+    } config_set_numerical_field(
+      "auto-aof-rewrite-dead-percentage",server.aof_rewrite_dead_perc,0,100) {
+        /* The dataset is not sampled while disabled: start again. */
+        server.aof_dataset_estimate = 0;
+        if (server.aof_rewrite_dead_perc && server.aof_state == AOF_ON)
+            aofSampleDataset();
     } config_set_numerical_field(
       "hash-max-ziplist-entries",server.hash_max_ziplist_entries,0,LLONG_MAX) {
     } config_set_numerical_field(
@@ -982,10 +1202,16 @@ void configSetCommand(client *c) {
             }
             freeMemoryIfNeeded();
         }
+    } config_set_memory_field("maxmemory-clients",server.maxmemory_clients) {
+        /* Clients are evicted by the next beforeSleep(): freeing them here
+         * could free the client calling CONFIG SET. */
     } config_set_memory_field("repl-backlog-size",ll) {
         resizeReplicationBacklog(ll);
+    } config_set_memory_field("rdb-save-max-rate",server.rdb_save_max_rate) {
     } config_set_memory_field("auto-aof-rewrite-min-size",ll) {
         server.aof_rewrite_min_size = ll;
+    } config_set_memory_field(
+      "aof-writer-max-pending",server.aof_writer_max_pending) {
 
     /* Enumeration fields.
      * config_set_enum_field(name,var,enum_var) */
@@ -995,6 +1221,18 @@ void configSetCommand(client *c) {
       "maxmemory-policy",server.maxmemory_policy,maxmemory_policy_enum) {
     } config_set_enum_field(
       "appendfsync",server.aof_fsync,aof_fsync_enum) {
+        if (!aofGroupCommitEnabled()) aofReleaseFsyncWaiters(LLONG_MAX);
+    } config_set_enum_field(
+      "aof-format",server.aof_format,aof_format_enum) {
+    } config_set_enum_field(
+      "aof-binary-compression",server.aof_binary_compression,
+      aof_binary_compression_enum) {
+    } config_set_enum_field(
+      "rdb-compression-codec",server.rdb_compression_codec,
+      rdb_compression_codec_enum) {
+    } config_set_enum_field(
+      "repl-diskless-load",server.repl_diskless_load,
+      repl_diskless_load_enum) {
 
     /* Everyhing else is an error... */
     } config_set_else {
@@ -1069,12 +1307,24 @@ void configGetCommand(client *c) {
 
     /* Numerical values */
     config_get_numerical_field("maxmemory",server.maxmemory);
+    config_get_numerical_field("maxmemory-clients",server.maxmemory_clients);
+    config_get_numerical_field("rdb-load-threads",server.rdb_load_threads);
+    config_get_numerical_field("rdb-delta-max-chain",server.rdb_delta_max_chain);
+    config_get_numerical_field("intern-max-entries",server.intern_max_entries);
+    config_get_numerical_field("intern-max-len",server.intern_max_len);
+    config_get_numerical_field("small-objects-arena-size",
+            server.small_objects_arena_size);
     config_get_numerical_field("maxmemory-samples",server.maxmemory_samples);
     config_get_numerical_field("timeout",server.maxidletime);
     config_get_numerical_field("auto-aof-rewrite-percentage",
             server.aof_rewrite_perc);
+    config_get_numerical_field("auto-aof-rewrite-dead-percentage",
+            server.aof_rewrite_dead_perc);
+    config_get_numerical_field("rdb-save-max-rate",server.rdb_save_max_rate);
     config_get_numerical_field("auto-aof-rewrite-min-size",
             server.aof_rewrite_min_size);
+    config_get_numerical_field("aof-writer-max-pending",
+            server.aof_writer_max_pending);
     config_get_numerical_field("hash-max-ziplist-entries",
             server.hash_max_ziplist_entries);
     config_get_numerical_field("hash-max-ziplist-value",
@@ -1101,6 +1351,10 @@ void configGetCommand(client *c) {
     config_get_numerical_field("port",server.port);
     config_get_numerical_field("tcp-backlog",server.tcp_backlog);
     config_get_numerical_field("databases",server.dbnum);
+    config_get_numerical_field("bio-close-file-workers",
+            server.bio_close_file_workers);
+    config_get_numerical_field("bio-aof-fsync-workers",
+            server.bio_aof_fsync_workers);
     config_get_numerical_field("repl-ping-slave-period",server.repl_ping_slave_period);
     config_get_numerical_field("repl-timeout",server.repl_timeout);
     config_get_numerical_field("repl-backlog-size",server.repl_backlog_size);
@@ -1132,6 +1386,17 @@ void configGetCommand(client *c) {
     config_get_bool_field("daemonize", server.daemonize);
     config_get_bool_field("rdbcompression", server.rdb_compression);
     config_get_bool_field("rdbchecksum", server.rdb_checksum);
+    config_get_bool_field("rdb-chunked", server.rdb_chunked);
+    config_get_bool_field("rdb-list-compressed-nodes",
+            server.rdb_list_compressed_nodes);
+    config_get_bool_field("rdb-forkless-snapshot",
+            server.rdb_forkless_snapshot);
+    config_get_bool_field("bgsave-minimize-cow",
+            server.bgsave_minimize_cow);
+    config_get_bool_field("rdb-save-drop-cache",
+            server.rdb_save_drop_cache);
+    config_get_bool_field("rdb-delta-snapshots",
+            server.rdb_delta_snapshots);
     config_get_bool_field("activerehashing", server.activerehashing);
     config_get_bool_field("protected-mode", server.protected_mode);
     config_get_bool_field("repl-disable-tcp-nodelay",
@@ -1142,6 +1407,18 @@ void configGetCommand(client *c) {
             server.aof_rewrite_incremental_fsync);
     config_get_bool_field("aof-load-truncated",
             server.aof_load_truncated);
+    config_get_bool_field("aof-use-rdb-preamble",
+            server.aof_use_rdb_preamble);
+    config_get_bool_field("aof-multi-part",
+            server.aof_multi_part);
+    config_get_bool_field("aof-group-commit",
+            server.aof_group_commit);
+    config_get_bool_field("aof-load-threaded",
+            server.aof_load_threaded);
+    config_get_bool_field("aof-timestamp-enabled",
+            server.aof_timestamp_enabled);
+    config_get_bool_field("aof-writer-thread",
+            server.aof_writer_thread);
 
     /* Enum values */
     config_get_enum_field("maxmemory-policy",
@@ -1152,6 +1429,14 @@ void configGetCommand(client *c) {
             server.supervised_mode,supervised_mode_enum);
     config_get_enum_field("appendfsync",
             server.aof_fsync,aof_fsync_enum);
+    config_get_enum_field("aof-format",
+            server.aof_format,aof_format_enum);
+    config_get_enum_field("aof-binary-compression",
+            server.aof_binary_compression,aof_binary_compression_enum);
+    config_get_enum_field("rdb-compression-codec",
+            server.rdb_compression_codec,rdb_compression_codec_enum);
+    config_get_enum_field("repl-diskless-load",
+            server.repl_diskless_load,repl_diskless_load_enum);
     config_get_enum_field("syslog-facility",
             server.syslog_facility,syslog_facility_enum);
 
@@ -1795,9 +2080,21 @@ int rewriteConfig(char *path) {
     rewriteConfigSyslogfacilityOption(state);
     rewriteConfigSaveOption(state);
     rewriteConfigNumericalOption(state,"databases",server.dbnum,CONFIG_DEFAULT_DBNUM);
+    rewriteConfigNumericalOption(state,"bio-close-file-workers",server.bio_close_file_workers,CONFIG_DEFAULT_BIO_WORKERS);
+    rewriteConfigNumericalOption(state,"bio-aof-fsync-workers",server.bio_aof_fsync_workers,CONFIG_DEFAULT_BIO_WORKERS);
     rewriteConfigYesNoOption(state,"stop-writes-on-bgsave-error",server.stop_writes_on_bgsave_err,CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR);
     rewriteConfigYesNoOption(state,"rdbcompression",server.rdb_compression,CONFIG_DEFAULT_RDB_COMPRESSION);
+    rewriteConfigEnumOption(state,"rdb-compression-codec",server.rdb_compression_codec,rdb_compression_codec_enum,CONFIG_DEFAULT_RDB_COMPRESSION_CODEC);
     rewriteConfigYesNoOption(state,"rdbchecksum",server.rdb_checksum,CONFIG_DEFAULT_RDB_CHECKSUM);
+    rewriteConfigYesNoOption(state,"rdb-chunked",server.rdb_chunked,CONFIG_DEFAULT_RDB_CHUNKED);
+    rewriteConfigYesNoOption(state,"rdb-list-compressed-nodes",server.rdb_list_compressed_nodes,CONFIG_DEFAULT_RDB_LIST_COMPRESSED_NODES);
+    rewriteConfigYesNoOption(state,"rdb-forkless-snapshot",server.rdb_forkless_snapshot,CONFIG_DEFAULT_RDB_FORKLESS_SNAPSHOT);
+    rewriteConfigYesNoOption(state,"bgsave-minimize-cow",server.bgsave_minimize_cow,CONFIG_DEFAULT_BGSAVE_MINIMIZE_COW);
+    rewriteConfigYesNoOption(state,"rdb-save-drop-cache",server.rdb_save_drop_cache,CONFIG_DEFAULT_RDB_SAVE_DROP_CACHE);
+    rewriteConfigYesNoOption(state,"rdb-delta-snapshots",server.rdb_delta_snapshots,CONFIG_DEFAULT_RDB_DELTA_SNAPSHOTS);
+    rewriteConfigNumericalOption(state,"rdb-delta-max-chain",server.rdb_delta_max_chain,CONFIG_DEFAULT_RDB_DELTA_MAX_CHAIN);
+    rewriteConfigBytesOption(state,"rdb-save-max-rate",server.rdb_save_max_rate,CONFIG_DEFAULT_RDB_SAVE_MAX_RATE);
+    rewriteConfigNumericalOption(state,"rdb-load-threads",server.rdb_load_threads,CONFIG_DEFAULT_RDB_LOAD_THREADS);
     rewriteConfigStringOption(state,"dbfilename",server.rdb_filename,CONFIG_DEFAULT_RDB_FILENAME);
     rewriteConfigDirOption(state);
     rewriteConfigSlaveofOption(state);
@@ -1811,6 +2108,7 @@ int rewriteConfig(char *path) {
     rewriteConfigBytesOption(state,"repl-backlog-ttl",server.repl_backlog_time_limit,CONFIG_DEFAULT_REPL_BACKLOG_TIME_LIMIT);
     rewriteConfigYesNoOption(state,"repl-disable-tcp-nodelay",server.repl_disable_tcp_nodelay,CONFIG_DEFAULT_REPL_DISABLE_TCP_NODELAY);
     rewriteConfigYesNoOption(state,"repl-diskless-sync",server.repl_diskless_sync,CONFIG_DEFAULT_REPL_DISKLESS_SYNC);
+    rewriteConfigEnumOption(state,"repl-diskless-load",server.repl_diskless_load,repl_diskless_load_enum,CONFIG_DEFAULT_REPL_DISKLESS_LOAD);
     rewriteConfigNumericalOption(state,"repl-diskless-sync-delay",server.repl_diskless_sync_delay,CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY);
     rewriteConfigNumericalOption(state,"slave-priority",server.slave_priority,CONFIG_DEFAULT_SLAVE_PRIORITY);
     rewriteConfigNumericalOption(state,"min-slaves-to-write",server.repl_min_slaves_to_write,CONFIG_DEFAULT_MIN_SLAVES_TO_WRITE);
@@ -1818,13 +2116,18 @@ int rewriteConfig(char *path) {
     rewriteConfigStringOption(state,"requirepass",server.requirepass,NULL);
     rewriteConfigNumericalOption(state,"maxclients",server.maxclients,CONFIG_DEFAULT_MAX_CLIENTS);
     rewriteConfigBytesOption(state,"maxmemory",server.maxmemory,CONFIG_DEFAULT_MAXMEMORY);
+    rewriteConfigBytesOption(state,"maxmemory-clients",server.maxmemory_clients,CONFIG_DEFAULT_MAXMEMORY_CLIENTS);
+    rewriteConfigBytesOption(state,"small-objects-arena-size",server.small_objects_arena_size,CONFIG_DEFAULT_SMALL_OBJECTS_ARENA_SIZE);
     rewriteConfigEnumOption(state,"maxmemory-policy",server.maxmemory_policy,maxmemory_policy_enum,CONFIG_DEFAULT_MAXMEMORY_POLICY);
     rewriteConfigNumericalOption(state,"maxmemory-samples",server.maxmemory_samples,CONFIG_DEFAULT_MAXMEMORY_SAMPLES);
+    rewriteConfigNumericalOption(state,"intern-max-entries",server.intern_max_entries,CONFIG_DEFAULT_INTERN_MAX_ENTRIES);
+    rewriteConfigNumericalOption(state,"intern-max-len",server.intern_max_len,CONFIG_DEFAULT_INTERN_MAX_LEN);
     rewriteConfigYesNoOption(state,"appendonly",server.aof_state != AOF_OFF,0);
     rewriteConfigStringOption(state,"appendfilename",server.aof_filename,CONFIG_DEFAULT_AOF_FILENAME);
     rewriteConfigEnumOption(state,"appendfsync",server.aof_fsync,aof_fsync_enum,CONFIG_DEFAULT_AOF_FSYNC);
     rewriteConfigYesNoOption(state,"no-appendfsync-on-rewrite",server.aof_no_fsync_on_rewrite,CONFIG_DEFAULT_AOF_NO_FSYNC_ON_REWRITE);
     rewriteConfigNumericalOption(state,"auto-aof-rewrite-percentage",server.aof_rewrite_perc,AOF_REWRITE_PERC);
+    rewriteConfigNumericalOption(state,"auto-aof-rewrite-dead-percentage",server.aof_rewrite_dead_perc,AOF_REWRITE_DEAD_PERC);
     rewriteConfigBytesOption(state,"auto-aof-rewrite-min-size",server.aof_rewrite_min_size,AOF_REWRITE_MIN_SIZE);
     rewriteConfigNumericalOption(state,"lua-time-limit",server.lua_time_limit,LUA_SCRIPT_TIME_LIMIT);
     rewriteConfigYesNoOption(state,"cluster-enabled",server.cluster_enabled,0);
@@ -1851,6 +2154,15 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"hz",server.hz,CONFIG_DEFAULT_HZ);
     rewriteConfigYesNoOption(state,"aof-rewrite-incremental-fsync",server.aof_rewrite_incremental_fsync,CONFIG_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC);
     rewriteConfigYesNoOption(state,"aof-load-truncated",server.aof_load_truncated,CONFIG_DEFAULT_AOF_LOAD_TRUNCATED);
+    rewriteConfigYesNoOption(state,"aof-use-rdb-preamble",server.aof_use_rdb_preamble,CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE);
+    rewriteConfigYesNoOption(state,"aof-multi-part",server.aof_multi_part,CONFIG_DEFAULT_AOF_MULTI_PART);
+    rewriteConfigYesNoOption(state,"aof-group-commit",server.aof_group_commit,CONFIG_DEFAULT_AOF_GROUP_COMMIT);
+    rewriteConfigYesNoOption(state,"aof-load-threaded",server.aof_load_threaded,CONFIG_DEFAULT_AOF_LOAD_THREADED);
+    rewriteConfigYesNoOption(state,"aof-timestamp-enabled",server.aof_timestamp_enabled,CONFIG_DEFAULT_AOF_TIMESTAMP_ENABLED);
+    rewriteConfigYesNoOption(state,"aof-writer-thread",server.aof_writer_thread,CONFIG_DEFAULT_AOF_WRITER_THREAD);
+    rewriteConfigBytesOption(state,"aof-writer-max-pending",server.aof_writer_max_pending,CONFIG_DEFAULT_AOF_WRITER_MAX_PENDING);
+    rewriteConfigEnumOption(state,"aof-format",server.aof_format,aof_format_enum,CONFIG_DEFAULT_AOF_FORMAT);
+    rewriteConfigEnumOption(state,"aof-binary-compression",server.aof_binary_compression,aof_binary_compression_enum,CONFIG_DEFAULT_AOF_BINARY_COMPRESSION);
     rewriteConfigEnumOption(state,"supervised",server.supervised_mode,supervised_mode_enum,SUPERVISED_NONE);
 
     /* Rewrite Sentinel config if in Sentinel mode. */
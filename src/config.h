@@ -114,6 +114,12 @@
 #define rdb_fsync_range(fd,off,size) fsync(fd)
 #endif
 
+/* Define HAVE_FADVISE if posix_fadvise() can be used to drop from the page
+ * cache the pages of the files we write and no longer need to access. */
+#ifdef __linux__
+#define HAVE_FADVISE 1
+#endif
+
 /* Check if we can use setproctitle().
  * BSD systems have support for it, we provide an implementation for
  * Linux and osx. */
@@ -136,6 +136,8 @@ robj *lookupKeyRead(redisDb *db, robj *key) {
  * Returns the linked value object if the key exists or NULL if the key
  * does not exist in the specified DB. */
 robj *lookupKeyWrite(redisDb *db, robj *key) {
+    if (server.rdb_forkless) rdbForklessBeforeWrite(db,key);
+    if (server.rdb_delta) rdbDeltaTrackKey(db,key);
     expireIfNeeded(db,key);
     return lookupKey(db,key,LOOKUP_NONE);
 }
@@ -157,8 +159,13 @@ robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply) {
  *
  * The program is aborted if the key already exists. */
 void dbAdd(redisDb *db, robj *key, robj *val) {
-    sds copy = sdsdup(key->ptr);
-    int retval = dictAdd(db->dict, copy, val);
+    sds copy;
+    int retval;
+
+    if (server.rdb_forkless) rdbForklessBeforeWrite(db,key);
+    if (server.rdb_delta) rdbDeltaTrackKey(db,key);
+    copy = sdsdup(key->ptr);
+    retval = dictAdd(db->dict, copy, val);
 
     serverAssertWithInfo(NULL,key,retval == DICT_OK);
     if (val->type == OBJ_LIST) signalListAsReady(db, key);
@@ -174,6 +181,8 @@ void dbOverwrite(redisDb *db, robj *key, robj *val) {
     dictEntry *de = dictFind(db->dict,key->ptr);
 
     serverAssertWithInfo(NULL,key,de != NULL);
+    if (server.rdb_forkless) rdbForklessBeforeWrite(db,key);
+    if (server.rdb_delta) rdbDeltaTrackKey(db,key);
     dictReplace(db->dict, key->ptr, val);
 }
 
@@ -226,6 +235,8 @@ robj *dbRandomKey(redisDb *db) {
 
 /* Delete a key, value, and associated expiration entry if any, from the DB */
 int dbDelete(redisDb *db, robj *key) {
+    if (server.rdb_forkless) rdbForklessBeforeWrite(db,key);
+    if (server.rdb_delta) rdbDeltaTrackKey(db,key);
     /* Deleting an entry from the expires dict will not free the sds of
      * the key, because it is shared with the main dictionary. */
     if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
@@ -279,6 +290,8 @@ long long emptyDb(void(callback)(void*)) {
     int j;
     long long removed = 0;
 
+    if (server.rdb_forkless) rdbForklessFlushDb(-1);
+    if (server.rdb_delta) rdbDeltaTrackFlush(-1);
     for (j = 0; j < server.dbnum; j++) {
         removed += dictSize(server.db[j].dict);
         dictEmpty(server.db[j].dict,callback);
@@ -319,6 +332,8 @@ void signalFlushedDb(int dbid) {
 void flushdbCommand(client *c) {
     server.dirty += dictSize(c->db->dict);
     signalFlushedDb(c->db->id);
+    if (server.rdb_forkless) rdbForklessFlushDb(c->db->id);
+    if (server.rdb_delta) rdbDeltaTrackFlush(c->db->id);
     dictEmpty(c->db->dict,NULL);
     dictEmpty(c->db->expires,NULL);
     if (server.cluster_enabled) slotToKeyFlush();
@@ -326,6 +341,9 @@ void flushdbCommand(client *c) {
 }
 
 void flushallCommand(client *c) {
+    /* Unlike FLUSHDB, that must save the keys of the flushed DB first, the
+     * fork-less snapshot is stopped like a saving child would be. */
+    if (server.rdb_forkless) rdbForklessAbort();
     signalFlushedDb(-1);
     server.dirty += emptyDb(NULL);
     addReply(c,shared.ok);
@@ -1271,6 +1289,24 @@ int *georadiusGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numk
     return keys;
 }
 
+/* Helper function to extract keys from the MEMORY command. Only the USAGE
+ * subcommand takes a key:
+ *
+ * MEMORY USAGE <key> [SAMPLES <count>] */
+int *memoryGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys) {
+    int *keys;
+    UNUSED(cmd);
+
+    if (argc >= 3 && !strcasecmp(argv[1]->ptr,"usage")) {
+        keys = zmalloc(sizeof(int));
+        keys[0] = 2;
+        *numkeys = 1;
+        return keys;
+    }
+    *numkeys = 0;
+    return NULL;
+}
+
 /* Slot to Key API. This is used by Redis Cluster in order to obtain in
  * a fast way a key that belongs to a specified hash slot. This is useful
  * while rehashing the cluster. */
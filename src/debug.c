@@ -348,7 +348,7 @@ void debugCommand(client *c) {
     } else if (!strcasecmp(c->argv[1]->ptr,"loadaof")) {
         if (server.aof_state == AOF_ON) flushAppendOnlyFile(1);
         emptyDb(NULL);
-        if (loadAppendOnlyFile(server.aof_filename) != C_OK) {
+        if (loadAppendOnlyFiles() != C_OK) {
             addReply(c,shared.err);
             return;
         }
@@ -66,6 +66,16 @@
  * 当一个哈希表中的元素个数和散列数组（桶）的比例大于dict_force_resize_ratio时，
  * 触发字典重新规划空间的操作。 */
 static int dict_can_resize = 1;  // 字典重新规划空间开关
+
+/* Using dictEnableRehash() / dictDisableRehash() the single rehashing steps
+ * performed by lookups and updates can be suspended, for the same reason:
+ * every step writes to both the tables, touching memory pages that would
+ * otherwise not be modified. Explicit dictRehash() calls are not affected. */
+
+/* dictEnableRehash()和dictDisableRehash()函数允许暂停查找和更新操作中执行的单步rehash，
+ * 原因同上：每一步rehash都会写入两个哈希表，修改原本不会被修改的内存页。
+ * 显式调用dictRehash()不受影响。 */
+static int dict_can_rehash = 1;  // 单步rehash开关
 static unsigned int dict_force_resize_ratio = 5;  // 字典被强制进行重新规划空间时的（元素个数/桶大小）比例
 
 /* -------------------------- private prototypes ---------------------------- */
@@ -377,7 +387,7 @@ int dictRehashMilliseconds(dict *d, int ms) {
  *
  * 在字典的键查找或更新操作过程中，如果符合rehash条件，就会触发一次rehash，每次执行一步。 */
 static void _dictRehashStep(dict *d) {
-    if (d->iterators == 0) dictRehash(d,1);  // 没有迭代器在使用时，执行一次一步的rehash
+    if (d->iterators == 0 && dict_can_rehash) dictRehash(d,1);  // 没有迭代器在使用且允许单步rehash时，执行一次一步的rehash
 }
 
 /* Add an element to the target hash table */
@@ -1076,6 +1086,26 @@ unsigned long dictScan(dict *d,
     return v;
 }
 
+/* Return non-zero if a scan that returned the cursor 'v' already emitted the
+ * bucket where 'key' is stored, or would be stored if not in the dictionary.
+ *
+ * Buckets are visited in order of reversed index, so the bucket was visited
+ * if its reversed index is smaller than the reversed cursor. Using the mask
+ * of the smaller table while rehashing is enough since the expansions of a
+ * bucket in the larger table are emitted together with it. The answer stays
+ * correct if the table grows between two calls, as the new bit is the least
+ * significant one of the reversed index, but not if it shrinks. A cursor of
+ * zero means the scan did not start (or is over), so false is returned. */
+int dictScanVisited(dict *d, const void *key, unsigned long v) {
+    unsigned long m, h;
+
+    if (v == 0 || d->ht[0].size == 0) return 0;
+    m = d->ht[0].sizemask;
+    if (dictIsRehashing(d) && d->ht[1].sizemask < m) m = d->ht[1].sizemask;
+    h = dictHashKey(d, key);
+    return rev(h & m) < rev(v & m);
+}
+
 /* ------------------------- private functions ------------------------------ */
 /* ------------------------- 私有函数 ------------------------------ */
 
@@ -1179,6 +1209,16 @@ void dictDisableResize(void) {
     dict_can_resize = 0;
 }
 
+/* 允许单步rehash */
+void dictEnableRehash(void) {
+    dict_can_rehash = 1;
+}
+
+/* 暂停单步rehash */
+void dictDisableRehash(void) {
+    dict_can_rehash = 0;
+}
+
 /* ------------------------------- Debugging ---------------------------------*/
 /* ------------------------------- 调试用 ---------------------------------*/
 
@@ -197,11 +197,14 @@ unsigned int dictGenCaseHashFunction(const unsigned char *buf, int len);  // 对
 void dictEmpty(dict *d, void(callback)(void*));  // 清空字典数据并调用回调函数
 void dictEnableResize(void);                     // 开启字典resize
 void dictDisableResize(void);                    // 禁用字典resize
+void dictEnableRehash(void);                     // 开启单步rehash
+void dictDisableRehash(void);                    // 暂停单步rehash
 int dictRehash(dict *d, int n);                  // 字典rehash
 int dictRehashMilliseconds(dict *d, int ms);     // 在ms时间内rehash，超过则停止
 void dictSetHashFunctionSeed(unsigned int initval);  // 设置rehash函数种子
 unsigned int dictGetHashFunctionSeed(void);  // 获取rehash函数种子
 unsigned long dictScan(dict *d, unsigned long v, dictScanFunction *fn, void *privdata);  // 遍历整个字典，每次访问一个元素都会调用fn操作其数据
+int dictScanVisited(dict *d, const void *key, unsigned long v);  // 判断key所在的桶是否已被游标v之前的dictScan遍历过
 
 /* Hash table types */
 /* 哈希表类型 */
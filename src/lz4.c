@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2026, the Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "lz4.h"
+#include <stdint.h>
+#include <string.h>
+
+/* A sequence is made of a token byte, holding the length of the literals
+ * in the high 4 bits and the length of the match minus LZ4_MINMATCH in the
+ * low 4 bits, the literals, the 16 bit little endian offset of the match,
+ * and the lengths that don't fit the token, as a run of 255 bytes followed
+ * by the remainder. The last sequence only has literals. The format also
+ * requires the last match to start at least LZ4_MFLIMIT bytes before the
+ * end of the input, and the last LZ4_LASTLITERALS bytes to be literals. */
+#define LZ4_MINMATCH 4
+#define LZ4_MFLIMIT 12
+#define LZ4_LASTLITERALS 5
+#define LZ4_MAX_DISTANCE 65535
+#define LZ4_HASH_LOG_MIN 8
+#define LZ4_HASH_LOG_MAX 14
+#define LZ4_SKIP_TRIGGER 6  /* Search faster after 2^6 bytes without match. */
+
+static uint32_t lz4Read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v,p,sizeof(v));
+    return v;
+}
+
+static uint64_t lz4Read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v,p,sizeof(v));
+    return v;
+}
+
+static uint32_t lz4Hash(uint32_t v, int hash_log) {
+    return (v*2654435761U) >> (32-hash_log);
+}
+
+/* Write the part of 'len' that does not fit the token. Returns NULL if
+ * there is no room in the output. */
+static unsigned char *lz4WriteLength(unsigned char *op, unsigned char *oend,
+                                     size_t len)
+{
+    while (len >= 255) {
+        if (op == oend) return NULL;
+        *op++ = 255;
+        len -= 255;
+    }
+    if (op == oend) return NULL;
+    *op++ = len;
+    return op;
+}
+
+/* Write a sequence with the literals from 'anchor' to 'ip' and a match of
+ * 'mlen' bytes at 'offset', or just the literals if 'mlen' is 0. Returns
+ * NULL if there is no room in the output. */
+static unsigned char *lz4WriteSequence(unsigned char *op, unsigned char *oend,
+                                       const unsigned char *anchor,
+                                       const unsigned char *ip,
+                                       size_t offset, size_t mlen)
+{
+    size_t litlen = ip-anchor;
+    unsigned char *token;
+
+    if (op == oend) return NULL;
+    token = op++;
+    *token = (litlen >= 15 ? 15 : litlen) << 4;
+    if (litlen >= 15 && (op = lz4WriteLength(op,oend,litlen-15)) == NULL)
+        return NULL;
+    if ((size_t)(oend-op) < litlen) return NULL;
+    memcpy(op,anchor,litlen);
+    op += litlen;
+    if (mlen == 0) return op;
+
+    if (oend-op < 2) return NULL;
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    mlen -= LZ4_MINMATCH;
+    *token |= mlen >= 15 ? 15 : mlen;
+    if (mlen >= 15 && (op = lz4WriteLength(op,oend,mlen-15)) == NULL)
+        return NULL;
+    return op;
+}
+
+size_t lz4_compress(const void *in_data, size_t in_len, void *out_data,
+                    size_t out_len)
+{
+    const unsigned char *in = in_data, *ip = in, *anchor = in;
+    const unsigned char *iend = in+in_len;
+    unsigned char *out = out_data, *op = out, *oend = out+out_len;
+    uint32_t htab[1<<LZ4_HASH_LOG_MAX];
+    int hash_log = LZ4_HASH_LOG_MIN;
+
+    /* Inputs shorter than this can only be stored as literals. */
+    if (in_len > LZ4_MFLIMIT) {
+        const unsigned char *mflimit = iend-LZ4_MFLIMIT;
+        const unsigned char *matchlimit = iend-LZ4_LASTLITERALS;
+
+        /* Most inputs are small strings: size the hash table according to
+         * the input, so that clearing it does not dominate the time spent.
+         * Entries pointing to the start of the input are harmless, since
+         * every candidate match is verified. */
+        while (hash_log < LZ4_HASH_LOG_MAX && ((size_t)1<<hash_log) < in_len)
+            hash_log++;
+        memset(htab,0,sizeof(uint32_t)<<hash_log);
+        ip++;
+        while (ip < mflimit) {
+            uint32_t seq = lz4Read32(ip), h = lz4Hash(seq,hash_log);
+            const unsigned char *ref = in+htab[h], *mp, *rp;
+
+            htab[h] = ip-in;
+            if (ip-ref > LZ4_MAX_DISTANCE || lz4Read32(ref) != seq) {
+                /* Like the reference implementation, skip more and more
+                 * bytes while no match is found, so that incompressible
+                 * data is processed quickly. */
+                ip += 1+((ip-anchor) >> LZ4_SKIP_TRIGGER);
+                continue;
+            }
+
+            /* Extend the match forward and backward. */
+            mp = ip+LZ4_MINMATCH;
+            rp = ref+LZ4_MINMATCH;
+            while (mp+8 <= matchlimit && lz4Read64(mp) == lz4Read64(rp)) {
+                mp += 8;
+                rp += 8;
+            }
+            while (mp < matchlimit && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+            while (ip > anchor && ref > in && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+
+            op = lz4WriteSequence(op,oend,anchor,ip,ip-ref,mp-ip);
+            if (op == NULL) return 0;
+            ip = anchor = mp;
+            if (ip < mflimit)
+                htab[lz4Hash(lz4Read32(ip-2),hash_log)] = ip-2-in;
+        }
+    }
+
+    /* Last literals. */
+    op = lz4WriteSequence(op,oend,anchor,iend,0,0);
+    return op ? (size_t)(op-out) : 0;
+}
+
+/* Read the part of a length that does not fit the token, adding it to
+ * 'len'. Returns NULL on truncated input. */
+static const unsigned char *lz4ReadLength(const unsigned char *ip,
+                                          const unsigned char *iend,
+                                          size_t *len)
+{
+    unsigned char b;
+
+    do {
+        if (ip == iend) return NULL;
+        b = *ip++;
+        *len += b;
+    } while (b == 255);
+    return ip;
+}
+
+size_t lz4_decompress(const void *in_data, size_t in_len, void *out_data,
+                      size_t out_len)
+{
+    const unsigned char *ip = in_data, *iend = ip+in_len;
+    unsigned char *out = out_data, *op = out, *oend = out+out_len;
+
+    while (ip < iend) {
+        unsigned char token = *ip++;
+        size_t len = token >> 4, offset;
+        const unsigned char *ref;
+
+        /* Literals. */
+        if (len == 15 && (ip = lz4ReadLength(ip,iend,&len)) == NULL) return 0;
+        if ((size_t)(iend-ip) < len || (size_t)(oend-op) < len) return 0;
+        memcpy(op,ip,len);
+        op += len;
+        ip += len;
+        if (ip == iend) break; /* The last sequence has no match. */
+
+        /* Match. */
+        if (iend-ip < 2) return 0;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op-out)) return 0;
+        len = token & 15;
+        if (len == 15 && (ip = lz4ReadLength(ip,iend,&len)) == NULL) return 0;
+        len += LZ4_MINMATCH;
+        if ((size_t)(oend-op) < len) return 0;
+
+        /* The match may overlap the output being written, in which case
+         * it is copied one byte at a time. */
+        ref = op-offset;
+        if (offset >= len) {
+            memcpy(op,ref,len);
+            op += len;
+        } else {
+            while (len--) *op++ = *ref++;
+        }
+    }
+    return op-out;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2026, the Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LZ4_H
+#define __LZ4_H
+
+#include <stddef.h>
+
+/* A minimal implementation of the LZ4 block format, used as a faster
+ * alternative to LZF when compressing RDB and DUMP payloads. Compression
+ * is a plain greedy match finder, much faster than LZF but with a worse
+ * ratio. The blocks produced can be decompressed by any LZ4 implementation.
+ *
+ * Like lzf_compress(), lz4_compress() returns 0 if the output does not fit
+ * in out_len bytes, otherwise the compressed length. lz4_decompress()
+ * validates the input and returns 0 if it is not a valid block or if the
+ * output does not fit in out_len bytes, otherwise the decompressed length. */
+size_t lz4_compress(const void *in_data, size_t in_len, void *out_data,
+                    size_t out_len);
+size_t lz4_decompress(const void *in_data, size_t in_len, void *out_data,
+                      size_t out_len);
+
+#endif
@@ -119,10 +119,12 @@ client *createClient(int fd) {
     c->bpop.numreplicas = 0;
     c->bpop.reploffset = 0;
     c->woff = 0;
+    c->aof_fsync_offset = 0;
     c->watched_keys = listCreate();
     c->pubsub_channels = dictCreate(&setDictType,NULL);
     c->pubsub_patterns = listCreate();
     c->peerid = NULL;
+    c->last_memory_usage = 0;
     listSetFreeMethod(c->pubsub_patterns,decrRefCountVoid);
     listSetMatchMethod(c->pubsub_patterns,listMatchObjects);
     if (fd != -1) listAddNodeTail(server.clients,c);
@@ -781,11 +783,25 @@ void unlinkClient(client *c) {
         listDelNode(server.unblocked_clients,ln);
         c->flags &= ~CLIENT_UNBLOCKED;
     }
+
+    /* Remove from the list of clients waiting for the AOF group fsync. */
+    if (c->flags & CLIENT_AOF_FSYNC_WAIT) {
+        ln = listSearchKey(server.aof_fsync_waiting,c);
+        serverAssert(ln != NULL);
+        listDelNode(server.aof_fsync_waiting,ln);
+        c->flags &= ~CLIENT_AOF_FSYNC_WAIT;
+    }
 }
 
 void freeClient(client *c) {
     listNode *ln;
 
+    /* Remove the client from the clients memory accounting. If it is our
+     * master being cached, the accounting will start again from zero once
+     * it is resurrected. */
+    server.clients_memory -= c->last_memory_usage;
+    c->last_memory_usage = 0;
+
     /* If it is our master that's beging disconnected we should make sure
      * to cache the state to try a partial resynchronization later.
      *
@@ -986,9 +1002,17 @@ int writeToClient(int fd, client *c, int handler_installed) {
 
 /* Write event handler. Just send data to the client. */
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
+    client *c = privdata;
     UNUSED(el);
     UNUSED(mask);
-    writeToClient(fd,privdata,1);
+
+    /* The replies are held until the AOF group fsync completes: stop
+     * polling, aofReleaseFsyncWaiters() will schedule the write again. */
+    if (c->flags & CLIENT_AOF_FSYNC_WAIT) {
+        aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
+        return;
+    }
+    writeToClient(fd,c,1);
 }
 
 /* This function is called just before entering the event loop, in the hope
@@ -1006,6 +1030,9 @@ int handleClientsWithPendingWrites(void) {
         c->flags &= ~CLIENT_PENDING_WRITE;
         listDelNode(server.clients_pending_write,ln);
 
+        /* Replies waiting for the AOF group fsync are written later. */
+        if (c->flags & CLIENT_AOF_FSYNC_WAIT) continue;
+
         /* Try to write buffers to the client socket. */
         if (writeToClient(c->fd,c,0) == C_ERR) continue;
 
@@ -1303,6 +1330,8 @@ void processInputBuffer(client *c) {
             if (server.current_client == NULL) break;
         }
     }
+    /* Refresh the client memory accounting, unless the client was freed. */
+    if (server.current_client != NULL) updateClientMemUsage(c);
     server.current_client = NULL;
 }
 
@@ -1448,7 +1477,7 @@ sds catClientInfoString(sds s, client *client) {
     if (emask & AE_WRITABLE) *p++ = 'w';
     *p = '\0';
     return sdscatfmt(s,
-        "id=%U addr=%s fd=%i name=%s age=%I idle=%I flags=%s db=%i sub=%i psub=%i multi=%i qbuf=%U qbuf-free=%U obl=%U oll=%U omem=%U events=%s cmd=%s",
+        "id=%U addr=%s fd=%i name=%s age=%I idle=%I flags=%s db=%i sub=%i psub=%i multi=%i qbuf=%U qbuf-free=%U obl=%U oll=%U omem=%U tot-mem=%U events=%s cmd=%s",
         (unsigned long long) client->id,
         getClientPeerId(client),
         client->fd,
@@ -1465,6 +1494,7 @@ sds catClientInfoString(sds s, client *client) {
         (unsigned long long) client->bufpos,
         (unsigned long long) listLength(client->reply),
         (unsigned long long) getClientOutputBufferMemoryUsage(client),
+        (unsigned long long) getClientMemoryUsage(client),
         events,
         client->lastcmd ? client->lastcmd->name : "NULL");
 }
@@ -1749,6 +1779,91 @@ unsigned long getClientOutputBufferMemoryUsage(client *c) {
     return c->reply_bytes + (list_item_size*listLength(c->reply));
 }
 
+/* Return the total amount of memory used by a client: the client structure
+ * itself, the query buffer, the output buffers, the arguments of the command
+ * being processed, the commands queued by MULTI and the Pub/Sub structures.
+ *
+ * The function is O(argc) so it is cheap to call when the client is not in
+ * the middle of a command with many arguments. */
+size_t getClientMemoryUsage(client *c) {
+    size_t mem = sizeof(client);
+    int j;
+
+    if (c->querybuf) mem += sdsZmallocSize(c->querybuf);
+    mem += getClientOutputBufferMemoryUsage(c);
+    if (c->argv) {
+        mem += zmalloc_size(c->argv);
+        for (j = 0; j < c->argc; j++)
+            mem += sizeof(robj)+getStringObjectSdsUsedMemory(c->argv[j]);
+    }
+    mem += c->mstate.count*sizeof(multiCmd);
+    mem += dictSize(c->pubsub_channels)*sizeof(dictEntry) +
+           dictSlots(c->pubsub_channels)*sizeof(dictEntry*);
+    mem += listLength(c->pubsub_patterns)*sizeof(listNode);
+    return mem;
+}
+
+/* Refresh the memory usage cached in the client and the global counter
+ * server.clients_memory used to enforce maxmemory-clients. Only normal and
+ * Pub/Sub clients are accounted: slaves are already handled by the
+ * maxmemory logic and our master must never be evicted. */
+void updateClientMemUsage(client *c) {
+    size_t mem = 0;
+
+    if (c->fd != -1 && !(c->flags & (CLIENT_SLAVE|CLIENT_MASTER)))
+        mem = getClientMemoryUsage(c);
+    server.clients_memory -= c->last_memory_usage;
+    server.clients_memory += mem;
+    c->last_memory_usage = mem;
+}
+
+static int clientsMemoryUsageCompare(const void *a, const void *b) {
+    size_t ma = (*(client**)a)->last_memory_usage;
+    size_t mb = (*(client**)b)->last_memory_usage;
+
+    if (ma == mb) return 0;
+    return ma > mb ? -1 : 1;
+}
+
+/* If maxmemory-clients is set and the memory used by the normal and Pub/Sub
+ * clients is over the limit, disconnect clients starting from the ones using
+ * the most memory, until we are back under the limit. This is used instead
+ * of evicting keys to reclaim memory used by clients.
+ *
+ * The function frees clients synchronously, so it must be called from a
+ * context where no client is being processed, like beforeSleep(). */
+void evictClientsIfNeeded(void) {
+    client **clients;
+    listIter li;
+    listNode *ln;
+    unsigned long j, numclients = 0;
+
+    if (!server.maxmemory_clients ||
+        server.clients_memory <= server.maxmemory_clients) return;
+
+    clients = zmalloc(sizeof(client*)*listLength(server.clients));
+    listRewind(server.clients,&li);
+    while((ln = listNext(&li)) != NULL) {
+        client *c = listNodeValue(ln);
+        if (c->last_memory_usage == 0) continue;
+        clients[numclients++] = c;
+    }
+    qsort(clients,numclients,sizeof(client*),clientsMemoryUsageCompare);
+
+    for (j = 0; j < numclients; j++) {
+        client *c = clients[j];
+        sds ci;
+
+        if (server.clients_memory <= server.maxmemory_clients) break;
+        ci = catClientInfoString(sdsempty(),c);
+        serverLog(LL_WARNING,"Evicting client to free memory used by clients (maxmemory-clients reached): %s", ci);
+        sdsfree(ci);
+        server.stat_evictedclients++;
+        freeClient(c);
+    }
+    zfree(clients);
+}
+
 /* Get the class of a client, used in order to enforce limits to different
  * classes of clients.
  *
@@ -40,7 +40,7 @@
 
 /* 创建Redis对象 */
 robj *createObject(int type, void *ptr) {
-    robj *o = zmalloc(sizeof(*o));  // 分配redis对象空间
+    robj *o = zmalloc_small(sizeof(*o));  // 分配redis对象空间
     o->type = type;  // 对象类型
     o->encoding = OBJ_ENCODING_RAW;  // 对象编码，初始化时为原始对象
     o->ptr = ptr;  // 对象指针
@@ -68,7 +68,7 @@ robj *createRawStringObject(const char *ptr, size_t len) {
  * 它内嵌在字符串对象内存中。 */
 robj *createEmbeddedStringObject(const char *ptr, size_t len) {
     // 分配字符串对象空间，大小为robj的大小加上类型为sdshdr8的sds字符串的大小
-    robj *o = zmalloc(sizeof(robj)+sizeof(struct sdshdr8)+len+1);
+    robj *o = zmalloc_small(sizeof(robj)+sizeof(struct sdshdr8)+len+1);
     struct sdshdr8 *sh = (void*)(o+1);  // 内存布局上，sds字符串紧跟在robj后面
 
     o->type = OBJ_STRING;
@@ -106,12 +106,20 @@ robj *createStringObject(const char *ptr, size_t len) {
         return createRawStringObject(ptr,len);
 }
 
+/* Set in the threads that create objects concurrently with the main thread,
+ * like the RDB loading threads. Such threads can't use the shared integers
+ * nor the interned strings, since the reference count of the shared objects
+ * is not updated atomically. */
+/* 在与主线程并发创建对象的线程中设置（如rdb载入线程），这些线程不能使用
+ * 共享整数和共享字符串，因为共享对象的引用计数不是原子更新的。 */
+__thread int objectSharingDisabled = 0;
+
 /* 从long long类型创建一个字符串对象 */
 robj *createStringObjectFromLongLong(long long value) {
     robj *o;
     /* value ∈ [0, 10000)，这部分数字经常用到，内存中会预先创建一个这个范围的整数对象数组，
      * 对其增加引用计数后直接返回这个整数对象即可。 */
-    if (value >= 0 && value < OBJ_SHARED_INTEGERS) {
+    if (value >= 0 && value < OBJ_SHARED_INTEGERS && !objectSharingDisabled) {
         incrRefCount(shared.integers[value]);
         o = shared.integers[value];
     } else {
@@ -411,6 +419,88 @@ int isObjectRepresentableAsLongLong(robj *o, long long *llval) {
     }
 }
 
+/* Shared strings interning.
+ *
+ * When intern-max-entries is set, small string values that are stored many
+ * times (OBJ_INTERN_PROMOTE_COUNT occurrences) are added to a table of
+ * interned values, and further occurrences are replaced by the shared object
+ * in the table, exactly like it happens for small integers.
+ *
+ * The occurrences of values not yet interned are counted in a candidates
+ * table. When the table is full a random candidate is evicted for every new
+ * one, so that only the values that are repeated often enough get interned,
+ * and the work done by every write stays constant. */
+/* 共享字符串。
+ * 如果设置了intern-max-entries，被多次保存的小字符串值会被加入共享字符串表，
+ * 之后再出现该值时将使用表中的共享对象代替，和小整数的共享方式一样。
+ * 尚未共享的值的出现次数记录在候选表中，候选表满时每加入一个新候选值就随机淘汰一个，
+ * 这样只有重复次数足够多的值才会被共享，且每次写入的开销是常数。 */
+
+/* Return true if values can be interned with the current configuration.
+ * Like shared integers, interning is not used when maxmemory is used with
+ * an LRU policy, because every key needs a private LRU field in its value
+ * for the LRU algorithm to work well. */
+/* 判断当前配置下是否可以使用共享字符串 */
+static int internStringsEnabled(void) {
+    return server.intern_max_entries && !objectSharingDisabled &&
+           (server.maxmemory == 0 ||
+            (server.maxmemory_policy != MAXMEMORY_VOLATILE_LRU &&
+             server.maxmemory_policy != MAXMEMORY_ALLKEYS_LRU));
+}
+
+/* Return the interned object for the value of 'o', incrementing its
+ * reference count and releasing 'o', or NULL if the value is not interned.
+ * As a side effect the occurrences of the value are counted, and the value
+ * gets interned when they reach OBJ_INTERN_PROMOTE_COUNT. */
+/* 如果o的值已被共享，释放o并返回共享对象，否则返回NULL。
+ * 同时记录该值的出现次数，达到OBJ_INTERN_PROMOTE_COUNT次时将其共享。 */
+static robj *tryInternStringObject(robj *o) {
+    sds s = o->ptr;
+    dictEntry *de;
+    robj *shared;
+
+    if ((de = dictFind(server.interned_strings,s)) != NULL) {
+        shared = dictGetVal(de);
+        incrRefCount(shared);
+        decrRefCount(o);
+        server.stat_intern_hits++;
+        return shared;
+    }
+    if (dictSize(server.interned_strings) >= server.intern_max_entries)
+        return NULL;
+
+    // 记录候选值的出现次数，候选表已满时随机淘汰一个候选值
+    if ((de = dictFind(server.intern_candidates,s)) == NULL) {
+        if (dictSize(server.intern_candidates) >=
+            server.intern_max_entries*OBJ_INTERN_CANDIDATES_RATIO)
+        {
+            dictEntry *victim = dictGetRandomKey(server.intern_candidates);
+            dictDelete(server.intern_candidates,dictGetKey(victim));
+        }
+        de = dictAddRaw(server.intern_candidates,sdsdup(s));
+        dictSetUnsignedIntegerVal(de,0);
+    }
+    dictSetUnsignedIntegerVal(de,dictGetUnsignedIntegerVal(de)+1);
+    if (dictGetUnsignedIntegerVal(de) < OBJ_INTERN_PROMOTE_COUNT) return NULL;
+
+    // 出现次数足够多，将该值加入共享字符串表
+    dictDelete(server.intern_candidates,s);
+    shared = createEmbeddedStringObject(s,sdslen(s));
+    dictAdd(server.interned_strings,sdsdup(s),shared);
+    incrRefCount(shared);
+    decrRefCount(o);
+    server.stat_intern_hits++;
+    return shared;
+}
+
+/* Release the interned strings and the candidates. Keys already using an
+ * interned object keep sharing it. */
+/* 清空共享字符串表和候选表，已在使用共享对象的key不受影响 */
+void resetInternedStrings(void) {
+    dictEmpty(server.interned_strings,NULL);
+    dictEmpty(server.intern_candidates,NULL);
+}
+
 /* Try to encode a string object in order to save space */
 /* 尝试编码一个字符串对象以节省存储空间 */
 robj *tryObjectEncoding(robj *o) {
@@ -446,6 +536,7 @@ robj *tryObjectEncoding(robj *o) {
         if ((server.maxmemory == 0 ||
              (server.maxmemory_policy != MAXMEMORY_VOLATILE_LRU &&
               server.maxmemory_policy != MAXMEMORY_ALLKEYS_LRU)) &&
+            !objectSharingDisabled &&
             value >= 0 &&
             value < OBJ_SHARED_INTEGERS)
         {
@@ -460,6 +551,12 @@ robj *tryObjectEncoding(robj *o) {
         }
     }
 
+    /* Try to use an interned object if the value is repeated often. */
+    if (len <= server.intern_max_len && internStringsEnabled()) {
+        robj *shared = tryInternStringObject(o);
+        if (shared) return shared;
+    }
+
     /* If the string is small and is still RAW encoded,
      * try the EMBSTR encoding which is more efficient.
      * In this representation the object and the SDS string are allocated
@@ -808,3 +905,351 @@ void objectCommand(client *c) {
     }
 }
 
+
+/* ======================= The MEMORY command ============================== */
+
+/* Return the amount of memory used by a string object, including the robj
+ * header itself and the allocator internal fragmentation. */
+/* 返回一个字符串对象占用的内存大小，包括robj结构本身和内存分配器的内部碎片。 */
+static size_t objectComputeStringSize(robj *o) {
+    size_t asize = zmalloc_size(o);
+
+    if (o->encoding == OBJ_ENCODING_RAW) asize += sdsZmallocSize(o->ptr);
+    return asize;
+}
+
+/* Return the memory used by the dict structure and its hash tables, not
+ * counting the entries stored inside. */
+/* 返回字典结构及其哈希表数组占用的内存大小，不包括其中保存的节点。 */
+static size_t objectComputeDictSize(dict *d) {
+    size_t asize = zmalloc_size(d);
+
+    if (d->ht[0].table) asize += zmalloc_size(d->ht[0].table);
+    if (d->ht[1].table) asize += zmalloc_size(d->ht[1].table);
+    return asize;
+}
+
+/* Returns the size in bytes consumed by the key's value in RAM, including
+ * the allocator overhead. For aggregated types only up to 'sample_size'
+ * elements are inspected and the result is extrapolated to the whole
+ * collection. A 'sample_size' of zero means to inspect every element. */
+/* 返回key对应的值在内存中占用的字节数，包括内存分配器的开销。对于聚合类型，
+ * 最多只检视sample_size个元素，然后根据样本推算整个集合的大小。
+ * sample_size为0表示检视所有元素。 */
+#define OBJ_COMPUTE_SIZE_DEF_SAMPLES 5 /* Default sample size. */
+size_t objectComputeSize(robj *o, size_t sample_size) {
+    robj *ele;
+    dict *d;
+    dictIterator *di;
+    dictEntry *de;
+    size_t asize = 0, elesize = 0, samples = 0;
+
+    if (o->type == OBJ_STRING) {
+        asize = objectComputeStringSize(o);
+    } else if (o->type == OBJ_LIST) {
+        if (o->encoding == OBJ_ENCODING_QUICKLIST) {
+            quicklist *ql = o->ptr;
+            quicklistNode *node = ql->head;
+            asize = zmalloc_size(o)+zmalloc_size(ql);
+            // 对quicklist的节点进行抽样，节点中的ziplist可能是LZF压缩过的
+            while(node && (!sample_size || samples < sample_size)) {
+                elesize += zmalloc_size(node)+zmalloc_size(node->zl);
+                samples++;
+                node = node->next;
+            }
+            if (samples) asize += (double)elesize/samples*ql->len;
+        } else if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+            asize = zmalloc_size(o)+zmalloc_size(o->ptr);
+        } else {
+            serverPanic("Unknown list encoding");
+        }
+    } else if (o->type == OBJ_SET) {
+        if (o->encoding == OBJ_ENCODING_HT) {
+            d = o->ptr;
+            asize = zmalloc_size(o)+objectComputeDictSize(d);
+            di = dictGetIterator(d);
+            while((de = dictNext(di)) != NULL &&
+                  (!sample_size || samples < sample_size))
+            {
+                ele = dictGetKey(de);
+                elesize += zmalloc_size(de)+objectComputeStringSize(ele);
+                samples++;
+            }
+            dictReleaseIterator(di);
+            if (samples) asize += (double)elesize/samples*dictSize(d);
+        } else if (o->encoding == OBJ_ENCODING_INTSET) {
+            asize = zmalloc_size(o)+zmalloc_size(o->ptr);
+        } else {
+            serverPanic("Unknown set encoding");
+        }
+    } else if (o->type == OBJ_ZSET) {
+        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+            asize = zmalloc_size(o)+zmalloc_size(o->ptr);
+        } else if (o->encoding == OBJ_ENCODING_SKIPLIST) {
+            zset *zs = o->ptr;
+            zskiplist *zsl = zs->zsl;
+            zskiplistNode *znode = zsl->header->level[0].forward;
+            d = zs->dict;
+            // 成员对象由跳跃表和字典共享，因此只在跳跃表节点中计算一次
+            asize = zmalloc_size(o)+zmalloc_size(zs)+objectComputeDictSize(d)+
+                    zmalloc_size(zsl)+zmalloc_size(zsl->header);
+            while(znode != NULL && (!sample_size || samples < sample_size)) {
+                elesize += zmalloc_size(znode)+
+                           objectComputeStringSize(znode->obj)+
+                           sizeof(dictEntry);
+                samples++;
+                znode = znode->level[0].forward;
+            }
+            if (samples) asize += (double)elesize/samples*zsl->length;
+        } else {
+            serverPanic("Unknown sorted set encoding");
+        }
+    } else if (o->type == OBJ_HASH) {
+        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+            asize = zmalloc_size(o)+zmalloc_size(o->ptr);
+        } else if (o->encoding == OBJ_ENCODING_HT) {
+            d = o->ptr;
+            asize = zmalloc_size(o)+objectComputeDictSize(d);
+            di = dictGetIterator(d);
+            while((de = dictNext(di)) != NULL &&
+                  (!sample_size || samples < sample_size))
+            {
+                elesize += zmalloc_size(de)+
+                           objectComputeStringSize(dictGetKey(de))+
+                           objectComputeStringSize(dictGetVal(de));
+                samples++;
+            }
+            dictReleaseIterator(di);
+            if (samples) asize += (double)elesize/samples*dictSize(d);
+        } else {
+            serverPanic("Unknown hash encoding");
+        }
+    } else {
+        serverPanic("Unknown object type");
+    }
+    return asize;
+}
+
+/* Return a struct redisMemOverhead filled with memory overhead
+ * information used for the MEMORY STATS command. The returned
+ * structure pointer should be freed calling freeMemoryOverheadData(). */
+/* 返回一个填充了内存开销信息的redisMemOverhead结构，供MEMORY STATS命令使用。
+ * 返回的结构需要调用freeMemoryOverheadData()释放。 */
+struct redisMemOverhead *getMemoryOverheadData(void) {
+    int j;
+    size_t mem_total = 0;
+    size_t mem = 0;
+    size_t zmalloc_used = zmalloc_used_memory();
+    struct redisMemOverhead *mh = zcalloc(sizeof(*mh));
+
+    mh->total_allocated = zmalloc_used;
+    mh->startup_allocated = server.initial_memory_usage;
+    mh->peak_allocated = server.stat_peak_memory;
+    mh->fragmentation =
+        zmalloc_get_fragmentation_ratio(server.resident_set_size);
+    mem_total += server.initial_memory_usage;
+
+    // 复制积压缓冲区
+    mem = 0;
+    if (server.repl_backlog)
+        mem += zmalloc_size(server.repl_backlog);
+    mh->repl_backlog = mem;
+    mem_total += mem;
+
+    // 从节点和普通客户端的输入输出缓冲区
+    mem = 0;
+    if (listLength(server.slaves)) {
+        listIter li;
+        listNode *ln;
+
+        listRewind(server.slaves,&li);
+        while((ln = listNext(&li))) {
+            client *c = listNodeValue(ln);
+            mem += getClientOutputBufferMemoryUsage(c);
+            mem += sdsAllocSize(c->querybuf);
+            mem += sizeof(client);
+        }
+    }
+    mh->clients_slaves = mem;
+    mem_total+=mem;
+
+    mem = 0;
+    if (listLength(server.clients)) {
+        listIter li;
+        listNode *ln;
+
+        listRewind(server.clients,&li);
+        while((ln = listNext(&li))) {
+            client *c = listNodeValue(ln);
+            if (c->flags & CLIENT_SLAVE)
+                continue;
+            mem += getClientOutputBufferMemoryUsage(c);
+            mem += sdsAllocSize(c->querybuf);
+            mem += sizeof(client);
+        }
+    }
+    mh->clients_normal = mem;
+    mem_total+=mem;
+
+    // AOF缓冲区和AOF重写缓冲区
+    mem = 0;
+    if (server.aof_state != AOF_OFF) {
+        mem += sdsAllocSize(server.aof_buf);
+        mem += aofRewriteBufferSize();
+    }
+    mh->aof_buffer = mem;
+    mem_total+=mem;
+
+    // 每个数据库的主字典和过期字典的哈希表开销
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j;
+        long long keyscount = dictSize(db->dict);
+        if (keyscount==0) continue;
+
+        mh->total_keys += keyscount;
+        mh->db = zrealloc(mh->db,sizeof(mh->db[0])*(mh->num_dbs+1));
+        mh->db[mh->num_dbs].dbid = j;
+
+        mem = dictSize(db->dict) * sizeof(dictEntry) +
+              dictSlots(db->dict) * sizeof(dictEntry*) +
+              dictSize(db->dict) * sizeof(robj);
+        mh->db[mh->num_dbs].overhead_ht_main = mem;
+        mem_total+=mem;
+
+        mem = dictSize(db->expires) * sizeof(dictEntry) +
+              dictSlots(db->expires) * sizeof(dictEntry*);
+        mh->db[mh->num_dbs].overhead_ht_expires = mem;
+        mem_total+=mem;
+
+        mh->num_dbs++;
+    }
+
+    mh->overhead_total = mem_total;
+    mh->dataset = zmalloc_used > mem_total ? zmalloc_used - mem_total : 0;
+    mh->peak_perc = mh->peak_allocated ?
+        (float)zmalloc_used*100/mh->peak_allocated : 0;
+
+    /* Metrics computed after subtracting the startup memory from
+     * the total memory. */
+    /* 以下指标在总内存中减去启动时占用的内存后再计算 */
+    size_t net_usage = 1;
+    if (zmalloc_used > mh->startup_allocated)
+        net_usage = zmalloc_used - mh->startup_allocated;
+    mh->dataset_perc = (float)mh->dataset*100/net_usage;
+    mh->bytes_per_key = mh->total_keys ? (net_usage / mh->total_keys) : 0;
+
+    return mh;
+}
+
+/* 释放getMemoryOverheadData()返回的结构 */
+void freeMemoryOverheadData(struct redisMemOverhead *mh) {
+    zfree(mh->db);
+    zfree(mh);
+}
+
+/* The memory command will eventually be a complete interface for the
+ * memory introspection capabilities of Redis.
+ *
+ * Usage: MEMORY USAGE <key> [SAMPLES <count>] | MEMORY STATS */
+/* MEMORY命令用于检视Redis的内存使用情况。
+ * 使用方式：MEMORY USAGE <key> [SAMPLES <count>] | MEMORY STATS */
+void memoryCommand(client *c) {
+    dictEntry *de;
+
+    if (!strcasecmp(c->argv[1]->ptr,"usage") && c->argc >= 3) {
+        long long samples = OBJ_COMPUTE_SIZE_DEF_SAMPLES;
+        int j;
+
+        for (j = 3; j < c->argc; j++) {
+            if (!strcasecmp(c->argv[j]->ptr,"samples") &&
+                j+1 < c->argc)
+            {
+                if (getLongLongFromObjectOrReply(c,c->argv[j+1],&samples,NULL)
+                     == C_ERR) return;
+                if (samples < 0) {
+                    addReply(c,shared.syntaxerr);
+                    return;
+                }
+                j++; /* skip option argument. */
+            } else {
+                addReply(c,shared.syntaxerr);
+                return;
+            }
+        }
+        /* Like the other read commands, expired keys are not reported. */
+        if (lookupKeyReadWithFlags(c->db,c->argv[2],LOOKUP_NOTOUCH) == NULL) {
+            addReply(c,shared.nullbulk);
+            return;
+        }
+        de = dictFind(c->db->dict,c->argv[2]->ptr);
+        size_t usage = objectComputeSize(dictGetVal(de),samples);
+        // 加上key本身的sds字符串和数据库字典节点的开销
+        usage += sdsZmallocSize(dictGetKey(de));
+        usage += zmalloc_size(de);
+        addReplyLongLong(c,usage);
+    } else if (!strcasecmp(c->argv[1]->ptr,"stats") && c->argc == 2) {
+        struct redisMemOverhead *mh = getMemoryOverheadData();
+        size_t j;
+
+        addReplyMultiBulkLen(c,(14+mh->num_dbs)*2);
+
+        addReplyBulkCString(c,"peak.allocated");
+        addReplyLongLong(c,mh->peak_allocated);
+
+        addReplyBulkCString(c,"total.allocated");
+        addReplyLongLong(c,mh->total_allocated);
+
+        addReplyBulkCString(c,"startup.allocated");
+        addReplyLongLong(c,mh->startup_allocated);
+
+        addReplyBulkCString(c,"replication.backlog");
+        addReplyLongLong(c,mh->repl_backlog);
+
+        addReplyBulkCString(c,"clients.slaves");
+        addReplyLongLong(c,mh->clients_slaves);
+
+        addReplyBulkCString(c,"clients.normal");
+        addReplyLongLong(c,mh->clients_normal);
+
+        addReplyBulkCString(c,"aof.buffer");
+        addReplyLongLong(c,mh->aof_buffer);
+
+        for (j = 0; j < mh->num_dbs; j++) {
+            char dbname[32];
+            snprintf(dbname,sizeof(dbname),"db.%zu",mh->db[j].dbid);
+            addReplyBulkCString(c,dbname);
+            addReplyMultiBulkLen(c,4);
+
+            addReplyBulkCString(c,"overhead.hashtable.main");
+            addReplyLongLong(c,mh->db[j].overhead_ht_main);
+
+            addReplyBulkCString(c,"overhead.hashtable.expires");
+            addReplyLongLong(c,mh->db[j].overhead_ht_expires);
+        }
+
+        addReplyBulkCString(c,"overhead.total");
+        addReplyLongLong(c,mh->overhead_total);
+
+        addReplyBulkCString(c,"keys.count");
+        addReplyLongLong(c,mh->total_keys);
+
+        addReplyBulkCString(c,"keys.bytes-per-key");
+        addReplyLongLong(c,mh->bytes_per_key);
+
+        addReplyBulkCString(c,"dataset.bytes");
+        addReplyLongLong(c,mh->dataset);
+
+        addReplyBulkCString(c,"dataset.percentage");
+        addReplyDouble(c,mh->dataset_perc);
+
+        addReplyBulkCString(c,"peak.percentage");
+        addReplyDouble(c,mh->peak_perc);
+
+        addReplyBulkCString(c,"fragmentation");
+        addReplyDouble(c,mh->fragmentation);
+
+        freeMemoryOverheadData(mh);
+    } else {
+        addReplyError(c,"Syntax error. Try MEMORY (usage <key> [SAMPLES <count>]|stats)");
+    }
+}
@@ -533,6 +533,59 @@ void quicklistAppendZiplist(quicklist *quicklist, unsigned char *zl) {
     quicklist->count += node->count;
 }
 
+/* Create a new node from 'zl', that is a pre-formed ziplist of 'sz' bytes
+ * holding 'count' entries, or if 'compressed' is true, a quicklistLZF with
+ * the LZF compressed form of such a ziplist.
+ *
+ * Used for loading RDBs where the nodes were saved in their in memory form,
+ * so that compressed nodes don't need to be decompressed. The compress depth
+ * is not enforced while appending, otherwise nodes near the tail would be
+ * decompressed and compressed again as the list grows: once all the nodes
+ * are appended quicklistApplyCompressDepth() must be called. */
+void quicklistAppendNode(quicklist *quicklist, unsigned char *zl,
+                         unsigned int sz, unsigned int count, int compressed) {
+    quicklistNode *node = quicklistCreateNode();
+
+    node->zl = zl;
+    node->sz = sz;
+    node->count = count;
+    if (compressed) node->encoding = QUICKLIST_NODE_ENCODING_LZF;
+
+    node->prev = quicklist->tail;
+    if (quicklist->tail)
+        quicklist->tail->next = node;
+    else
+        quicklist->head = node;
+    quicklist->tail = node;
+    quicklist->len++;
+    quicklist->count += node->count;
+}
+
+/* Compress the interior nodes of 'quicklist' and decompress the nodes
+ * within the compress depth from both ends, whatever their current
+ * encoding is.
+ *
+ * Returns 1 on success, 0 if a node can't be decompressed. */
+int quicklistApplyCompressDepth(quicklist *quicklist) {
+    quicklistNode *node = quicklist->head;
+    unsigned long idx = 0;
+
+    while (node) {
+        if (quicklistAllowsCompression(quicklist) &&
+            idx >= quicklist->compress &&
+            idx + quicklist->compress < quicklist->len)
+        {
+            quicklistCompressNode(node);
+        } else if (node->encoding == QUICKLIST_NODE_ENCODING_LZF) {
+            if (!__quicklistDecompressNode(node)) return 0;
+        }
+        node->recompress = 0;
+        node = node->next;
+        idx++;
+    }
+    return 1;
+}
+
 /* Append all values of ziplist 'zl' individually into 'quicklist'.
  *
  * This allows us to restore old RDB ziplists into new quicklists
@@ -126,6 +126,9 @@ int quicklistPushTail(quicklist *quicklist, void *value, const size_t sz);
 void quicklistPush(quicklist *quicklist, void *value, const size_t sz,
                    int where);
 void quicklistAppendZiplist(quicklist *quicklist, unsigned char *zl);
+void quicklistAppendNode(quicklist *quicklist, unsigned char *zl,
+                         unsigned int sz, unsigned int count, int compressed);
+int quicklistApplyCompressDepth(quicklist *quicklist);
 quicklist *quicklistAppendValuesFromZiplist(quicklist *quicklist,
                                             unsigned char *zl);
 quicklist *quicklistCreateFromZiplist(int fill, int compress,
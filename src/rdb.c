@@ -28,7 +28,10 @@
  */
 
 #include "server.h"
+#include "cluster.h"
 #include "lzf.h"    /* LZF compression library */
+#include "lz4.h"    /* LZ4 compression */
+#include "bio.h"
 #include "zipmap.h"
 #include "endianconv.h"
 
@@ -40,6 +43,7 @@
 #include <arpa/inet.h>
 #include <sys/stat.h>
 #include <sys/param.h>
+#include <fcntl.h>
 
 #define RDB_LOAD_NONE   0
 #define RDB_LOAD_ENC    (1<<0)
@@ -198,8 +202,8 @@ int rdbEncodeInteger(long long value, unsigned char *enc) {
 
 /* Loads an integer-encoded object with the specified encoding type "enctype".
  * The returned value changes according to the flags, see
- * rdbGenerincLoadStringObject() for more info. */
-void *rdbLoadIntegerObject(rio *rdb, int enctype, int flags) {
+ * rdbGenerincLoadStringObject() for more info, like 'lenptr'. */
+void *rdbLoadIntegerObject(rio *rdb, int enctype, int flags, size_t *lenptr) {
     int plain = flags & RDB_LOAD_PLAIN;
     int encode = flags & RDB_LOAD_ENC;
     unsigned char enc[4];
@@ -227,6 +231,7 @@ void *rdbLoadIntegerObject(rio *rdb, int enctype, int flags) {
         int len = ll2string(buf,sizeof(buf),val);
         p = zmalloc(len);
         memcpy(p,buf,len);
+        if (lenptr) *lenptr = len;
         return p;
     } else if (encode) {
         return createStringObjectFromLongLong(val);
@@ -254,13 +259,62 @@ int rdbTryIntegerEncoding(char *s, size_t len, unsigned char *enc) {
     return rdbEncodeInteger(value,enc);
 }
 
-ssize_t rdbSaveLzfBlob(rio *rdb, void *data, size_t compress_len,
-                       size_t original_len) {
+/* Compression codecs, indexed by the RDB_CODEC_* value selected with the
+ * rdb-compression-codec option. */
+typedef struct rdbCodec {
+    int enc;    /* RDB_ENC_* type of the strings compressed by the codec. */
+    size_t (*compress)(const void *in, size_t in_len, void *out,
+                       size_t out_len);
+    size_t (*decompress)(const void *in, size_t in_len, void *out,
+                         size_t out_len);
+} rdbCodec;
+
+static size_t rdbLzfCompress(const void *in, size_t in_len, void *out,
+                             size_t out_len)
+{
+    return lzf_compress(in,in_len,out,out_len);
+}
+
+static size_t rdbLzfDecompress(const void *in, size_t in_len, void *out,
+                               size_t out_len)
+{
+    return lzf_decompress(in,in_len,out,out_len);
+}
+
+static rdbCodec rdbCodecs[] = {
+    {RDB_ENC_LZF,rdbLzfCompress,rdbLzfDecompress},  /* RDB_CODEC_LZF */
+    {RDB_ENC_LZ4,lz4_compress,lz4_decompress}       /* RDB_CODEC_LZ4 */
+};
+
+/* Return the codec of the RDB_ENC_* type 'enc', or NULL if it is unknown. */
+static rdbCodec *rdbCodecByEnc(int enc) {
+    unsigned int j;
+
+    for (j = 0; j < sizeof(rdbCodecs)/sizeof(rdbCodec); j++)
+        if (rdbCodecs[j].enc == enc) return rdbCodecs+j;
+    return NULL;
+}
+
+/* Return the RDB version to write. Files and payloads that older versions
+ * can't read because they are 'chunked', use a codec other than LZF or the
+ * RDB_TYPE_LIST_QUICKLIST_NODES type are marked with RDB_EXTENDED_VERSION. */
+int rdbVersionToSave(int chunked) {
+    if (chunked || server.rdb_list_compressed_nodes ||
+        (server.rdb_compression &&
+         server.rdb_compression_codec != RDB_CODEC_LZF))
+        return RDB_EXTENDED_VERSION;
+    return RDB_VERSION;
+}
+
+/* Save a blob compressed with the codec of the RDB_ENC_* type 'enc'. */
+static ssize_t rdbSaveCompressedBlob(rio *rdb, int enc, void *data,
+                                     size_t compress_len, size_t original_len)
+{
     unsigned char byte;
     ssize_t n, nwritten = 0;
 
     /* Data compressed! Let's save it on disk */
-    byte = (RDB_ENCVAL<<6)|RDB_ENC_LZF;
+    byte = (RDB_ENCVAL<<6)|enc;
     if ((n = rdbWriteRaw(rdb,&byte,1)) == -1) goto writeerr;
     nwritten += n;
 
@@ -279,7 +333,17 @@ writeerr:
     return -1;
 }
 
-ssize_t rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
+ssize_t rdbSaveLzfBlob(rio *rdb, void *data, size_t compress_len,
+                       size_t original_len) {
+    return rdbSaveCompressedBlob(rdb,RDB_ENC_LZF,data,compress_len,
+                                 original_len);
+}
+
+/* Save a string compressed with the codec selected by the
+ * rdb-compression-codec option. Returns 0 if the string can't be
+ * compressed. */
+ssize_t rdbSaveCompressedStringObject(rio *rdb, unsigned char *s, size_t len) {
+    rdbCodec *codec = rdbCodecs+server.rdb_compression_codec;
     size_t comprlen, outlen;
     void *out;
 
@@ -287,20 +351,25 @@ ssize_t rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
     if (len <= 4) return 0;
     outlen = len-4;
     if ((out = zmalloc(outlen+1)) == NULL) return 0;
-    comprlen = lzf_compress(s, len, out, outlen);
+    comprlen = codec->compress(s, len, out, outlen);
     if (comprlen == 0) {
         zfree(out);
         return 0;
     }
-    ssize_t nwritten = rdbSaveLzfBlob(rdb, out, comprlen, len);
+    ssize_t nwritten = rdbSaveCompressedBlob(rdb, codec->enc, out, comprlen,
+                                             len);
     zfree(out);
     return nwritten;
 }
 
-/* Load an LZF compressed string in RDB format. The returned value
- * changes according to 'flags'. For more info check the
- * rdbGenericLoadStringObject() function. */
-void *rdbLoadLzfStringObject(rio *rdb, int flags) {
+/* Load a string in RDB format compressed with the codec of the RDB_ENC_*
+ * type 'enctype'. The returned value changes according to 'flags'. For
+ * more info check the rdbGenericLoadStringObject() function, like for
+ * 'lenptr'. */
+void *rdbLoadCompressedStringObject(rio *rdb, int enctype, int flags,
+                                    size_t *lenptr)
+{
+    rdbCodec *codec = rdbCodecByEnc(enctype);
     int plain = flags & RDB_LOAD_PLAIN;
     unsigned int len, clen;
     unsigned char *c = NULL;
@@ -319,14 +388,16 @@ void *rdbLoadLzfStringObject(rio *rdb, int flags) {
 
     /* Load the compressed representation and uncompress it to target. */
     if (rioRead(rdb,c,clen) == 0) goto err;
-    if (lzf_decompress(c,clen,val,len) == 0) {
-        if (rdbCheckMode) rdbCheckSetError("Invalid LZF compressed string");
+    if (codec->decompress(c,clen,val,len) != len) {
+        if (rdbCheckMode) rdbCheckSetError("Invalid compressed string");
         goto err;
     }
     zfree(c);
 
-    if (plain)
+    if (plain) {
+        if (lenptr) *lenptr = len;
         return val;
+    }
     else
         return createObject(OBJ_STRING,val);
 err:
@@ -353,10 +424,10 @@ ssize_t rdbSaveRawString(rio *rdb, unsigned char *s, size_t len) {
         }
     }
 
-    /* Try LZF compression - under 20 bytes it's unable to compress even
+    /* Try compression - under 20 bytes it's unable to compress even
      * aaaaaaaaaaaaaaaaaa so skip it */
     if (server.rdb_compression && len > 20) {
-        n = rdbSaveLzfStringObject(rdb,s,len);
+        n = rdbSaveCompressedStringObject(rdb,s,len);
         if (n == -1) return -1;
         if (n > 0) return n;
         /* Return value of 0 means data can't be compressed, save the old way */
@@ -413,8 +484,10 @@ int rdbSaveStringObject(rio *rdb, robj *obj) {
  * RDB_LOAD_PLAIN: Return a plain string allocated with zmalloc()
  *                 instead of a Redis object with an sds in it.
  * RDB_LOAD_SDS: Return an SDS string instead of a Redis object.
- */
-void *rdbGenericLoadStringObject(rio *rdb, int flags) {
+ *
+ * With RDB_LOAD_PLAIN, if 'lenptr' is not NULL it is set to the length of
+ * the returned string. */
+void *rdbGenericLoadStringObject(rio *rdb, int flags, size_t *lenptr) {
     int encode = flags & RDB_LOAD_ENC;
     int plain = flags & RDB_LOAD_PLAIN;
     int isencoded;
@@ -426,9 +499,10 @@ void *rdbGenericLoadStringObject(rio *rdb, int flags) {
         case RDB_ENC_INT8:
         case RDB_ENC_INT16:
         case RDB_ENC_INT32:
-            return rdbLoadIntegerObject(rdb,len,flags);
+            return rdbLoadIntegerObject(rdb,len,flags,lenptr);
         case RDB_ENC_LZF:
-            return rdbLoadLzfStringObject(rdb,flags);
+        case RDB_ENC_LZ4:
+            return rdbLoadCompressedStringObject(rdb,len,flags,lenptr);
         default:
             rdbExitReportCorruptRDB("Unknown RDB string encoding type %d",len);
         }
@@ -449,16 +523,17 @@ void *rdbGenericLoadStringObject(rio *rdb, int flags) {
             zfree(buf);
             return NULL;
         }
+        if (lenptr) *lenptr = len;
         return buf;
     }
 }
 
 robj *rdbLoadStringObject(rio *rdb) {
-    return rdbGenericLoadStringObject(rdb,RDB_LOAD_NONE);
+    return rdbGenericLoadStringObject(rdb,RDB_LOAD_NONE,NULL);
 }
 
 robj *rdbLoadEncodedStringObject(rio *rdb) {
-    return rdbGenericLoadStringObject(rdb,RDB_LOAD_ENC);
+    return rdbGenericLoadStringObject(rdb,RDB_LOAD_ENC,NULL);
 }
 
 /* Save a double value. Doubles are saved as strings prefixed by an unsigned
@@ -528,7 +603,8 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
         return rdbSaveType(rdb,RDB_TYPE_STRING);
     case OBJ_LIST:
         if (o->encoding == OBJ_ENCODING_QUICKLIST)
-            return rdbSaveType(rdb,RDB_TYPE_LIST_QUICKLIST);
+            return rdbSaveType(rdb,server.rdb_list_compressed_nodes ?
+                RDB_TYPE_LIST_QUICKLIST_NODES : RDB_TYPE_LIST_QUICKLIST);
         else
             serverPanic("Unknown list encoding");
     case OBJ_SET:
@@ -585,7 +661,27 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
             nwritten += n;
 
             do {
-                if (quicklistNodeIsCompressed(node)) {
+                if (server.rdb_list_compressed_nodes) {
+                    /* See RDB_TYPE_LIST_QUICKLIST_NODES in rdb.h. */
+                    int compressed = quicklistNodeIsCompressed(node);
+
+                    if ((n = rdbSaveLen(rdb,node->count)) == -1) return -1;
+                    nwritten += n;
+                    if ((n = rdbSaveLen(rdb,compressed ? node->sz : 0)) == -1)
+                        return -1;
+                    nwritten += n;
+                    if (compressed) {
+                        void *data;
+                        size_t compress_len = quicklistGetLzf(node, &data);
+                        if ((n = rdbSaveLen(rdb,compress_len)) == -1) return -1;
+                        nwritten += n;
+                        if ((n = rdbWriteRaw(rdb,data,compress_len)) == -1) return -1;
+                        nwritten += n;
+                    } else {
+                        if ((n = rdbSaveRawString(rdb,node->zl,node->sz)) == -1) return -1;
+                        nwritten += n;
+                    }
+                } else if (quicklistNodeIsCompressed(node)) {
                     void *data;
                     size_t compress_len = quicklistGetLzf(node, &data);
                     if ((n = rdbSaveLzfBlob(rdb,data,compress_len,node->sz)) == -1) return -1;
@@ -751,6 +847,132 @@ int rdbSaveInfoAuxFields(rio *rdb) {
     return 1;
 }
 
+/* Save a 64 bit unsigned integer in little endian. */
+static int rdbSaveRawUint64(rio *rdb, uint64_t v) {
+    memrev64ifbe(&v);
+    return rdbWriteRaw(rdb,&v,8);
+}
+
+/* Load a 64 bit unsigned integer saved with rdbSaveRawUint64(). */
+static int rdbLoadRawUint64(rio *rdb, uint64_t *v) {
+    if (rioRead(rdb,v,8) == 0) return -1;
+    memrev64ifbe(v);
+    return 0;
+}
+
+/* State of rdbSaveRio() when writing the keys in chunks, see rdb.h for the
+ * format of the chunks and of their index. */
+typedef struct rdbChunkWriter {
+    rio payload;            /* Records of the chunk being filled. */
+    rdbChunkInfo cur;       /* Info about the chunk being filled. */
+    rdbChunkInfo *index;    /* Info about the chunks already written. */
+    uint32_t count;         /* Number of chunks already written. */
+    size_t base;            /* Bytes written to the target before the RDB. */
+} rdbChunkWriter;
+
+static void rdbResetChunk(rdbChunkWriter *cw) {
+    sdsclear(cw->payload.io.buffer.ptr);
+    cw->payload.io.buffer.pos = 0;
+    cw->cur.keys = 0;
+    cw->cur.minslot = CLUSTER_SLOTS-1;
+    cw->cur.maxslot = 0;
+}
+
+static void rdbInitChunkWriter(rdbChunkWriter *cw, rio *rdb) {
+    rioInitWithBuffer(&cw->payload,sdsempty());
+    cw->index = NULL;
+    cw->count = 0;
+    cw->base = rdb->processed_bytes;
+    rdbResetChunk(cw);
+}
+
+static void rdbFreeChunkWriter(rdbChunkWriter *cw) {
+    sdsfree(cw->payload.io.buffer.ptr);
+    zfree(cw->index);
+}
+
+/* Account the key just added to the chunk being filled. */
+static void rdbChunkAddKey(rdbChunkWriter *cw, sds key) {
+    uint32_t slot = keyHashSlot(key,sdslen(key));
+
+    cw->cur.keys++;
+    if (slot < cw->cur.minslot) cw->cur.minslot = slot;
+    if (slot > cw->cur.maxslot) cw->cur.maxslot = slot;
+}
+
+/* Write the chunk being filled, holding keys of the DB 'dbid', to the rio,
+ * compressing it if rdbcompression is enabled. Returns -1 on error. */
+static int rdbFlushChunk(rio *rdb, rdbChunkWriter *cw, int dbid) {
+    sds payload = cw->payload.io.buffer.ptr;
+    size_t len = sdslen(payload), clen = 0;
+    rdbCodec *codec = rdbCodecs+server.rdb_compression_codec;
+    rdbChunkInfo *info = &cw->cur;
+    unsigned char *stored = (unsigned char*)payload;
+    void *out = NULL;
+
+    if (info->keys == 0) return 0;
+    info->offset = rdb->processed_bytes-cw->base;
+    info->dbid = dbid;
+
+    /* Like for strings, store the payload as it is if compression can't
+     * save at least a few bytes. */
+    if (server.rdb_compression && len > 4) {
+        out = zmalloc(len);
+        if ((clen = codec->compress(payload,len,out,len-4)) != 0)
+            stored = out;
+    }
+    info->crc = crc64(0,stored,clen ? clen : len);
+
+    if (rdbSaveType(rdb,RDB_OPCODE_CHUNK) == -1 ||
+        rdbSaveLen(rdb,info->dbid) == -1 ||
+        rdbSaveLen(rdb,info->keys) == -1 ||
+        rdbSaveLen(rdb,info->minslot) == -1 ||
+        rdbSaveLen(rdb,info->maxslot) == -1 ||
+        rdbSaveLen(rdb,codec->enc) == -1 ||
+        rdbSaveRawUint64(rdb,len) == -1 ||
+        rdbSaveRawUint64(rdb,clen) == -1 ||
+        rdbSaveRawUint64(rdb,info->crc) == -1 ||
+        rdbWriteRaw(rdb,stored,clen ? clen : len) == -1)
+    {
+        zfree(out);
+        return -1;
+    }
+    zfree(out);
+
+    cw->index = zrealloc(cw->index,sizeof(rdbChunkInfo)*(cw->count+1));
+    cw->index[cw->count++] = *info;
+    rdbResetChunk(cw);
+    return 0;
+}
+
+/* Write the index of all the chunks written so far. */
+static int rdbSaveChunkIndex(rio *rdb, rdbChunkWriter *cw) {
+    uint64_t offset = rdb->processed_bytes-cw->base;
+    uint32_t j;
+
+    if (rdbSaveType(rdb,RDB_OPCODE_CHUNK_INDEX) == -1) return -1;
+    if (rdbSaveLen(rdb,cw->count) == -1) return -1;
+    for (j = 0; j < cw->count; j++) {
+        rdbChunkInfo *info = cw->index+j;
+
+        if (rdbSaveRawUint64(rdb,info->offset) == -1 ||
+            rdbSaveRawUint64(rdb,info->crc) == -1 ||
+            rdbSaveLen(rdb,info->dbid) == -1 ||
+            rdbSaveLen(rdb,info->keys) == -1 ||
+            rdbSaveLen(rdb,info->minslot) == -1 ||
+            rdbSaveLen(rdb,info->maxslot) == -1) return -1;
+    }
+    return rdbSaveRawUint64(rdb,offset);
+}
+
+/* Id of the full RDB being saved by rdbSave(), written in the "delta-base"
+ * AUX field so that delta snapshots can be chained to it. NULL when the RDB
+ * is not saved on disk or rdb-delta-snapshots is disabled. */
+static char *rdbSaveDeltaBase = NULL;
+
+static void rdbDeltaReset(char *base, int seq);
+static void rdbDeltaUnlinkChain(int seq);
+
 /* Produces a dump of the database in RDB format sending it to the specified
  * Redis I/O channel. On success C_OK is returned, otherwise C_ERR
  * is returned and part of the output, or all the output, can be
@@ -758,20 +980,32 @@ int rdbSaveInfoAuxFields(rio *rdb) {
  *
  * When the function returns C_ERR and if 'error' is not NULL, the
  * integer pointed by 'error' is set to the value of errno just after the I/O
- * error. */
-int rdbSaveRio(rio *rdb, int *error) {
+ * error.
+ *
+ * With the RDB_SAVE_AOF_PREAMBLE flag the RDB is the preamble of an AOF
+ * rewrite: the diffs sent by the parent are read while saving. */
+int rdbSaveRio(rio *rdb, int *error, int flags) {
     dictIterator *di = NULL;
     dictEntry *de;
     char magic[10];
     int j;
     long long now = mstime();
     uint64_t cksum;
+    size_t processed = 0;
+    int chunked = server.rdb_chunked;
+    rdbChunkWriter cw;
 
     if (server.rdb_checksum)
         rdb->update_cksum = rioGenericUpdateChecksum;
-    snprintf(magic,sizeof(magic),"REDIS%04d",RDB_VERSION);
+    if (chunked) rdbInitChunkWriter(&cw,rdb);
+    snprintf(magic,sizeof(magic),"REDIS%04d",rdbVersionToSave(chunked));
     if (rdbWriteRaw(rdb,magic,9) == -1) goto werr;
     if (rdbSaveInfoAuxFields(rdb) == -1) goto werr;
+    if (rdbSaveDeltaBase &&
+        rdbSaveAuxFieldStrStr(rdb,"delta-base",rdbSaveDeltaBase) == -1)
+        goto werr;
+    if ((flags & RDB_SAVE_AOF_PREAMBLE) &&
+        rdbSaveAuxFieldStrInt(rdb,"aof-preamble",1) == -1) goto werr;
 
     for (j = 0; j < server.dbnum; j++) {
         redisDb *db = server.db+j;
@@ -807,11 +1041,40 @@ int rdbSaveRio(rio *rdb, int *error) {
 
             initStaticStringObject(key,keystr);
             expire = getExpire(db,&key);
-            if (rdbSaveKeyValuePair(rdb,&key,o,expire,now) == -1) goto werr;
+
+            /* When saving the AOF preamble, read some diff from the parent
+             * process from time to time, like rewriteAppendOnlyFileRio(). */
+            if ((flags & RDB_SAVE_AOF_PREAMBLE) &&
+                rdb->processed_bytes > processed+AOF_READ_DIFF_INTERVAL_BYTES)
+            {
+                processed = rdb->processed_bytes;
+                aofReadDiffFromParent();
+            }
+            if (!chunked) {
+                if (rdbSaveKeyValuePair(rdb,&key,o,expire,now) == -1)
+                    goto werr;
+                continue;
+            }
+
+            /* Accumulate the key in the current chunk, that is written
+             * when big enough. */
+            switch(rdbSaveKeyValuePair(&cw.payload,&key,o,expire,now)) {
+            case -1: goto werr;
+            case 1: rdbChunkAddKey(&cw,keystr); break;
+            }
+            if (sdslen(cw.payload.io.buffer.ptr) >= RDB_CHUNK_SIZE &&
+                rdbFlushChunk(rdb,&cw,j) == -1) goto werr;
         }
         dictReleaseIterator(di);
+        di = NULL;
+        if (chunked && rdbFlushChunk(rdb,&cw,j) == -1) goto werr;
+    }
+
+    if (chunked) {
+        if (rdbSaveChunkIndex(rdb,&cw) == -1) goto werr;
+        rdbFreeChunkWriter(&cw);
+        chunked = 0; /* So that we don't release it again on error. */
     }
-    di = NULL; /* So that we don't release it again on error. */
 
     /* EOF opcode */
     if (rdbSaveType(rdb,RDB_OPCODE_EOF) == -1) goto werr;
@@ -826,6 +1089,7 @@ int rdbSaveRio(rio *rdb, int *error) {
 werr:
     if (error) *error = errno;
     if (di) dictReleaseIterator(di);
+    if (chunked) rdbFreeChunkWriter(&cw);
     return C_ERR;
 }
 
@@ -845,7 +1109,7 @@ int rdbSaveRioWithEOFMark(rio *rdb, int *error) {
     if (rioWrite(rdb,"$EOF:",5) == 0) goto werr;
     if (rioWrite(rdb,eofmark,RDB_EOF_MARK_SIZE) == 0) goto werr;
     if (rioWrite(rdb,"\r\n",2) == 0) goto werr;
-    if (rdbSaveRio(rdb,error) == C_ERR) goto werr;
+    if (rdbSaveRio(rdb,error,RDB_SAVE_NONE) == C_ERR) goto werr;
     if (rioWrite(rdb,eofmark,RDB_EOF_MARK_SIZE) == 0) goto werr;
     return C_OK;
 
@@ -855,8 +1119,80 @@ werr: /* Write error. */
     return C_ERR;
 }
 
-/* Save the DB on disk. Return C_ERR on error, C_OK on success. */
-int rdbSave(char *filename) {
+/* Write to the rio the delta snapshot of the keys in
+ * server.rdb_delta_saving, chained to the full RDB and to the delta
+ * preceding server.rdb_delta_bgsave_seq. See rdb.h for the format.
+ * Like rdbSaveRio() returns C_ERR on I/O errors, setting 'error'. */
+static int rdbSaveDeltaRio(rio *rdb, int *error) {
+    rdbDeltaTracker *t = server.rdb_delta_saving;
+    dictIterator *di = NULL;
+    dictEntry *de;
+    char magic[10];
+    int j;
+    long long now = mstime();
+    uint64_t cksum;
+
+    if (server.rdb_checksum)
+        rdb->update_cksum = rioGenericUpdateChecksum;
+    snprintf(magic,sizeof(magic),"REDIS%04d",RDB_EXTENDED_VERSION);
+    if (rdbWriteRaw(rdb,magic,9) == -1) goto werr;
+    if (rdbSaveInfoAuxFields(rdb) == -1) goto werr;
+    if (rdbSaveAuxFieldStrStr(rdb,"delta-base",
+                              server.rdb_delta_bgsave_base) == -1) goto werr;
+    if (rdbSaveAuxFieldStrInt(rdb,"delta-seq",
+                              server.rdb_delta_bgsave_seq) == -1) goto werr;
+
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j;
+        dict *keys = t->keys[j];
+
+        if (!t->flushed[j] && (keys == NULL || dictSize(keys) == 0))
+            continue;
+        if (rdbSaveType(rdb,RDB_OPCODE_SELECTDB) == -1) goto werr;
+        if (rdbSaveLen(rdb,j) == -1) goto werr;
+        if (t->flushed[j] && rdbSaveType(rdb,RDB_OPCODE_FLUSHDB) == -1)
+            goto werr;
+        if (keys == NULL) continue;
+
+        di = dictGetIterator(keys);
+        while((de = dictNext(di)) != NULL) {
+            sds keystr = dictGetKey(de);
+            dictEntry *kde = dictFind(db->dict,keystr);
+            robj key;
+
+            initStaticStringObject(key,keystr);
+            if (kde) {
+                switch(rdbSaveKeyValuePair(rdb,&key,dictGetVal(kde),
+                                           getExpire(db,&key),now)) {
+                case -1: goto werr;
+                case 1: continue;
+                }
+            }
+            /* The key was deleted, or is already expired. */
+            if (rdbSaveType(rdb,RDB_OPCODE_DELKEY) == -1) goto werr;
+            if (rdbSaveRawString(rdb,(unsigned char*)keystr,
+                                 sdslen(keystr)) == -1) goto werr;
+        }
+        dictReleaseIterator(di);
+        di = NULL;
+    }
+
+    if (rdbSaveType(rdb,RDB_OPCODE_EOF) == -1) goto werr;
+    cksum = rdb->cksum;
+    memrev64ifbe(&cksum);
+    if (rioWrite(rdb,&cksum,8) == 0) goto werr;
+    return C_OK;
+
+werr:
+    if (error) *error = errno;
+    if (di) dictReleaseIterator(di);
+    return C_ERR;
+}
+
+/* Save the DB, or if 'delta' is true the delta snapshot of the keys in
+ * server.rdb_delta_saving, on disk. Return C_ERR on error, C_OK on
+ * success. */
+static int rdbSaveFile(char *filename, int delta) {
     char tmpfile[256];
     char cwd[MAXPATHLEN]; /* Current working dir path for error messages. */
     FILE *fp;
@@ -877,52 +1213,740 @@ int rdbSave(char *filename) {
     }
 
     rioInitWithFile(&rdb,fp);
-    if (rdbSaveRio(&rdb,&error) == C_ERR) {
+    rioSetAutoSync(&rdb,RDB_AUTOSYNC_BYTES);
+    rioSetDropCache(&rdb,server.rdb_save_drop_cache);
+    /* Only throttle saving children: SAVE and the save performed on
+     * shutdown block the server until they complete. */
+    if (getpid() != server.pid)
+        rioSetMaxWriteRate(&rdb,server.rdb_save_max_rate);
+    if ((delta ? rdbSaveDeltaRio(&rdb,&error) :
+                 rdbSaveRio(&rdb,&error,RDB_SAVE_NONE)) == C_ERR)
+    {
         errno = error;
         goto werr;
     }
 
-    /* Make sure data will not remain on the OS's output buffers */
-    if (fflush(fp) == EOF) goto werr;
-    if (fsync(fileno(fp)) == -1) goto werr;
-    if (fclose(fp) == EOF) goto werr;
+    /* Make sure data will not remain on the OS's output buffers */
+    if (fflush(fp) == EOF) goto werr;
+    if (fsync(fileno(fp)) == -1) goto werr;
+    if (server.rdb_save_drop_cache) rioFileDropCache(&rdb);
+    if (fclose(fp) == EOF) goto werr;
+
+    /* Use RENAME to make sure the DB file is changed atomically only
+     * if the generate DB file is ok. */
+    if (rename(tmpfile,filename) == -1) {
+        char *cwdp = getcwd(cwd,MAXPATHLEN);
+        serverLog(LL_WARNING,
+            "Error moving temp DB file %s on the final "
+            "destination %s (in server root dir %s): %s",
+            tmpfile,
+            filename,
+            cwdp ? cwdp : "unknown",
+            strerror(errno));
+        unlink(tmpfile);
+        return C_ERR;
+    }
+
+    serverLog(LL_NOTICE,"DB saved on disk");
+    server.dirty = 0;
+    server.lastsave = time(NULL);
+    server.lastbgsave_status = C_OK;
+    return C_OK;
+
+werr:
+    serverLog(LL_WARNING,"Write error saving DB on disk: %s", strerror(errno));
+    fclose(fp);
+    unlink(tmpfile);
+    return C_ERR;
+}
+
+/* Save the DB on disk. Return C_ERR on error, C_OK on success.
+ *
+ * When rdb-delta-snapshots is enabled the RDB is saved with a new id, or
+ * with the one chosen by the parent if we are a BGSAVE child, and becomes
+ * the base of the following delta snapshots. */
+int rdbSave(char *filename) {
+    char base[CONFIG_RUN_ID_SIZE+1];
+    int child = getpid() != server.pid, retval;
+
+    if (server.rdb_delta) {
+        if (child) {
+            memcpy(base,server.rdb_delta_bgsave_base,sizeof(base));
+        } else {
+            getRandomHexChars(base,CONFIG_RUN_ID_SIZE);
+            base[CONFIG_RUN_ID_SIZE] = '\0';
+        }
+        rdbSaveDeltaBase = base;
+    }
+    retval = rdbSaveFile(filename,0);
+    rdbSaveDeltaBase = NULL;
+    if (retval == C_OK && !child) {
+        if (server.rdb_delta) rdbDeltaReset(base,0);
+        rdbDeltaUnlinkChain(1);
+    }
+    return retval;
+}
+
+/* -----------------------------------------------------------------------------
+ * Delta snapshots
+ * -------------------------------------------------------------------------- */
+
+/* With rdb-delta-snapshots enabled the keys touched by write operations
+ * (and the DBs flushed) are tracked in server.rdb_delta. A BGSAVE then
+ * writes, instead of the whole dataset, only the keys tracked since the
+ * previous snapshot, in a delta file chained to the full RDB on disk (see
+ * rdb.h). The tracking is performed in the low level DB functions, so that
+ * keys removed because expired or evicted are tracked as well.
+ *
+ * When the BGSAVE starts the keys tracked so far are moved to
+ * server.rdb_delta_saving, and the tracking restarts from scratch: on
+ * success the keys saved are just dropped, otherwise they are merged back.
+ *
+ * A full RDB is saved instead, compacting the chain, when the chain is
+ * already rdb-delta-max-chain deltas long, when more than half of the keys
+ * were modified, when the BGSAVE is needed by slaves, and when the content
+ * of the RDB on disk is not known. SAVE, SHUTDOWN and the other foreground
+ * saves always write a full RDB. At startup the deltas chained to the RDB
+ * loaded are loaded in sequence by rdbDeltaLoadChain(). */
+
+static rdbDeltaTracker *rdbDeltaCreateTracker(void) {
+    rdbDeltaTracker *t = zmalloc(sizeof(*t));
+
+    t->keys = zcalloc(sizeof(dict*)*server.dbnum);
+    t->flushed = zcalloc(sizeof(int)*server.dbnum);
+    return t;
+}
+
+static void rdbDeltaFreeTracker(rdbDeltaTracker *t) {
+    int j;
+
+    if (t == NULL) return;
+    for (j = 0; j < server.dbnum; j++)
+        if (t->keys[j]) dictRelease(t->keys[j]);
+    zfree(t->keys);
+    zfree(t->flushed);
+    zfree(t);
+}
+
+static void rdbDeltaFilename(char *buf, size_t len, char *filename, int seq) {
+    snprintf(buf,len,"%s.delta.%d",filename,seq);
+}
+
+/* Remove the delta files from 'seq' on, once they are no longer chained to
+ * the full RDB on disk. */
+static void rdbDeltaUnlinkChain(int seq) {
+    char deltafile[256];
+
+    while(1) {
+        rdbDeltaFilename(deltafile,sizeof(deltafile),server.rdb_filename,seq++);
+        if (unlink(deltafile) == -1) break;
+    }
+}
+
+/* The dataset was saved or loaded as a whole: restart the tracking with
+ * 'base' (NULL if the disk content does not match the dataset) as the id of
+ * the full RDB on disk, followed by 'seq' deltas. */
+static void rdbDeltaReset(char *base, int seq) {
+    snprintf(server.rdb_delta_base,sizeof(server.rdb_delta_base),"%s",
+        base ? base : "");
+    server.rdb_delta_seq = seq;
+    server.rdb_delta_epoch++;
+    if (server.rdb_delta) {
+        rdbDeltaFreeTracker(server.rdb_delta);
+        server.rdb_delta = rdbDeltaCreateTracker();
+    }
+}
+
+/* Start tracking the modified keys. The next BGSAVE saves a full RDB, as
+ * the one on disk may be unrelated to the dataset. */
+void rdbDeltaEnable(void) {
+    if (server.rdb_delta) return;
+    server.rdb_delta = rdbDeltaCreateTracker();
+    server.rdb_delta_base[0] = '\0';
+    server.rdb_delta_seq = 0;
+}
+
+void rdbDeltaDisable(void) {
+    rdbDeltaFreeTracker(server.rdb_delta);
+    rdbDeltaFreeTracker(server.rdb_delta_saving);
+    server.rdb_delta = NULL;
+    server.rdb_delta_saving = NULL;
+    server.rdb_delta_base[0] = '\0';
+    server.rdb_delta_seq = 0;
+}
+
+/* Called by the DB functions before 'key' is modified or deleted. */
+void rdbDeltaTrackKey(redisDb *db, robj *key) {
+    rdbDeltaTracker *t = server.rdb_delta;
+    dict *d = t->keys[db->id];
+
+    if (server.loading) return;
+    if (d == NULL) d = t->keys[db->id] = dictCreate(&forklessKeysDictType,NULL);
+    if (dictFind(d,key->ptr) == NULL) dictAdd(d,sdsdup(key->ptr),NULL);
+}
+
+/* Called when the DB 'dbid', or all the DBs if -1, are flushed. */
+void rdbDeltaTrackFlush(int dbid) {
+    rdbDeltaTracker *t = server.rdb_delta;
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        if (dbid != -1 && dbid != j) continue;
+        t->flushed[j] = 1;
+        if (t->keys[j]) dictEmpty(t->keys[j],NULL);
+    }
+}
+
+long long rdbDeltaTrackedKeys(void) {
+    long long count = 0;
+    int j;
+
+    if (server.rdb_delta == NULL) {
+        server.rdb_delta_bgsave_seq = 0;
+        return 0;
+    }
+    for (j = 0; j < server.dbnum; j++)
+        if (server.rdb_delta->keys[j])
+            count += dictSize(server.rdb_delta->keys[j]);
+    return count;
+}
+
+/* Merge in server.rdb_delta the modifications tracked in 't', that happened
+ * before the ones tracked in server.rdb_delta. */
+static void rdbDeltaMerge(rdbDeltaTracker *t) {
+    rdbDeltaTracker *cur = server.rdb_delta;
+    dictIterator *di;
+    dictEntry *de;
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        /* A flush makes the previous modifications irrelevant. */
+        if (cur->flushed[j]) continue;
+        cur->flushed[j] = t->flushed[j];
+        if (t->keys[j] == NULL) continue;
+        if (cur->keys[j] == NULL) {
+            cur->keys[j] = t->keys[j];
+            t->keys[j] = NULL;
+            continue;
+        }
+        di = dictGetIterator(t->keys[j]);
+        while((de = dictNext(di)) != NULL) {
+            sds key = dictGetKey(de);
+
+            if (dictFind(cur->keys[j],key) == NULL)
+                dictAdd(cur->keys[j],sdsdup(key),NULL);
+        }
+        dictReleaseIterator(di);
+    }
+}
+
+static int rdbDeltaSlavesWaiting(void) {
+    listIter li;
+    listNode *ln;
+
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        client *slave = ln->value;
+
+        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) return 1;
+    }
+    return 0;
+}
+
+/* Called when a BGSAVE starts, if 'allowdelta' is false a full RDB is
+ * saved anyway. Returns the sequence number of the delta to save, or 0 if
+ * a full RDB must be saved. */
+static int rdbDeltaStartSave(int allowdelta) {
+    long long keys = 0;
+    int j, seq = 0;
+
+    if (server.rdb_delta == NULL) {
+        server.rdb_delta_bgsave_seq = 0;
+        return 0;
+    }
+    for (j = 0; j < server.dbnum; j++) keys += dictSize(server.db[j].dict);
+    if (allowdelta &&
+        server.rdb_delta_base[0] != '\0' &&
+        server.rdb_delta_seq < server.rdb_delta_max_chain &&
+        rdbDeltaTrackedKeys()*2 <= keys &&
+        !rdbDeltaSlavesWaiting())
+    {
+        seq = server.rdb_delta_seq+1;
+        memcpy(server.rdb_delta_bgsave_base,server.rdb_delta_base,
+            sizeof(server.rdb_delta_base));
+    } else {
+        getRandomHexChars(server.rdb_delta_bgsave_base,CONFIG_RUN_ID_SIZE);
+        server.rdb_delta_bgsave_base[CONFIG_RUN_ID_SIZE] = '\0';
+    }
+    server.rdb_delta_bgsave_seq = seq;
+    server.rdb_delta_bgsave_epoch = server.rdb_delta_epoch;
+    server.rdb_delta_saving = server.rdb_delta;
+    server.rdb_delta = rdbDeltaCreateTracker();
+    return seq;
+}
+
+/* Called when the BGSAVE terminates, successfully if 'ok' is true. */
+static void rdbDeltaSaveDone(int ok) {
+    rdbDeltaTracker *saved = server.rdb_delta_saving;
+    int seq = server.rdb_delta_bgsave_seq;
+    char deltafile[256];
+
+    if (saved == NULL) {
+        /* Delta snapshots are disabled: the deltas left on disk are still
+         * loaded at startup, until a full RDB replaces the one they are
+         * chained to. */
+        if (ok && seq == 0) rdbDeltaUnlinkChain(1);
+        return;
+    }
+    server.rdb_delta_saving = NULL;
+    if (server.rdb_delta_epoch != server.rdb_delta_bgsave_epoch) {
+        /* The dataset or the RDB on disk were replaced meanwhile: the delta
+         * is chained to a stale RDB, while a full RDB is older than the
+         * dataset it replaced. */
+        if (ok && seq) {
+            rdbDeltaFilename(deltafile,sizeof(deltafile),server.rdb_filename,
+                seq);
+            unlink(deltafile);
+        } else if (ok) {
+            server.rdb_delta_base[0] = '\0';
+        }
+    } else if (ok) {
+        if (seq) {
+            server.rdb_delta_seq = seq;
+        } else {
+            memcpy(server.rdb_delta_base,server.rdb_delta_bgsave_base,
+                sizeof(server.rdb_delta_base));
+            server.rdb_delta_seq = 0;
+            rdbDeltaUnlinkChain(1);
+        }
+    } else {
+        rdbDeltaMerge(saved);
+        /* The child may have failed after replacing the RDB. */
+        if (!seq) server.rdb_delta_base[0] = '\0';
+    }
+    rdbDeltaFreeTracker(saved);
+}
+
+/* Save the delta snapshot 'seq' of the RDB 'filename'. */
+static int rdbSaveDelta(char *filename, int seq) {
+    char deltafile[256];
+
+    rdbDeltaFilename(deltafile,sizeof(deltafile),filename,seq);
+    return rdbSaveFile(deltafile,1);
+}
+
+/* Called at startup after loading the RDB: load the deltas chained to it.
+ * Loading stops at the first delta missing or chained to another RDB. */
+void rdbDeltaLoadChain(void) {
+    char deltafile[256];
+    long long start = ustime();
+    int loaded = 0;
+
+    if (server.rdb_delta_base[0] == '\0') return;
+    while(1) {
+        rdbDeltaFilename(deltafile,sizeof(deltafile),server.rdb_filename,
+            server.rdb_delta_seq+1);
+        if (rdbLoad(deltafile) == C_ERR) break;
+        loaded++;
+    }
+    if (errno != ENOENT && errno != ESTALE) {
+        serverLog(LL_WARNING,"Error loading the delta snapshot %s: %s",
+            deltafile, strerror(errno));
+    }
+    if (loaded) {
+        serverLog(LL_NOTICE,"%d delta snapshots loaded: %.3f seconds",
+            loaded, (float)(ustime()-start)/1000000);
+    }
+}
+
+/* -----------------------------------------------------------------------------
+ * Fork-less snapshots
+ * -------------------------------------------------------------------------- */
+
+/* With rdb-forkless-snapshot enabled BGSAVE does not fork a child. The DBs
+ * are instead scanned a few buckets at a time from serverCron(), appending
+ * the keys to a temp file, with a dictScan() cursor that survives the writes
+ * served between two steps (only shrinking the table would break it, so
+ * databasesCron() does not resize the tables meanwhile).
+ *
+ * To still save the dataset as it was when BGSAVE started, every write is
+ * preceded by rdbForklessBeforeWrite(): if the scan did not reach the key
+ * yet its current value, the pre-image, is appended to the file right away
+ * and the key is remembered in a per DB set, so that the scan will skip it.
+ * Keys created during the snapshot are remembered the same way, without
+ * writing anything. No value is ever duplicated in memory: the additional
+ * memory used is just the set of names of the keys written meanwhile.
+ *
+ * A DB flushed before the scan completed it is not saved on the spot:
+ * the snapshot takes over its dicts, replacing them with empty ones, and
+ * keeps scanning them incrementally, releasing them when done. The same
+ * happens to the dicts of a DB backup released by replication.
+ *
+ * The main thread never waits for the disk: every few MB the writeback of
+ * the file is started with sync_file_range() where available, and at the
+ * end the file is fsynced and closed by a bio thread. The snapshot is
+ * completed, renaming the file, once that job is done.
+ *
+ * Since keys are not saved DB after DB anymore, a SELECTDB opcode is emitted
+ * every time the DB of the key to save is not the last one selected in the
+ * file. RESIZEDB hints are not emitted as the sizes change meanwhile. */
+
+#define RDB_FORKLESS_TIME_PERC 5 /* CPU max % per cron cycle. */
+#define RDB_FORKLESS_SYNC_BYTES (1024*1024*4) /* Writeback every 4MB. */
+
+typedef struct rdbForklessSnapshot {
+    FILE *fp;               /* NULL once handed to bio to be closed. */
+    rio rdb;
+    char tmpfile[256];
+    sds filename;           /* Final RDB file name. */
+    long long now;          /* Start time in ms, for keys expiring meanwhile. */
+    int dbid;               /* DB the scan is in. */
+    unsigned long cursor;   /* dictScan() cursor in the DB 'dbid'. */
+    int seldb;              /* Last DB selected in the file, -1 if none. */
+    int *done;              /* done[j] is true if DB j was fully saved. */
+    dict **dicts;           /* dicts[j] is the keyspace of DB j to save. */
+    dict **expires;         /* expires[j] is the expires dict of DB j. */
+    int *detached;          /* detached[j] if the snapshot owns the dicts. */
+    dict **handled;         /* Per DB set of keys the scan must skip. */
+    off_t synced;           /* Writeback was started up to this offset. */
+    off_t dropped;          /* Pages before this offset left the cache. */
+    bioCloseResult *sync;   /* Outcome of the bio fsync, while waiting it. */
+    int error;              /* errno of the first write error, or zero. */
+} rdbForklessSnapshot;
+
+/* Append a key to the snapshot, selecting its DB first if needed. After a
+ * write error nothing is written anymore, the snapshot fails at the end. */
+static void rdbForklessSaveKey(rdbForklessSnapshot *fs, int dbid, sds keystr,
+                               robj *val, long long expire)
+{
+    robj key;
+
+    if (fs->error) return;
+    if (fs->seldb != dbid) {
+        if (rdbSaveType(&fs->rdb,RDB_OPCODE_SELECTDB) == -1 ||
+            rdbSaveLen(&fs->rdb,dbid) == -1) goto werr;
+        fs->seldb = dbid;
+    }
+    initStaticStringObject(key,keystr);
+    if (rdbSaveKeyValuePair(&fs->rdb,&key,val,expire,fs->now) == -1)
+        goto werr;
+    return;
+
+werr:
+    fs->error = errno ? errno : EIO;
+}
+
+/* Return true if the key is not saved yet and the scan will reach it. Once
+ * the dicts of a DB were detached, the writes to the DB no longer concern
+ * the snapshot. */
+static int rdbForklessKeyPending(rdbForklessSnapshot *fs, int dbid, sds key) {
+    if (fs->done[dbid] || fs->dicts[dbid] != server.db[dbid].dict) return 0;
+    if (dbid == fs->dbid && dictScanVisited(fs->dicts[dbid],key,fs->cursor))
+        return 0;
+    return fs->handled[dbid] == NULL || dictFind(fs->handled[dbid],key) == NULL;
+}
+
+/* The key is about to be created, modified or deleted. If the snapshot did
+ * not save it yet, save the current value now, and make sure the scan will
+ * skip the key, including when it does not exist yet. */
+void rdbForklessBeforeWrite(redisDb *db, robj *key) {
+    rdbForklessSnapshot *fs = server.rdb_forkless;
+    dictEntry *de;
+
+    if (!rdbForklessKeyPending(fs,db->id,key->ptr)) return;
+    if ((de = dictFind(db->dict,key->ptr)) != NULL) {
+        rdbForklessSaveKey(fs,db->id,dictGetKey(de),dictGetVal(de),
+                           getExpire(db,key));
+        server.rdb_forkless_preimages++;
+    }
+    if (fs->handled[db->id] == NULL)
+        fs->handled[db->id] = dictCreate(&forklessKeysDictType,NULL);
+    dictAdd(fs->handled[db->id],sdsdup(key->ptr),NULL);
+}
+
+static void rdbForklessScanCallback(void *privdata, const dictEntry *de) {
+    rdbForklessSnapshot *fs = privdata;
+    sds key = dictGetKey(de);
+    dict *expires = fs->expires[fs->dbid];
+    dictEntry *ede;
+    long long expire = -1;
+
+    if (fs->handled[fs->dbid] && dictFind(fs->handled[fs->dbid],key)) return;
+    if (dictSize(expires) && (ede = dictFind(expires,key)) != NULL)
+        expire = dictGetSignedIntegerVal(ede);
+    rdbForklessSaveKey(fs,fs->dbid,key,dictGetVal(de),expire);
+}
+
+/* Release the dicts of DB 'dbid' if the snapshot owns them. */
+static void rdbForklessReleaseDb(rdbForklessSnapshot *fs, int dbid) {
+    if (!fs->detached[dbid]) return;
+    dictRelease(fs->dicts[dbid]);
+    dictRelease(fs->expires[dbid]);
+    fs->detached[dbid] = 0;
+}
+
+/* Flag the DB as saved, releasing the keys that were skipped by the scan. */
+static void rdbForklessDbDone(rdbForklessSnapshot *fs, int dbid) {
+    fs->done[dbid] = 1;
+    rdbForklessReleaseDb(fs,dbid);
+    if (fs->handled[dbid]) {
+        dictRelease(fs->handled[dbid]);
+        fs->handled[dbid] = NULL;
+    }
+}
+
+/* Start the writeback of the bytes written since the last call, dropping
+ * from the page cache the ones of the previous call if requested, since
+ * they should be on disk by now. Nothing here waits for the disk. */
+static void rdbForklessWriteback(rdbForklessSnapshot *fs) {
+    off_t pos = fs->rdb.processed_bytes;
+
+    if (pos - fs->synced < RDB_FORKLESS_SYNC_BYTES) return;
+    if (fflush(fs->fp) == EOF) {
+        fs->error = errno ? errno : EIO;
+        return;
+    }
+#ifdef HAVE_SYNC_FILE_RANGE
+    sync_file_range(fileno(fs->fp),fs->synced,pos-fs->synced,
+                    SYNC_FILE_RANGE_WRITE);
+#endif
+#ifdef HAVE_FADVISE
+    if (server.rdb_save_drop_cache && fs->synced > fs->dropped) {
+        posix_fadvise(fileno(fs->fp),fs->dropped,fs->synced-fs->dropped,
+                      POSIX_FADV_DONTNEED);
+        fs->dropped = fs->synced;
+    }
+#endif
+    fs->synced = pos;
+}
+
+/* Write the EOF opcode and the checksum, and hand the file to a bio thread
+ * that fsyncs and closes it. */
+static int rdbForklessWriteTrailer(rdbForklessSnapshot *fs) {
+    uint64_t cksum;
+    int fd;
+
+    if (rdbSaveType(&fs->rdb,RDB_OPCODE_EOF) == -1) return C_ERR;
+    cksum = fs->rdb.cksum;
+    memrev64ifbe(&cksum);
+    if (rioWrite(&fs->rdb,&cksum,8) == 0) return C_ERR;
+    if (fflush(fs->fp) == EOF) return C_ERR;
+    if ((fd = dup(fileno(fs->fp))) == -1) return C_ERR;
+    if (fclose(fs->fp) == EOF) {
+        fs->fp = NULL;
+        close(fd);
+        return C_ERR;
+    }
+    fs->fp = NULL;
+    fs->sync = bioCreateCloseResult();
+    bioCreateBackgroundJob(BIO_CLOSE_FILE,(void*)(long)fd,(void*)1,fs->sync);
+    return C_OK;
+}
+
+/* Terminate the snapshot. If 'aborted' is false the file, already fsynced,
+ * is renamed into the RDB file, unless there was an error, otherwise it is
+ * just removed, without reporting an error, like it happens when a saving
+ * child is killed with SIGUSR1. The bookkeeping is the same performed by
+ * backgroundSaveDoneHandlerDisk(). */
+static void rdbForklessEnd(int aborted) {
+    rdbForklessSnapshot *fs = server.rdb_forkless;
+    int ok = !aborted && !fs->error, j;
+
+    if (fs->fp) fclose(fs->fp);
+    if (fs->sync) {
+        /* When aborting the job may still be running: the file is unlinked
+         * anyway, the job just fsyncs and closes the last descriptor. */
+        if (ok && !fs->error && fs->sync->err) {
+            fs->error = fs->sync->err;
+            ok = 0;
+        }
+        bioReleaseCloseResult(fs->sync);
+    }
+    if (ok && rename(fs->tmpfile,fs->filename) == -1) {
+        fs->error = errno;
+        ok = 0;
+    }
+    if (!ok) unlink(fs->tmpfile);
+
+    if (ok) {
+        serverLog(LL_NOTICE,
+            "Background fork-less saving terminated with success");
+        server.dirty = server.dirty - server.dirty_before_bgsave;
+        server.lastsave = time(NULL);
+        server.lastbgsave_status = C_OK;
+    } else if (!aborted) {
+        serverLog(LL_WARNING,"Background fork-less saving error: %s",
+            strerror(fs->error));
+        server.lastbgsave_status = C_ERR;
+    } else {
+        serverLog(LL_WARNING,"Background fork-less saving aborted");
+    }
+    server.rdb_save_time_last = time(NULL)-server.rdb_save_time_start;
+    server.rdb_save_time_start = -1;
+
+    for (j = 0; j < server.dbnum; j++) {
+        rdbForklessReleaseDb(fs,j);
+        if (fs->handled[j]) dictRelease(fs->handled[j]);
+    }
+    zfree(fs->handled);
+    zfree(fs->detached);
+    zfree(fs->expires);
+    zfree(fs->dicts);
+    zfree(fs->done);
+    sdsfree(fs->filename);
+    zfree(fs);
+    server.rdb_forkless = NULL;
+    rdbDeltaSaveDone(ok);
+    updateSlavesWaitingBgsave(ok ? C_OK : C_ERR, RDB_CHILD_TYPE_DISK);
+}
+
+/* Advance the scan for about 'timelimit' microseconds, and write the end of
+ * the file when all the DBs are saved. */
+static void rdbForklessStep(long long timelimit) {
+    rdbForklessSnapshot *fs = server.rdb_forkless;
+    long long start = ustime();
+    int iteration = 0;
+
+    while (fs->dbid < server.dbnum && !fs->error) {
+        if (!fs->done[fs->dbid]) {
+            fs->cursor = dictScan(fs->dicts[fs->dbid],fs->cursor,
+                                  rdbForklessScanCallback,fs);
+            if (fs->cursor != 0) {
+                if ((++iteration & 15) == 0) {
+                    rdbForklessWriteback(fs);
+                    if (ustime()-start > timelimit) return;
+                }
+                continue;
+            }
+            rdbForklessDbDone(fs,fs->dbid);
+        }
+        fs->dbid++;
+        fs->cursor = 0;
+    }
+    if (!fs->error && rdbForklessWriteTrailer(fs) == C_OK) return;
+    if (!fs->error) fs->error = errno ? errno : EIO;
+    rdbForklessEnd(0);
+}
+
+/* Called by serverCron() while a fork-less snapshot is in progress. */
+void rdbForklessCron(void) {
+    rdbForklessSnapshot *fs = server.rdb_forkless;
+
+    if (fs->sync) {
+        if (bioCloseResultDone(fs->sync)) rdbForklessEnd(0);
+        return;
+    }
+    rdbForklessStep(RDB_FORKLESS_TIME_PERC*1000000/server.hz/100);
+}
+
+/* The DB 'dbid' (or all the DBs if -1) is going to be emptied. If the scan
+ * did not complete it yet, the snapshot takes over its dicts, replacing
+ * them with empty ones, so that it can keep saving them incrementally. */
+void rdbForklessFlushDb(int dbid) {
+    rdbForklessSnapshot *fs = server.rdb_forkless;
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        if (dbid != -1 && dbid != j) continue;
+        if (fs->done[j] || fs->dicts[j] != server.db[j].dict) continue;
+        fs->detached[j] = 1;
+        server.db[j].dict = dictCreate(&dbDictType,NULL);
+        server.db[j].expires = dictCreate(&keyptrDictType,NULL);
+    }
+}
+
+/* The dicts of the DB 'dbid', no longer part of the dataset, are about to
+ * be released. If the snapshot did not save them yet it takes them over,
+ * releasing them when done, and 1 is returned. Otherwise 0 is returned and
+ * the caller should release them. */
+int rdbForklessAdoptDb(int dbid, dict *d, dict *expires) {
+    rdbForklessSnapshot *fs = server.rdb_forkless;
 
-    /* Use RENAME to make sure the DB file is changed atomically only
-     * if the generate DB file is ok. */
-    if (rename(tmpfile,filename) == -1) {
-        char *cwdp = getcwd(cwd,MAXPATHLEN);
-        serverLog(LL_WARNING,
-            "Error moving temp DB file %s on the final "
-            "destination %s (in server root dir %s): %s",
-            tmpfile,
-            filename,
-            cwdp ? cwdp : "unknown",
+    if (fs->done[dbid] || fs->detached[dbid] || fs->dicts[dbid] != d)
+        return 0;
+    serverAssert(fs->expires[dbid] == expires);
+    fs->detached[dbid] = 1;
+    return 1;
+}
+
+/* Stop the snapshot in progress without saving anything. */
+void rdbForklessAbort(void) {
+    rdbForklessEnd(1);
+}
+
+/* Start a fork-less snapshot, see the top comment of this section. */
+static int rdbForklessStart(char *filename) {
+    rdbForklessSnapshot *fs;
+    char magic[10];
+    FILE *fp;
+    int j;
+
+    fs = zcalloc(sizeof(*fs));
+    snprintf(fs->tmpfile,sizeof(fs->tmpfile),"temp-forkless-%d.rdb",
+        (int) getpid());
+    /* The snapshot is always a full RDB. */
+    rdbDeltaStartSave(0);
+    if ((fp = fopen(fs->tmpfile,"w")) == NULL) {
+        serverLog(LL_WARNING,"Can't save in background: fopen: %s",
             strerror(errno));
-        unlink(tmpfile);
+        rdbDeltaSaveDone(0);
+        zfree(fs);
+        server.lastbgsave_status = C_ERR;
+        return C_ERR;
+    }
+    fs->fp = fp;
+    rioInitWithFile(&fs->rdb,fp);
+    if (server.rdb_checksum)
+        fs->rdb.update_cksum = rioGenericUpdateChecksum;
+    snprintf(magic,sizeof(magic),"REDIS%04d",rdbVersionToSave(0));
+    if (rdbWriteRaw(&fs->rdb,magic,9) == -1 ||
+        rdbSaveInfoAuxFields(&fs->rdb) == -1 ||
+        (server.rdb_delta_saving &&
+         rdbSaveAuxFieldStrStr(&fs->rdb,"delta-base",
+                               server.rdb_delta_bgsave_base) == -1))
+    {
+        serverLog(LL_WARNING,"Can't save in background: write: %s",
+            strerror(errno));
+        rdbDeltaSaveDone(0);
+        fclose(fp);
+        unlink(fs->tmpfile);
+        zfree(fs);
+        server.lastbgsave_status = C_ERR;
         return C_ERR;
     }
+    fs->filename = sdsnew(filename);
+    fs->now = mstime();
+    fs->seldb = -1;
+    fs->done = zcalloc(sizeof(int)*server.dbnum);
+    fs->dicts = zmalloc(sizeof(dict*)*server.dbnum);
+    fs->expires = zmalloc(sizeof(dict*)*server.dbnum);
+    fs->detached = zcalloc(sizeof(int)*server.dbnum);
+    fs->handled = zcalloc(sizeof(dict*)*server.dbnum);
+    for (j = 0; j < server.dbnum; j++) {
+        fs->dicts[j] = server.db[j].dict;
+        fs->expires[j] = server.db[j].expires;
+    }
 
-    serverLog(LL_NOTICE,"DB saved on disk");
-    server.dirty = 0;
-    server.lastsave = time(NULL);
-    server.lastbgsave_status = C_OK;
+    server.rdb_forkless = fs;
+    server.rdb_forkless_preimages = 0;
+    server.rdb_save_time_start = time(NULL);
+    serverLog(LL_NOTICE,"Background fork-less saving started");
     return C_OK;
-
-werr:
-    serverLog(LL_WARNING,"Write error saving DB on disk: %s", strerror(errno));
-    fclose(fp);
-    unlink(tmpfile);
-    return C_ERR;
 }
 
 int rdbSaveBackground(char *filename) {
     pid_t childpid;
     long long start;
+    int seq;
 
-    if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
+    if (server.aof_child_pid != -1 || server.rdb_child_pid != -1 ||
+        server.rdb_forkless) return C_ERR;
 
     server.dirty_before_bgsave = server.dirty;
     server.lastbgsave_try = time(NULL);
+    if (server.rdb_forkless_snapshot) return rdbForklessStart(filename);
+    seq = rdbDeltaStartSave(1);
+    openChildInfoPipe();
 
     start = ustime();
     if ((childpid = fork()) == 0) {
@@ -931,7 +1955,7 @@ int rdbSaveBackground(char *filename) {
         /* Child */
         closeListeningSockets(0);
         redisSetProcTitle("redis-rdb-bgsave");
-        retval = rdbSave(filename);
+        retval = seq ? rdbSaveDelta(filename,seq) : rdbSave(filename);
         if (retval == C_OK) {
             size_t private_dirty = zmalloc_get_private_dirty();
 
@@ -940,6 +1964,9 @@ int rdbSaveBackground(char *filename) {
                     "RDB: %zu MB of memory used by copy-on-write",
                     private_dirty/(1024*1024));
             }
+
+            server.child_info_data.cow_size = private_dirty;
+            sendChildInfo(CHILD_INFO_TYPE_RDB);
         }
         exitFromChild((retval == C_OK) ? 0 : 1);
     } else {
@@ -948,12 +1975,21 @@ int rdbSaveBackground(char *filename) {
         server.stat_fork_rate = (double) zmalloc_used_memory() * 1000000 / server.stat_fork_time / (1024*1024*1024); /* GB per second. */
         latencyAddSampleIfNeeded("fork",server.stat_fork_time/1000);
         if (childpid == -1) {
+            closeChildInfoPipe();
+            rdbDeltaSaveDone(0);
             server.lastbgsave_status = C_ERR;
             serverLog(LL_WARNING,"Can't save in background: fork: %s",
                 strerror(errno));
             return C_ERR;
         }
-        serverLog(LL_NOTICE,"Background saving started by pid %d",childpid);
+        if (seq) {
+            serverLog(LL_NOTICE,
+                "Background saving of delta snapshot %d started by pid %d",
+                seq, childpid);
+        } else {
+            serverLog(LL_NOTICE,"Background saving started by pid %d",
+                childpid);
+        }
         server.rdb_save_time_start = time(NULL);
         server.rdb_child_pid = childpid;
         server.rdb_child_type = RDB_CHILD_TYPE_DISK;
@@ -970,6 +2006,86 @@ void rdbRemoveTempFile(pid_t childpid) {
     unlink(tmpfile);
 }
 
+/* Load the 'len' nodes of a RDB_TYPE_LIST_QUICKLIST_NODES list into 'ql'.
+ *
+ * The nodes are appended as they are, and only at the end the ones that
+ * need it are compressed or decompressed according to our compress depth.
+ * If it is the same used when saving, nothing is done. Returns C_ERR on
+ * short read or if a node is not valid. */
+static int rdbLoadQuicklistNodes(rio *rdb, quicklist *ql, uint64_t len) {
+    while (len--) {
+        uint32_t count, sz, clen;
+
+        if ((count = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return C_ERR;
+        if (count == 0 || count > UINT16_MAX) {
+            if (rdbCheckMode)
+                rdbCheckSetError("Quicklist node with %u entries",count);
+            return C_ERR;
+        }
+        if ((sz = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return C_ERR;
+        if (sz) {
+            quicklistLZF *lzf;
+            unsigned char *zl;
+            int valid;
+
+            /* Cheap checks first: the count should fit the ziplist size
+             * (header and end, and two bytes or more per entry), and the
+             * sizes should be the ones of a compressed node. */
+            if ((clen = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return C_ERR;
+            if (clen == 0 || clen >= sz ||
+                sz/RDB_CODEC_MAX_EXPANSION > clen ||
+                sz < (uint64_t)count*2+ZIPLIST_HEADER_SIZE+ZIPLIST_END_SIZE)
+            {
+                if (rdbCheckMode)
+                    rdbCheckSetError("Invalid compressed quicklist node");
+                return C_ERR;
+            }
+            lzf = zmalloc(sizeof(*lzf)+clen);
+            lzf->sz = clen;
+            if (rioRead(rdb,lzf->compressed,clen) == 0) {
+                zfree(lzf);
+                return C_ERR;
+            }
+
+            /* The node may come from RESTORE or from the master: make sure
+             * it decompresses to the ziplist we were told about, otherwise
+             * it would only fail later, when used. */
+            zl = zmalloc(sz);
+            valid = lzf_decompress(lzf->compressed,clen,zl,sz) == sz &&
+                    ziplistBlobLen(zl) == sz && ziplistLen(zl) == count;
+            zfree(zl);
+            if (!valid) {
+                if (rdbCheckMode)
+                    rdbCheckSetError("Corrupted compressed quicklist node");
+                zfree(lzf);
+                return C_ERR;
+            }
+            quicklistAppendNode(ql,(unsigned char*)lzf,sz,count,1);
+        } else {
+            size_t len;
+            unsigned char *zl =
+                rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,&len);
+
+            if (zl == NULL) return C_ERR;
+            /* Don't read the ziplist header before knowing it is there. */
+            if (len < ZIPLIST_HEADER_SIZE+ZIPLIST_END_SIZE ||
+                ziplistBlobLen(zl) != len || ziplistLen(zl) != count)
+            {
+                if (rdbCheckMode)
+                    rdbCheckSetError("Invalid quicklist node");
+                zfree(zl);
+                return C_ERR;
+            }
+            quicklistAppendNode(ql,zl,len,count,0);
+        }
+    }
+    if (quicklistApplyCompressDepth(ql) == 0) {
+        if (rdbCheckMode) rdbCheckSetError("Can't decompress quicklist node");
+        return C_ERR;
+    }
+    return C_OK;
+}
+
 /* Load a Redis object of the specified type from the specified file.
  * On success a newly allocated object is returned, otherwise NULL. */
 robj *rdbLoadObject(int rdbtype, rio *rdb) {
@@ -1142,17 +2258,26 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                             server.list_compress_depth);
 
         while (len--) {
-            unsigned char *zl = rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN);
+            unsigned char *zl = rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,NULL);
             if (zl == NULL) return NULL;
             quicklistAppendZiplist(o->ptr, zl);
         }
+    } else if (rdbtype == RDB_TYPE_LIST_QUICKLIST_NODES) {
+        if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
+        o = createQuicklistObject();
+        quicklistSetOptions(o->ptr, server.list_max_ziplist_size,
+                            server.list_compress_depth);
+        if (rdbLoadQuicklistNodes(rdb,o->ptr,len) == C_ERR) {
+            decrRefCount(o);
+            return NULL;
+        }
     } else if (rdbtype == RDB_TYPE_HASH_ZIPMAP  ||
                rdbtype == RDB_TYPE_LIST_ZIPLIST ||
                rdbtype == RDB_TYPE_SET_INTSET   ||
                rdbtype == RDB_TYPE_ZSET_ZIPLIST ||
                rdbtype == RDB_TYPE_HASH_ZIPLIST)
     {
-        unsigned char *encoded = rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN);
+        unsigned char *encoded = rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,NULL);
         if (encoded == NULL) return NULL;
         o = createObject(OBJ_STRING,encoded); /* Obj type fixed below. */
 
@@ -1226,19 +2351,24 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
 }
 
 /* Mark that we are loading in the global state and setup the fields
- * needed to provide loading stats. */
-void startLoading(FILE *fp) {
-    struct stat sb;
-
+ * needed to provide loading stats. 'size' is the number of bytes to load,
+ * or zero if unknown. */
+void startLoadingSize(off_t size) {
     /* Load the DB */
     server.loading = 1;
     server.loading_start_time = time(NULL);
     server.loading_loaded_bytes = 0;
-    if (fstat(fileno(fp), &sb) == -1) {
-        server.loading_total_bytes = 0;
-    } else {
-        server.loading_total_bytes = sb.st_size;
-    }
+    server.loading_total_bytes = size;
+}
+
+/* Like startLoadingSize() when loading the file 'fp'. */
+void startLoading(FILE *fp) {
+    struct stat sb;
+
+    if (fstat(fileno(fp), &sb) == -1)
+        startLoadingSize(0);
+    else
+        startLoadingSize(sb.st_size);
 }
 
 /* Refresh the loading progress info */
@@ -1272,67 +2402,591 @@ void rdbLoadProgressCallback(rio *r, const void *buf, size_t len) {
     }
 }
 
-int rdbLoad(char *filename) {
-    uint32_t dbid;
-    int type, rdbver;
-    redisDb *db = server.db+0;
-    char buf[1024];
-    long long expiretime, now = mstime();
-    FILE *fp;
+/* -----------------------------------------------------------------------------
+ * Chunked RDB loading, see rdb.h for the format
+ * -------------------------------------------------------------------------- */
+
+/* Read the 'size' bytes of a chunk payload. The sizes come from the file,
+ * or from the master socket, so the buffer only grows as the bytes are
+ * actually read: a corrupted size results in a short read rather than in
+ * allocating all the memory it claims. Returns NULL on short read. */
+static sds rdbReadChunkPayload(rio *rdb, uint64_t size) {
+    sds buf = sdsempty();
+
+    while (sdslen(buf) < size) {
+        size_t cur = sdslen(buf);
+        size_t step = size-cur;
+
+        /* Read at most RDB_CHUNK_SIZE bytes, or as many as already read,
+         * at a time. */
+        if (step > RDB_CHUNK_SIZE && step > cur)
+            step = cur > RDB_CHUNK_SIZE ? cur : RDB_CHUNK_SIZE;
+        buf = sdsMakeRoomFor(buf,step);
+        if (rioRead(rdb,buf+cur,step) == 0) {
+            sdsfree(buf);
+            return NULL;
+        }
+        sdsIncrLen(buf,step);
+    }
+    return buf;
+}
+
+/* Report an invalid chunk, see rdbLoadChunk(). */
+static void rdbChunkError(const char *msg) {
+    if (rdbCheckMode)
+        rdbCheckSetError("%s",msg);
+    else
+        serverLog(LL_WARNING,"%s",msg);
+}
+
+/* A chunk as it is stored in the file, see rdbReadChunk(). */
+typedef struct rdbStoredChunk {
+    rdbChunkInfo info;
+    uint32_t enc;       /* RDB_ENC_* type of the codec of the payload. */
+    uint64_t len;       /* Uncompressed payload size. */
+    uint64_t clen;      /* Stored payload size, or 0 if not compressed. */
+    sds stored;         /* The payload as it is stored. */
+} rdbStoredChunk;
+
+/* Read a chunk, after the RDB_OPCODE_CHUNK opcode was read: its header and
+ * its payload as it is stored, without verifying or decompressing it, see
+ * rdbDecodeChunk(). Returns C_ERR on short read or invalid header. */
+static int rdbReadChunk(rio *rdb, rdbStoredChunk *chunk) {
+    rdbChunkInfo *info = &chunk->info;
+
+    if ((info->dbid = rdbLoadLen(rdb,NULL)) == RDB_LENERR ||
+        (info->keys = rdbLoadLen(rdb,NULL)) == RDB_LENERR ||
+        (info->minslot = rdbLoadLen(rdb,NULL)) == RDB_LENERR ||
+        (info->maxslot = rdbLoadLen(rdb,NULL)) == RDB_LENERR ||
+        (chunk->enc = rdbLoadLen(rdb,NULL)) == RDB_LENERR ||
+        rdbLoadRawUint64(rdb,&chunk->len) == -1 ||
+        rdbLoadRawUint64(rdb,&chunk->clen) == -1 ||
+        rdbLoadRawUint64(rdb,&info->crc) == -1) return C_ERR;
+
+    /* Empty chunks are never written. A payload is only stored compressed
+     * if it gets smaller, and no codec expands it more than
+     * RDB_CODEC_MAX_EXPANSION times. */
+    if (chunk->len == 0 ||
+        (chunk->clen && (chunk->clen >= chunk->len ||
+                         chunk->len/RDB_CODEC_MAX_EXPANSION > chunk->clen)))
+    {
+        rdbChunkError("Invalid RDB chunk length");
+        return C_ERR;
+    }
+    chunk->stored = rdbReadChunkPayload(rdb,chunk->clen ? chunk->clen :
+                                                          chunk->len);
+    return chunk->stored ? C_OK : C_ERR;
+}
+
+/* Verify the CRC of a chunk read with rdbReadChunk() and return its
+ * uncompressed records. The stored payload is released, or returned if not
+ * compressed. On error NULL is returned and '*err' is set. This function
+ * is also called by the loading threads, so it must not log. */
+static sds rdbDecodeChunk(rdbStoredChunk *chunk, const char **err) {
+    sds stored = chunk->stored, payload;
+    rdbCodec *codec;
+
+    chunk->stored = NULL;
+    if (crc64(0,(unsigned char*)stored,sdslen(stored)) != chunk->info.crc) {
+        *err = "RDB chunk CRC error";
+        sdsfree(stored);
+        return NULL;
+    }
+    if (chunk->clen == 0) return stored;
+
+    if ((codec = rdbCodecByEnc(chunk->enc)) == NULL) {
+        *err = "Unknown RDB chunk encoding type";
+        sdsfree(stored);
+        return NULL;
+    }
+    payload = sdsnewlen(NULL,chunk->len);
+    if (codec->decompress(stored,chunk->clen,payload,chunk->len) !=
+        chunk->len)
+    {
+        *err = "Invalid compressed chunk";
+        sdsfree(stored);
+        sdsfree(payload);
+        return NULL;
+    }
+    sdsfree(stored);
+    return payload;
+}
+
+/* Load a chunk, after the RDB_OPCODE_CHUNK opcode was read, filling 'info'
+ * with everything but the offset of the chunk. The uncompressed records of
+ * the chunk are returned, or NULL on short read or invalid content, so that
+ * the caller can decide if the error is fatal. */
+sds rdbLoadChunk(rio *rdb, rdbChunkInfo *info) {
+    rdbStoredChunk chunk;
+    const char *err;
+    sds payload;
+
+    if (rdbReadChunk(rdb,&chunk) == C_ERR) return NULL;
+    *info = chunk.info;
+    if ((payload = rdbDecodeChunk(&chunk,&err)) == NULL) rdbChunkError(err);
+    return payload;
+}
+
+/* Load the chunks index, after the RDB_OPCODE_CHUNK_INDEX opcode was read.
+ * If 'index' is not NULL it is set to an array of 'count' entries, that the
+ * caller should free with zfree(), otherwise the index is just skipped.
+ * Returns -1 on short read. */
+int rdbLoadChunkIndex(rio *rdb, rdbChunkInfo **index, uint32_t *count) {
+    rdbChunkInfo *entries;
+    uint64_t offset;
+    uint32_t j, n;
+
+    if ((n = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return -1;
+    /* Like the chunk payloads, the array grows as the entries are read,
+     * since 'n' may be corrupted. */
+    entries = NULL;
+    for (j = 0; j < n; j++) {
+        rdbChunkInfo *info;
+
+        if ((j & (j-1)) == 0)
+            entries = zrealloc(entries,sizeof(rdbChunkInfo)*(j ? j*2 : 1));
+        info = entries+j;
+        if (rdbLoadRawUint64(rdb,&info->offset) == -1 ||
+            rdbLoadRawUint64(rdb,&info->crc) == -1 ||
+            (info->dbid = rdbLoadLen(rdb,NULL)) == RDB_LENERR ||
+            (info->keys = rdbLoadLen(rdb,NULL)) == RDB_LENERR ||
+            (info->minslot = rdbLoadLen(rdb,NULL)) == RDB_LENERR ||
+            (info->maxslot = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
+        {
+            zfree(entries);
+            return -1;
+        }
+    }
+    if (rdbLoadRawUint64(rdb,&offset) == -1) {
+        zfree(entries);
+        return -1;
+    }
+    if (index) {
+        *index = entries;
+        *count = n;
+    } else {
+        zfree(entries);
+    }
+    return 0;
+}
+
+/* Read the chunks index of a chunked RDB file seeking directly to it, using
+ * the index offset stored just before the EOF opcode and the checksum, so
+ * that single chunks can then be read seeking to their offset. Returns -1
+ * if the file has no index or on read error. */
+int rdbReadChunkIndexFromFile(FILE *fp, rdbChunkInfo **index,
+                              uint32_t *count)
+{
+    unsigned char trailer[9];
+    uint64_t offset;
     rio rdb;
 
-    if ((fp = fopen(filename,"r")) == NULL) return C_ERR;
+    if (fseeko(fp,-17,SEEK_END) == -1) return -1;
+    if (fread(trailer,sizeof(trailer),1,fp) != 1) return -1;
+    if (trailer[8] != RDB_OPCODE_EOF) return -1;
+    memcpy(&offset,trailer,8);
+    memrev64ifbe(&offset);
+    if (fseeko(fp,offset,SEEK_SET) == -1) return -1;
 
     rioInitWithFile(&rdb,fp);
-    rdb.update_cksum = rdbLoadProgressCallback;
-    rdb.max_processing_chunk = server.loading_process_events_interval_bytes;
-    if (rioRead(&rdb,buf,9) == 0) goto eoferr;
+    if (rdbLoadType(&rdb) != RDB_OPCODE_CHUNK_INDEX) return -1;
+    return rdbLoadChunkIndex(&rdb,index,count);
+}
+
+/* -----------------------------------------------------------------------------
+ * Parallel RDB loading
+ *
+ * When rdb-load-threads is set, the chunks of a chunked RDB file (see
+ * rdb-chunked) are decoded by a pool of threads. The main thread still
+ * reads the file sequentially, but it only reads the header of every chunk
+ * and its payload as it is stored, without parsing it. The threads verify
+ * the CRC of the chunks, decompress them and decode their key-value
+ * records. The decoded chunks are added to the DB by the main thread in the
+ * same order they were read, so the resulting dataset is the same obtained
+ * loading the file serially. String values are left as plain strings by
+ * the threads and are encoded by the main thread, so that they can use the
+ * shared integers and the interned strings, that the loading threads are
+ * not allowed to use.
+ *
+ * Files that are not chunked are loaded serially: the end of a value can
+ * only be found parsing it, so the main thread would do all the work of the
+ * serial loading anyway.
+ * -------------------------------------------------------------------------- */
+
+typedef struct rdbLoadEntry {
+    robj *key;
+    robj *val;
+    long long expiretime;   /* Expire time in milliseconds or -1. */
+} rdbLoadEntry;
+
+typedef struct rdbLoadBatch {
+    rdbStoredChunk chunk;   /* The chunk to decode. */
+    redisDb *db;            /* DB of the keys of the chunk. */
+    rdbLoadEntry *entries;  /* Decoded keys, in the order they are stored. */
+    uint32_t count;         /* Number of decoded keys. */
+    const char *error;      /* Set if the chunk can't be decoded. */
+    int done;               /* True when the chunk is decoded. */
+} rdbLoadBatch;
+
+typedef struct rdbParallelLoader {
+    pthread_t *threads;
+    int numthreads;
+    pthread_mutex_t mutex;      /* Protects 'jobs', 'done' and 'exiting'. */
+    pthread_cond_t jobs_cond;   /* Signaled when a batch is queued. */
+    pthread_cond_t done_cond;   /* Signaled when a batch is decoded. */
+    list *jobs;                 /* Batches waiting for a thread. */
+    list *inflight;             /* Batches not yet added to the DB, in order. */
+    long long now;              /* Reference time to discard expired keys. */
+    int exiting;                /* Threads should terminate. */
+} rdbParallelLoader;
+
+/* Decode the key-value records of the chunk of 'batch'. On error
+ * batch->error is set, and the keys decoded so far are left in the batch
+ * to be released by the main thread. */
+static void rdbDecodeLoadBatch(rdbLoadBatch *batch) {
+    uint32_t size = 0;
+    sds payload;
+    rio chunk;
+
+    if ((payload = rdbDecodeChunk(&batch->chunk,&batch->error)) == NULL)
+        return;
+    rioInitWithBuffer(&chunk,payload);
+    while ((size_t)chunk.io.buffer.pos < sdslen(payload)) {
+        rdbLoadEntry *e;
+        int type;
+
+        if (batch->count == size) {
+            size = size ? size*2 : 64;
+            batch->entries = zrealloc(batch->entries,sizeof(*e)*size);
+        }
+        e = batch->entries+batch->count;
+        e->expiretime = -1;
+        if ((type = rdbLoadType(&chunk)) == -1) break;
+        if (type == RDB_OPCODE_EXPIRETIME_MS) {
+            if ((e->expiretime = rdbLoadMillisecondTime(&chunk)) == -1) break;
+            if ((type = rdbLoadType(&chunk)) == -1) break;
+        }
+        if (!rdbIsObjectType(type)) {
+            batch->error = "Unknown RDB type in chunk";
+            break;
+        }
+        if ((e->key = rdbLoadStringObject(&chunk)) == NULL) break;
+        if (type == RDB_TYPE_STRING)
+            e->val = rdbGenericLoadStringObject(&chunk,RDB_LOAD_NONE,NULL);
+        else
+            e->val = rdbLoadObject(type,&chunk);
+        if (e->val == NULL) {
+            decrRefCount(e->key);
+            break;
+        }
+        batch->count++;
+    }
+    if (!batch->error && (size_t)chunk.io.buffer.pos != sdslen(payload))
+        batch->error = "Invalid key-value record in RDB chunk";
+    sdsfree(payload);
+}
+
+static void *rdbLoadThreadMain(void *arg) {
+    rdbParallelLoader *loader = arg;
+
+    objectSharingDisabled = 1;
+    pthread_mutex_lock(&loader->mutex);
+    while(1) {
+        listNode *ln;
+        rdbLoadBatch *batch;
+
+        while (listLength(loader->jobs) == 0 && !loader->exiting)
+            pthread_cond_wait(&loader->jobs_cond,&loader->mutex);
+        if (listLength(loader->jobs) == 0) break;
+        ln = listFirst(loader->jobs);
+        batch = ln->value;
+        listDelNode(loader->jobs,ln);
+        pthread_mutex_unlock(&loader->mutex);
+
+        rdbDecodeLoadBatch(batch);
+
+        pthread_mutex_lock(&loader->mutex);
+        batch->done = 1;
+        pthread_cond_broadcast(&loader->done_cond);
+    }
+    pthread_mutex_unlock(&loader->mutex);
+    return NULL;
+}
+
+/* Stop the loading threads and release the loader. */
+static void rdbReleaseParallelLoader(rdbParallelLoader *loader) {
+    int j;
+
+    pthread_mutex_lock(&loader->mutex);
+    loader->exiting = 1;
+    pthread_cond_broadcast(&loader->jobs_cond);
+    pthread_mutex_unlock(&loader->mutex);
+    for (j = 0; j < loader->numthreads; j++)
+        pthread_join(loader->threads[j],NULL);
+    pthread_mutex_destroy(&loader->mutex);
+    pthread_cond_destroy(&loader->jobs_cond);
+    pthread_cond_destroy(&loader->done_cond);
+    listRelease(loader->jobs);
+    listRelease(loader->inflight);
+    zfree(loader->threads);
+    zfree(loader);
+}
+
+/* Create a loader with 'numthreads' decoding threads. On error NULL is
+ * returned and the caller should load the file serially. */
+static rdbParallelLoader *rdbCreateParallelLoader(int numthreads,
+                                                  long long now)
+{
+    rdbParallelLoader *loader = zcalloc(sizeof(*loader));
+    int j;
+
+    loader->threads = zmalloc(sizeof(pthread_t)*numthreads);
+    pthread_mutex_init(&loader->mutex,NULL);
+    pthread_cond_init(&loader->jobs_cond,NULL);
+    pthread_cond_init(&loader->done_cond,NULL);
+    loader->jobs = listCreate();
+    loader->inflight = listCreate();
+    loader->now = now;
+    for (j = 0; j < numthreads; j++) {
+        if (pthread_create(&loader->threads[j],NULL,
+                           rdbLoadThreadMain,loader) != 0)
+        {
+            serverLog(LL_WARNING,
+                "Can't create RDB loading threads, loading serially.");
+            rdbReleaseParallelLoader(loader);
+            return NULL;
+        }
+        loader->numthreads++;
+    }
+    return loader;
+}
+
+/* Free a batch, releasing the keys not added to the DB. */
+static void rdbFreeLoadBatch(rdbLoadBatch *batch) {
+    uint32_t j;
+
+    for (j = 0; j < batch->count; j++) {
+        decrRefCount(batch->entries[j].key);
+        decrRefCount(batch->entries[j].val);
+    }
+    sdsfree(batch->chunk.stored);
+    zfree(batch->entries);
+    zfree(batch);
+}
+
+/* Remove the oldest batch in flight, waiting for it to be decoded. */
+static rdbLoadBatch *rdbWaitOldestLoadBatch(rdbParallelLoader *loader) {
+    listNode *ln = listFirst(loader->inflight);
+    rdbLoadBatch *batch = ln->value;
+
+    listDelNode(loader->inflight,ln);
+    pthread_mutex_lock(&loader->mutex);
+    while (!batch->done)
+        pthread_cond_wait(&loader->done_cond,&loader->mutex);
+    pthread_mutex_unlock(&loader->mutex);
+    return batch;
+}
+
+/* Wait for the oldest batch in flight to be decoded and add its keys to the
+ * DB, with the same rules used when loading serially. */
+static int rdbFlushOldestLoadBatch(rdbParallelLoader *loader) {
+    rdbLoadBatch *batch = rdbWaitOldestLoadBatch(loader);
+    uint32_t j;
+
+    if (batch->error) {
+        rdbChunkError(batch->error);
+        rdbFreeLoadBatch(batch);
+        return C_ERR;
+    }
+    for (j = 0; j < batch->count; j++) {
+        rdbLoadEntry *e = batch->entries+j;
+
+        if (server.masterhost == NULL && e->expiretime != -1 &&
+            e->expiretime < loader->now)
+        {
+            decrRefCount(e->key);
+            decrRefCount(e->val);
+            continue;
+        }
+        if (e->val->type == OBJ_STRING) e->val = tryObjectEncoding(e->val);
+        dbAdd(batch->db,e->key,e->val);
+        if (e->expiretime != -1) setExpire(batch->db,e->key,e->expiretime);
+        decrRefCount(e->key);
+    }
+    batch->count = 0;
+    rdbFreeLoadBatch(batch);
+    return C_OK;
+}
+
+/* Hand the chunk just read to the loading threads, taking ownership of
+ * its payload. To bound the memory used, when too many chunks are in
+ * flight we wait for the oldest ones. */
+static int rdbQueueLoadChunk(rdbParallelLoader *loader, redisDb *db,
+                             rdbStoredChunk *chunk)
+{
+    rdbLoadBatch *batch = zcalloc(sizeof(*batch));
+
+    batch->chunk = *chunk;
+    batch->db = db;
+    listAddNodeTail(loader->inflight,batch);
+    pthread_mutex_lock(&loader->mutex);
+    listAddNodeTail(loader->jobs,batch);
+    pthread_cond_signal(&loader->jobs_cond);
+    pthread_mutex_unlock(&loader->mutex);
+    while (listLength(loader->inflight) > (unsigned)loader->numthreads*2) {
+        if (rdbFlushOldestLoadBatch(loader) == C_ERR) return C_ERR;
+    }
+    return C_OK;
+}
+
+/* Add all the chunks in flight to the DB, so that what follows in the file
+ * can be loaded by the main thread in order. */
+static int rdbDrainParallelLoad(rdbParallelLoader *loader) {
+    while (listLength(loader->inflight)) {
+        if (rdbFlushOldestLoadBatch(loader) == C_ERR) return C_ERR;
+    }
+    return C_OK;
+}
+
+/* Stop loading after an error, discarding the batches not yet added to the
+ * DB. Only needed when the server survives the error. */
+static void rdbAbortParallelLoad(rdbParallelLoader *loader) {
+    while (listLength(loader->inflight))
+        rdbFreeLoadBatch(rdbWaitOldestLoadBatch(loader));
+    rdbReleaseParallelLoader(loader);
+}
+
+/* Add all the queued keys to the DB and release the loader. */
+static int rdbFinishParallelLoad(rdbParallelLoader *loader) {
+    /* On error the loader is left to the caller, that either exits or,
+     * loading from a stream, releases it with rdbAbortParallelLoad(). */
+    if (rdbDrainParallelLoad(loader) == C_ERR) return C_ERR;
+    rdbReleaseParallelLoader(loader);
+    return C_OK;
+}
+
+/* Load the value of type 'rdbtype' of the key 'key' from the rio and add
+ * the key to 'db', unless it is already expired. */
+static int rdbLoadKeyValue(rio *rdb, redisDb *db, robj *key, int rdbtype,
+                           long long expiretime, long long now)
+{
+    robj *val;
+
+    /* Read value */
+    if ((val = rdbLoadObject(rdbtype,rdb)) == NULL) return C_ERR;
+    /* Check if the key already expired. This function is used when loading
+     * an RDB file from disk, either at startup, or when an RDB was
+     * received from the master. In the latter case, the master is
+     * responsible for key expiry. If we would expire keys here, the
+     * snapshot taken by the master may not be reflected on the slave. */
+    if (server.masterhost == NULL && expiretime != -1 && expiretime < now) {
+        decrRefCount(key);
+        decrRefCount(val);
+        return C_OK;
+    }
+    /* Add the new object in the hash table */
+    dbAdd(db,key,val);
+
+    /* Set the expire time if needed */
+    if (expiretime != -1) setExpire(db,key,expiretime);
+
+    decrRefCount(key);
+    return C_OK;
+}
+
+/* Load all the key-value records of a chunk payload into 'db'. */
+static int rdbLoadChunkRecords(sds payload, redisDb *db, long long now) {
+    rio chunk;
+
+    rioInitWithBuffer(&chunk,payload);
+    while ((size_t)chunk.io.buffer.pos < sdslen(payload)) {
+        long long expiretime = -1;
+        robj *key;
+        int type;
+
+        if ((type = rdbLoadType(&chunk)) == -1) return C_ERR;
+        if (type == RDB_OPCODE_EXPIRETIME_MS) {
+            if ((expiretime = rdbLoadMillisecondTime(&chunk)) == -1)
+                return C_ERR;
+            if ((type = rdbLoadType(&chunk)) == -1) return C_ERR;
+        }
+        if (!rdbIsObjectType(type))
+            rdbExitReportCorruptRDB("Unknown RDB type %d in chunk",type);
+        if ((key = rdbLoadStringObject(&chunk)) == NULL) return C_ERR;
+        if (rdbLoadKeyValue(&chunk,db,key,type,expiretime,now) == C_ERR)
+            return C_ERR;
+    }
+    return C_OK;
+}
+
+/* Load an RDB from the rio 'rdb' into the DBs. The caller is responsible
+ * for startLoading() / stopLoading().
+ *
+ * Returns C_ERR with errno set to EINVAL if the signature or the version are
+ * not valid. An unexpected EOF is a fatal error when loading a file, but if
+ * 'stream' is true C_ERR is returned instead, as it just means that the
+ * connection we were reading from was lost. Keys already loaded are left in
+ * the DBs in this case.
+ *
+ * A delta snapshot is applied to the DBs as they are, but only if it
+ * follows the RDB (and deltas) loaded last, otherwise C_ERR is returned with
+ * errno set to ESTALE, before modifying the DBs. */
+int rdbLoadRio(rio *rdb, int stream) {
+    uint32_t dbid;
+    int type, rdbver;
+    redisDb *db = server.db+0;
+    char buf[1024];
+    long long expiretime, now = mstime(), deltaseq = 0;
+    rdbParallelLoader *loader = NULL;
+    int threads = server.rdb_load_threads;
+    sds deltabase = NULL;
+
+    rdb->update_cksum = rdbLoadProgressCallback;
+    rdb->max_processing_chunk = server.loading_process_events_interval_bytes;
+    if (rioRead(rdb,buf,9) == 0) goto eoferr;
     buf[9] = '\0';
     if (memcmp(buf,"REDIS",5) != 0) {
-        fclose(fp);
         serverLog(LL_WARNING,"Wrong signature trying to load DB from file");
         errno = EINVAL;
         return C_ERR;
     }
     rdbver = atoi(buf+5);
-    if (rdbver < 1 || rdbver > RDB_VERSION) {
-        fclose(fp);
+    if (rdbver < 1 || rdbver > RDB_EXTENDED_VERSION) {
         serverLog(LL_WARNING,"Can't handle RDB format version %d",rdbver);
         errno = EINVAL;
         return C_ERR;
     }
 
-    startLoading(fp);
     while(1) {
-        robj *key, *val;
+        robj *key;
         expiretime = -1;
 
         /* Read type. */
-        if ((type = rdbLoadType(&rdb)) == -1) goto eoferr;
+        if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
 
         /* Handle special types. */
         if (type == RDB_OPCODE_EXPIRETIME) {
             /* EXPIRETIME: load an expire associated with the next key
              * to load. Note that after loading an expire we need to
              * load the actual type, and continue. */
-            if ((expiretime = rdbLoadTime(&rdb)) == -1) goto eoferr;
+            if ((expiretime = rdbLoadTime(rdb)) == -1) goto eoferr;
             /* We read the time so we need to read the object type again. */
-            if ((type = rdbLoadType(&rdb)) == -1) goto eoferr;
+            if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
             /* the EXPIRETIME opcode specifies time in seconds, so convert
              * into milliseconds. */
             expiretime *= 1000;
         } else if (type == RDB_OPCODE_EXPIRETIME_MS) {
             /* EXPIRETIME_MS: milliseconds precision expire times introduced
              * with RDB v3. Like EXPIRETIME but no with more precision. */
-            if ((expiretime = rdbLoadMillisecondTime(&rdb)) == -1) goto eoferr;
+            if ((expiretime = rdbLoadMillisecondTime(rdb)) == -1) goto eoferr;
             /* We read the time so we need to read the object type again. */
-            if ((type = rdbLoadType(&rdb)) == -1) goto eoferr;
+            if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
         } else if (type == RDB_OPCODE_EOF) {
             /* EOF: End of file, exit the main loop. */
             break;
         } else if (type == RDB_OPCODE_SELECTDB) {
             /* SELECTDB: Select the specified database. */
-            if ((dbid = rdbLoadLen(&rdb,NULL)) == RDB_LENERR)
+            if ((dbid = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
                 goto eoferr;
             if (dbid >= (unsigned)server.dbnum) {
                 serverLog(LL_WARNING,
@@ -1347,13 +3001,66 @@ int rdbLoad(char *filename) {
             /* RESIZEDB: Hint about the size of the keys in the currently
              * selected data base, in order to avoid useless rehashing. */
             uint32_t db_size, expires_size;
-            if ((db_size = rdbLoadLen(&rdb,NULL)) == RDB_LENERR)
+            if ((db_size = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
                 goto eoferr;
-            if ((expires_size = rdbLoadLen(&rdb,NULL)) == RDB_LENERR)
+            if ((expires_size = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
                 goto eoferr;
             dictExpand(db->dict,db_size);
             dictExpand(db->expires,expires_size);
             continue; /* Read type again. */
+        } else if (type == RDB_OPCODE_CHUNK) {
+            /* CHUNK: a block of key-value records of a given DB, saved when
+             * rdb-chunked is enabled. See rdb.h for the details. */
+            rdbStoredChunk chunk;
+            const char *err;
+            sds payload;
+
+            if (rdbReadChunk(rdb,&chunk) == C_ERR) goto eoferr;
+            if (chunk.info.dbid >= (unsigned)server.dbnum) {
+                serverLog(LL_WARNING,
+                    "FATAL: Data file was created with a Redis "
+                    "server configured to handle more than %d "
+                    "databases. Exiting\n", server.dbnum);
+                exit(1);
+            }
+            db = server.db+chunk.info.dbid;
+            /* The threads are only started when the file turns out to be
+             * chunked. */
+            if (threads && loader == NULL &&
+                (loader = rdbCreateParallelLoader(threads,now)) == NULL)
+                threads = 0;
+            if (loader) {
+                if (rdbQueueLoadChunk(loader,db,&chunk) == C_ERR)
+                    goto eoferr;
+                continue; /* Read type again. */
+            }
+            if ((payload = rdbDecodeChunk(&chunk,&err)) == NULL) {
+                rdbChunkError(err);
+                goto eoferr;
+            }
+            if (rdbLoadChunkRecords(payload,db,now) == C_ERR) {
+                sdsfree(payload);
+                goto eoferr;
+            }
+            sdsfree(payload);
+            continue; /* Read type again. */
+        } else if (type == RDB_OPCODE_FLUSHDB) {
+            /* FLUSHDB: the selected DB was flushed, in delta snapshots. */
+            dictEmpty(db->dict,NULL);
+            dictEmpty(db->expires,NULL);
+            if (server.cluster_enabled) slotToKeyFlush();
+            continue; /* Read type again. */
+        } else if (type == RDB_OPCODE_DELKEY) {
+            /* DELKEY: a key deleted, in delta snapshots. */
+            if ((key = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
+            dbDelete(db,key);
+            decrRefCount(key);
+            continue; /* Read type again. */
+        } else if (type == RDB_OPCODE_CHUNK_INDEX) {
+            /* CHUNK_INDEX: the index of the chunks, only useful to access
+             * them randomly. */
+            if (rdbLoadChunkIndex(rdb,NULL,NULL) == -1) goto eoferr;
+            continue; /* Read type again. */
         } else if (type == RDB_OPCODE_AUX) {
             /* AUX: generic string-string fields. Use to add state to RDB
              * which is backward compatible. Implementations of RDB loading
@@ -1361,10 +3068,35 @@ int rdbLoad(char *filename) {
              *
              * An AUX field is composed of two strings: key and value. */
             robj *auxkey, *auxval;
-            if ((auxkey = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
-            if ((auxval = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
-
-            if (((char*)auxkey->ptr)[0] == '%') {
+            if ((auxkey = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
+            if ((auxval = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
+
+            if (!strcasecmp(auxkey->ptr,"delta-base")) {
+                /* Id of the full RDB, or the one a delta is chained to. */
+                sdsfree(deltabase);
+                deltabase = sdsnew(auxval->ptr);
+            } else if (!strcasecmp(auxkey->ptr,"delta-seq")) {
+                /* A delta snapshot: it can only be applied to the RDB it
+                 * is chained to, after the previous delta. */
+                if (getLongLongFromObject(auxval,&deltaseq) == C_ERR ||
+                    stream || deltabase == NULL ||
+                    strcmp(deltabase,server.rdb_delta_base) != 0 ||
+                    deltaseq != server.rdb_delta_seq+1)
+                {
+                    decrRefCount(auxkey);
+                    decrRefCount(auxval);
+                    sdsfree(deltabase);
+                    if (loader) rdbAbortParallelLoad(loader);
+                    errno = ESTALE;
+                    return C_ERR;
+                }
+                /* Keys are replaced, so they are loaded in order. */
+                threads = 0;
+                if (loader) {
+                    rdbAbortParallelLoad(loader);
+                    loader = NULL;
+                }
+            } else if (((char*)auxkey->ptr)[0] == '%') {
                 /* All the fields with a name staring with '%' are considered
                  * information fields and are logged at startup with a log
                  * level of NOTICE. */
@@ -1383,35 +3115,33 @@ int rdbLoad(char *filename) {
             continue; /* Read type again. */
         }
 
-        /* Read key */
-        if ((key = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
-        /* Read value */
-        if ((val = rdbLoadObject(type,&rdb)) == NULL) goto eoferr;
-        /* Check if the key already expired. This function is used when loading
-         * an RDB file from disk, either at startup, or when an RDB was
-         * received from the master. In the latter case, the master is
-         * responsible for key expiry. If we would expire keys here, the
-         * snapshot taken by the master may not be reflected on the slave. */
-        if (server.masterhost == NULL && expiretime != -1 && expiretime < now) {
+        /* Read key and value */
+        if ((key = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
+        if (deltaseq) dbDelete(db,key);
+        /* Keys outside chunks are loaded in order after the chunks before
+         * them. */
+        if (loader && rdbDrainParallelLoad(loader) == C_ERR) {
             decrRefCount(key);
-            decrRefCount(val);
-            continue;
+            goto eoferr;
         }
-        /* Add the new object in the hash table */
-        dbAdd(db,key,val);
-
-        /* Set the expire time if needed */
-        if (expiretime != -1) setExpire(db,key,expiretime);
-
-        decrRefCount(key);
+        if (rdbLoadKeyValue(rdb,db,key,type,expiretime,now) == C_ERR)
+            goto eoferr;
     }
-    /* Verify the checksum if RDB version is >= 5 */
-    if (rdbver >= 5 && server.rdb_checksum) {
-        uint64_t cksum, expected = rdb.cksum;
+    if (loader) {
+        if (rdbFinishParallelLoad(loader) == C_ERR) goto eoferr;
+        loader = NULL; /* Released, don't abort it on a short read below. */
+    }
+    /* Verify the checksum if RDB version is >= 5. The checksum is consumed
+     * even if we don't verify it, so that when loading from a stream we
+     * stop exactly at the end of the payload. */
+    if (rdbver >= 5) {
+        uint64_t cksum, expected = rdb->cksum;
 
-        if (rioRead(&rdb,&cksum,8) == 0) goto eoferr;
+        if (rioRead(rdb,&cksum,8) == 0) goto eoferr;
         memrev64ifbe(&cksum);
-        if (cksum == 0) {
+        if (!server.rdb_checksum) {
+            /* Checksum verification disabled. */
+        } else if (cksum == 0) {
             serverLog(LL_WARNING,"RDB file was saved with checksum disabled: no check performed.");
         } else if (cksum != expected) {
             serverLog(LL_WARNING,"Wrong RDB checksum. Aborting now.");
@@ -1419,16 +3149,38 @@ int rdbLoad(char *filename) {
         }
     }
 
-    fclose(fp);
-    stopLoading();
+    /* What is on disk matches the dataset only if loaded from a file. */
+    rdbDeltaReset(stream ? NULL : deltabase,deltaseq);
+    sdsfree(deltabase);
     return C_OK;
 
 eoferr: /* unexpected end of file is handled here with a fatal exit */
+    sdsfree(deltabase);
+    if (stream) {
+        serverLog(LL_WARNING,"Short read or OOM loading DB from the stream.");
+        if (loader) rdbAbortParallelLoad(loader);
+        return C_ERR;
+    }
     serverLog(LL_WARNING,"Short read or OOM loading DB. Unrecoverable error, aborting now.");
     rdbExitReportCorruptRDB("Unexpected EOF reading RDB file");
     return C_ERR; /* Just to avoid warning */
 }
 
+int rdbLoad(char *filename) {
+    FILE *fp;
+    rio rdb;
+    int retval;
+
+    if ((fp = fopen(filename,"r")) == NULL) return C_ERR;
+    rioInitWithFile(&rdb,fp);
+    startLoading(fp);
+    retval = rdbLoadRio(&rdb,0);
+    fclose(fp);
+    stopLoading();
+    return retval;
+}
+
+
 /* A background saving child (BGSAVE) terminated its work. Handle this.
  * This function covers the case of actual BGSAVEs. */
 void backgroundSaveDoneHandlerDisk(int exitcode, int bysignal) {
@@ -1459,6 +3211,7 @@ void backgroundSaveDoneHandlerDisk(int exitcode, int bysignal) {
     server.rdb_child_type = RDB_CHILD_TYPE_NONE;
     server.rdb_save_time_last = time(NULL)-server.rdb_save_time_start;
     server.rdb_save_time_start = -1;
+    rdbDeltaSaveDone(!bysignal && exitcode == 0);
     /* Possibly there are slaves waiting for a BGSAVE in order to be served
      * (the first stage of SYNC is a bulk transfer of dump.rdb) */
     updateSlavesWaitingBgsave((!bysignal && exitcode == 0) ? C_OK : C_ERR, RDB_CHILD_TYPE_DISK);
@@ -1586,7 +3339,8 @@ int rdbSaveToSlavesSockets(void) {
     long long start;
     int pipefds[2];
 
-    if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
+    if (server.aof_child_pid != -1 || server.rdb_child_pid != -1 ||
+        server.rdb_forkless) return C_ERR;
 
     /* Before to fork, create a pipe that will be used in order to
      * send back to the parent the IDs of the slaves that successfully
@@ -1621,6 +3375,7 @@ int rdbSaveToSlavesSockets(void) {
     }
 
     /* Create the child process. */
+    openChildInfoPipe();
     start = ustime();
     if ((childpid = fork()) == 0) {
         /* Child */
@@ -1646,6 +3401,9 @@ int rdbSaveToSlavesSockets(void) {
                     private_dirty/(1024*1024));
             }
 
+            server.child_info_data.cow_size = private_dirty;
+            sendChildInfo(CHILD_INFO_TYPE_RDB);
+
             /* If we are returning OK, at least one slave was served
              * with the RDB file as expected, so we need to send a report
              * to the parent via the pipe. The format of the message is:
@@ -1691,6 +3449,7 @@ int rdbSaveToSlavesSockets(void) {
     } else {
         /* Parent */
         if (childpid == -1) {
+            closeChildInfoPipe();
             serverLog(LL_WARNING,"Can't save in background: fork: %s",
                 strerror(errno));
 
@@ -1731,7 +3490,7 @@ int rdbSaveToSlavesSockets(void) {
 }
 
 void saveCommand(client *c) {
-    if (server.rdb_child_pid != -1) {
+    if (server.rdb_child_pid != -1 || server.rdb_forkless) {
         addReplyError(c,"Background save already in progress");
         return;
     }
@@ -1757,7 +3516,7 @@ void bgsaveCommand(client *c) {
         }
     }
 
-    if (server.rdb_child_pid != -1) {
+    if (server.rdb_child_pid != -1 || server.rdb_forkless) {
         addReplyError(c,"Background save already in progress");
     } else if (server.aof_child_pid != -1) {
         if (schedule) {
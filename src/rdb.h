@@ -40,6 +40,18 @@
  * backward compatible this number gets incremented. */
 #define RDB_VERSION 7
 
+/* Version used by RDB files and DUMP payloads that older versions of Redis
+ * can't read, because they are written in chunks (see rdb-chunked), use
+ * a codec other than LZF (see rdb-compression-codec) or save the lists
+ * with RDB_TYPE_LIST_QUICKLIST_NODES (see rdb-list-compressed-nodes), so
+ * that older versions refuse to load them.
+ *
+ * Note that upstream Redis 4.0 and newer use version 8, the object type
+ * RDB_TYPE_LIST_QUICKLIST_NODES and the opcodes from RDB_OPCODE_DELKEY to
+ * RDB_OPCODE_CHUNK for different things, so they may accept these files
+ * and misread them. The incompatibility is documented in redis.conf. */
+#define RDB_EXTENDED_VERSION 8
+
 /* Defines related to the dump file format. To store 32 bits lengths for short
  * keys requires a lot of space, so we check the most significant 2 bits of
  * the first byte to interpreter the length:
@@ -66,6 +78,7 @@
 #define RDB_ENC_INT16 1       /* 16 bit signed integer */
 #define RDB_ENC_INT32 2       /* 32 bit signed integer */
 #define RDB_ENC_LZF 3         /* string compressed with FASTLZ */
+#define RDB_ENC_LZ4 4         /* string compressed with LZ4 */
 
 /* Dup object types to RDB object types. Only reason is readability (are we
  * dealing with RDB types or with in-memory object types?). */
@@ -83,12 +96,34 @@
 #define RDB_TYPE_ZSET_ZIPLIST  12
 #define RDB_TYPE_HASH_ZIPLIST  13
 #define RDB_TYPE_LIST_QUICKLIST 14
+#define RDB_TYPE_LIST_QUICKLIST_NODES 15
 /* NOTE: WHEN ADDING NEW RDB TYPE, UPDATE rdbIsObjectType() BELOW */
 
 /* Test if a type is an object type. */
-#define rdbIsObjectType(t) ((t >= 0 && t <= 4) || (t >= 9 && t <= 14))
+#define rdbIsObjectType(t) ((t >= 0 && t <= 4) || (t >= 9 && t <= 15))
+
+/* A list saved as RDB_TYPE_LIST_QUICKLIST_NODES is stored as the number of
+ * quicklist nodes followed, for every node, by:
+ *
+ * <count><sz><lzf-len><lzf-data>   (compressed node)
+ * <count><0><ziplist>              (uncompressed node)
+ *
+ * All the fields are lengths, but 'lzf-data', the raw LZF compressed form
+ * of the ziplist exactly as the quicklist keeps it in memory, and the
+ * 'ziplist' string. 'count' is the number of entries in the node and 'sz'
+ * the size of the uncompressed ziplist. Compressed nodes are so saved
+ * without being decompressed, and loaded without being compressed again.
+ * On load they are decompressed once to be validated, since they may come
+ * from RESTORE or from the master. The compress depth used when saving is
+ * not stored: the form of every node already tells which ones are
+ * compressed, and on load only the nodes that don't match the current
+ * list-compress-depth are converted. */
 
 /* Special RDB opcodes (saved/loaded with rdbSaveType/rdbLoadType). */
+#define RDB_OPCODE_FLUSHDB    246
+#define RDB_OPCODE_DELKEY     247
+#define RDB_OPCODE_CHUNK_INDEX 248
+#define RDB_OPCODE_CHUNK      249
 #define RDB_OPCODE_AUX        250
 #define RDB_OPCODE_RESIZEDB   251
 #define RDB_OPCODE_EXPIRETIME_MS 252
@@ -96,6 +131,59 @@
 #define RDB_OPCODE_SELECTDB   254
 #define RDB_OPCODE_EOF        255
 
+/* Uncompressed size after which a chunk is closed when saving in chunks. */
+#define RDB_CHUNK_SIZE (1024*1024)
+/* Max ratio between the uncompressed and the compressed size of a payload:
+ * no codec expands its input more than that. Larger ratios in a chunk or a
+ * quicklist node header mean it is corrupted. */
+#define RDB_CODEC_MAX_EXPANSION 256
+
+/* In a chunked RDB file the keys of every DB are stored in a sequence of
+ * chunks, each one holding the usual key-value records, compressed as a
+ * whole. A chunk is stored after the RDB_OPCODE_CHUNK opcode as:
+ *
+ * <dbid><keys><minslot><maxslot><enc><len><clen><crc><payload>
+ *
+ * Where the first five fields are lengths, 'enc' being the RDB_ENC_* type
+ * of the codec used to compress the payload, while 'len' (the uncompressed
+ * payload size), 'clen' (the stored payload size, or 0 if the payload is
+ * not compressed) and 'crc' (the CRC64 of the stored payload) are 64 bit
+ * little endian integers. Before the EOF opcode the RDB_OPCODE_CHUNK_INDEX
+ * opcode introduces the index of the chunks:
+ *
+ * <count> count*[<offset><crc><dbid><keys><minslot><maxslot>] <index-offset>
+ *
+ * Where 'offset' is the offset of the chunk opcode from the start of the
+ * file. The final 64 bit 'index-offset' is the offset of the index opcode,
+ * so that the index can be found at a fixed distance from the end of the
+ * file, before the EOF opcode and the checksum, without reading the rest
+ * of the file. */
+/* A delta snapshot, written by BGSAVE when rdb-delta-snapshots is enabled,
+ * is an RDB file named "<dbfilename>.delta.<seq>" holding only the keys
+ * modified since the previous snapshot. Its AUX fields "delta-base" and
+ * "delta-seq" chain it to the full RDB (saved with the same "delta-base"
+ * AUX field) and to the delta 'seq'-1. For every DB touched the
+ * RDB_OPCODE_SELECTDB opcode is followed by RDB_OPCODE_FLUSHDB if the DB was
+ * flushed, then by the usual key-value records of the keys that exist, and
+ * by RDB_OPCODE_DELKEY <key> for the keys that were deleted. */
+typedef struct rdbDeltaTracker {
+    dict **keys;        /* Keys modified since the last snapshot, per DB. */
+    int *flushed;       /* DBs flushed since the last snapshot. */
+} rdbDeltaTracker;
+
+typedef struct rdbChunkInfo {
+    uint64_t offset;    /* Offset of the chunk from the start of the file. */
+    uint64_t crc;       /* CRC64 of the stored payload. */
+    uint32_t dbid;      /* DB of the keys in the chunk. */
+    uint32_t keys;      /* Number of keys in the chunk. */
+    uint32_t minslot;   /* Hash slots range of the keys in the chunk. */
+    uint32_t maxslot;
+} rdbChunkInfo;
+
+/* Flags of rdbSaveRio(). */
+#define RDB_SAVE_NONE 0
+#define RDB_SAVE_AOF_PREAMBLE (1<<0)
+
 int rdbSaveType(rio *rdb, unsigned char type);
 int rdbLoadType(rio *rdb);
 int rdbSaveTime(rio *rdb, time_t t);
@@ -105,15 +193,32 @@ uint32_t rdbLoadLen(rio *rdb, int *isencoded);
 int rdbSaveObjectType(rio *rdb, robj *o);
 int rdbLoadObjectType(rio *rdb);
 int rdbLoad(char *filename);
+int rdbLoadRio(rio *rdb, int stream);
 int rdbSaveBackground(char *filename);
 int rdbSaveToSlavesSockets(void);
 void rdbRemoveTempFile(pid_t childpid);
 int rdbSave(char *filename);
+int rdbSaveRio(rio *rdb, int *error, int flags);
 ssize_t rdbSaveObject(rio *rdb, robj *o);
 size_t rdbSavedObjectLen(robj *o);
 robj *rdbLoadObject(int type, rio *rdb);
 void backgroundSaveDoneHandler(int exitcode, int bysignal);
 int rdbSaveKeyValuePair(rio *rdb, robj *key, robj *val, long long expiretime, long long now);
 robj *rdbLoadStringObject(rio *rdb);
+int rdbVersionToSave(int chunked);
+sds rdbLoadChunk(rio *rdb, rdbChunkInfo *info);
+int rdbLoadChunkIndex(rio *rdb, rdbChunkInfo **index, uint32_t *count);
+int rdbReadChunkIndexFromFile(FILE *fp, rdbChunkInfo **index, uint32_t *count);
+void rdbForklessCron(void);
+void rdbForklessBeforeWrite(redisDb *db, robj *key);
+void rdbForklessFlushDb(int dbid);
+int rdbForklessAdoptDb(int dbid, dict *d, dict *expires);
+void rdbForklessAbort(void);
+void rdbDeltaEnable(void);
+void rdbDeltaDisable(void);
+void rdbDeltaTrackKey(redisDb *db, robj *key);
+void rdbDeltaTrackFlush(int dbid);
+long long rdbDeltaTrackedKeys(void);
+void rdbDeltaLoadChain(void);
 
 #endif
@@ -33,18 +33,36 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include "config.h"
+#include "aofbin.h"
 
 #define ERROR(...) { \
-    char __buf[1024]; \
-    sprintf(__buf, __VA_ARGS__); \
-    sprintf(error, "0x%16llx: %s", (long long)epos, __buf); \
+    char __buf[512]; \
+    snprintf(__buf, sizeof(__buf), __VA_ARGS__); \
+    snprintf(error, sizeof(error), "0x%16llx: %s", (long long)epos, __buf); \
 }
 
 static char error[1024];
 static off_t epos;
 
+/* With --truncate-to-timestamp the AOF is checked up to the first timestamp
+ * annotation after 'truncate_to'. */
+static long long truncate_to = -1;
+static int truncate_reached = 0;
+
+/* Output of --convert: the commands checked are written again as RESP or as
+ * binary blocks. */
+typedef struct converter {
+    FILE *fp;
+    int binary;
+    unsigned char *block;   /* Room for a header, then the pending records. */
+    size_t len;             /* Length of the pending records. */
+    size_t size;            /* Room for records in 'block'. */
+} converter;
+
 int consumeNewline(char *buf) {
     if (strncmp(buf,"\r\n",2) != 0) {
         ERROR("Expected \\r\\n, got: %02x%02x",buf[0],buf[1]);
@@ -78,12 +96,13 @@ int readBytes(FILE *fp, char *target, long length) {
     return 1;
 }
 
-int readString(FILE *fp, char** target) {
+int readString(FILE *fp, char** target, long *length) {
     long len;
     *target = NULL;
     if (!readLong(fp,'$',&len)) {
         return 0;
     }
+    *length = len;
 
     /* Increase length to also consume \r\n */
     len += 2;
@@ -102,42 +121,261 @@ int readArgc(FILE *fp, long *target) {
     return readLong(fp,'*',target);
 }
 
-off_t process(FILE *fp) {
-    long argc;
+/* Track MULTI/EXEC given the name of the next command. Returns 0 if the
+ * command is not expected. */
+int checkMulti(const char *name, size_t len, int *multi) {
+    if (len == 5 && strncasecmp(name,"multi",5) == 0) {
+        if ((*multi)++) {
+            ERROR("Unexpected MULTI");
+            return 0;
+        }
+    } else if (len == 4 && strncasecmp(name,"exec",4) == 0) {
+        if (--(*multi)) {
+            ERROR("Unexpected EXEC");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Write the pending binary records as a block. */
+void convertFlushBlock(converter *conv) {
+    unsigned char *tmp;
+    size_t len;
+
+    if (conv->len == 0) return;
+    tmp = malloc(conv->len);
+    len = aofBinSealBlock(conv->block,conv->len,AOF_BIN_CODEC_LZF,tmp);
+    fwrite(conv->block,len,1,conv->fp);
+    free(tmp);
+    conv->len = 0;
+}
+
+/* Write a command to the output of --convert. */
+void convertCommand(converter *conv, long argc, const char **argv,
+                    size_t *lens)
+{
+    unsigned char *p;
+    size_t reclen = AOF_BIN_VARINT_MAX_LEN;
+    long j;
+    int id;
+
+    for (j = 0; j < argc; j++) reclen += AOF_BIN_VARINT_MAX_LEN+lens[j];
+
+    /* Commands too big for a block are written as RESP, like the server
+     * does. */
+    if (!conv->binary || reclen >= AOF_BIN_MAX_PAYLOAD/4) {
+        convertFlushBlock(conv);
+        fprintf(conv->fp,"*%ld\r\n",argc);
+        for (j = 0; j < argc; j++) {
+            fprintf(conv->fp,"$%zu\r\n",lens[j]);
+            fwrite(argv[j],lens[j],1,conv->fp);
+            fwrite("\r\n",2,1,conv->fp);
+        }
+        return;
+    }
+
+    if (conv->len+reclen > conv->size) {
+        conv->size = conv->len+reclen;
+        if (conv->size < AOF_BIN_BLOCK_LEN) conv->size = AOF_BIN_BLOCK_LEN;
+        conv->block = realloc(conv->block,AOF_BIN_HDR_LEN+conv->size);
+    }
+    p = conv->block+AOF_BIN_HDR_LEN+conv->len;
+    p += aofBinEncodeVarint(p,argc);
+    id = aofBinCommandId(argv[0],lens[0]);
+    p += aofBinEncodeVarint(p,id);
+    for (j = id ? 1 : 0; j < argc; j++) {
+        p += aofBinEncodeVarint(p,lens[j]);
+        memcpy(p,argv[j],lens[j]);
+        p += lens[j];
+    }
+    conv->len = p-(conv->block+AOF_BIN_HDR_LEN);
+    if (conv->len >= AOF_BIN_BLOCK_LEN) convertFlushBlock(conv);
+}
+
+/* Write an annotation line to the output of --convert. */
+void convertAnnotation(converter *conv, const char *line, size_t len) {
+    convertFlushBlock(conv);
+    fwrite(line,len,1,conv->fp);
+}
+
+/* Check the annotation whose '#' was just read. Returns 0 if it is not
+ * valid, or if it is a timestamp after the one of --truncate-to-timestamp. */
+int processAnnotation(FILE *fp, converter *conv) {
+    char buf[128], *eptr;
+    size_t len;
+    long long ts;
+
+    epos = ftello(fp)-1;
+    buf[0] = '#';
+    if (fgets(buf+1,sizeof(buf)-1,fp) == NULL) {
+        ERROR("Expected an annotation");
+        return 0;
+    }
+    len = strlen(buf);
+    if (buf[len-1] != '\n') {
+        ERROR("Expected \\n at the end of the annotation");
+        return 0;
+    }
+    if (strncmp(buf,"#TS:",4) == 0) {
+        ts = strtoll(buf+4,&eptr,10);
+        if (eptr == buf+4 || !consumeNewline(eptr)) return 0;
+        if (truncate_to != -1 && ts > truncate_to) {
+            truncate_reached = 1;
+            return 0;
+        }
+    }
+    if (conv) convertAnnotation(conv,buf,len);
+    return 1;
+}
+
+/* Check the binary block whose marker was just read, in a file of 'size'
+ * bytes. Returns 0 if the block is not valid. */
+int processBinaryBlock(FILE *fp, off_t size, int *multi, converter *conv) {
+    unsigned char hdr[AOF_BIN_HDR_LEN], *payload, *records = NULL;
+    const unsigned char *p, *end;
+    const char **argv = NULL;
+    size_t *lens = NULL;
+    aofBinHeader h;
+    int valid = 0;
+
+    epos = ftello(fp)-1;
+    hdr[0] = AOF_BIN_MARKER;
+    if (fread(hdr+1,AOF_BIN_HDR_LEN-1,1,fp) == 0) {
+        ERROR("Expected a binary block header");
+        return 0;
+    }
+    if (!aofBinParseHeader(hdr,&h)) {
+        ERROR("Invalid binary block header");
+        return 0;
+    }
+    if ((off_t)h.len > size-ftello(fp)) {
+        ERROR("Expected to read %lu bytes of binary block, got %lld bytes",
+            (unsigned long)h.len,(long long)(size-ftello(fp)));
+        return 0;
+    }
+
+    payload = malloc(h.len+1);
+    if (fread(payload,1,h.len,fp) != h.len) {
+        ERROR("Failed to read %lu bytes of binary block",
+            (unsigned long)h.len);
+        goto cleanup;
+    }
+    if (!aofBinCheckPayload(hdr,payload)) {
+        ERROR("Bad CRC64 of binary block");
+        goto cleanup;
+    }
+    records = malloc(h.rawlen+1);
+    if (!aofBinDecodePayload(hdr,payload,records)) {
+        ERROR("Failed to decompress binary block");
+        goto cleanup;
+    }
+
+    p = records;
+    end = records+h.rawlen;
+    while (p < end) {
+        long argc, j;
+
+        if (!aofBinReadArgc(&p,end,&argc)) {
+            ERROR("Invalid binary record at offset %ld of the block",
+                (long)(p-records));
+            goto cleanup;
+        }
+        if (conv) {
+            argv = malloc(sizeof(char*)*argc);
+            lens = malloc(sizeof(size_t)*argc);
+        }
+        for (j = 0; j < argc; j++) {
+            const char *arg;
+            size_t len;
+
+            if (!aofBinReadArg(&p,end,j == 0,&arg,&len)) {
+                ERROR("Invalid binary record at offset %ld of the block",
+                    (long)(p-records));
+                goto cleanup;
+            }
+            if (j == 0 && !checkMulti(arg,len,multi)) goto cleanup;
+            if (conv) {
+                argv[j] = arg;
+                lens[j] = len;
+            }
+        }
+        if (conv) {
+            convertCommand(conv,argc,argv,lens);
+            free(argv);
+            free(lens);
+            argv = NULL;
+            lens = NULL;
+        }
+    }
+    valid = 1;
+
+cleanup:
+    free(argv);
+    free(lens);
+    free(records);
+    free(payload);
+    return valid;
+}
+
+/* Check the AOF of 'size' bytes, writing its commands to 'conv' if not
+ * NULL. Returns the offset up to which the AOF is valid. */
+off_t process(FILE *fp, off_t size, converter *conv) {
+    long argc, len;
     off_t pos = 0;
-    int i, multi = 0;
-    char *str;
+    int c, i, multi = 0;
+    char *str, **argv = NULL;
+    size_t *lens = NULL;
 
     while(1) {
         if (!multi) pos = ftello(fp);
+        if ((c = getc(fp)) == AOF_BIN_MARKER) {
+            if (!processBinaryBlock(fp,size,&multi,conv)) break;
+            continue;
+        }
+        if (c == '#') {
+            if (!processAnnotation(fp,conv)) break;
+            continue;
+        }
+        if (c != EOF) ungetc(c,fp);
         if (!readArgc(fp, &argc)) break;
 
+        if (conv && argc > 0) {
+            argv = calloc(argc,sizeof(char*));
+            lens = malloc(sizeof(size_t)*argc);
+        }
         for (i = 0; i < argc; i++) {
-            if (!readString(fp,&str)) break;
-            if (i == 0) {
-                if (strcasecmp(str, "multi") == 0) {
-                    if (multi++) {
-                        ERROR("Unexpected MULTI");
-                        break;
-                    }
-                } else if (strcasecmp(str, "exec") == 0) {
-                    if (--multi) {
-                        ERROR("Unexpected EXEC");
-                        break;
-                    }
-                }
+            if (!readString(fp,&str,&len)) break;
+            if (i == 0 && !checkMulti(str,len,&multi)) break;
+            if (conv) {
+                argv[i] = str;
+                lens[i] = len;
+            } else {
+                free(str);
             }
-            free(str);
         }
 
         /* Stop if the loop did not finish */
         if (i < argc) {
             if (str) free(str);
+            if (argv) {
+                while (i--) free(argv[i]);
+                free(argv);
+                free(lens);
+            }
             break;
         }
+        if (argv) {
+            convertCommand(conv,argc,(const char**)argv,lens);
+            while (i--) free(argv[i]);
+            free(argv);
+            free(lens);
+            argv = NULL;
+            lens = NULL;
+        }
     }
 
-    if (feof(fp) && multi && strlen(error) == 0) {
+    if (!truncate_reached && feof(fp) && multi && strlen(error) == 0) {
         ERROR("Reached EOF before reading EXEC for MULTI");
     }
     if (strlen(error) > 0) {
@@ -146,15 +384,537 @@ off_t process(FILE *fp) {
     return pos;
 }
 
+/* ----------------------------------------------------------------------------
+ * Parallel scan (--scan and --salvage)
+ *
+ * The AOF is mapped in memory and split in chunks checked by different
+ * threads. Every thread starts at the first offset of its chunk where the
+ * commands can be parsed, and stops at the first command boundary after the
+ * end of the chunk. Instead of stopping at the first error, the corrupt range
+ * is recorded and the scan resynchronizes at the next offset where commands
+ * can be parsed again, so all the corrupt ranges are reported, and the valid
+ * commands after them can be salvaged.
+ *
+ * The offset where a thread started may not be a real command boundary, for
+ * instance if it is in the middle of a value that looks like a command. So
+ * the chunks are merged in order, trusting a chunk only from one of the
+ * boundaries its thread recorded where the previous chunk stopped. Otherwise
+ * the chunk is scanned again from there: the result is always the same of a
+ * sequential scan.
+ * ------------------------------------------------------------------------- */
+
+#define SCAN_MAX_THREADS 64
+#define SCAN_MIN_CHUNK (1024*1024)  /* Smaller chunks are not worth a thread. */
+#define SCAN_BOUNDARIES 64          /* Boundaries recorded at chunk start. */
+#define SCAN_ERR_LEN 128
+
+typedef struct scanRange {
+    off_t start, end;
+    /* Set for an EXEC without MULTI found after a resync: the commands since
+     * the previous corrupt range are the tail of a broken transaction, so the
+     * two ranges are merged. */
+    int extend;
+    char error[SCAN_ERR_LEN];
+} scanRange;
+
+typedef struct scanChunk {
+    off_t start, limit;     /* The chunk is [start,limit). */
+    off_t end;              /* Where the scan stopped, a boundary >= limit. */
+    int resynced;           /* No MULTI/EXEC since the last resync at 'end'. */
+    /* The first boundaries met, with the 'resynced' state there. */
+    off_t boundaries[SCAN_BOUNDARIES];
+    int boundaries_resynced[SCAN_BOUNDARIES];
+    int numboundaries;
+    scanRange *ranges;
+    int numranges;
+    unsigned char *records; /* Decompressed binary block. */
+    size_t records_size;
+    long long seldb;        /* DB of the last SELECT scanned, -1 if none. */
+    int unselected;         /* Commands scanned before any SELECT. */
+    pthread_t thread;
+} scanChunk;
+
+static const unsigned char *scan_data;
+static off_t scan_size;
+
+static void scanAddRange(scanChunk *c, off_t start, off_t end, int extend,
+                         const char *error)
+{
+    scanRange *r;
+
+    c->ranges = realloc(c->ranges,sizeof(scanRange)*(c->numranges+1));
+    r = c->ranges+c->numranges++;
+    r->start = start;
+    r->end = end;
+    r->extend = extend;
+    snprintf(r->error,sizeof(r->error),"%s",error);
+}
+
+/* Parse "<prefix><number>\r\n" at '*pos'. */
+static int scanLong(off_t *pos, char prefix, long long *value, char *err) {
+    const unsigned char *p = scan_data+*pos, *end = scan_data+scan_size;
+    long long v = 0;
+    int digits = 0, neg = 0;
+
+    if (p == end || *p != prefix) {
+        snprintf(err,SCAN_ERR_LEN,"Expected prefix '%c'",prefix);
+        return 0;
+    }
+    p++;
+    if (p < end && *p == '-') {
+        neg = 1;
+        p++;
+    }
+    while (p < end && *p >= '0' && *p <= '9' && digits < 18) {
+        v = v*10+(*p++-'0');
+        digits++;
+    }
+    if (!digits || end-p < 2 || p[0] != '\r' || p[1] != '\n') {
+        snprintf(err,SCAN_ERR_LEN,"Expected a number and \\r\\n");
+        return 0;
+    }
+    *value = neg ? -v : v;
+    *pos = p+2-scan_data;
+    return 1;
+}
+
+/* Track MULTI/EXEC like checkMulti(). 'orphan' is set for an EXEC without
+ * MULTI, 'tokens' for every MULTI or EXEC. */
+static int scanMulti(const char *name, size_t len, int *multi, int *tokens,
+                     int *orphan, char *err)
+{
+    if (len == 5 && strncasecmp(name,"multi",5) == 0) {
+        *tokens = 1;
+        if ((*multi)++) {
+            snprintf(err,SCAN_ERR_LEN,"Unexpected MULTI");
+            return 0;
+        }
+    } else if (len == 4 && strncasecmp(name,"exec",4) == 0) {
+        *tokens = 1;
+        if (--(*multi)) {
+            *orphan = 1;
+            snprintf(err,SCAN_ERR_LEN,"Unexpected EXEC");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Track the SELECT commands: 'j' is the index of the argument 'arg', and
+ * 'select' is set when the command is a SELECT. */
+static void scanSelect(scanChunk *c, long j, const char *arg, size_t len,
+                       int *select)
+{
+    char buf[32];
+
+    if (j == 0) {
+        *select = len == 6 && strncasecmp(arg,"select",6) == 0;
+        if (!*select && c->seldb == -1) c->unselected++;
+    } else if (j == 1 && *select && len < sizeof(buf)) {
+        memcpy(buf,arg,len);
+        buf[len] = '\0';
+        c->seldb = strtoll(buf,NULL,10);
+    }
+}
+
+static off_t scanBinaryBlock(scanChunk *c, off_t pos, int *multi, int *tokens,
+                             int *orphan, char *err)
+{
+    const unsigned char *hdr = scan_data+pos, *p, *end;
+    aofBinHeader h;
+
+    if (scan_size-pos < AOF_BIN_HDR_LEN) {
+        snprintf(err,SCAN_ERR_LEN,"Expected a binary block header");
+        return -1;
+    }
+    if (!aofBinParseHeader(hdr,&h)) {
+        snprintf(err,SCAN_ERR_LEN,"Invalid binary block header");
+        return -1;
+    }
+    if ((off_t)h.len > scan_size-pos-AOF_BIN_HDR_LEN) {
+        snprintf(err,SCAN_ERR_LEN,
+            "Expected to read %lu bytes of binary block, got %lld bytes",
+            (unsigned long)h.len,
+            (long long)(scan_size-pos-AOF_BIN_HDR_LEN));
+        return -1;
+    }
+    if (!aofBinCheckPayload(hdr,hdr+AOF_BIN_HDR_LEN)) {
+        snprintf(err,SCAN_ERR_LEN,"Bad CRC64 of binary block");
+        return -1;
+    }
+    if (c->records_size < (size_t)h.rawlen+1) {
+        c->records_size = (size_t)h.rawlen+1;
+        c->records = realloc(c->records,c->records_size);
+    }
+    if (!aofBinDecodePayload(hdr,hdr+AOF_BIN_HDR_LEN,c->records)) {
+        snprintf(err,SCAN_ERR_LEN,"Failed to decompress binary block");
+        return -1;
+    }
+
+    p = c->records;
+    end = c->records+h.rawlen;
+    while (p < end) {
+        long argc, j;
+        int select = 0;
+
+        if (!aofBinReadArgc(&p,end,&argc)) goto badrecord;
+        for (j = 0; j < argc; j++) {
+            const char *arg;
+            size_t len;
+
+            if (!aofBinReadArg(&p,end,j == 0,&arg,&len)) goto badrecord;
+            if (j == 0 && !scanMulti(arg,len,multi,tokens,orphan,err))
+                return -1;
+            scanSelect(c,j,arg,len,&select);
+        }
+    }
+    return pos+AOF_BIN_HDR_LEN+h.len;
+
+badrecord:
+    snprintf(err,SCAN_ERR_LEN,
+        "Invalid binary record at offset %ld of the block",
+        (long)(p-c->records));
+    return -1;
+}
+
+static off_t scanAnnotation(off_t pos, char *err) {
+    const unsigned char *p = scan_data+pos, *nl, *q;
+    size_t max = scan_size-pos < 127 ? scan_size-pos : 127;
+
+    /* Annotations are written by the server as text lines: checking it
+     * makes random bytes much less likely to look like one on resync. */
+    if ((nl = memchr(p,'\n',max)) == NULL || nl-p < 2 || nl[-1] != '\r') {
+        snprintf(err,SCAN_ERR_LEN,
+            "Expected \\r\\n at the end of the annotation");
+        return -1;
+    }
+    for (q = p+1; q < nl-1; q++) {
+        if (*q < 0x20 || *q > 0x7e) {
+            snprintf(err,SCAN_ERR_LEN,"Invalid character in the annotation");
+            return -1;
+        }
+    }
+    if (nl-p >= 4 && memcmp(p,"#TS:",4) == 0) {
+        const unsigned char *d = p+4;
+
+        while (d < nl && *d >= '0' && *d <= '9') d++;
+        if (d == p+4 || d+1 != nl || *d != '\r') {
+            snprintf(err,SCAN_ERR_LEN,"Invalid timestamp annotation");
+            return -1;
+        }
+    }
+    return nl+1-scan_data;
+}
+
+/* Check the command, binary block or annotation at 'pos'. Returns the offset
+ * after it, or -1 if it is not valid, with the reason in 'err'. */
+static off_t scanUnit(scanChunk *c, off_t pos, int *multi, int *tokens,
+                      int *orphan, char *err)
+{
+    long long argc, len, j;
+    off_t start;
+    int select = 0;
+
+    *tokens = 0;
+    *orphan = 0;
+    if (scan_data[pos] == AOF_BIN_MARKER)
+        return scanBinaryBlock(c,pos,multi,tokens,orphan,err);
+    if (scan_data[pos] == '#') return scanAnnotation(pos,err);
+
+    if (!scanLong(&pos,'*',&argc,err)) return -1;
+    if (argc < 1) {
+        snprintf(err,SCAN_ERR_LEN,"Invalid number of arguments: %lld",argc);
+        return -1;
+    }
+    for (j = 0; j < argc; j++) {
+        if (!scanLong(&pos,'$',&len,err)) return -1;
+        if (len < 0 || len > scan_size-pos-2) {
+            snprintf(err,SCAN_ERR_LEN,
+                "Expected to read %lld bytes, got %lld bytes",
+                len+2,(long long)(scan_size-pos));
+            return -1;
+        }
+        start = pos;
+        pos += len;
+        if (scan_data[pos] != '\r' || scan_data[pos+1] != '\n') {
+            snprintf(err,SCAN_ERR_LEN,"Expected \\r\\n, got: %02x%02x",
+                scan_data[pos],scan_data[pos+1]);
+            return -1;
+        }
+        pos += 2;
+        if (j == 0 && !scanMulti((const char*)scan_data+start,len,multi,
+                                 tokens,orphan,err)) return -1;
+        scanSelect(c,j,(const char*)scan_data+start,len,&select);
+    }
+    return pos;
+}
+
+/* Return 1 if the scan can resynchronize at 'pos': the first two commands
+ * found there are valid. */
+static int scanSyncPoint(scanChunk *c, off_t pos) {
+    int multi = 0, tokens, orphan;
+    char err[SCAN_ERR_LEN];
+    unsigned char first = scan_data[pos];
+    off_t next;
+
+    if (first != '*' && first != '#' && first != AOF_BIN_MARKER) return 0;
+
+    /* Before checking the CRC of a binary block look at what follows it,
+     * that must be the end of the file or another command. */
+    if (first == AOF_BIN_MARKER) {
+        aofBinHeader h;
+
+        if (scan_size-pos < AOF_BIN_HDR_LEN ||
+            !aofBinParseHeader(scan_data+pos,&h)) return 0;
+        next = pos+AOF_BIN_HDR_LEN+h.len;
+        if (next > scan_size) return 0;
+        if (next < scan_size && scan_data[next] != '*' &&
+            scan_data[next] != '#' && scan_data[next] != AOF_BIN_MARKER)
+            return 0;
+    }
+
+    if ((next = scanUnit(c,pos,&multi,&tokens,&orphan,err)) == -1) return 0;
+    if (next == scan_size || first == AOF_BIN_MARKER) return 1;
+    return scanUnit(c,next,&multi,&tokens,&orphan,err) != -1;
+}
+
+/* Scan from 'pos', a boundary, up to the first boundary at or after the
+ * chunk limit. 'resynced' is the state of the scan at 'pos'. */
+static void scanChunkFrom(scanChunk *c, off_t pos, int resynced) {
+    int multi = 0, tokens, orphan, inmulti;
+    off_t unit = pos, next;
+    char err[SCAN_ERR_LEN];
+
+    c->numboundaries = 0;
+    while(1) {
+        if (!multi) {
+            if (c->numboundaries < SCAN_BOUNDARIES) {
+                c->boundaries[c->numboundaries] = pos;
+                c->boundaries_resynced[c->numboundaries++] = resynced;
+            }
+            if (pos >= c->limit) break;
+            unit = pos;
+        } else if (pos == scan_size) {
+            scanAddRange(c,unit,scan_size,0,
+                "Reached EOF before reading EXEC for MULTI");
+            multi = 0;
+            continue;
+        }
+
+        inmulti = multi;
+        next = scanUnit(c,pos,&multi,&tokens,&orphan,err);
+        if (next != -1) {
+            if (tokens) resynced = 0;
+            pos = next;
+            continue;
+        }
+
+        /* A broken transaction is corrupt from its MULTI. */
+        if (inmulti) orphan = 0;
+        else unit = pos;
+        for (next = unit+1; next < scan_size; next++)
+            if (scanSyncPoint(c,next)) break;
+        scanAddRange(c,unit,next,orphan && resynced,err);
+        multi = 0;
+        resynced = 1;
+        pos = next;
+    }
+    c->end = pos;
+    c->resynced = resynced;
+}
+
+static void *scanChunkThread(void *arg) {
+    scanChunk *c = arg;
+    off_t pos = c->start;
+
+    if (pos != 0)
+        while (pos < c->limit && !scanSyncPoint(c,pos)) pos++;
+    if (pos < c->limit) scanChunkFrom(c,pos,0);
+    return NULL;
+}
+
+/* Scan the AOF with 'threads' threads, report the corrupt ranges and, if
+ * 'output' is not NULL, write the valid commands there. Returns the exit
+ * code of the program. */
+int scanAof(int fd, off_t size, int threads, char *output) {
+    scanChunk *chunks;
+    scanRange *ranges = NULL;
+    int numchunks, numranges = 0, rescanned = 0, j, k;
+    off_t pos = 0, chunksize, corrupt = 0;
+    int resynced = 0;
+
+    if (threads == 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads < 1) threads = 1;
+        if (threads > SCAN_MAX_THREADS) threads = SCAN_MAX_THREADS;
+    }
+    numchunks = threads;
+    if (size/SCAN_MIN_CHUNK < numchunks) numchunks = size/SCAN_MIN_CHUNK;
+    if (numchunks < 1) numchunks = 1;
+
+    scan_data = mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0);
+    if (scan_data == MAP_FAILED) {
+        printf("Cannot map the AOF in memory\n");
+        return 1;
+    }
+    scan_size = size;
+
+    chunks = calloc(numchunks,sizeof(scanChunk));
+    chunksize = size/numchunks;
+    for (j = 0; j < numchunks; j++) {
+        chunks[j].start = chunksize*j;
+        chunks[j].limit = j == numchunks-1 ? size : chunksize*(j+1);
+        if (numchunks > 1 && pthread_create(&chunks[j].thread,NULL,
+                                            scanChunkThread,chunks+j) != 0)
+        {
+            printf("Cannot create the scan threads\n");
+            return 1;
+        }
+    }
+    if (numchunks == 1) scanChunkThread(chunks);
+
+    /* Merge the chunks in order. */
+    for (j = 0; j < numchunks; j++) {
+        scanChunk *c = chunks+j;
+
+        if (numchunks > 1) pthread_join(c->thread,NULL);
+        if (pos >= c->limit) goto next;
+        for (k = 0; k < c->numboundaries; k++) {
+            if (c->boundaries[k] == pos &&
+                c->boundaries_resynced[k] == resynced) break;
+        }
+        if (k == c->numboundaries) {
+            free(c->ranges);
+            c->ranges = NULL;
+            c->numranges = 0;
+            scanChunkFrom(c,pos,resynced);
+            rescanned++;
+        }
+        for (k = 0; k < c->numranges; k++) {
+            scanRange *r = c->ranges+k;
+
+            if (r->start < pos) continue;
+            if (r->extend && numranges) {
+                ranges[numranges-1].end = r->end;
+                continue;
+            }
+            ranges = realloc(ranges,sizeof(scanRange)*(numranges+1));
+            ranges[numranges++] = *r;
+        }
+        pos = c->end;
+        resynced = c->resynced;
+next:
+        free(c->ranges);
+        free(c->records);
+    }
+    free(chunks);
+
+    for (j = 0; j < numranges; j++) {
+        printf("0x%16llx-0x%16llx: %s\n",(long long)ranges[j].start,
+            (long long)ranges[j].end,ranges[j].error);
+        corrupt += ranges[j].end-ranges[j].start;
+    }
+    printf("AOF analyzed: size=%lld, chunks=%d, rescanned=%d, "
+           "corrupt_ranges=%d, corrupt_bytes=%lld\n",
+        (long long)size,numchunks,rescanned,numranges,(long long)corrupt);
+
+    if (output) {
+        FILE *fp = fopen(output,"w");
+        off_t from = 0, written = 0;
+        long long seldb = 0;
+        scanChunk w;
+
+        if (fp == NULL) {
+            printf("Cannot open file: %s\n", output);
+            return 1;
+        }
+        /* The commands of a kept range run in the DB selected at the end of
+         * the previous one, unless a dropped range selected another DB: so
+         * the DB is selected explicitly, and the commands that may have been
+         * logged for another DB are reported. */
+        memset(&w,0,sizeof(w));
+        for (j = 0; j <= numranges; j++) {
+            off_t to = j < numranges ? ranges[j].start : size, p;
+            int multi = 0, tokens, orphan;
+            char err[SCAN_ERR_LEN];
+
+            if (to > from) {
+                w.seldb = -1;
+                w.unselected = 0;
+                for (p = from; p != -1 && p < to; )
+                    p = scanUnit(&w,p,&multi,&tokens,&orphan,err);
+                if (j > 0 && w.unselected) {
+                    char db[21], buf[64];
+                    int len = snprintf(db,sizeof(db),"%lld",seldb);
+
+                    len = snprintf(buf,sizeof(buf),
+                        "*2\r\n$6\r\nSELECT\r\n$%d\r\n%s\r\n",len,db);
+
+                    fwrite(buf,len,1,fp);
+                    written += len;
+                    printf("Warning: %d commands at 0x%llx follow a corrupt "
+                           "range, they are salvaged into DB %lld\n",
+                        w.unselected,(long long)from,seldb);
+                }
+                if (w.seldb != -1) seldb = w.seldb;
+                fwrite(scan_data+from,to-from,1,fp);
+                written += to-from;
+            }
+            if (j < numranges) from = ranges[j].end;
+        }
+        free(w.records);
+        if (fflush(fp) == EOF || ferror(fp) || fsync(fileno(fp)) == -1) {
+            printf("Failed to write the salvaged AOF\n");
+            fclose(fp);
+            unlink(output);
+            return 1;
+        }
+        fclose(fp);
+        printf("AOF salvaged: %lld bytes of valid commands written to %s\n",
+            (long long)written,output);
+        return 0;
+    }
+    printf(numranges ? "AOF is not valid\n" : "AOF is valid\n");
+    return numranges ? 1 : 0;
+}
+
 int main(int argc, char **argv) {
-    char *filename;
-    int fix = 0;
+    char *filename, *output = NULL, *salvage = NULL;
+    int fix = 0, scan = 0, threads = 0;
+    converter conv = {NULL,0,NULL,0,0};
 
     if (argc < 2) {
         printf("Usage: %s [--fix] <file.aof>\n", argv[0]);
+        printf("       %s --truncate-to-timestamp <unix time> <file.aof>\n",
+            argv[0]);
+        printf("       %s --convert resp|binary <file.aof> <output.aof>\n",
+            argv[0]);
+        printf("       %s --scan [--threads <n>] <file.aof>\n", argv[0]);
+        printf("       %s --salvage [--threads <n>] <file.aof> <output.aof>\n",
+            argv[0]);
         exit(1);
     } else if (argc == 2) {
         filename = argv[1];
+    } else if (strcmp(argv[1],"--scan") == 0 ||
+               strcmp(argv[1],"--salvage") == 0)
+    {
+        int j = 2, files = strcmp(argv[1],"--scan") == 0 ? 1 : 2;
+
+        if (argc > j+1 && strcmp(argv[j],"--threads") == 0) {
+            threads = atoi(argv[j+1]);
+            if (threads < 1 || threads > SCAN_MAX_THREADS) {
+                printf("Invalid number of threads: %s\n", argv[j+1]);
+                exit(1);
+            }
+            j += 2;
+        }
+        if (argc != j+files) {
+            printf("Invalid arguments\n");
+            exit(1);
+        }
+        filename = argv[j];
+        if (files == 2) salvage = argv[j+1];
+        scan = 1;
     } else if (argc == 3) {
         if (strcmp(argv[1],"--fix") != 0) {
             printf("Invalid argument: %s\n", argv[1]);
@@ -162,12 +922,30 @@ int main(int argc, char **argv) {
         }
         filename = argv[2];
         fix = 1;
+    } else if (argc == 4 && strcmp(argv[1],"--truncate-to-timestamp") == 0) {
+        char *eptr;
+
+        truncate_to = strtoll(argv[2],&eptr,10);
+        if (*argv[2] == '\0' || *eptr != '\0' || truncate_to < 0) {
+            printf("Invalid timestamp: %s\n", argv[2]);
+            exit(1);
+        }
+        filename = argv[3];
+    } else if (argc == 5 && strcmp(argv[1],"--convert") == 0) {
+        if (strcmp(argv[2],"binary") == 0) {
+            conv.binary = 1;
+        } else if (strcmp(argv[2],"resp") != 0) {
+            printf("Invalid format: %s\n", argv[2]);
+            exit(1);
+        }
+        filename = argv[3];
+        output = argv[4];
     } else {
         printf("Invalid arguments\n");
         exit(1);
     }
 
-    FILE *fp = fopen(filename,"r+");
+    FILE *fp = fopen(filename,(output || scan) ? "r" : "r+");
     if (fp == NULL) {
         printf("Cannot open file: %s\n", filename);
         exit(1);
@@ -185,11 +963,67 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
-    off_t pos = process(fp);
+    /* AOF files rewritten with aof-use-rdb-preamble start with an RDB file,
+     * that this tool is not able to parse. */
+    char sig[5];
+    if (fread(sig,1,5,fp) == 5 && memcmp(sig,"REDIS",5) == 0) {
+        printf("The AOF starts with an RDB preamble, that can't be checked "
+               "by this tool: use redis-check-rdb to check the preamble\n");
+        exit(1);
+    }
+    if (fseek(fp,0,SEEK_SET) == -1) {
+        printf("Cannot seek file: %s\n", filename);
+        exit(1);
+    }
+
+    if (scan) exit(scanAof(fileno(fp),size,threads,salvage));
+
+    if (output) {
+        conv.fp = fopen(output,"w");
+        if (conv.fp == NULL) {
+            printf("Cannot open file: %s\n", output);
+            exit(1);
+        }
+    }
+
+    off_t pos = process(fp,size,output ? &conv : NULL);
     off_t diff = size-pos;
     printf("AOF analyzed: size=%lld, ok_up_to=%lld, diff=%lld\n",
         (long long) size, (long long) pos, (long long) diff);
-    if (diff > 0) {
+    if (output) {
+        /* Only valid files are converted: fix the AOF first otherwise. */
+        convertFlushBlock(&conv);
+        if (diff > 0 || fflush(conv.fp) == EOF || ferror(conv.fp) ||
+            fsync(fileno(conv.fp)) == -1)
+        {
+            printf(diff > 0 ? "AOF is not valid\n" :
+                              "Failed to write the converted AOF\n");
+            fclose(conv.fp);
+            unlink(output);
+            exit(1);
+        }
+        fclose(conv.fp);
+        free(conv.block);
+        printf("AOF converted to %s: %s\n", argv[2], output);
+    } else if (truncate_reached) {
+        char buf[2];
+        printf("This will truncate the AOF at the first command after %lld, "
+               "from %lld bytes to %lld bytes\n",
+               truncate_to,(long long)size,(long long)pos);
+        printf("Continue? [y/N]: ");
+        if (fgets(buf,sizeof(buf),stdin) == NULL ||
+            strncasecmp(buf,"y",1) != 0) {
+                printf("Aborting...\n");
+                exit(1);
+        }
+        if (ftruncate(fileno(fp), pos) == -1) {
+            printf("Failed to truncate AOF\n");
+            exit(1);
+        } else {
+            printf("Successfully truncated AOF to timestamp %lld\n",
+                truncate_to);
+        }
+    } else if (diff > 0) {
         if (fix) {
             char buf[2];
             printf("This will shrink the AOF from %lld bytes, with %lld bytes, to %lld bytes\n",(long long)size,(long long)diff,(long long)pos);
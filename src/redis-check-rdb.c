@@ -44,6 +44,9 @@ struct {
     unsigned long keys;             /* Number of keys processed. */
     unsigned long expires;          /* Number of keys with an expire. */
     unsigned long already_expired;  /* Number of keys already expired. */
+    unsigned long chunks;           /* Number of chunks processed. */
+    int chunk_index;                /* True if a chunks index was found. */
+    rdbChunkInfo *chunk_info;       /* Info about the chunks processed. */
     int doing;                      /* The state while reading the RDB. */
     int error_set;                  /* True if error is populated. */
     char error[1024];
@@ -59,6 +62,8 @@ struct {
 #define RDB_CHECK_DOING_CHECK_SUM 5
 #define RDB_CHECK_DOING_READ_LEN 6
 #define RDB_CHECK_DOING_READ_AUX 7
+#define RDB_CHECK_DOING_READ_CHUNK 8
+#define RDB_CHECK_DOING_READ_CHUNK_INDEX 9
 
 char *rdb_check_doing_string[] = {
     "start",
@@ -68,7 +73,9 @@ char *rdb_check_doing_string[] = {
     "read-object-value",
     "check-sum",
     "read-len",
-    "read-aux"
+    "read-aux",
+    "read-chunk",
+    "read-chunk-index"
 };
 
 char *rdb_type_string[] = {
@@ -93,6 +100,8 @@ void rdbShowGenericInfo(void) {
     printf("[info] %lu keys read\n", rdbstate.keys);
     printf("[info] %lu expires\n", rdbstate.expires);
     printf("[info] %lu already expired\n", rdbstate.already_expired);
+    if (rdbstate.chunks)
+        printf("[info] %lu chunks\n", rdbstate.chunks);
 }
 
 /* Called on RDB errors. Provides details about the RDB and the offset
@@ -172,6 +181,109 @@ void rdbCheckSetupSignals(void) {
     sigaction(SIGILL, &act, NULL);
 }
 
+/* Check a key-value record, after its object type and expire were read. */
+int rdbCheckKeyValue(rio *rdb, int type, long long expiretime, long long now) {
+    robj *key, *val;
+
+    /* Read key */
+    rdbstate.doing = RDB_CHECK_DOING_READ_KEY;
+    if ((key = rdbLoadStringObject(rdb)) == NULL) return C_ERR;
+    rdbstate.key = key;
+    rdbstate.keys++;
+    /* Read value */
+    rdbstate.doing = RDB_CHECK_DOING_READ_OBJECT_VALUE;
+    if ((val = rdbLoadObject(type,rdb)) == NULL) return C_ERR;
+    /* Check if the key already expired. This function is used when loading
+     * an RDB file from disk, either at startup, or when an RDB was
+     * received from the master. In the latter case, the master is
+     * responsible for key expiry. If we would expire keys here, the
+     * snapshot taken by the master may not be reflected on the slave. */
+    if (server.masterhost == NULL && expiretime != -1 && expiretime < now)
+        rdbstate.already_expired++;
+    if (expiretime != -1) rdbstate.expires++;
+    rdbstate.key = NULL;
+    decrRefCount(key);
+    decrRefCount(val);
+    rdbstate.key_type = -1;
+    return C_OK;
+}
+
+/* Check a chunk, after the chunk opcode at 'offset' was read, remembering
+ * its info in order to check the chunks index later. Errors are reported
+ * before returning C_ERR. */
+int rdbCheckChunk(rio *rdb, uint64_t offset, long long now) {
+    rdbChunkInfo info;
+    unsigned long keys = rdbstate.keys;
+    sds payload;
+    rio chunk;
+
+    rdbstate.doing = RDB_CHECK_DOING_READ_CHUNK;
+    if ((payload = rdbLoadChunk(rdb,&info)) == NULL) {
+        rdbCheckError(rdbstate.error_set ? rdbstate.error :
+                      "Unexpected EOF reading RDB chunk");
+        return C_ERR;
+    }
+    info.offset = offset;
+    rdbstate.chunk_info = zrealloc(rdbstate.chunk_info,
+        sizeof(rdbChunkInfo)*(rdbstate.chunks+1));
+    rdbstate.chunk_info[rdbstate.chunks++] = info;
+
+    rioInitWithBuffer(&chunk,payload);
+    while ((size_t)chunk.io.buffer.pos < sdslen(payload)) {
+        long long expiretime = -1;
+        int type;
+
+        rdbstate.doing = RDB_CHECK_DOING_READ_TYPE;
+        if ((type = rdbLoadType(&chunk)) == -1) goto err;
+        if (type == RDB_OPCODE_EXPIRETIME_MS) {
+            rdbstate.doing = RDB_CHECK_DOING_READ_EXPIRE;
+            if ((expiretime = rdbLoadMillisecondTime(&chunk)) == -1) goto err;
+            rdbstate.doing = RDB_CHECK_DOING_READ_TYPE;
+            if ((type = rdbLoadType(&chunk)) == -1) goto err;
+        }
+        if (!rdbIsObjectType(type)) {
+            rdbCheckError("Invalid object type in chunk: %d", type);
+            sdsfree(payload);
+            return C_ERR;
+        }
+        rdbstate.key_type = type;
+        if (rdbCheckKeyValue(&chunk,type,expiretime,now) == C_ERR) goto err;
+    }
+    sdsfree(payload);
+    if (rdbstate.keys-keys != info.keys) {
+        rdbCheckError("Chunk at offset %llu has %lu keys, %u expected",
+            (unsigned long long)offset, rdbstate.keys-keys, info.keys);
+        return C_ERR;
+    }
+    return C_OK;
+
+err:
+    sdsfree(payload);
+    rdbCheckError(rdbstate.error_set ? rdbstate.error :
+                  "Unexpected EOF reading RDB chunk");
+    return C_ERR;
+}
+
+/* Check that the chunks index matches the chunks found in the file. */
+int rdbCheckChunkIndex(rdbChunkInfo *index, uint32_t count) {
+    uint32_t j;
+
+    if (count != rdbstate.chunks) {
+        rdbCheckError("Chunk index has %u entries, %lu chunks found",
+            count, rdbstate.chunks);
+        return C_ERR;
+    }
+    for (j = 0; j < count; j++) {
+        if (memcmp(index+j,rdbstate.chunk_info+j,sizeof(rdbChunkInfo))) {
+            rdbCheckError("Chunk index entry %u does not match chunk at "
+                          "offset %llu", j,
+                          (unsigned long long)rdbstate.chunk_info[j].offset);
+            return C_ERR;
+        }
+    }
+    return C_OK;
+}
+
 /* Check the specified RDB file. */
 int redis_check_rdb(char *rdbfilename) {
     uint64_t dbid;
@@ -193,14 +305,13 @@ int redis_check_rdb(char *rdbfilename) {
         return 1;
     }
     rdbver = atoi(buf+5);
-    if (rdbver < 1 || rdbver > RDB_VERSION) {
+    if (rdbver < 1 || rdbver > RDB_EXTENDED_VERSION) {
         rdbCheckError("Can't handle RDB format version %d",rdbver);
         return 1;
     }
 
     startLoading(fp);
     while(1) {
-        robj *key, *val;
         expiretime = -1;
 
         /* Read type. */
@@ -264,6 +375,34 @@ int redis_check_rdb(char *rdbfilename) {
             decrRefCount(auxkey);
             decrRefCount(auxval);
             continue; /* Read type again. */
+        } else if (type == RDB_OPCODE_FLUSHDB) {
+            /* FLUSHDB: the selected DB was flushed, in delta snapshots. */
+            rdbCheckInfo("Flushing the selected DB");
+            continue; /* Read type again. */
+        } else if (type == RDB_OPCODE_DELKEY) {
+            /* DELKEY: a key deleted, in delta snapshots. */
+            robj *key;
+            rdbstate.doing = RDB_CHECK_DOING_READ_KEY;
+            if ((key = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
+            decrRefCount(key);
+            continue; /* Read type again. */
+        } else if (type == RDB_OPCODE_CHUNK) {
+            if (rdbCheckChunk(&rdb,rdb.processed_bytes-1,now) == C_ERR)
+                return 1;
+            continue; /* Read type again. */
+        } else if (type == RDB_OPCODE_CHUNK_INDEX) {
+            rdbChunkInfo *index;
+            uint32_t count;
+            int retval;
+
+            rdbstate.doing = RDB_CHECK_DOING_READ_CHUNK_INDEX;
+            if (rdbLoadChunkIndex(&rdb,&index,&count) == -1) goto eoferr;
+            retval = rdbCheckChunkIndex(index,count);
+            zfree(index);
+            if (retval == C_ERR) return 1;
+            rdbstate.chunk_index = 1;
+            rdbCheckInfo("Chunk index OK (%u chunks)", count);
+            continue; /* Read type again. */
         } else {
             if (!rdbIsObjectType(type)) {
                 rdbCheckError("Invalid object type: %d", type);
@@ -272,26 +411,7 @@ int redis_check_rdb(char *rdbfilename) {
             rdbstate.key_type = type;
         }
 
-        /* Read key */
-        rdbstate.doing = RDB_CHECK_DOING_READ_KEY;
-        if ((key = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
-        rdbstate.key = key;
-        rdbstate.keys++;
-        /* Read value */
-        rdbstate.doing = RDB_CHECK_DOING_READ_OBJECT_VALUE;
-        if ((val = rdbLoadObject(type,&rdb)) == NULL) goto eoferr;
-        /* Check if the key already expired. This function is used when loading
-         * an RDB file from disk, either at startup, or when an RDB was
-         * received from the master. In the latter case, the master is
-         * responsible for key expiry. If we would expire keys here, the
-         * snapshot taken by the master may not be reflected on the slave. */
-        if (server.masterhost == NULL && expiretime != -1 && expiretime < now)
-            rdbstate.already_expired++;
-        if (expiretime != -1) rdbstate.expires++;
-        rdbstate.key = NULL;
-        decrRefCount(key);
-        decrRefCount(val);
-        rdbstate.key_type = -1;
+        if (rdbCheckKeyValue(&rdb,type,expiretime,now) == C_ERR) goto eoferr;
     }
     /* Verify the checksum if RDB version is >= 5 */
     if (rdbver >= 5 && server.rdb_checksum) {
@@ -309,6 +429,22 @@ int redis_check_rdb(char *rdbfilename) {
         }
     }
 
+    /* Chunked files should allow to find the index without reading the
+     * whole file. */
+    if (rdbstate.chunk_index) {
+        rdbChunkInfo *index;
+        uint32_t count;
+        int retval;
+
+        if (rdbReadChunkIndexFromFile(fp,&index,&count) == -1) {
+            rdbCheckError("Can't read the chunk index from the file trailer");
+            return 1;
+        }
+        retval = rdbCheckChunkIndex(index,count);
+        zfree(index);
+        if (retval == C_ERR) return 1;
+    }
+
     fclose(fp);
     return 0;
 
@@ -30,6 +30,7 @@
 
 
 #include "server.h"
+#include "cluster.h"
 
 #include <sys/time.h>
 #include <unistd.h>
@@ -625,9 +626,12 @@ void syncCommand(client *c) {
     c->flags |= CLIENT_SLAVE;
     listAddNodeTail(server.slaves,c);
 
-    /* CASE 1: BGSAVE is in progress, with disk target. */
-    if (server.rdb_child_pid != -1 &&
-        server.rdb_child_type == RDB_CHILD_TYPE_DISK)
+    /* CASE 1: BGSAVE is in progress, with disk target. A fork-less
+     * snapshot is a disk BGSAVE as well, and attaching a slave works the
+     * same way since it is a point in time copy of the dataset. */
+    if ((server.rdb_child_pid != -1 &&
+         server.rdb_child_type == RDB_CHILD_TYPE_DISK) ||
+        server.rdb_forkless)
     {
         /* Ok a background save is in progress. Let's check if it is a good
          * one for replication, i.e. if there is another slave that is
@@ -979,6 +983,180 @@ void replicationCreateMasterClient(int fd) {
         server.master->flags |= CLIENT_PRE_PSYNC;
 }
 
+/* Return true if the RDB received from the master should be loaded
+ * directly from the socket, according to repl-diskless-load. */
+static int useDisklessLoad(void) {
+    int j;
+
+    if (server.repl_diskless_load == REPL_DISKLESS_LOAD_SWAPDB) return 1;
+    if (server.repl_diskless_load != REPL_DISKLESS_LOAD_WHEN_DB_EMPTY)
+        return 0;
+    for (j = 0; j < server.dbnum; j++)
+        if (dictSize(server.db[j].dict)) return 0;
+    return 1;
+}
+
+/* The old dataset saved by repl-diskless-load swapdb while the new one is
+ * loaded from the socket, so that it can be restored on failure. */
+typedef struct replDbBackup {
+    dict **dicts;           /* Main dictionaries of every DB. */
+    dict **expires;         /* Expires dictionaries of every DB. */
+    zskiplist *slots_to_keys;   /* Cluster slots to keys map. */
+} replDbBackup;
+
+/* Move the whole dataset into a backup, leaving empty DBs in its place. */
+static replDbBackup *replBackupDb(void) {
+    replDbBackup *backup = zmalloc(sizeof(*backup));
+    int j;
+
+    backup->dicts = zmalloc(sizeof(dict*)*server.dbnum);
+    backup->expires = zmalloc(sizeof(dict*)*server.dbnum);
+    for (j = 0; j < server.dbnum; j++) {
+        backup->dicts[j] = server.db[j].dict;
+        backup->expires[j] = server.db[j].expires;
+        server.db[j].dict = dictCreate(&dbDictType,NULL);
+        server.db[j].expires = dictCreate(&keyptrDictType,NULL);
+    }
+    backup->slots_to_keys = NULL;
+    if (server.cluster_enabled) {
+        backup->slots_to_keys = server.cluster->slots_to_keys;
+        server.cluster->slots_to_keys = zslCreate();
+    }
+    return backup;
+}
+
+/* Put the backup back in place of the current dataset if 'restore' is
+ * true, otherwise just release it. The backup itself is freed. */
+static void replDiscardDbBackup(replDbBackup *backup, int restore) {
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        if (restore) {
+            dictRelease(server.db[j].dict);
+            dictRelease(server.db[j].expires);
+            server.db[j].dict = backup->dicts[j];
+            server.db[j].expires = backup->expires[j];
+        } else if (!server.rdb_forkless ||
+                   !rdbForklessAdoptDb(j,backup->dicts[j],backup->expires[j]))
+        {
+            dictRelease(backup->dicts[j]);
+            dictRelease(backup->expires[j]);
+        }
+    }
+    if (backup->slots_to_keys) {
+        if (restore) {
+            zslFree(server.cluster->slots_to_keys);
+            server.cluster->slots_to_keys = backup->slots_to_keys;
+        } else {
+            zslFree(backup->slots_to_keys);
+        }
+    }
+    zfree(backup->dicts);
+    zfree(backup->expires);
+    zfree(backup);
+}
+
+/* Load the RDB payload directly from the master socket, without storing
+ * it on disk. When 'usemark' is true the payload is terminated by the
+ * 'eofmark' delimiter, otherwise its size is server.repl_transfer_size.
+ *
+ * With repl-diskless-load swapdb the old dataset is kept until the load
+ * completes and restored on failure, otherwise on failure the DBs are
+ * left empty. Returns C_OK or C_ERR. */
+static int readSyncBulkPayloadDiskless(int usemark, char *eofmark) {
+    replDbBackup *backup = NULL;
+    off_t limit = usemark ? 0 : server.repl_transfer_size;
+    int retval;
+    rio rdb;
+
+    serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Flushing old data");
+    signalFlushedDb(-1);
+    if (server.repl_diskless_load == REPL_DISKLESS_LOAD_SWAPDB) {
+        backup = replBackupDb();
+    } else {
+        emptyDb(replicationEmptyDbCallback);
+    }
+
+    /* The readable handler must be removed, otherwise it would be called
+     * recursively by the events processed while loading. */
+    aeDeleteFileEvent(server.el,server.repl_transfer_s,AE_READABLE);
+    serverLog(LL_NOTICE,
+        "MASTER <-> SLAVE sync: Loading DB in memory from the socket");
+    rioInitWithFd(&rdb,server.repl_transfer_s,limit,
+        server.repl_timeout*1000);
+    startLoadingSize(limit);
+    retval = rdbLoadRio(&rdb,1);
+    if (retval == C_OK) {
+        if (usemark) {
+            char mark[CONFIG_RUN_ID_SIZE];
+
+            if (rioRead(&rdb,mark,CONFIG_RUN_ID_SIZE) == 0 ||
+                memcmp(mark,eofmark,CONFIG_RUN_ID_SIZE) != 0)
+            {
+                serverLog(LL_WARNING,"Replication stream EOF mark not found "
+                                     "after the RDB payload");
+                retval = C_ERR;
+            }
+        }
+        /* Nothing past the payload should have been consumed, as it
+         * belongs to the replication stream. */
+        if (retval == C_OK &&
+            rioTell(&rdb) != rdb.io.fd.read_so_far)
+        {
+            serverLog(LL_WARNING,"Unexpected data after the RDB payload");
+            retval = C_ERR;
+        }
+    } else {
+        serverLog(LL_WARNING,"Failed trying to load the MASTER "
+                             "synchronization DB from the socket: %s",
+                             strerror(errno));
+    }
+    stopLoading();
+    server.stat_net_input_bytes += rdb.io.fd.read_so_far;
+    server.repl_transfer_read = rdb.io.fd.read_so_far;
+    server.repl_transfer_lastio = server.unixtime;
+    rioFreeFd(&rdb);
+
+    if (retval == C_ERR) {
+        if (backup) {
+            serverLog(LL_NOTICE,"MASTER <-> SLAVE sync: Restoring the "
+                                "old dataset");
+            replDiscardDbBackup(backup,1);
+        } else {
+            emptyDb(NULL);
+        }
+    } else if (backup) {
+        replDiscardDbBackup(backup,0);
+    }
+    return retval;
+}
+
+/* The full synchronization completed: create the master client and
+ * restart the AOF if needed. */
+static void replicationFinishSync(void) {
+    /* Final setup of the connected slave <- master link */
+    zfree(server.repl_transfer_tmpfile);
+    close(server.repl_transfer_fd);
+    replicationCreateMasterClient(server.repl_transfer_s);
+    serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Finished with success");
+    /* Restart the AOF subsystem now that we finished the sync. This
+     * will trigger an AOF rewrite, and when done will start appending
+     * to the new file. */
+    if (server.aof_state != AOF_OFF) {
+        int retry = 10;
+
+        stopAppendOnly();
+        while (retry-- && startAppendOnly() == C_ERR) {
+            serverLog(LL_WARNING,"Failed enabling the AOF after successful master synchronization! Trying it again in one second.");
+            sleep(1);
+        }
+        if (!retry) {
+            serverLog(LL_WARNING,"FATAL: this slave instance finished the synchronization with its master, but the AOF can't be turned on. Exiting now.");
+            exit(1);
+        }
+    }
+}
+
 /* Asynchronously read the SYNC payload we receive from a master */
 #define REPL_MAX_WRITTEN_BEFORE_FSYNC (1024*1024*8) /* 8 MB */
 void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
@@ -1050,6 +1228,18 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
         return;
     }
 
+    /* With diskless load the whole payload is parsed as it arrives from
+     * the socket, and the temp file is not used at all. */
+    if (server.repl_transfer_read == 0 && useDisklessLoad()) {
+        if (readSyncBulkPayloadDiskless(usemark,eofmark) == C_ERR) {
+            cancelReplicationHandshake();
+            return;
+        }
+        unlink(server.repl_transfer_tmpfile);
+        replicationFinishSync();
+        return;
+    }
+
     /* Read bulk data */
     if (usemark) {
         readlen = sizeof(buf);
@@ -1139,27 +1329,7 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
             cancelReplicationHandshake();
             return;
         }
-        /* Final setup of the connected slave <- master link */
-        zfree(server.repl_transfer_tmpfile);
-        close(server.repl_transfer_fd);
-        replicationCreateMasterClient(server.repl_transfer_s);
-        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Finished with success");
-        /* Restart the AOF subsystem now that we finished the sync. This
-         * will trigger an AOF rewrite, and when done will start appending
-         * to the new file. */
-        if (server.aof_state != AOF_OFF) {
-            int retry = 10;
-
-            stopAppendOnly();
-            while (retry-- && startAppendOnly() == C_ERR) {
-                serverLog(LL_WARNING,"Failed enabling the AOF after successful master synchronization! Trying it again in one second.");
-                sleep(1);
-            }
-            if (!retry) {
-                serverLog(LL_WARNING,"FATAL: this slave instance finished the synchronization with its master, but the AOF can't be turned on. Exiting now.");
-                exit(1);
-            }
-        }
+        replicationFinishSync();
     }
 
     return;
@@ -2367,7 +2537,9 @@ void replicationCron(void) {
      * In case of diskless replication, we make sure to wait the specified
      * number of seconds (according to configuration) so that other slaves
      * have the time to arrive before we start streaming. */
-    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1) {
+    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
+        !server.rdb_forkless)
+    {
         time_t idle, max_idle = 0;
         int slaves_waiting = 0;
         int mincapa = -1;
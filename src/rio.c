@@ -49,6 +49,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include "rio.h"
 #include "util.h"
 #include "crc64.h"
@@ -105,6 +106,22 @@ void rioInitWithBuffer(rio *r, sds s) {
 
 /* --------------------- Stdio file pointer implementation ------------------- */
 
+/* Don't sleep for less than that when throttling writes, in usec. */
+#define RIO_THROTTLE_MIN_SLEEP 10000
+
+/* Sleep as needed so that the average write rate since the first write does
+ * not exceed the configured max rate, see rioSetMaxWriteRate(). */
+static void rioFileThrottle(rio *r, size_t len) {
+    long long now = ustime(), elapsed, expected;
+
+    if (r->io.file.rate_start == 0) r->io.file.rate_start = now;
+    r->io.file.rate_bytes += len;
+    elapsed = now - r->io.file.rate_start;
+    expected = r->io.file.rate_bytes*1000000/r->io.file.maxrate;
+    if (expected - elapsed >= RIO_THROTTLE_MIN_SLEEP)
+        usleep(expected - elapsed);
+}
+
 /* Returns 1 or 0 for success/failure. */
 static size_t rioFileWrite(rio *r, const void *buf, size_t len) {
     size_t retval;
@@ -117,8 +134,10 @@ static size_t rioFileWrite(rio *r, const void *buf, size_t len) {
     {
         fflush(r->io.file.fp);
         aof_fsync(fileno(r->io.file.fp));
+        if (r->io.file.dropcache) rioFileDropCache(r);
         r->io.file.buffered = 0;
     }
+    if (r->io.file.maxrate) rioFileThrottle(r,len);
     return retval;
 }
 
@@ -155,6 +174,11 @@ void rioInitWithFile(rio *r, FILE *fp) {
     r->io.file.fp = fp;
     r->io.file.buffered = 0;
     r->io.file.autosync = 0;
+    r->io.file.dropcache = 0;
+    r->io.file.synced = 0;
+    r->io.file.maxrate = 0;
+    r->io.file.rate_start = 0;
+    r->io.file.rate_bytes = 0;
 }
 
 /* ------------------- File descriptors set implementation ------------------- */
@@ -283,6 +307,104 @@ void rioFreeFdset(rio *r) {
     sdsfree(r->io.fdset.buf);
 }
 
+/* ------------------- File descriptor source implementation ----------------
+ * Used to read an RDB payload directly from a socket. Data is read in blocks
+ * of PROTO_IOBUF_LEN bytes, but never more than 'read_limit' bytes in total,
+ * so that nothing that follows the payload is consumed. When the socket is
+ * non blocking we wait up to 'timeout' milliseconds for it to be readable. */
+
+/* Returns 1 or 0 for success/failure. */
+static size_t rioFdRead(rio *r, void *buf, size_t len) {
+    unsigned char *p = buf;
+
+    while (len) {
+        size_t avail = sdslen(r->io.fd.buf) - r->io.fd.pos;
+
+        if (avail == 0) {
+            size_t toread = PROTO_IOBUF_LEN;
+            ssize_t nread;
+
+            if (r->io.fd.read_limit) {
+                off_t left = r->io.fd.read_limit - r->io.fd.read_so_far;
+                if (left == 0) return 0; /* Reading past the payload. */
+                if ((off_t)toread > left) toread = left;
+            }
+            sdsclear(r->io.fd.buf);
+            r->io.fd.pos = 0;
+            r->io.fd.buf = sdsMakeRoomFor(r->io.fd.buf,toread);
+            nread = read(r->io.fd.fd,r->io.fd.buf,toread);
+            if (nread == -1 && errno == EAGAIN) {
+                if (!(aeWait(r->io.fd.fd,AE_READABLE,r->io.fd.timeout) &
+                      AE_READABLE))
+                {
+                    errno = ETIMEDOUT;
+                    return 0;
+                }
+                continue;
+            }
+            if (nread <= 0) {
+                if (nread == 0) errno = ECONNRESET;
+                return 0;
+            }
+            sdsIncrLen(r->io.fd.buf,nread);
+            r->io.fd.read_so_far += nread;
+            avail = nread;
+        }
+        if (avail > len) avail = len;
+        memcpy(p,r->io.fd.buf+r->io.fd.pos,avail);
+        r->io.fd.pos += avail;
+        p += avail;
+        len -= avail;
+    }
+    return 1;
+}
+
+/* Returns 1 or 0 for success/failure. */
+static size_t rioFdWrite(rio *r, const void *buf, size_t len) {
+    UNUSED(r);
+    UNUSED(buf);
+    UNUSED(len);
+    return 0; /* Error, this target does not support writing. */
+}
+
+/* Returns the number of bytes consumed so far. */
+static off_t rioFdTell(rio *r) {
+    return r->io.fd.read_so_far - (sdslen(r->io.fd.buf) - r->io.fd.pos);
+}
+
+/* Nothing to flush when reading. */
+static int rioFdFlush(rio *r) {
+    UNUSED(r);
+    return 1;
+}
+
+static const rio rioFdIO = {
+    rioFdRead,
+    rioFdWrite,
+    rioFdTell,
+    rioFdFlush,
+    NULL,           /* update_checksum */
+    0,              /* current checksum */
+    0,              /* bytes read or written */
+    0,              /* read/write chunk size */
+    { { NULL, 0 } } /* union for io-specific vars */
+};
+
+void rioInitWithFd(rio *r, int fd, off_t read_limit, long long timeout) {
+    *r = rioFdIO;
+    r->io.fd.fd = fd;
+    r->io.fd.buf = sdsempty();
+    r->io.fd.pos = 0;
+    r->io.fd.read_so_far = 0;
+    r->io.fd.read_limit = read_limit;
+    r->io.fd.timeout = timeout;
+}
+
+/* Release the rio stream. */
+void rioFreeFd(rio *r) {
+    sdsfree(r->io.fd.buf);
+}
+
 /* ---------------------------- Generic functions ---------------------------- */
 
 /* This function can be installed both in memory and file streams when checksum
@@ -304,6 +426,45 @@ void rioSetAutoSync(rio *r, off_t bytes) {
     r->io.file.autosync = bytes;
 }
 
+/* Set the file-based rio object to drop from the page cache the pages
+ * written, every time an auto-fsync is performed (see rioSetAutoSync()).
+ *
+ * When writing big files we'll not read again soon, like RDB snapshots,
+ * caching them is useless and just evicts from the page cache the pages of
+ * other files, or of other processes sharing the host. */
+void rioSetDropCache(rio *r, int enabled) {
+    serverAssert(r->read == rioFileIO.read);
+    r->io.file.dropcache = enabled;
+}
+
+/* Limit the write rate of the file-based rio object to 'bytes_per_sec'
+ * bytes per second on average, sleeping as needed. Zero means no limit.
+ * Since the caller is blocked, this is only useful in child processes. */
+void rioSetMaxWriteRate(rio *r, long long bytes_per_sec) {
+    serverAssert(r->read == rioFileIO.read);
+    r->io.file.maxrate = bytes_per_sec;
+    r->io.file.rate_start = 0;
+    r->io.file.rate_bytes = 0;
+}
+
+/* Drop from the page cache the pages of the file written since the last
+ * call. Only pages already on disk can be dropped, so the caller should
+ * flush and fsync the file first. */
+void rioFileDropCache(rio *r) {
+#ifdef HAVE_FADVISE
+    int fd = fileno(r->io.file.fp);
+    off_t pos = ftello(r->io.file.fp);
+
+    if (pos > r->io.file.synced) {
+        posix_fadvise(fd,r->io.file.synced,pos-r->io.file.synced,
+            POSIX_FADV_DONTNEED);
+        r->io.file.synced = pos;
+    }
+#else
+    UNUSED(r);
+#endif
+}
+
 /* --------------------------- Higher level interface --------------------------
  *
  * The following higher level functions use lower level rio.c functions to help
@@ -72,6 +72,11 @@ struct _rio {
             FILE *fp;
             off_t buffered; /* Bytes written since last fsync. */
             off_t autosync; /* fsync after 'autosync' bytes written. */
+            int dropcache;  /* Drop written pages from the page cache. */
+            off_t synced;   /* Pages before this offset were dropped. */
+            long long maxrate;  /* Max bytes written per second, 0 = no limit. */
+            long long rate_start;   /* Time of the first write, in usec. */
+            long long rate_bytes;   /* Bytes written since rate_start. */
         } file;
         /* Multiple FDs target (used to write to N sockets). */
         struct {
@@ -81,6 +86,15 @@ struct _rio {
             off_t pos;
             sds buf;
         } fdset;
+        /* File descriptor source (used to read from a socket). */
+        struct {
+            int fd;         /* File descriptor, may be non blocking. */
+            sds buf;        /* Bytes read but not consumed yet. */
+            size_t pos;     /* Position of the first unconsumed byte. */
+            off_t read_so_far;  /* Bytes read from the fd. */
+            off_t read_limit;   /* Don't read more than that, 0 = no limit. */
+            long long timeout;  /* Max milliseconds to wait for data. */
+        } fd;
     } io;
 };
 
@@ -129,6 +143,8 @@ void rioInitWithBuffer(rio *r, sds s);
 void rioInitWithFdset(rio *r, int *fds, int numfds);
 
 void rioFreeFdset(rio *r);
+void rioInitWithFd(rio *r, int fd, off_t read_limit, long long timeout);
+void rioFreeFd(rio *r);
 
 size_t rioWriteBulkCount(rio *r, char prefix, int count);
 size_t rioWriteBulkString(rio *r, const char *buf, size_t len);
@@ -137,5 +153,8 @@ size_t rioWriteBulkDouble(rio *r, double d);
 
 void rioGenericUpdateChecksum(rio *r, const void *buf, size_t len);
 void rioSetAutoSync(rio *r, off_t bytes);
+void rioSetDropCache(rio *r, int enabled);
+void rioSetMaxWriteRate(rio *r, long long bytes_per_sec);
+void rioFileDropCache(rio *r);
 
 #endif
@@ -107,7 +107,7 @@ sds sdsnewlen(const void *init, size_t initlen) {
     int hdrlen = sdsHdrSize(type);  // 获取header长度
     unsigned char *fp; /* flags pointer. */
 
-    sh = s_malloc(hdrlen+initlen+1);  // 为sds字符串header申请内存空间，大小为：头部大小+初始化长度大小+1（其中1是为'\0'留的）
+    sh = s_malloc_small(hdrlen+initlen+1);  // 为sds字符串header申请内存空间，大小为：头部大小+初始化长度大小+1（其中1是为'\0'留的）
     if (!init)  // 初始数据指针为NULL
         memset(sh, 0, hdrlen+initlen+1);  // 把整个sds的内容都设置为0
     if (sh == NULL) return NULL;  // 申请内存失败返回NULL
@@ -38,5 +38,6 @@
 
 #include "zmalloc.h"
 #define s_malloc zmalloc
+#define s_malloc_small zmalloc_small
 #define s_realloc zrealloc
 #define s_free zfree
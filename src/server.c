@@ -272,6 +272,7 @@ struct redisCommand redisCommandTable[] = {
     {"readwrite",readwriteCommand,1,"F",0,NULL,0,0,0,0,0},
     {"dump",dumpCommand,2,"r",0,NULL,1,1,1,0,0},
     {"object",objectCommand,3,"r",0,NULL,2,2,2,0,0},
+    {"memory",memoryCommand,-2,"r",0,memoryGetKeys,0,0,0,0,0},
     {"client",clientCommand,-2,"as",0,NULL,0,0,0,0,0},
     {"eval",evalCommand,-3,"s",0,evalGetKeys,0,0,0,0,0},
     {"evalsha",evalShaCommand,-3,"s",0,evalGetKeys,0,0,0,0,0},
@@ -301,7 +302,7 @@ struct redisCommand redisCommandTable[] = {
     {"latency",latencyCommand,-2,"aslt",0,NULL,0,0,0,0,0}
 };
 
-struct evictionPoolEntry *evictionPoolAlloc(void);
+void evictionPoolAlloc(void);
 
 /*============================ Utility functions ============================ */
 
@@ -576,6 +577,26 @@ dictType shaScriptObjectDictType = {
     dictObjectDestructor   /* val destructor */
 };
 
+/* Interned strings table: sds -> shared string object. */
+dictType internDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    dictObjectDestructor        /* val destructor */
+};
+
+/* Interning candidates: sds -> occurrences, stored as unsigned integer. */
+dictType internCandidatesDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    NULL                        /* val destructor */
+};
+
 /* Db->expires */
 dictType keyptrDictType = {
     dictSdsHash,               /* hash function */
@@ -651,6 +672,17 @@ dictType migrateCacheDictType = {
     NULL                        /* val destructor */
 };
 
+/* Keys already saved or created during a fork-less snapshot. Keys are sds
+ * strings, values are not used. */
+dictType forklessKeysDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    NULL                        /* val destructor */
+};
+
 /* Replication cached script dict (server.repl_scriptcache_dict).
  * Keys are sds SHA1 strings, while values are not used at all in the current
  * implementation. */
@@ -709,10 +741,18 @@ int incrementallyRehash(int dbid) {
  * for dict.c to resize the hash tables accordingly to the fact we have o not
  * running childs. */
 void updateDictResizePolicy(void) {
-    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1)
+    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1) {
         dictEnableResize();
-    else
+        dictEnableRehash();
+    } else {
         dictDisableResize();
+        /* With bgsave-minimize-cow the rehashing steps performed by the
+         * lookups are suspended as well. */
+        if (server.bgsave_minimize_cow)
+            dictDisableRehash();
+        else
+            dictEnableRehash();
+    }
 }
 
 /* ======================= Cron: called every 100 ms ======================== */
@@ -784,6 +824,12 @@ void activeExpireCycle(int type) {
      * expires and evictions of keys not being performed. */
      if (clientsArePaused()) return;
 
+    /* With bgsave-minimize-cow, expired keys are not actively reclaimed
+     * while a child is saving, since freeing them writes to memory pages
+     * that would then be duplicated. They are still expired on access. */
+    if (server.bgsave_minimize_cow &&
+        (server.rdb_child_pid != -1 || server.aof_child_pid != -1)) return;
+
     if (type == ACTIVE_EXPIRE_CYCLE_FAST) {
         /* Don't start a fast cycle if the previous cycle did not exited
          * for time limt. Also don't repeat a fast cycle for the same period
@@ -1020,6 +1066,9 @@ void clientsCron(void) {
          * terminated. */
         if (clientsCronHandleTimeout(c,now)) continue;
         if (clientsCronResizeQueryBuffer(c)) continue;
+        /* Refresh the memory accounting of clients that don't send
+         * commands, like Pub/Sub clients receiving messages. */
+        updateClientMemUsage(c);
     }
 }
 
@@ -1047,8 +1096,9 @@ void databasesCron(void) {
         /* Don't test more DBs than we have. */
         if (dbs_per_call > server.dbnum) dbs_per_call = server.dbnum;
 
-        /* Resize */
-        for (j = 0; j < dbs_per_call; j++) {
+        /* Resize. Not while a fork-less snapshot is in progress: its
+         * dictScan() cursor survives tables growing, but not shrinking. */
+        for (j = 0; j < dbs_per_call && !server.rdb_forkless; j++) {
             tryResizeHashTables(resize_db % server.dbnum);
             resize_db++;
         }
@@ -1177,6 +1227,9 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     /* Handle background operations on Redis databases. */
     databasesCron();
 
+    /* Save the next part of the dataset if a fork-less BGSAVE is running. */
+    if (server.rdb_forkless) rdbForklessCron();
+
     /* Start a scheduled AOF rewrite if this was requested by the user while
      * a BGSAVE was in progress. */
     if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
@@ -1206,8 +1259,12 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
                     (int) server.aof_child_pid);
             } else if (pid == server.rdb_child_pid) {
                 backgroundSaveDoneHandler(exitcode,bysignal);
+                receiveChildInfo();
+                closeChildInfoPipe();
             } else if (pid == server.aof_child_pid) {
                 backgroundRewriteDoneHandler(exitcode,bysignal);
+                receiveChildInfo();
+                closeChildInfoPipe();
             } else {
                 if (!ldbRemoveChild(pid)) {
                     serverLog(LL_WARNING,
@@ -1217,7 +1274,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
             }
             updateDictResizePolicy();
         }
-    } else {
+    } else if (!server.rdb_forkless) {
         /* If there is not a background saving/rewrite in progress check if
          * we have to save/rewrite now */
          for (j = 0; j < server.saveparamslen; j++) {
@@ -1240,8 +1297,20 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
             }
          }
 
-         /* Trigger an AOF rewrite if needed */
+         /* Trigger an AOF rewrite if needed. The estimate of the dead bytes
+          * is used once known, that is, after the first rewrite. */
          if (server.rdb_child_pid == -1 &&
+             server.aof_child_pid == -1 &&
+             server.aof_rewrite_dead_perc &&
+             server.aof_current_size > server.aof_rewrite_min_size &&
+             aofDeadPercentage() != -1)
+         {
+            int dead = aofDeadPercentage();
+            if (dead >= server.aof_rewrite_dead_perc) {
+                serverLog(LL_NOTICE,"Starting automatic rewriting of AOF on %d%% dead bytes (estimated)",dead);
+                rewriteAppendOnlyFileBackground();
+            }
+         } else if (server.rdb_child_pid == -1 &&
              server.aof_child_pid == -1 &&
              server.aof_rewrite_perc &&
              server.aof_current_size > server.aof_rewrite_min_size)
@@ -1270,6 +1339,12 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
             flushAppendOnlyFile(0);
     }
 
+    /* Sample the dataset to estimate the dead bytes of the AOF. */
+    run_with_period(1000) {
+        if (server.aof_state == AOF_ON && server.aof_rewrite_dead_perc &&
+            !server.loading) aofSampleDataset();
+    }
+
     /* Close clients that need to be closed asynchronous */
     freeClientsInAsyncFreeQueue();
 
@@ -1303,7 +1378,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
      * make sure when refactoring this file to keep this order. This is useful
      * because we want to give priority to RDB savings for replication. */
     if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
-        server.rdb_bgsave_scheduled &&
+        !server.rdb_forkless && server.rdb_bgsave_scheduled &&
         (server.unixtime-server.lastbgsave_try > CONFIG_BGSAVE_RETRY_DELAY ||
          server.lastbgsave_status == C_OK))
     {
@@ -1356,6 +1431,10 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     if (listLength(server.unblocked_clients))
         processUnblockedClients();
 
+    /* Disconnect the clients using the most memory if the memory used by
+     * all the clients is over the maxmemory-clients limit. */
+    evictClientsIfNeeded();
+
     /* Write the AOF buffer on disk */
     flushAppendOnlyFile(0);
 
@@ -1473,6 +1552,8 @@ void initServerConfig(void) {
     server.sofd = -1;  // Unix socket文件描述符
     server.protected_mode = CONFIG_DEFAULT_PROTECTED_MODE;  // 保护模式开关，是否允许外部主机连接
     server.dbnum = CONFIG_DEFAULT_DBNUM;  // Redis server中db的个数
+    server.bio_close_file_workers = CONFIG_DEFAULT_BIO_WORKERS;  // 后台关闭文件任务的线程数
+    server.bio_aof_fsync_workers = CONFIG_DEFAULT_BIO_WORKERS;  // 后台AOF fsync任务的线程数
     server.verbosity = CONFIG_DEFAULT_VERBOSITY;  // 日志级别
     server.maxidletime = CONFIG_DEFAULT_CLIENT_TIMEOUT;  // 客户端超时时间，客户端空闲时间超过此值时服务器会断开和客户端的连接
     server.tcpkeepalive = CONFIG_DEFAULT_TCP_KEEPALIVE;  // tcp保活标志，当此值非零时，会设置SO_KEEPALIVE
@@ -1493,6 +1574,10 @@ void initServerConfig(void) {
     server.aof_rewrite_perc = AOF_REWRITE_PERC;  /* Rewrite AOF if % growth is > M and... */
     server.aof_rewrite_min_size = AOF_REWRITE_MIN_SIZE;  // AOF文件的最小大小
     server.aof_rewrite_base_size = 0;  // 上一次rewrite后AOF文件大小
+    server.aof_rewrite_dead_perc = AOF_REWRITE_DEAD_PERC;  // AOF中失效数据的估计比例超过该值时自动rewrite，0表示禁用
+    server.aof_dataset_estimate = 0;  // 抽样估计的数据集内存大小
+    server.aof_rewrite_dataset_estimate = 0;  // rewrite开始时估计的数据集内存大小
+    server.aof_live_ratio = 0;  // AOF字节数与数据集内存的比例，在rewrite完成后校准
     server.aof_rewrite_scheduled = 0;  // BGSAVE结束后开始rewrite
     server.aof_last_fsync = time(NULL);  // 上一次fsync()的UNIX时间戳
     server.aof_rewrite_time_last = -1;  // 上一次AOF rewrite耗时
@@ -1504,12 +1589,32 @@ void initServerConfig(void) {
     server.aof_flush_postponed_start = 0;  // AOF文件延迟刷新的时间
     server.aof_rewrite_incremental_fsync = CONFIG_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC;  // rewrite期间有fsync增量吗
     server.aof_load_truncated = CONFIG_DEFAULT_AOF_LOAD_TRUNCATED;  /* Don't stop on unexpected AOF EOF. */
+    server.aof_use_rdb_preamble = CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE;  // AOF重写时是否以RDB格式写入数据集
+    server.aof_multi_part = CONFIG_DEFAULT_AOF_MULTI_PART;  // AOF是否由manifest、base文件和incr文件组成
+    server.aof_group_commit = CONFIG_DEFAULT_AOF_GROUP_COMMIT;  // appendfsync always时是否合并多个客户端的fsync
+    server.aof_load_threaded = CONFIG_DEFAULT_AOF_LOAD_THREADED;  // 载入AOF时是否由单独的线程读取并解析命令
+    server.aof_format = CONFIG_DEFAULT_AOF_FORMAT;  // 追加到AOF的命令格式，RESP文本或二进制记录
+    server.aof_binary_compression = CONFIG_DEFAULT_AOF_BINARY_COMPRESSION;  // 二进制AOF数据块的压缩算法
+    server.aof_timestamp_enabled = CONFIG_DEFAULT_AOF_TIMESTAMP_ENABLED;  // 是否在AOF中记录时间戳注释，用于按时间点恢复
+    server.aof_cur_timestamp = 0;  // 最后一次写入AOF的时间戳
+    server.aof_writer_thread = CONFIG_DEFAULT_AOF_WRITER_THREAD;  // 是否由单独的写线程执行AOF的write
+    server.aof_writer_max_pending = CONFIG_DEFAULT_AOF_WRITER_MAX_PENDING;  // 等待写线程写入的最大字节数，超过时主线程等待
     server.pidfile = NULL;  // redis server的pid文件路径
     server.rdb_filename = zstrdup(CONFIG_DEFAULT_RDB_FILENAME);  // rdb文件名
     server.aof_filename = zstrdup(CONFIG_DEFAULT_AOF_FILENAME);  // aof文件名
     server.requirepass = NULL;  // AUTH命令的密码，为NULL即不需要密码
     server.rdb_compression = CONFIG_DEFAULT_RDB_COMPRESSION;  // 是否在rdb中使用压缩
+    server.rdb_compression_codec = CONFIG_DEFAULT_RDB_COMPRESSION_CODEC;  // rdb中使用的压缩算法
     server.rdb_checksum = CONFIG_DEFAULT_RDB_CHECKSUM;  // 是否使用rdb校验码
+    server.rdb_load_threads = CONFIG_DEFAULT_RDB_LOAD_THREADS;  // 载入rdb时解码值的线程数，0表示不使用
+    server.rdb_chunked = CONFIG_DEFAULT_RDB_CHUNKED;  // 是否将rdb文件分块保存并添加索引
+    server.rdb_list_compressed_nodes = CONFIG_DEFAULT_RDB_LIST_COMPRESSED_NODES;  // 是否按quicklist节点的内存形式（包括LZF压缩）保存列表
+    server.rdb_forkless_snapshot = CONFIG_DEFAULT_RDB_FORKLESS_SNAPSHOT;  // BGSAVE时是否不fork子进程而是增量保存
+    server.rdb_delta_snapshots = CONFIG_DEFAULT_RDB_DELTA_SNAPSHOTS;  // BGSAVE时是否只保存上次快照后修改过的键
+    server.rdb_delta_max_chain = CONFIG_DEFAULT_RDB_DELTA_MAX_CHAIN;  // 一个完整rdb之后最多链接的增量快照数
+    server.bgsave_minimize_cow = CONFIG_DEFAULT_BGSAVE_MINIMIZE_COW;  // 子进程保存数据时是否尽量避免写内存以减少写时复制
+    server.rdb_save_drop_cache = CONFIG_DEFAULT_RDB_SAVE_DROP_CACHE;  // 保存RDB时是否将写入的页从page cache中丢弃
+    server.rdb_save_max_rate = CONFIG_DEFAULT_RDB_SAVE_MAX_RATE;  // 子进程保存RDB时每秒最多写入的字节数，0表示不限制
     server.stop_writes_on_bgsave_err = CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR;  // 是否不允许在BGSAVE出错时写入
     server.activerehashing = CONFIG_DEFAULT_ACTIVE_REHASHING;  // serverCron()时是否可以执行增量哈希
     server.notify_keyspace_events = 0;  // 
@@ -1517,6 +1622,10 @@ void initServerConfig(void) {
     server.bpop_blocked_clients = 0;  // 被列表bpop命令阻塞住的客户端数 
     server.maxmemory = CONFIG_DEFAULT_MAXMEMORY;  // 最大使用内存量（字节）
     server.maxmemory_policy = CONFIG_DEFAULT_MAXMEMORY_POLICY;  // 在内存达到最大值时的key淘汰策略
+    server.maxmemory_clients = CONFIG_DEFAULT_MAXMEMORY_CLIENTS;  // 所有客户端可使用的最大内存量（字节）
+    server.small_objects_arena_size = CONFIG_DEFAULT_SMALL_OBJECTS_ARENA_SIZE;  // 小对象内存池的大小，0表示不使用
+    server.intern_max_entries = CONFIG_DEFAULT_INTERN_MAX_ENTRIES;  // 共享字符串的最大数量，0表示不使用
+    server.intern_max_len = CONFIG_DEFAULT_INTERN_MAX_LEN;  // 可共享字符串的最大长度
     server.maxmemory_samples = CONFIG_DEFAULT_MAXMEMORY_SAMPLES;
     server.hash_max_ziplist_entries = OBJ_HASH_MAX_ZIPLIST_ENTRIES;
     server.hash_max_ziplist_value = OBJ_HASH_MAX_ZIPLIST_VALUE;
@@ -1562,6 +1671,7 @@ void initServerConfig(void) {
     server.repl_master_initial_offset = -1;
     server.repl_state = REPL_STATE_NONE;
     server.repl_syncio_timeout = CONFIG_REPL_SYNCIO_TIMEOUT;
+    server.repl_diskless_load = CONFIG_DEFAULT_REPL_DISKLESS_LOAD;  // slave直接从socket加载RDB的模式
     server.repl_serve_stale_data = CONFIG_DEFAULT_SLAVE_SERVE_STALE_DATA;
     server.repl_slave_ro = CONFIG_DEFAULT_SLAVE_READ_ONLY;
     server.repl_down_since = 0; /* Never connected, repl is down since EVER. */
@@ -1862,9 +1972,15 @@ void resetServerStats(void) {
     server.stat_numconnections = 0;
     server.stat_expiredkeys = 0;
     server.stat_evictedkeys = 0;
+    server.stat_evictedclients = 0;
+    server.stat_intern_hits = 0;
     server.stat_keyspace_misses = 0;
     server.stat_keyspace_hits = 0;
     server.stat_fork_time = 0;
+    server.stat_rdb_cow_bytes = 0;
+    server.stat_aof_cow_bytes = 0;
+    server.stat_aof_group_fsyncs = 0;
+    server.stat_aof_writer_waits = 0;
     server.stat_fork_rate = 0;
     server.stat_rejected_conn = 0;
     server.stat_sync_full = 0;
@@ -1901,6 +2017,7 @@ void initServer(void) {
     server.clients_to_close = listCreate();  // 需要异步关闭的客户端列表
     server.slaves = listCreate();  // 从服务器列表
     server.monitors = listCreate();  // 监控服务器列表
+    server.clients_memory = 0;  // 普通客户端和订阅客户端占用的内存总量
     server.clients_pending_write = listCreate();  // 
     server.slaveseldb = -1; /* Force to emit the first SELECT command. */  // 
     server.unblocked_clients = listCreate();  // 在下一个事件循环中需要解锁的客户端列表
@@ -1949,21 +2066,46 @@ void initServer(void) {
         server.db[j].blocking_keys = dictCreate(&keylistDictType,NULL);
         server.db[j].ready_keys = dictCreate(&setDictType,NULL);
         server.db[j].watched_keys = dictCreate(&keylistDictType,NULL);
-        server.db[j].eviction_pool = evictionPoolAlloc();
         server.db[j].id = j;
         server.db[j].avg_ttl = 0;
     }
+    evictionPoolAlloc(); /* Initialize the LRU keys pool. */
+    server.interned_strings = dictCreate(&internDictType,NULL);  // 共享字符串表
+    server.intern_candidates = dictCreate(&internCandidatesDictType,NULL);  // 共享字符串候选表
     server.pubsub_channels = dictCreate(&keylistDictType,NULL);
     server.pubsub_patterns = listCreate();
     listSetFreeMethod(server.pubsub_patterns,freePubsubPattern);
     listSetMatchMethod(server.pubsub_patterns,listMatchPubsubPattern);
     server.cronloops = 0;
     server.rdb_child_pid = -1;
+    server.child_info_pipe[0] = -1;
+    server.child_info_pipe[1] = -1;
+    server.rdb_forkless = NULL;
+    server.rdb_forkless_preimages = 0;
+    server.rdb_delta = NULL;
+    server.rdb_delta_saving = NULL;
+    server.rdb_delta_base[0] = '\0';
+    server.rdb_delta_seq = 0;
+    server.rdb_delta_epoch = 0;
+    if (server.rdb_delta_snapshots) rdbDeltaEnable();
     server.aof_child_pid = -1;
     server.rdb_child_type = RDB_CHILD_TYPE_NONE;
     server.rdb_bgsave_scheduled = 0;
     aofRewriteBufferReset();  // 重置AOF rewrite buffer
     server.aof_buf = sdsempty();
+    server.aof_bin_block_start = -1;
+    server.aof_base = NULL;
+    server.aof_incrs = listCreate();
+    server.aof_base_seq = 0;
+    server.aof_incr_seq = 0;
+    server.aof_rewrite_incr_seq = 0;
+    server.aof_last_incr_size = 0;
+    server.aof_fed_offset = 0;
+    server.aof_written_offset = 0;
+    server.aof_fsynced_offset = 0;
+    server.aof_group_fsync_in_progress = 0;
+    server.aof_fsync_waiting = listCreate();
+    aofCreateFsyncPipe();
     server.lastsave = time(NULL); /* At startup we consider the DB saved. */
     server.lastbgsave_try = 0;    /* At startup we never tried to BGSAVE. */
     server.rdb_save_time_last = -1;
@@ -2004,7 +2146,9 @@ void initServer(void) {
 
     /* Open the AOF file if needed. */
     /* 在需要时打开AOF文件 */
-    if (server.aof_state == AOF_ON) {
+    if (server.aof_state == AOF_ON && server.aof_multi_part) {
+        aofOpenMultiPart();
+    } else if (server.aof_state == AOF_ON) {
         server.aof_fd = open(server.aof_filename,
                                O_WRONLY|O_APPEND|O_CREAT,0644);
         if (server.aof_fd == -1) {
@@ -2262,6 +2406,7 @@ void preventCommandReplication(client *c) {
  */
 void call(client *c, int flags) {
     long long dirty, start, duration;
+    long long aof_offset = server.aof_fed_offset;
     int client_old_flags = c->flags;
 
     /* Sent the command to clients in MONITOR mode, only if the commands are
@@ -2371,6 +2516,11 @@ void call(client *c, int flags) {
         }
         redisOpArrayFree(&server.also_propagate);
     }
+
+    /* With AOF group commit, the reply to a command that was logged into
+     * the AOF is released only once it is fsynced. */
+    if (server.aof_fed_offset != aof_offset && aofGroupCommitEnabled())
+        aofClientWaitFsync(c);
     server.stat_numcommands++;
 }
 
@@ -2602,6 +2752,10 @@ int prepareForShutdown(int flags) {
         kill(server.rdb_child_pid,SIGUSR1);
         rdbRemoveTempFile(server.rdb_child_pid);
     }
+    if (server.rdb_forkless) {
+        serverLog(LL_WARNING,"There is a fork-less snapshot in progress. Aborting it!");
+        rdbForklessAbort();
+    }
 
     if (server.aof_state != AOF_OFF) {
         /* Kill the AOF saving child as the AOF we already have may be longer
@@ -2961,10 +3115,12 @@ sds genRedisInfoString(char *section) {
             "connected_clients:%lu\r\n"
             "client_longest_output_list:%lu\r\n"
             "client_biggest_input_buf:%lu\r\n"
-            "blocked_clients:%d\r\n",
+            "blocked_clients:%d\r\n"
+            "clients_memory:%zu\r\n",
             listLength(server.clients)-listLength(server.slaves),
             lol, bib,
-            server.bpop_blocked_clients);
+            server.bpop_blocked_clients,
+            server.clients_memory);
     }
 
     /* Memory */
@@ -3010,6 +3166,9 @@ sds genRedisInfoString(char *section) {
             "maxmemory:%lld\r\n"
             "maxmemory_human:%s\r\n"
             "maxmemory_policy:%s\r\n"
+            "maxmemory_clients:%llu\r\n"
+            "small_objects_arena_allocated:%zu\r\n"
+            "interned_strings:%lu\r\n"
             "mem_fragmentation_ratio:%.2f\r\n"
             "mem_allocator:%s\r\n",
             zmalloc_used,
@@ -3025,6 +3184,9 @@ sds genRedisInfoString(char *section) {
             server.maxmemory,
             maxmemory_hmem,
             evict_policy,
+            server.maxmemory_clients,
+            zmalloc_arena_allocated(),
+            dictSize(server.interned_strings),
             zmalloc_get_fragmentation_ratio(server.resident_set_size),
             ZMALLOC_LIB
             );
@@ -3042,21 +3204,30 @@ sds genRedisInfoString(char *section) {
             "rdb_last_bgsave_status:%s\r\n"
             "rdb_last_bgsave_time_sec:%jd\r\n"
             "rdb_current_bgsave_time_sec:%jd\r\n"
+            "rdb_forkless_preimages:%lld\r\n"
+            "rdb_delta_chain_len:%d\r\n"
+            "rdb_delta_tracked_keys:%lld\r\n"
+            "rdb_last_cow_size:%zu\r\n"
             "aof_enabled:%d\r\n"
             "aof_rewrite_in_progress:%d\r\n"
             "aof_rewrite_scheduled:%d\r\n"
             "aof_last_rewrite_time_sec:%jd\r\n"
             "aof_current_rewrite_time_sec:%jd\r\n"
             "aof_last_bgrewrite_status:%s\r\n"
-            "aof_last_write_status:%s\r\n",
+            "aof_last_write_status:%s\r\n"
+            "aof_last_cow_size:%zu\r\n",
             server.loading,
             server.dirty,
-            server.rdb_child_pid != -1,
+            server.rdb_child_pid != -1 || server.rdb_forkless != NULL,
             (intmax_t)server.lastsave,
             (server.lastbgsave_status == C_OK) ? "ok" : "err",
             (intmax_t)server.rdb_save_time_last,
-            (intmax_t)((server.rdb_child_pid == -1) ?
+            (intmax_t)((server.rdb_child_pid == -1 && !server.rdb_forkless) ?
                 -1 : time(NULL)-server.rdb_save_time_start),
+            server.rdb_forkless_preimages,
+            server.rdb_delta_seq,
+            rdbDeltaTrackedKeys(),
+            server.stat_rdb_cow_bytes,
             server.aof_state != AOF_OFF,
             server.aof_child_pid != -1,
             server.aof_rewrite_scheduled,
@@ -3064,7 +3235,8 @@ sds genRedisInfoString(char *section) {
             (intmax_t)((server.aof_child_pid == -1) ?
                 -1 : time(NULL)-server.aof_rewrite_time_start),
             (server.aof_lastbgrewrite_status == C_OK) ? "ok" : "err",
-            (server.aof_last_write_status == C_OK) ? "ok" : "err");
+            (server.aof_last_write_status == C_OK) ? "ok" : "err",
+            server.stat_aof_cow_bytes);
 
         if (server.aof_state != AOF_OFF) {
             info = sdscatprintf(info,
@@ -3074,14 +3246,29 @@ sds genRedisInfoString(char *section) {
                 "aof_buffer_length:%zu\r\n"
                 "aof_rewrite_buffer_length:%lu\r\n"
                 "aof_pending_bio_fsync:%llu\r\n"
-                "aof_delayed_fsync:%lu\r\n",
+                "aof_delayed_fsync:%lu\r\n"
+                "aof_group_fsyncs:%lld\r\n"
+                "aof_fsync_waiting_clients:%lu\r\n"
+                "aof_writer_pending_bytes:%zu\r\n"
+                "aof_writer_backpressure_waits:%lld\r\n"
+                "aof_live_bytes_estimate:%lld\r\n"
+                "aof_dead_bytes_estimate:%lld\r\n"
+                "aof_dead_percentage_estimate:%d\r\n",
                 (long long) server.aof_current_size,
                 (long long) server.aof_rewrite_base_size,
                 server.aof_rewrite_scheduled,
                 sdslen(server.aof_buf),
                 aofRewriteBufferSize(),
                 bioPendingJobsOfType(BIO_AOF_FSYNC),
-                server.aof_delayed_fsync);
+                server.aof_delayed_fsync,
+                server.stat_aof_group_fsyncs,
+                listLength(server.aof_fsync_waiting),
+                aofWriterPendingBytes(),
+                server.stat_aof_writer_waits,
+                aofLiveBytesEstimate(),
+                aofLiveBytesEstimate() == -1 ? -1 :
+                    (long long) server.aof_current_size-aofLiveBytesEstimate(),
+                aofDeadPercentage());
         }
 
         if (server.loading) {
@@ -3134,6 +3321,8 @@ sds genRedisInfoString(char *section) {
             "sync_partial_err:%lld\r\n"
             "expired_keys:%lld\r\n"
             "evicted_keys:%lld\r\n"
+            "evicted_clients:%lld\r\n"
+            "intern_hits:%lld\r\n"
             "keyspace_hits:%lld\r\n"
             "keyspace_misses:%lld\r\n"
             "pubsub_channels:%ld\r\n"
@@ -3153,6 +3342,8 @@ sds genRedisInfoString(char *section) {
             server.stat_sync_partial_err,
             server.stat_expiredkeys,
             server.stat_evictedkeys,
+            server.stat_evictedclients,
+            server.stat_intern_hits,
             server.stat_keyspace_hits,
             server.stat_keyspace_misses,
             dictSize(server.pubsub_channels),
@@ -3298,6 +3489,13 @@ sds genRedisInfoString(char *section) {
         (float)c_ru.ru_utime.tv_sec+(float)c_ru.ru_utime.tv_usec/1000000);
     }
 
+    /* Background jobs */
+    if (allsections || defsections || !strcasecmp(section,"bio")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscat(info,"# Bio\r\n");
+        info = bioGenInfoString(info);
+    }
+
     /* cmdtime */
     if (allsections || !strcasecmp(section,"commandstats")) {
         if (sections++) info = sdscat(info,"\r\n");
@@ -3387,6 +3585,8 @@ void monitorCommand(client *c) {
  * memory. Every time there is a key to expire, we sample N keys (with
  * N very small, usually in around 5) to populate a pool of best keys to
  * evict of M keys (the pool size is defined by MAXMEMORY_EVICTION_POOL_SIZE).
+ * Keys are sampled from every DB into the same pool, so the key evicted is
+ * the best candidate across all the DBs.
  *
  * The N keys sampled are added in the pool of good keys to expire (the one
  * with an old access time) if they are better than one of the current keys
@@ -3401,8 +3601,12 @@ void monitorCommand(client *c) {
  * one key that can be evicted, if there is at least one key that can be
  * evicted in the whole database. */
 
-/* Create a new eviction pool. */
-struct evictionPoolEntry *evictionPoolAlloc(void) {
+static struct evictionPoolEntry *EvictionPoolLRU;
+
+/* Create a new eviction pool. Every entry preallocates an SDS string used
+ * to store the key name, so that populating the pool does not require
+ * allocating and freeing memory most of the times. */
+void evictionPoolAlloc(void) {
     struct evictionPoolEntry *ep;
     int j;
 
@@ -3410,8 +3614,10 @@ struct evictionPoolEntry *evictionPoolAlloc(void) {
     for (j = 0; j < MAXMEMORY_EVICTION_POOL_SIZE; j++) {
         ep[j].idle = 0;
         ep[j].key = NULL;
+        ep[j].cached = sdsnewlen(NULL,EVPOOL_CACHED_SDS_SIZE);
+        ep[j].dbid = 0;
     }
-    return ep;
+    EvictionPoolLRU = ep;
 }
 
 /* This is an helper function for freeMemoryIfNeeded(), it is used in order
@@ -3424,7 +3630,7 @@ struct evictionPoolEntry *evictionPoolAlloc(void) {
  * right. */
 
 #define EVICTION_SAMPLES_ARRAY_SIZE 16
-void evictionPoolPopulate(dict *sampledict, dict *keydict, struct evictionPoolEntry *pool) {
+void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evictionPoolEntry *pool) {
     int j, k, count;
     dictEntry *_samples[EVICTION_SAMPLES_ARRAY_SIZE];
     dictEntry **samples;
@@ -3472,19 +3678,38 @@ void evictionPoolPopulate(dict *sampledict, dict *keydict, struct evictionPoolEn
             if (pool[MAXMEMORY_EVICTION_POOL_SIZE-1].key == NULL) {
                 /* Free space on the right? Insert at k shifting
                  * all the elements from k to end to the right. */
+
+                /* Save SDS before overwriting. */
+                sds cached = pool[MAXMEMORY_EVICTION_POOL_SIZE-1].cached;
                 memmove(pool+k+1,pool+k,
                     sizeof(pool[0])*(MAXMEMORY_EVICTION_POOL_SIZE-k-1));
+                pool[k].cached = cached;
             } else {
                 /* No free space on right? Insert at k-1 */
                 k--;
                 /* Shift all elements on the left of k (included) to the
                  * left, so we discard the element with smaller idle time. */
-                sdsfree(pool[0].key);
+                sds cached = pool[0].cached; /* Save SDS before overwriting. */
+                if (pool[0].key != pool[0].cached) sdsfree(pool[0].key);
                 memmove(pool,pool+1,sizeof(pool[0])*k);
+                pool[k].cached = cached;
             }
         }
-        pool[k].key = sdsdup(key);
+
+        /* Try to reuse the cached SDS string allocated in the pool entry,
+         * since this function is called very often and allocating and
+         * freeing the key name every time showed up in the profiler.
+         * Only keys longer than the cached buffer are duplicated. */
+        int klen = sdslen(key);
+        if (klen > EVPOOL_CACHED_SDS_SIZE) {
+            pool[k].key = sdsdup(key);
+        } else {
+            memcpy(pool[k].cached,key,klen+1);
+            sdssetlen(pool[k].cached,klen);
+            pool[k].key = pool[k].cached;
+        }
         pool[k].idle = idle;
+        pool[k].dbid = dbid;
     }
     if (samples != _samples) zfree(samples);
 }
@@ -3493,6 +3718,7 @@ int freeMemoryIfNeeded(void) {
     size_t mem_used, mem_tofree, mem_freed;
     int slaves = listLength(server.slaves);
     mstime_t latency, eviction_latency;
+    long long delta;
 
     /* When clients are paused the dataset should be static not just from the
      * POV of clients not being able to write, but also from the POV of
@@ -3521,6 +3747,16 @@ int freeMemoryIfNeeded(void) {
         mem_used -= aofRewriteBufferSize();
     }
 
+    /* When maxmemory-clients is set the memory used by normal and Pub/Sub
+     * clients has its own budget, enforced disconnecting clients, so it
+     * should not cause keys to be evicted. */
+    if (server.maxmemory_clients) {
+        if (server.clients_memory > mem_used)
+            mem_used = 0;
+        else
+            mem_used -= server.clients_memory;
+    }
+
     /* Check if we are over the memory limit. */
     if (mem_used <= server.maxmemory) return C_OK;
 
@@ -3532,70 +3768,107 @@ int freeMemoryIfNeeded(void) {
     mem_freed = 0;
     latencyStartMonitor(latency);
     while (mem_freed < mem_tofree) {
-        int j, k, keys_freed = 0;
+        int j, k, i;
+        static int next_db = 0;
+        sds bestkey = NULL;
+        int bestdbid = 0;
+        redisDb *db;
+        dict *dict;
+        dictEntry *de;
 
-        for (j = 0; j < server.dbnum; j++) {
-            long bestval = 0; /* just to prevent warning */
-            sds bestkey = NULL;
-            dictEntry *de;
-            redisDb *db = server.db+j;
-            dict *dict;
+        /* volatile-lru and allkeys-lru policy */
+        if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_LRU ||
+            server.maxmemory_policy == MAXMEMORY_VOLATILE_LRU)
+        {
+            struct evictionPoolEntry *pool = EvictionPoolLRU;
+
+            while(bestkey == NULL) {
+                unsigned long total_keys = 0, keys;
+                int first = -1;
+
+                /* We don't want to make local-db choices when expiring keys,
+                 * so to start populate the eviction pool sampling keys from
+                 * every DB. The idle time has a resolution of one second,
+                 * and on ties the keys sampled first are evicted first, so
+                 * every time we start from the DB after the one sampled
+                 * first the previous time: otherwise the first DBs would
+                 * lose more keys than the others. */
+                for (i = 0; i < server.dbnum; i++) {
+                    j = (next_db+i) % server.dbnum;
+                    db = server.db+j;
+                    dict = (server.maxmemory_policy == MAXMEMORY_ALLKEYS_LRU) ?
+                            db->dict : db->expires;
+                    if ((keys = dictSize(dict)) != 0) {
+                        if (first == -1) first = j;
+                        evictionPoolPopulate(j, dict, db->dict, pool);
+                        total_keys += keys;
+                    }
+                }
+                if (!total_keys) break; /* No keys to evict. */
+                next_db = (first+1) % server.dbnum;
+
+                /* Go backward from best to worst element to evict. */
+                for (k = MAXMEMORY_EVICTION_POOL_SIZE-1; k >= 0; k--) {
+                    if (pool[k].key == NULL) continue;
+                    bestdbid = pool[k].dbid;
+
+                    if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_LRU) {
+                        de = dictFind(server.db[pool[k].dbid].dict,
+                            pool[k].key);
+                    } else {
+                        de = dictFind(server.db[pool[k].dbid].expires,
+                            pool[k].key);
+                    }
 
-            if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_LRU ||
-                server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM)
-            {
-                dict = server.db[j].dict;
-            } else {
-                dict = server.db[j].expires;
+                    /* Remove the entry from the pool. */
+                    if (pool[k].key != pool[k].cached)
+                        sdsfree(pool[k].key);
+                    pool[k].key = NULL;
+                    pool[k].idle = 0;
+
+                    /* If the key exists, is our pick. Otherwise it is
+                     * a ghost and we need to try the next element. */
+                    if (de) {
+                        bestkey = dictGetKey(de);
+                        break;
+                    } else {
+                        /* Ghost... Iterate again. */
+                    }
+                }
             }
-            if (dictSize(dict) == 0) continue;
+        }
 
-            /* volatile-random and allkeys-random policy */
-            if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM ||
-                server.maxmemory_policy == MAXMEMORY_VOLATILE_RANDOM)
-            {
-                de = dictGetRandomKey(dict);
-                bestkey = dictGetKey(de);
+        /* volatile-random and allkeys-random policy */
+        else if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM ||
+                 server.maxmemory_policy == MAXMEMORY_VOLATILE_RANDOM)
+        {
+            /* When evicting a random key, we try to evict a key for
+             * each DB, so we use the static 'next_db' variable to
+             * incrementally visit all DBs. */
+            for (i = 0; i < server.dbnum; i++) {
+                j = (++next_db) % server.dbnum;
+                db = server.db+j;
+                dict = (server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM) ?
+                        db->dict : db->expires;
+                if (dictSize(dict) != 0) {
+                    de = dictGetRandomKey(dict);
+                    bestkey = dictGetKey(de);
+                    bestdbid = j;
+                    break;
+                }
             }
+        }
 
-            /* volatile-lru and allkeys-lru policy */
-            else if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_LRU ||
-                server.maxmemory_policy == MAXMEMORY_VOLATILE_LRU)
-            {
-                struct evictionPoolEntry *pool = db->eviction_pool;
+        /* volatile-ttl */
+        else if (server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL) {
+            long bestval = 0; /* just to prevent warning */
 
-                while(bestkey == NULL) {
-                    evictionPoolPopulate(dict, db->dict, db->eviction_pool);
-                    /* Go backward from best to worst element to evict. */
-                    for (k = MAXMEMORY_EVICTION_POOL_SIZE-1; k >= 0; k--) {
-                        if (pool[k].key == NULL) continue;
-                        de = dictFind(dict,pool[k].key);
+            /* Sample keys from every DB and pick the one that will expire
+             * sooner among all the DBs. */
+            for (i = 0; i < server.dbnum; i++) {
+                dict = server.db[i].expires;
+                if (dictSize(dict) == 0) continue;
 
-                        /* Remove the entry from the pool. */
-                        sdsfree(pool[k].key);
-                        /* Shift all elements on its right to left. */
-                        memmove(pool+k,pool+k+1,
-                            sizeof(pool[0])*(MAXMEMORY_EVICTION_POOL_SIZE-k-1));
-                        /* Clear the element on the right which is empty
-                         * since we shifted one position to the left.  */
-                        pool[MAXMEMORY_EVICTION_POOL_SIZE-1].key = NULL;
-                        pool[MAXMEMORY_EVICTION_POOL_SIZE-1].idle = 0;
-
-                        /* If the key exists, is our pick. Otherwise it is
-                         * a ghost and we need to try the next element. */
-                        if (de) {
-                            bestkey = dictGetKey(de);
-                            break;
-                        } else {
-                            /* Ghost... */
-                            continue;
-                        }
-                    }
-                }
-            }
-
-            /* volatile-ttl */
-            else if (server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL) {
                 for (k = 0; k < server.maxmemory_samples; k++) {
                     sds thiskey;
                     long thisval;
@@ -3609,46 +3882,44 @@ int freeMemoryIfNeeded(void) {
                     if (bestkey == NULL || thisval < bestval) {
                         bestkey = thiskey;
                         bestval = thisval;
+                        bestdbid = i;
                     }
                 }
             }
-
-            /* Finally remove the selected key. */
-            if (bestkey) {
-                long long delta;
-
-                robj *keyobj = createStringObject(bestkey,sdslen(bestkey));
-                propagateExpire(db,keyobj);
-                /* We compute the amount of memory freed by dbDelete() alone.
-                 * It is possible that actually the memory needed to propagate
-                 * the DEL in AOF and replication link is greater than the one
-                 * we are freeing removing the key, but we can't account for
-                 * that otherwise we would never exit the loop.
-                 *
-                 * AOF and Output buffer memory will be freed eventually so
-                 * we only care about memory used by the key space. */
-                delta = (long long) zmalloc_used_memory();
-                latencyStartMonitor(eviction_latency);
-                dbDelete(db,keyobj);
-                latencyEndMonitor(eviction_latency);
-                latencyAddSampleIfNeeded("eviction-del",eviction_latency);
-                latencyRemoveNestedEvent(latency,eviction_latency);
-                delta -= (long long) zmalloc_used_memory();
-                mem_freed += delta;
-                server.stat_evictedkeys++;
-                notifyKeyspaceEvent(NOTIFY_EVICTED, "evicted",
-                    keyobj, db->id);
-                decrRefCount(keyobj);
-                keys_freed++;
-
-                /* When the memory to free starts to be big enough, we may
-                 * start spending so much time here that is impossible to
-                 * deliver data to the slaves fast enough, so we force the
-                 * transmission here inside the loop. */
-                if (slaves) flushSlavesOutputBuffers();
-            }
         }
-        if (!keys_freed) {
+
+        /* Finally remove the selected key. */
+        if (bestkey) {
+            db = server.db+bestdbid;
+            robj *keyobj = createStringObject(bestkey,sdslen(bestkey));
+            propagateExpire(db,keyobj);
+            /* We compute the amount of memory freed by dbDelete() alone.
+             * It is possible that actually the memory needed to propagate
+             * the DEL in AOF and replication link is greater than the one
+             * we are freeing removing the key, but we can't account for
+             * that otherwise we would never exit the loop.
+             *
+             * AOF and Output buffer memory will be freed eventually so
+             * we only care about memory used by the key space. */
+            delta = (long long) zmalloc_used_memory();
+            latencyStartMonitor(eviction_latency);
+            dbDelete(db,keyobj);
+            latencyEndMonitor(eviction_latency);
+            latencyAddSampleIfNeeded("eviction-del",eviction_latency);
+            latencyRemoveNestedEvent(latency,eviction_latency);
+            delta -= (long long) zmalloc_used_memory();
+            mem_freed += delta;
+            server.stat_evictedkeys++;
+            notifyKeyspaceEvent(NOTIFY_EVICTED, "evicted",
+                keyobj, db->id);
+            decrRefCount(keyobj);
+
+            /* When the memory to free starts to be big enough, we may
+             * start spending so much time here that is impossible to
+             * deliver data to the slaves fast enough, so we force the
+             * transmission here inside the loop. */
+            if (slaves) flushSlavesOutputBuffers();
+        } else {
             latencyEndMonitor(latency);
             latencyAddSampleIfNeeded("eviction-cycle",latency);
             return C_ERR; /* nothing to free... */
@@ -3847,12 +4118,13 @@ int checkForSentinelMode(int argc, char **argv) {
 void loadDataFromDisk(void) {
     long long start = ustime();
     if (server.aof_state == AOF_ON) {
-        if (loadAppendOnlyFile(server.aof_filename) == C_OK)
+        if (loadAppendOnlyFiles() == C_OK)
             serverLog(LL_NOTICE,"DB loaded from append only file: %.3f seconds",(float)(ustime()-start)/1000000);
     } else {
         if (rdbLoad(server.rdb_filename) == C_OK) {
             serverLog(LL_NOTICE,"DB loaded from disk: %.3f seconds",
                 (float)(ustime()-start)/1000000);
+            rdbDeltaLoadChain();
         } else if (errno != ENOENT) {
             serverLog(LL_WARNING,"Fatal error loading the DB: %s. Exiting.",strerror(errno));
             exit(1);
@@ -4114,7 +4386,18 @@ int main(int argc, char **argv) {
     int background = server.daemonize && !server.supervised;
     if (background) daemonize();
 
+    /* Reserve the small objects arena before creating any object. */
+    if (server.small_objects_arena_size &&
+        zmalloc_arena_init(server.small_objects_arena_size) == -1)
+    {
+        serverLog(LL_WARNING,
+            "Can't reserve %llu bytes for the small objects arena: %s. "
+            "Small objects will be allocated with the default allocator.",
+            server.small_objects_arena_size, strerror(errno));
+    }
+
     initServer();
+    server.initial_memory_usage = zmalloc_used_memory();
     if (background || server.pidfile) createPidFile();
     redisSetProcTitle(argv[0]);
     redisAsciiArt();
@@ -82,15 +82,19 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_TCP_BACKLOG       511     /* TCP listen backlog */
 #define CONFIG_DEFAULT_CLIENT_TIMEOUT       0       /* default client timeout: infinite */
 #define CONFIG_DEFAULT_DBNUM     16
+#define CONFIG_DEFAULT_BIO_WORKERS 1
 #define CONFIG_MAX_LINE    1024
 #define CRON_DBS_PER_CALL 16
 #define NET_MAX_WRITES_PER_EVENT (1024*64)
 #define PROTO_SHARED_SELECT_CMDS 10
 #define OBJ_SHARED_INTEGERS 10000
 #define OBJ_SHARED_BULKHDR_LEN 32
+#define OBJ_INTERN_PROMOTE_COUNT 4 /* Occurrences needed to intern a string */
+#define OBJ_INTERN_CANDIDATES_RATIO 4 /* Max candidates per intern-max-entries */
 #define LOG_MAX_LEN    1024 /* Default maximum length of syslog messages */
 #define AOF_REWRITE_PERC  100
 #define AOF_REWRITE_MIN_SIZE (64*1024*1024)
+#define AOF_REWRITE_DEAD_PERC 0
 #define AOF_REWRITE_ITEMS_PER_CMD 64
 #define CONFIG_DEFAULT_SLOWLOG_LOG_SLOWER_THAN 10000
 #define CONFIG_DEFAULT_SLOWLOG_MAX_LEN 128
@@ -117,6 +121,17 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR 1
 #define CONFIG_DEFAULT_RDB_COMPRESSION 1
 #define CONFIG_DEFAULT_RDB_CHECKSUM 1
+#define CONFIG_DEFAULT_RDB_LOAD_THREADS 0
+#define CONFIG_DEFAULT_RDB_CHUNKED 0
+#define CONFIG_DEFAULT_RDB_LIST_COMPRESSED_NODES 0
+#define CONFIG_DEFAULT_RDB_FORKLESS_SNAPSHOT 0
+#define CONFIG_DEFAULT_RDB_DELTA_SNAPSHOTS 0
+#define CONFIG_DEFAULT_RDB_DELTA_MAX_CHAIN 10
+#define CONFIG_MAX_RDB_DELTA_MAX_CHAIN 1000
+#define CONFIG_DEFAULT_BGSAVE_MINIMIZE_COW 0
+#define CONFIG_DEFAULT_RDB_SAVE_DROP_CACHE 0
+#define CONFIG_DEFAULT_RDB_SAVE_MAX_RATE 0
+#define CONFIG_MAX_RDB_LOAD_THREADS 64
 #define CONFIG_DEFAULT_RDB_FILENAME "dump.rdb"
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC 0
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY 5
@@ -126,10 +141,22 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_SLAVE_ANNOUNCE_PORT 0
 #define CONFIG_DEFAULT_REPL_DISABLE_TCP_NODELAY 0
 #define CONFIG_DEFAULT_MAXMEMORY 0
+#define CONFIG_DEFAULT_MAXMEMORY_CLIENTS 0
+#define CONFIG_DEFAULT_SMALL_OBJECTS_ARENA_SIZE 0
+#define CONFIG_DEFAULT_INTERN_MAX_ENTRIES 0
+#define CONFIG_MAX_INTERN_MAX_ENTRIES 1000000
+#define CONFIG_DEFAULT_INTERN_MAX_LEN 32
 #define CONFIG_DEFAULT_MAXMEMORY_SAMPLES 5
 #define CONFIG_DEFAULT_AOF_FILENAME "appendonly.aof"
 #define CONFIG_DEFAULT_AOF_NO_FSYNC_ON_REWRITE 0
 #define CONFIG_DEFAULT_AOF_LOAD_TRUNCATED 1
+#define CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE 0
+#define CONFIG_DEFAULT_AOF_MULTI_PART 0
+#define CONFIG_DEFAULT_AOF_GROUP_COMMIT 0
+#define CONFIG_DEFAULT_AOF_LOAD_THREADED 0
+#define CONFIG_DEFAULT_AOF_TIMESTAMP_ENABLED 0
+#define CONFIG_DEFAULT_AOF_WRITER_THREAD 0
+#define CONFIG_DEFAULT_AOF_WRITER_MAX_PENDING (64*1024*1024)
 #define CONFIG_DEFAULT_ACTIVE_REHASHING 1
 #define CONFIG_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC 1
 #define CONFIG_DEFAULT_MIN_SLAVES_TO_WRITE 0
@@ -161,6 +188,13 @@ typedef long long mstime_t; /* millisecond time type. */
 #define PROTO_MBULK_BIG_ARG     (1024*32)
 #define LONG_STR_SIZE      21          /* Bytes needed for long -> str + '\0' */
 #define AOF_AUTOSYNC_BYTES (1024*1024*32) /* fdatasync every 32MB */
+#define AOF_READ_DIFF_INTERVAL_BYTES (1024*10) /* Read parent diffs every 10k */
+#define RDB_AUTOSYNC_BYTES (1024*1024*32) /* fdatasync every 32MB */
+
+/* Child info pipe. */
+#define CHILD_INFO_MAGIC 0xC17DDA7A12345678LL
+#define CHILD_INFO_TYPE_RDB 0
+#define CHILD_INFO_TYPE_AOF 1
 
 /* When configuring the server eventloop, we setup it so that the total number
  * of file descriptors we can handle are server.maxclients + RESERVED_FDS +
@@ -305,6 +339,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CLIENT_REPLY_SKIP (1<<24)  /* Don't send just this reply. */
 #define CLIENT_LUA_DEBUG (1<<25)  /* Run EVAL in debug mode. */
 #define CLIENT_LUA_DEBUG_SYNC (1<<26)  /* EVAL debugging without fork() */
+#define CLIENT_AOF_FSYNC_WAIT (1<<27) /* Replies wait for the AOF group fsync. */
 
 /* Client block type (btype field in client structure)
  * if CLIENT_BLOCKED flag is set. */
@@ -396,6 +431,24 @@ typedef long long mstime_t; /* millisecond time type. */
 #define AOF_FSYNC_EVERYSEC 2
 #define CONFIG_DEFAULT_AOF_FSYNC AOF_FSYNC_EVERYSEC
 
+/* AOF formats (aof-format option). The codecs used to compress the blocks
+ * of the binary format are the AOF_BIN_CODEC_* defined in aofbin.h. */
+#define AOF_FORMAT_RESP 0
+#define AOF_FORMAT_BINARY 1
+#define CONFIG_DEFAULT_AOF_FORMAT AOF_FORMAT_RESP
+#define CONFIG_DEFAULT_AOF_BINARY_COMPRESSION 1 /* AOF_BIN_CODEC_LZF */
+
+/* RDB compression codecs */
+#define RDB_CODEC_LZF 0
+#define RDB_CODEC_LZ4 1
+#define CONFIG_DEFAULT_RDB_COMPRESSION_CODEC RDB_CODEC_LZF
+
+/* Slave diskless load modes (repl-diskless-load). */
+#define REPL_DISKLESS_LOAD_DISABLED 0
+#define REPL_DISKLESS_LOAD_WHEN_DB_EMPTY 1
+#define REPL_DISKLESS_LOAD_SWAPDB 2
+#define CONFIG_DEFAULT_REPL_DISKLESS_LOAD REPL_DISKLESS_LOAD_DISABLED
+
 /* Zip structure related defaults */
 #define OBJ_HASH_MAX_ZIPLIST_ENTRIES 512
 #define OBJ_HASH_MAX_ZIPLIST_VALUE 64
@@ -535,11 +588,17 @@ typedef struct redisObject {
  * Entries inside the eviciton pool are taken ordered by idle time, putting
  * greater idle times to the right (ascending order).
  *
+ * A single pool is shared by all the databases, so that the best candidate
+ * is selected globally and not just inside a given database.
+ *
  * Empty entries have the key pointer set to NULL. */
 #define MAXMEMORY_EVICTION_POOL_SIZE 16
+#define EVPOOL_CACHED_SDS_SIZE 255
 struct evictionPoolEntry {
     unsigned long long idle;    /* Object idle time. */
     sds key;                    /* Key name. */
+    sds cached;                 /* Cached SDS object for key name. */
+    int dbid;                   /* Key DB number. */
 };
 
 /* Redis database representation. There are multiple databases identified
@@ -563,9 +622,6 @@ typedef struct redisDb {
     // 使用MULTI/EXEC监控的key字典
     dict *watched_keys;         /* WATCHED keys for MULTI/EXEC CAS */
 
-    // 
-    struct evictionPoolEntry *eviction_pool;    /* Eviction pool of keys */
-
     // 数据库id
     int id;                     /* Database ID */
 
@@ -666,10 +722,12 @@ typedef struct client {
     int btype;              /* Type of blocking op if CLIENT_BLOCKED. */
     blockingState bpop;     /* blocking state */
     long long woff;         /* Last write global replication offset. */
+    long long aof_fsync_offset; /* AOF offset to fsync to release replies. */
     list *watched_keys;     /* Keys WATCHED for MULTI/EXEC CAS */
     dict *pubsub_channels;  /* channels a client is interested in (SUBSCRIBE) */
     list *pubsub_patterns;  /* patterns a client is interested in (SUBSCRIBE) */
     sds peerid;             /* Cached peer ID. */
+    size_t last_memory_usage; /* Memory accounted in server.clients_memory */
 
     /* Response buffer */
     int bufpos;
@@ -721,6 +779,18 @@ typedef struct zset {
     zskiplist *zsl;
 } zset;
 
+/* A file of a multi part AOF (see the aof-multi-part option): the base file
+ * produced by the latest rewrite, or one of the incremental files logging
+ * the writes performed after it. The files are listed in the manifest. */
+#define AOF_PART_BASE 'b'
+#define AOF_PART_INCR 'i'
+
+typedef struct aofPart {
+    sds filename;
+    long long seq;
+    int type;                       /* AOF_PART_BASE or AOF_PART_INCR. */
+} aofPart;
+
 typedef struct clientBufferLimitsConfig {
     unsigned long long hard_limit_bytes;
     unsigned long long soft_limit_bytes;
@@ -753,6 +823,31 @@ typedef struct redisOpArray {
     int numops;
 } redisOpArray;
 
+/* This structure is returned by the getMemoryOverheadData() function in
+ * order to return memory overhead information. */
+struct redisMemOverhead {
+    size_t peak_allocated;
+    size_t total_allocated;
+    size_t startup_allocated;
+    size_t repl_backlog;
+    size_t clients_slaves;
+    size_t clients_normal;
+    size_t aof_buffer;
+    size_t overhead_total;
+    size_t dataset;
+    size_t total_keys;
+    size_t bytes_per_key;
+    float dataset_perc;
+    float peak_perc;
+    float fragmentation;
+    size_t num_dbs;
+    struct {
+        size_t dbid;
+        size_t overhead_ht_main;
+        size_t overhead_ht_expires;
+    } *db;
+};
+
 /*-----------------------------------------------------------------------------
  * Global server state
  *----------------------------------------------------------------------------*/
@@ -801,6 +896,7 @@ struct redisServer {
     list *clients_to_close;     /* Clients to close asynchronously */
     list *clients_pending_write; /* There is to write or install handler. */
     list *slaves, *monitors;    /* List of slaves and MONITORs */
+    size_t clients_memory;      /* Memory used by normal and pubsub clients */
     client *current_client; /* Current client, only used on crash report */
     int clients_paused;         /* True if clients are currently paused */
     mstime_t clients_pause_end_time; /* Time when we undo clients_paused */
@@ -824,11 +920,17 @@ struct redisServer {
     long long stat_numconnections;  /* Number of connections received */
     long long stat_expiredkeys;     /* Number of expired keys */
     long long stat_evictedkeys;     /* Number of evicted keys (maxmemory) */
+    long long stat_evictedclients;  /* Number of evicted clients (maxmemory-clients) */
     long long stat_keyspace_hits;   /* Number of successful lookups of keys */
     long long stat_keyspace_misses; /* Number of failed lookups of keys */
     size_t stat_peak_memory;        /* Max used memory record */
+    size_t initial_memory_usage;    /* Bytes used after initialization. */
     long long stat_fork_time;       /* Time needed to perform latest fork() */
     double stat_fork_rate;          /* Fork rate in GB/sec. */
+    size_t stat_rdb_cow_bytes;      /* Copy on write bytes during RDB saving. */
+    size_t stat_aof_cow_bytes;      /* Copy on write bytes during AOF rewrite. */
+    long long stat_aof_group_fsyncs; /* Number of AOF group commit fsyncs. */
+    long long stat_aof_writer_waits; /* Waits for the AOF writer thread. */
     long long stat_rejected_conn;   /* Clients rejected because of maxclients */
     long long stat_sync_full;       /* Number of full resyncs with slaves. */
     long long stat_sync_partial_ok; /* Number of accepted PSYNC requests. */
@@ -858,6 +960,8 @@ struct redisServer {
     int supervised;                 /* 1 if supervised, 0 otherwise. */
     int supervised_mode;            /* See SUPERVISED_* */
     int daemonize;                  /* True if running as a daemon */
+    int bio_close_file_workers;     /* Threads of the bio close(2) queue. */
+    int bio_aof_fsync_workers;      /* Threads of the bio AOF fsync queue. */
     clientBufferLimitsConfig client_obuf_limits[CLIENT_TYPE_OBUF_COUNT];
     /* AOF persistence */
     int aof_state;                  /* AOF_(ON|OFF|WAIT_REWRITE) */
@@ -867,6 +971,10 @@ struct redisServer {
     int aof_rewrite_perc;           /* Rewrite AOF if % growth is > M and... */
     off_t aof_rewrite_min_size;     /* the AOF file is at least N bytes. */
     off_t aof_rewrite_base_size;    /* AOF size on latest startup or rewrite. */
+    int aof_rewrite_dead_perc;      /* Rewrite AOF if % of dead bytes is > M. */
+    double aof_dataset_estimate;    /* Sampled memory used by the dataset. */
+    double aof_rewrite_dataset_estimate; /* The same when the rewrite started. */
+    double aof_live_ratio;          /* AOF bytes per dataset byte, 0 if unknown. */
     off_t aof_current_size;         /* AOF current size. */
     int aof_rewrite_scheduled;      /* Rewrite once BGSAVE terminates. */
     pid_t aof_child_pid;            /* PID if rewriting process */
@@ -884,6 +992,29 @@ struct redisServer {
     int aof_last_write_status;      /* C_OK or C_ERR */
     int aof_last_write_errno;       /* Valid if aof_last_write_status is ERR */
     int aof_load_truncated;         /* Don't stop on unexpected AOF EOF. */
+    int aof_use_rdb_preamble;       /* Use RDB preamble on AOF rewrites. */
+    int aof_multi_part;             /* Manifest + base and incr files. */
+    aofPart *aof_base;              /* Multi part AOF base file, or NULL. */
+    list *aof_incrs;                /* Multi part AOF incr files, oldest first. */
+    long long aof_base_seq;         /* Last base file sequence number used. */
+    long long aof_incr_seq;         /* Last incr file sequence number used. */
+    long long aof_rewrite_incr_seq; /* First incr file not in the rewritten base. */
+    off_t aof_last_incr_size;       /* Size of the incr file we write to. */
+    int aof_group_commit;           /* Group commit fsync with "always". */
+    int aof_load_threaded;          /* Parse the AOF in a thread on load. */
+    int aof_format;                 /* AOF_FORMAT_* of the appended commands. */
+    int aof_binary_compression;     /* AOF_BIN_CODEC_* of binary blocks. */
+    ssize_t aof_bin_block_start;    /* Open binary block in aof_buf, or -1. */
+    int aof_timestamp_enabled;      /* Annotate the AOF with timestamps. */
+    time_t aof_cur_timestamp;       /* Time of the last annotation, or 0. */
+    int aof_writer_thread;          /* Write the AOF from a writer thread. */
+    long long aof_writer_max_pending; /* Max bytes queued for the writer. */
+    long long aof_fed_offset;       /* Bytes appended to the AOF buffer. */
+    long long aof_written_offset;   /* Bytes written to the AOF file. */
+    long long aof_fsynced_offset;   /* Bytes known to be fsynced. */
+    int aof_group_fsync_in_progress; /* A group fsync is running in bio. */
+    int aof_fsync_pipe[2];          /* bio -> main thread group fsync done. */
+    list *aof_fsync_waiting;        /* Clients waiting for the group fsync. */
     /* AOF pipes used to communicate between parent and child during rewrite. */
     int aof_pipe_write_data_to_child;
     int aof_pipe_read_data_from_parent;
@@ -894,6 +1025,15 @@ struct redisServer {
     int aof_stop_sending_diff;     /* If true stop sending accumulated diffs
                                       to child process. */
     sds aof_child_diff;             /* AOF diff accumulator child side. */
+    /* Pipe and data used by the saving children to report their info. */
+    int child_info_pipe[2];         /* Pipe used to read the child info. */
+    struct {
+        int process_type;           /* CHILD_INFO_TYPE_* */
+        size_t cow_size;            /* Copy on write size. */
+        unsigned long long magic;   /* Magic value to make sure data is valid. */
+    } child_info_data;
+    int bgsave_minimize_cow;        /* Avoid writing memory while a child
+                                       is saving, to limit copy-on-write. */
     /* RDB persistence */
     long long dirty;                /* Changes to DB from the last save */
     long long dirty_before_bgsave;  /* Used to restore dirty on failed BGSAVE */
@@ -902,7 +1042,36 @@ struct redisServer {
     int saveparamslen;              /* Number of saving points */
     char *rdb_filename;             /* Name of RDB file */
     int rdb_compression;            /* Use compression in RDB? */
+    int rdb_compression_codec;      /* RDB_CODEC_* used when compressing */
     int rdb_checksum;               /* Use RDB checksum? */
+    int rdb_load_threads;           /* Threads decoding values on load */
+    int rdb_chunked;                /* Save RDB files in indexed chunks? */
+    int rdb_list_compressed_nodes;  /* Save lists as RDB_TYPE_LIST_QUICKLIST_NODES? */
+    int rdb_forkless_snapshot;      /* BGSAVE without forking a child? */
+    int rdb_save_drop_cache;        /* Drop saved RDB pages from page cache */
+    long long rdb_save_max_rate;    /* Max bytes/sec written by saving
+                                       children, 0 = no limit. */
+    struct rdbForklessSnapshot *rdb_forkless; /* Fork-less BGSAVE state,
+                                                 NULL if not in progress. */
+    long long rdb_forkless_preimages; /* Pre-images saved by the current
+                                         or last fork-less BGSAVE. */
+    int rdb_delta_snapshots;        /* BGSAVE only the keys modified since
+                                       the last snapshot? */
+    int rdb_delta_max_chain;        /* Max deltas chained to a full RDB. */
+    struct rdbDeltaTracker *rdb_delta; /* Keys modified since the last
+                                          snapshot, NULL if not tracking. */
+    struct rdbDeltaTracker *rdb_delta_saving; /* Keys the BGSAVE in progress
+                                                 is saving. */
+    char rdb_delta_base[CONFIG_RUN_ID_SIZE+1]; /* Id of the full RDB on disk,
+                                                  empty if not chainable. */
+    int rdb_delta_seq;              /* Deltas chained to the full RDB. */
+    char rdb_delta_bgsave_base[CONFIG_RUN_ID_SIZE+1]; /* Id of the full RDB
+                                                         the BGSAVE refers to. */
+    int rdb_delta_bgsave_seq;       /* Delta written by BGSAVE, 0 if full. */
+    long long rdb_delta_epoch;      /* Incremented when the dataset or the
+                                       full RDB on disk are replaced outside
+                                       of a BGSAVE. */
+    long long rdb_delta_bgsave_epoch; /* Epoch when the BGSAVE started. */
     time_t lastsave;                /* Unix time of last successful save */
     time_t lastbgsave_try;          /* Unix time of last attempted bgsave */
     time_t rdb_save_time_last;      /* Time used by last RDB save run. */
@@ -947,6 +1116,7 @@ struct redisServer {
     client *master;     /* Client that is master for this slave */
     client *cached_master; /* Cached master to be reused for PSYNC. */
     int repl_syncio_timeout; /* Timeout for synchronous I/O calls */
+    int repl_diskless_load;  /* Load the RDB from the socket, see REPL_DISKLESS_LOAD_* */
     int repl_state;          /* Replication status if the instance is a slave */
     off_t repl_transfer_size; /* Size of RDB to read from master during sync. */
     off_t repl_transfer_read; /* Amount of RDB read from master during sync. */
@@ -974,6 +1144,14 @@ struct redisServer {
     /* Limits */
     unsigned int maxclients;            /* Max number of simultaneous clients */
     unsigned long long maxmemory;   /* Max number of memory bytes to use */
+    unsigned long long maxmemory_clients; /* Max memory for all the clients */
+    unsigned long long small_objects_arena_size; /* Small objects arena size */
+    /* Shared strings interning */
+    dict *interned_strings;         /* Interned values: sds -> shared robj */
+    dict *intern_candidates;        /* Values seen so far -> occurrences */
+    unsigned long intern_max_entries; /* Max number of interned values */
+    size_t intern_max_len;          /* Max length of an interned value */
+    long long stat_intern_hits;     /* Values replaced by an interned one */
     int maxmemory_policy;           /* Policy for key eviction */
     int maxmemory_samples;          /* Pricision of random sampling */
     /* Blocked clients */
@@ -1135,10 +1313,15 @@ extern dictType zsetDictType;
 extern dictType clusterNodesDictType;
 extern dictType clusterNodesBlackListDictType;
 extern dictType dbDictType;
+extern dictType keyptrDictType;
 extern dictType shaScriptObjectDictType;
 extern double R_Zero, R_PosInf, R_NegInf, R_Nan;
 extern dictType hashDictType;
 extern dictType replScriptCacheDictType;
+extern dictType forklessKeysDictType;
+extern dictType internDictType;
+extern dictType internCandidatesDictType;
+extern dictType commandTableDictType;
 
 /*-----------------------------------------------------------------------------
  * Functions prototypes
@@ -1191,6 +1374,11 @@ void rewriteClientCommandVector(client *c, int argc, ...);
 void rewriteClientCommandArgument(client *c, int i, robj *newval);
 void replaceClientCommandVector(client *c, int argc, robj **argv);
 unsigned long getClientOutputBufferMemoryUsage(client *c);
+size_t getClientMemoryUsage(client *c);
+void updateClientMemUsage(client *c);
+void evictClientsIfNeeded(void);
+size_t sdsZmallocSize(sds s);
+size_t getStringObjectSdsUsedMemory(robj *o);
 void freeClientsInAsyncFreeQueue(void);
 void asyncCloseClientOnOutputBufferLimitReached(client *c);
 int getClientType(client *c);
@@ -1266,6 +1454,7 @@ robj *tryObjectEncoding(robj *o);
 robj *getDecodedObject(robj *o);
 size_t stringObjectLen(robj *o);
 robj *createStringObjectFromLongLong(long long value);
+extern __thread int objectSharingDisabled;
 robj *createStringObjectFromLongDouble(long double value, int humanfriendly);
 robj *createQuicklistObject(void);
 robj *createZiplistObject(void);
@@ -1286,6 +1475,10 @@ int compareStringObjects(robj *a, robj *b);
 int collateStringObjects(robj *a, robj *b);
 int equalStringObjects(robj *a, robj *b);
 unsigned long long estimateObjectIdleTime(robj *o);
+size_t objectComputeSize(robj *o, size_t sample_size);
+void resetInternedStrings(void);
+struct redisMemOverhead *getMemoryOverheadData(void);
+void freeMemoryOverheadData(struct redisMemOverhead *mh);
 #define sdsEncodedObject(objptr) (objptr->encoding == OBJ_ENCODING_RAW || objptr->encoding == OBJ_ENCODING_EMBSTR)
 
 /* Synchronous I/O with timeout */
@@ -1319,23 +1512,43 @@ int replicationSetupSlaveForFullResync(client *slave, long long offset);
 
 /* Generic persistence functions */
 void startLoading(FILE *fp);
+void startLoadingSize(off_t size);
 void loadingProgress(off_t pos);
 void stopLoading(void);
 
 /* RDB persistence */
 #include "rdb.h"
 
+/* Child info */
+void openChildInfoPipe(void);
+void closeChildInfoPipe(void);
+void sendChildInfo(int process_type);
+void receiveChildInfo(void);
+
 /* AOF persistence */
 void flushAppendOnlyFile(int force);
 void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc);
 void aofRemoveTempFile(pid_t childpid);
 int rewriteAppendOnlyFileBackground(void);
 int loadAppendOnlyFile(char *filename);
+int loadAppendOnlyFiles(void);
+void aofCreateFsyncPipe(void);
+int aofGroupCommitEnabled(void);
+void aofWriterDrain(void);
+void aofSampleDataset(void);
+long long aofLiveBytesEstimate(void);
+int aofDeadPercentage(void);
+size_t aofWriterPendingBytes(void);
+void aofClientWaitFsync(client *c);
+void aofReleaseFsyncWaiters(long long offset);
+void aofGroupFsyncDone(long long offset);
+void aofOpenMultiPart(void);
 void stopAppendOnly(void);
 int startAppendOnly(void);
 void backgroundRewriteDoneHandler(int exitcode, int bysignal);
 void aofRewriteBufferReset(void);
 unsigned long aofRewriteBufferSize(void);
+ssize_t aofReadDiffFromParent(void);
 
 /* Sorted sets data type */
 
@@ -1486,6 +1699,7 @@ long long emptyDb(void(callback)(void*));
 int selectDb(client *c, int id);
 void signalModifiedKey(redisDb *db, robj *key);
 void signalFlushedDb(int dbid);
+void slotToKeyFlush(void);
 unsigned int getKeysInSlot(unsigned int hashslot, robj **keys, unsigned int count);
 unsigned int countKeysInSlot(unsigned int hashslot);
 unsigned int delKeysInSlot(unsigned int hashslot);
@@ -1501,6 +1715,7 @@ int *evalGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 int *sortGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 int *migrateGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 int *georadiusGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
+int *memoryGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 
 /* Cluster */
 void clusterInit(void);
@@ -1687,6 +1902,7 @@ void readonlyCommand(client *c);
 void readwriteCommand(client *c);
 void dumpCommand(client *c);
 void objectCommand(client *c);
+void memoryCommand(client *c);
 void clientCommand(client *c);
 void evalCommand(client *c);
 void evalShaCommand(client *c);
@@ -888,6 +888,8 @@ void handleClientsBlockedOnLists(void) {
                         robj *value = listTypePop(o,where);
 
                         if (value) {
+                            long long aof_offset = server.aof_fed_offset;
+
                             /* Protect receiver->bpop.target, that will be
                              * freed by the next unblockClient()
                              * call. */
@@ -903,6 +905,12 @@ void handleClientsBlockedOnLists(void) {
                                     listTypePush(o,value,where);
                             }
 
+                            /* The pop is propagated outside call(): hold
+                             * the reply for the AOF group commit here. */
+                            if (server.aof_fed_offset != aof_offset &&
+                                aofGroupCommitEnabled())
+                                aofClientWaitFsync(receiver);
+
                             if (dstkey) decrRefCount(dstkey);
                             decrRefCount(value);
                         } else {
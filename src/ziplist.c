@@ -227,11 +227,6 @@
 // 获取ziplist的节点数量，ziplist在zip header的第8~9个字节保存了ZIP_LENGTH
 #define ZIPLIST_LENGTH(zl)      (*((uint16_t*)((zl)+sizeof(uint32_t)*2)))
 
-// 获取ziplist的header大小，zip header中保存了ZIP_BYTES(uint32_t)、ZIP_TAIL(uint32_t)和ZIP_LENGTH(uint16_t)，一共10字节
-#define ZIPLIST_HEADER_SIZE     (sizeof(uint32_t)*2+sizeof(uint16_t))
-
-// 获取ziplist的ZIP_END大小，是一个uint8_t类型，1字节
-#define ZIPLIST_END_SIZE        (sizeof(uint8_t))
 
 // 获取ziplist ZIP_ENTRY头节点地址，ZIP_ENTRY头指针 = ziplist首地址 + head大小
 #define ZIPLIST_ENTRY_HEAD(zl)  ((zl)+ZIPLIST_HEADER_SIZE)
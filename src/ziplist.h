@@ -38,6 +38,12 @@
 #define ZIPLIST_HEAD 0  // 压缩链表头
 #define ZIPLIST_TAIL 1  // 压缩链表尾
 
+// 获取ziplist的header大小，zip header中保存了ZIP_BYTES(uint32_t)、ZIP_TAIL(uint32_t)和ZIP_LENGTH(uint16_t)，一共10字节
+#define ZIPLIST_HEADER_SIZE     (sizeof(uint32_t)*2+sizeof(uint16_t))
+
+// 获取ziplist的ZIP_END大小，是一个uint8_t类型，1字节
+#define ZIPLIST_END_SIZE        (sizeof(uint8_t))
+
 // 创建一个压缩链表
 unsigned char *ziplistNew(void);  
 
@@ -28,6 +28,7 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "fmacros.h"
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -41,6 +42,7 @@ void zlibc_free(void *ptr) {
 
 #include <string.h>
 #include <pthread.h>
+#include <sys/mman.h>
 #include "config.h"
 #include "zmalloc.h"
 
@@ -121,12 +123,149 @@ static void zmalloc_default_oom(size_t size) {
 
 static void (*zmalloc_oom_handler)(size_t) = zmalloc_default_oom;
 
+/* ----------------------------- Small objects arena -------------------------
+ *
+ * Most of the allocations performed in the hot path are very small: the
+ * robj structures, embedded strings and the short SDS strings. When enabled
+ * with zmalloc_arena_init(), these allocations (performed with
+ * zmalloc_small()) are served by a simple slab allocator using fixed size
+ * classes, from 8 to ZMALLOC_ARENA_MAX_SIZE bytes in steps of 8 bytes.
+ *
+ * The arena is a single region of virtual memory reserved at startup, so
+ * that checking if a pointer belongs to the arena is just a range check.
+ * The region is split into pages of ZARENA_PAGE_SIZE bytes, every page is
+ * assigned to a single size class the first time it is needed, and freed
+ * objects are put into a per-class free list to be reused. Pages are never
+ * returned to the operating system.
+ *
+ * The arena is owned by the thread that initialized it: other threads
+ * calling zmalloc_small() just get memory from zmalloc(). Memory obtained
+ * from the arena must be released by the owner thread, since the free
+ * lists are not protected by any lock: zfree() and zrealloc() abort the
+ * process if another thread tries. This matters for the buffers the main
+ * thread hands to other threads, like the AOF writer or the RDB loading
+ * threads. They start as small SDS strings in the arena, and are only
+ * safe to release elsewhere once they have grown out of it.
+ *
+ * Allocations are accounted in used_memory using the size of their class,
+ * that is exactly what zmalloc_size() reports for them. */
+
+#define ZARENA_PAGE_SHIFT 16
+#define ZARENA_PAGE_SIZE (1<<ZARENA_PAGE_SHIFT)
+#define ZARENA_CLASSES (ZMALLOC_ARENA_MAX_SIZE/8)
+#define ZARENA_CLASS(size) ((size) ? ((size)+7)/8-1 : 0)
+#define ZARENA_CLASS_SIZE(c) (((c)+1)*8)
+
+static char *zarena_base = NULL;        /* Start of the reserved region. */
+static char *zarena_end = NULL;         /* End of the reserved region. */
+static char *zarena_next_page = NULL;   /* First page not yet assigned. */
+static unsigned char *zarena_page_class; /* Size class of every page. */
+static void *zarena_freelist[ZARENA_CLASSES];
+static char *zarena_bump[ZARENA_CLASSES];     /* Next free slot in page. */
+static char *zarena_bump_end[ZARENA_CLASSES]; /* End of the current page. */
+static __thread int zarena_owner = 0;
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+#define zarena_contains(p) ((char*)(p) >= zarena_base && (char*)(p) < zarena_end)
+
+static size_t zarena_class_size(void *ptr) {
+    size_t page = ((char*)ptr-zarena_base) >> ZARENA_PAGE_SHIFT;
+    return ZARENA_CLASS_SIZE(zarena_page_class[page]);
+}
+
+/* Reserve 'size' bytes of virtual memory (rounded to the page size) for
+ * the arena and make the calling thread its owner. Physical memory is only
+ * used as pages are assigned to size classes. Returns 0 on success, -1 if
+ * the arena is already initialized or the memory can't be reserved. */
+int zmalloc_arena_init(size_t size) {
+    size_t pages = (size+ZARENA_PAGE_SIZE-1) >> ZARENA_PAGE_SHIFT;
+    void *base;
+
+    if (zarena_base || pages == 0) return -1;
+    base = mmap(NULL,pages*ZARENA_PAGE_SIZE,PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANON|MAP_NORESERVE,-1,0);
+    if (base == MAP_FAILED) return -1;
+    zarena_page_class = calloc(pages,1);
+    if (!zarena_page_class) {
+        munmap(base,pages*ZARENA_PAGE_SIZE);
+        return -1;
+    }
+    zarena_base = zarena_next_page = base;
+    zarena_end = zarena_base+pages*ZARENA_PAGE_SIZE;
+    zarena_owner = 1;
+    return 0;
+}
+
+/* Allocate memory for small objects. The arena is used if initialized by
+ * the calling thread and the object fits one of the size classes, otherwise
+ * (or when the arena is exhausted) the allocation is served by zmalloc(). */
+void *zmalloc_small(size_t size) {
+    int c;
+    void *ptr;
+
+    if (!zarena_owner || size > ZMALLOC_ARENA_MAX_SIZE) return zmalloc(size);
+    c = ZARENA_CLASS(size);
+    if ((ptr = zarena_freelist[c]) != NULL) {
+        zarena_freelist[c] = *(void**)ptr;
+    } else {
+        if (zarena_bump[c] == zarena_bump_end[c]) {
+            size_t csize = ZARENA_CLASS_SIZE(c);
+            char *page = zarena_next_page;
+
+            if (page == zarena_end) return zmalloc(size);
+            zarena_next_page += ZARENA_PAGE_SIZE;
+            zarena_page_class[(page-zarena_base) >> ZARENA_PAGE_SHIFT] = c;
+            zarena_bump[c] = page;
+            zarena_bump_end[c] = page+(ZARENA_PAGE_SIZE/csize)*csize;
+        }
+        ptr = zarena_bump[c];
+        zarena_bump[c] += ZARENA_CLASS_SIZE(c);
+    }
+    update_zmalloc_stat_alloc(ZARENA_CLASS_SIZE(c));
+    return ptr;
+}
+
+static void zarena_free(void *ptr) {
+    size_t page = ((char*)ptr-zarena_base) >> ZARENA_PAGE_SHIFT;
+    int c = zarena_page_class[page];
+
+    if (!zarena_owner) {
+        fprintf(stderr, "zmalloc: arena memory at %p released by a thread "
+                        "not owning the arena\n", ptr);
+        fflush(stderr);
+        abort();
+    }
+    update_zmalloc_stat_free(ZARENA_CLASS_SIZE(c));
+    *(void**)ptr = zarena_freelist[c];
+    zarena_freelist[c] = ptr;
+}
+
+/* Objects growing out of their size class move to the normal allocator. */
+static void *zarena_realloc(void *ptr, size_t size) {
+    size_t oldsize = zarena_class_size(ptr);
+    void *newptr;
+
+    if (size <= oldsize) return ptr;
+    newptr = zmalloc(size);
+    memcpy(newptr,ptr,oldsize);
+    zarena_free(ptr);
+    return newptr;
+}
+
+/* Return the amount of memory assigned to the arena size classes. */
+size_t zmalloc_arena_allocated(void) {
+    return zarena_next_page-zarena_base;
+}
+
 void *zmalloc(size_t size) {
     void *ptr = malloc(size+PREFIX_SIZE);
 
     if (!ptr) zmalloc_oom_handler(size);
 #ifdef HAVE_MALLOC_SIZE
-    update_zmalloc_stat_alloc(zmalloc_size(ptr));
+    update_zmalloc_stat_alloc(zmalloc_raw_size(ptr));
     return ptr;
 #else
     *((size_t*)ptr) = size;
@@ -140,7 +279,7 @@ void *zcalloc(size_t size) {
 
     if (!ptr) zmalloc_oom_handler(size);
 #ifdef HAVE_MALLOC_SIZE
-    update_zmalloc_stat_alloc(zmalloc_size(ptr));
+    update_zmalloc_stat_alloc(zmalloc_raw_size(ptr));
     return ptr;
 #else
     *((size_t*)ptr) = size;
@@ -157,13 +296,14 @@ void *zrealloc(void *ptr, size_t size) {
     void *newptr;
 
     if (ptr == NULL) return zmalloc(size);
+    if (zarena_contains(ptr)) return zarena_realloc(ptr,size);
 #ifdef HAVE_MALLOC_SIZE
-    oldsize = zmalloc_size(ptr);
+    oldsize = zmalloc_raw_size(ptr);
     newptr = realloc(ptr,size);
     if (!newptr) zmalloc_oom_handler(size);
 
     update_zmalloc_stat_free(oldsize);
-    update_zmalloc_stat_alloc(zmalloc_size(newptr));
+    update_zmalloc_stat_alloc(zmalloc_raw_size(newptr));
     return newptr;
 #else
     realptr = (char*)ptr-PREFIX_SIZE;
@@ -178,19 +318,23 @@ void *zrealloc(void *ptr, size_t size) {
 #endif
 }
 
-/* Provide zmalloc_size() for systems where this function is not provided by
- * malloc itself, given that in that case we store a header with this
- * information as the first bytes of every allocation. */
-#ifndef HAVE_MALLOC_SIZE
+/* Return the size of the allocation pointed by 'ptr'. Memory served by the
+ * small objects arena is sized according to its size class. Otherwise we
+ * ask malloc itself, or, when this function is not provided by malloc, we
+ * use the header we store as the first bytes of every allocation. */
 size_t zmalloc_size(void *ptr) {
+    if (zarena_contains(ptr)) return zarena_class_size(ptr);
+#ifdef HAVE_MALLOC_SIZE
+    return zmalloc_raw_size(ptr);
+#else
     void *realptr = (char*)ptr-PREFIX_SIZE;
     size_t size = *((size_t*)realptr);
     /* Assume at least that all the allocations are padded at sizeof(long) by
      * the underlying allocator. */
     if (size&(sizeof(long)-1)) size += sizeof(long)-(size&(sizeof(long)-1));
     return size+PREFIX_SIZE;
-}
 #endif
+}
 
 void zfree(void *ptr) {
 #ifndef HAVE_MALLOC_SIZE
@@ -199,8 +343,12 @@ void zfree(void *ptr) {
 #endif
 
     if (ptr == NULL) return;
+    if (zarena_contains(ptr)) {
+        zarena_free(ptr);
+        return;
+    }
 #ifdef HAVE_MALLOC_SIZE
-    update_zmalloc_stat_free(zmalloc_size(ptr));
+    update_zmalloc_stat_free(zmalloc_raw_size(ptr));
     free(ptr);
 #else
     realptr = (char*)ptr-PREFIX_SIZE;
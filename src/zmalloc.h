@@ -40,7 +40,7 @@
 #include <google/tcmalloc.h>
 #if (TC_VERSION_MAJOR == 1 && TC_VERSION_MINOR >= 6) || (TC_VERSION_MAJOR > 1)
 #define HAVE_MALLOC_SIZE 1
-#define zmalloc_size(p) tc_malloc_size(p)
+#define zmalloc_raw_size(p) tc_malloc_size(p)
 #else
 #error "Newer version of tcmalloc required"
 #endif
@@ -50,7 +50,7 @@
 #include <jemalloc/jemalloc.h>
 #if (JEMALLOC_VERSION_MAJOR == 2 && JEMALLOC_VERSION_MINOR >= 1) || (JEMALLOC_VERSION_MAJOR > 2)
 #define HAVE_MALLOC_SIZE 1
-#define zmalloc_size(p) je_malloc_usable_size(p)
+#define zmalloc_raw_size(p) je_malloc_usable_size(p)
 #else
 #error "Newer version of jemalloc required"
 #endif
@@ -58,7 +58,7 @@
 #elif defined(__APPLE__)
 #include <malloc/malloc.h>
 #define HAVE_MALLOC_SIZE 1
-#define zmalloc_size(p) malloc_size(p)
+#define zmalloc_raw_size(p) malloc_size(p)
 #endif
 
 #ifndef ZMALLOC_LIB
@@ -79,9 +79,12 @@ size_t zmalloc_get_private_dirty(void);
 size_t zmalloc_get_smap_bytes_by_field(char *field);
 size_t zmalloc_get_memory_size(void);
 void zlibc_free(void *ptr);
-
-#ifndef HAVE_MALLOC_SIZE
 size_t zmalloc_size(void *ptr);
-#endif
+
+/* Small objects arena, see zmalloc.c for more information. */
+#define ZMALLOC_ARENA_MAX_SIZE 64
+int zmalloc_arena_init(size_t size);
+void *zmalloc_small(size_t size);
+size_t zmalloc_arena_allocated(void);
 
 #endif /* __ZMALLOC_H */
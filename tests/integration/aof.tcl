@@ -251,6 +251,741 @@ tags {"aof"} {
         }
     }
 
+    ## Multi part AOF: a manifest listing a base file and incr files.
+    proc aof_parts {dir} {
+        lsort [glob -nocomplain -tails -directory $dir appendonly.aof*]
+    }
+
+    proc wait_aof_rewrite {client} {
+        wait_for_condition 50 100 {
+            [string match {*aof_rewrite_in_progress:0*} [$client info persistence]]
+        } else {
+            fail "AOF rewrite is taking too much time."
+        }
+    }
+
+    set server_path [tmpdir server.aof-multi-part]
+
+    start_server_aof [list dir $server_path aof-multi-part yes] {
+        set client [redis [dict get $srv host] [dict get $srv port]]
+
+        test "Multi part AOF: writes are logged into the first incr file" {
+            $client set foo bar
+            $client incr counter
+            assert_equal {appendonly.aof.1.incr.aof appendonly.aof.manifest} \
+                [aof_parts $server_path]
+        }
+
+        test "Multi part AOF: rewrite replaces the files with a new base file" {
+            $client bgrewriteaof
+            wait_aof_rewrite $client
+            $client incr counter
+            assert_equal {appendonly.aof.1.base.aof appendonly.aof.2.incr.aof appendonly.aof.manifest} \
+                [aof_parts $server_path]
+            assert_equal 2 [$client get counter]
+            $client debug loadaof
+            assert_equal bar [$client get foo]
+            assert_equal 2 [$client get counter]
+        }
+
+        test "Multi part AOF: BGREWRITEAOF inside MULTI is scheduled" {
+            $client multi
+            $client incr counter
+            $client bgrewriteaof
+            $client incr counter
+            set res [$client exec]
+            assert_match {*scheduled*} [lindex $res 1]
+            wait_for_condition 50 100 {
+                [aof_parts $server_path] eq {appendonly.aof.2.base.aof appendonly.aof.3.incr.aof appendonly.aof.manifest}
+            } else {
+                fail "Scheduled AOF rewrite not performed"
+            }
+            wait_aof_rewrite $client
+            $client debug loadaof
+            assert_equal 4 [$client get counter]
+        }
+    }
+
+    start_server_aof [list dir $server_path aof-multi-part yes] {
+        test "Multi part AOF: the dataset is loaded from all the files" {
+            set client [redis [dict get $srv host] [dict get $srv port]]
+            wait_for_condition 50 100 {
+                [catch {$client ping} e] == 0
+            } else {
+                fail "Loading DB is taking too much time."
+            }
+            assert_equal bar [$client get foo]
+            assert_equal 4 [$client get counter]
+        }
+    }
+
+    set server_path [tmpdir server.aof-multi-part]
+    set aof_path "$server_path/appendonly.aof"
+    create_aof {
+        append_to_aof [formatCommand set foo hello]
+    }
+
+    start_server_aof [list dir $server_path aof-multi-part yes] {
+        set client [redis [dict get $srv host] [dict get $srv port]]
+
+        test "Multi part AOF: an existing AOF is used as base file" {
+            wait_for_condition 50 100 {
+                [catch {$client ping} e] == 0
+            } else {
+                fail "Loading DB is taking too much time."
+            }
+            assert_equal hello [$client get foo]
+            set fp [open "$server_path/appendonly.aof.manifest"]
+            set manifest [read $fp]
+            close $fp
+            assert_match {file "appendonly.aof" seq 0 type b*} $manifest
+        }
+
+        test "Multi part AOF: enabling the AOF at runtime writes a new base file" {
+            $client config set appendonly no
+            $client set foo world
+            $client config set appendonly yes
+            wait_aof_rewrite $client
+            assert_equal {appendonly.aof.1.base.aof appendonly.aof.2.incr.aof appendonly.aof.manifest} \
+                [aof_parts $server_path]
+            $client debug loadaof
+            assert_equal world [$client get foo]
+        }
+    }
+
+    start_server_aof [list dir $server_path] {
+        test "Multi part AOF: a manifest with aof-multi-part disabled is fatal" {
+            set pattern "*manifest*exists but aof-multi-part is disabled*"
+            set retry 10
+            while {$retry} {
+                set result [exec tail -n1 < [dict get $srv stdout]]
+                if {[string match $pattern $result]} {
+                    break
+                }
+                incr retry -1
+                after 1000
+            }
+            if {$retry == 0} {
+                error "assertion:expected error not found on config file"
+            }
+            assert_equal 0 [is_alive $srv]
+        }
+    }
+
+    start_server {overrides {appendonly {yes} appendfilename {appendonly.aof} appendfsync always aof-group-commit yes}} {
+        test {AOF group commit: replies are released after the fsync} {
+            set clients {}
+            for {set j 0} {$j < 10} {incr j} {
+                set rd [redis_deferring_client]
+                lappend clients $rd
+                for {set i 0} {$i < 100} {incr i} {
+                    $rd incr counter
+                }
+            }
+            set replies {}
+            foreach rd $clients {
+                for {set i 0} {$i < 100} {incr i} {
+                    lappend replies [$rd read]
+                }
+                $rd close
+            }
+            assert_equal 1000 [llength [lsort -unique $replies]]
+            assert {[status r aof_group_fsyncs] > 0}
+            assert_equal 0 [status r aof_fsync_waiting_clients]
+            r debug loadaof
+            assert_equal 1000 [r get counter]
+        }
+
+        test {AOF group commit: the reply of a served BLPOP waits for the fsync} {
+            set rd [redis_deferring_client]
+            $rd blpop blist 0
+            wait_for_condition 50 100 {
+                [s blocked_clients] == 1
+            } else {
+                fail "BLPOP not blocked"
+            }
+            # The INFO is processed before the next fsync, as it is part of
+            # the same read as the push that served the BLPOP.
+            set rd2 [redis_deferring_client]
+            $rd2 write "[formatCommand rpush blist a][formatCommand info persistence]"
+            $rd2 flush
+            assert_equal 1 [$rd2 read]
+            assert_match {*aof_fsync_waiting_clients:2*} [$rd2 read]
+            assert_equal {blist a} [$rd read]
+            $rd close
+            $rd2 close
+            r debug loadaof
+            r exists blist
+        } {0}
+
+        test {AOF group commit: turning it off releases the replies} {
+            set rd [redis_deferring_client]
+            $rd incr counter
+            r config set aof-group-commit no
+            assert_equal 1001 [$rd read]
+            $rd close
+            r incr counter
+            r config set aof-group-commit yes
+            r incr counter
+            r debug loadaof
+            r get counter
+        } {1003}
+    }
+
+    start_server {overrides {appendonly {yes} appendfilename {appendonly.aof} appendfsync always aof-group-commit yes bio-aof-fsync-workers 2}} {
+        proc bio_stat {type field} {
+            regexp "bio_$type:(\[^\r\n\]*,)?$field=(\[0-9.\]+)" [r info bio] -> _ value
+            return $value
+        }
+
+        test {Bio: the workers of every job type are reported by INFO} {
+            assert_error {*Unsupported CONFIG parameter*} {r config set bio-aof-fsync-workers 4}
+            list [bio_stat close_file workers] [bio_stat aof_fsync workers] \
+                 [lindex [r config get bio-aof-fsync-workers] 1]
+        } {1 2 2}
+
+        test {Bio: group commit fsyncs are processed and measured} {
+            set processed [bio_stat aof_fsync processed]
+            set rd [redis_deferring_client]
+            for {set i 0} {$i < 100} {incr i} {
+                $rd incr counter
+            }
+            for {set i 0} {$i < 100} {incr i} {
+                $rd read
+            }
+            $rd close
+            r config set appendfsync everysec
+            r incr counter
+            after 1100
+            r config set appendfsync always
+            wait_for_condition 50 100 {
+                [bio_stat aof_fsync queued] == 0 &&
+                [bio_stat aof_fsync active] == 0
+            } else {
+                fail "Bio AOF fsync jobs still pending"
+            }
+            assert {[bio_stat aof_fsync processed] > $processed}
+            regexp {bio_aof_fsync_latency:([^\r\n]*)} [r info bio] -> buckets
+            set total 0
+            foreach bucket [split $buckets ,] {
+                incr total [lindex [split $bucket =] 1]
+            }
+            assert_equal [bio_stat aof_fsync processed] $total
+            r get counter
+        } {101}
+
+        test {Bio: closing the old AOF after a rewrite} {
+            set processed [bio_stat close_file processed]
+            r bgrewriteaof
+            wait_for_condition 50 100 {
+                [bio_stat close_file processed] > $processed
+            } else {
+                fail "The old AOF was not closed in background"
+            }
+            r debug loadaof
+            r get counter
+        } {101}
+    }
+
+    start_server {overrides {appendonly {yes} appendfilename {appendonly.aof} aof-writer-thread yes}} {
+        test {AOF writer thread: the writes are written to the AOF} {
+            set clients {}
+            for {set j 0} {$j < 10} {incr j} {
+                set rd [redis_deferring_client]
+                lappend clients $rd
+                for {set i 0} {$i < 100} {incr i} {
+                    $rd incr counter
+                    $rd rpush list [string repeat x 1000]
+                }
+            }
+            foreach rd $clients {
+                for {set i 0} {$i < 200} {incr i} {
+                    $rd read
+                }
+                $rd close
+            }
+            r debug loadaof
+            list [r get counter] [r llen list] [status r aof_writer_pending_bytes]
+        } {1000 1000 0}
+
+        test {AOF writer thread: backpressure with aof-writer-max-pending} {
+            r config set aof-writer-max-pending 0
+            for {set i 0} {$i < 100} {incr i} {
+                r incr counter
+            }
+            r config set aof-writer-max-pending 64mb
+            assert_match {*aof_writer_backpressure_waits:*} [r info persistence]
+            r debug loadaof
+            r get counter
+        } {1100}
+
+        test {AOF writer thread: AOF rewrite while the writer is busy} {
+            set rd [redis_deferring_client]
+            for {set i 0} {$i < 1000} {incr i} {
+                $rd incr counter
+            }
+            r bgrewriteaof
+            for {set i 0} {$i < 1000} {incr i} {
+                $rd read
+            }
+            $rd close
+            wait_for_condition 50 100 {
+                [string match {*aof_rewrite_in_progress:0*} [r info persistence]]
+            } else {
+                fail "AOF rewrite is taking too much time."
+            }
+            r incr counter
+            r debug loadaof
+            r get counter
+        } {2101}
+
+        test {AOF writer thread: switching it off or to appendfsync always} {
+            r config set aof-writer-thread no
+            r incr counter
+            r config set aof-writer-thread yes
+            r incr counter
+            r config set appendfsync always
+            r incr counter
+            r config set appendfsync everysec
+            r incr counter
+            r debug loadaof
+            r get counter
+        } {2105}
+    }
+
+    start_server {overrides {appendonly {yes} appendfilename {appendonly.aof} auto-aof-rewrite-percentage 0 auto-aof-rewrite-dead-percentage 100}} {
+        test {AOF dead bytes: no estimate before the first rewrite} {
+            for {set j 0} {$j < 1000} {incr j} {
+                r set key:$j [string repeat x 100]
+            }
+            list [status r aof_live_bytes_estimate] \
+                 [status r aof_dead_percentage_estimate]
+        } {-1 -1}
+
+        test {AOF dead bytes: overwritten keys are estimated as dead} {
+            r bgrewriteaof
+            wait_for_condition 50 100 {
+                [status r aof_rewrite_in_progress] == 0 &&
+                [status r aof_live_bytes_estimate] != -1
+            } else {
+                fail "AOF rewrite is taking too much time."
+            }
+            assert {[status r aof_dead_percentage_estimate] < 30}
+            for {set i 0} {$i < 5} {incr i} {
+                for {set j 0} {$j < 1000} {incr j} {
+                    r set key:$j [string repeat y 100]
+                }
+            }
+            after 1100
+            assert {[status r aof_dead_percentage_estimate] > 50}
+            assert {[status r aof_dead_bytes_estimate] > 0}
+        }
+
+        test {AOF dead bytes: auto-aof-rewrite-dead-percentage triggers a rewrite} {
+            r config set auto-aof-rewrite-min-size 0
+            r config set auto-aof-rewrite-dead-percentage 50
+            wait_for_condition 50 100 {
+                [string match {*Starting automatic rewriting of AOF on*dead bytes*} [exec tail -n20 < [srv 0 stdout]]]
+            } else {
+                fail "Can't find the automatic AOF rewrite into recent logs"
+            }
+            wait_for_condition 50 100 {
+                [status r aof_rewrite_in_progress] == 0 &&
+                [status r aof_dead_percentage_estimate] < 50
+            } else {
+                fail "AOF rewrite is taking too much time."
+            }
+            r config set auto-aof-rewrite-dead-percentage 0
+            r debug loadaof
+            r get key:999
+        } [string repeat y 100]
+
+        test {AOF dead bytes: no estimate while auto-aof-rewrite-dead-percentage is 0} {
+            status r aof_live_bytes_estimate
+        } {-1}
+    }
+
+    ## Threaded AOF loading: the same files are accepted and rejected.
+    set server_path [tmpdir server.aof-threaded]
+    set aof_path "$server_path/appendonly.aof"
+
+    create_aof {
+        for {set j 0} {$j < 3000} {incr j} {
+            append_to_aof [formatCommand incr foo]
+        }
+        append_to_aof [formatCommand set big [string repeat x 5000000]]
+        append_to_aof [formatCommand multi]
+        append_to_aof [formatCommand sadd set a b c]
+        append_to_aof [formatCommand exec]
+        append_to_aof [string range [formatCommand incr foo] 0 end-1]
+    }
+
+    start_server_aof [list dir $server_path aof-load-truncated yes aof-load-threaded yes] {
+        set client [redis [dict get $srv host] [dict get $srv port]]
+
+        test "Threaded AOF loading: commands up to the short read are loaded" {
+            assert_equal 3000 [$client get foo]
+            assert_equal 5000000 [$client strlen big]
+            assert_equal 3 [$client scard set]
+        }
+
+        test "Threaded AOF loading: the truncated AOF can be appended" {
+            $client incr foo
+        }
+    }
+
+    start_server_aof [list dir $server_path aof-load-threaded yes] {
+        set client [redis [dict get $srv host] [dict get $srv port]]
+
+        test "Threaded AOF loading: the fixed AOF is loaded" {
+            assert_equal 3001 [$client get foo]
+            $client config set aof-load-threaded no
+            $client debug loadaof
+            assert_equal 3001 [$client get foo]
+            assert_equal 5000000 [$client strlen big]
+        }
+    }
+
+    create_aof {
+        append_to_aof [formatCommand set foo hello]
+        append_to_aof [formatCommand multi]
+        append_to_aof [formatCommand set bar world]
+    }
+
+    start_server_aof [list dir $server_path aof-load-truncated no aof-load-threaded yes] {
+        test "Threaded AOF loading: unfinished MULTI is an error" {
+            wait_for_condition 10 1000 {
+                [string match "*Unexpected end of file reading the append only file*" \
+                    [exec tail -n1 < [dict get $srv stdout]]]
+            } else {
+                fail "expected error not found in the log"
+            }
+        }
+    }
+
+    create_aof {
+        append_to_aof [formatCommand set foo hello]
+        append_to_aof "!!!"
+        append_to_aof [formatCommand set foo hello]
+    }
+
+    start_server_aof [list dir $server_path aof-load-truncated yes aof-load-threaded yes] {
+        test "Threaded AOF loading: bad format is an error" {
+            wait_for_condition 10 1000 {
+                [string match "*Bad file format reading the append only file*" \
+                    [exec tail -n1 < [dict get $srv stdout]]]
+            } else {
+                fail "expected error not found in the log"
+            }
+        }
+    }
+
+    ## Binary AOF: commands appended as blocks of binary records.
+    proc read_binary {path} {
+        set fp [open $path r]
+        fconfigure $fp -translation binary
+        set data [read $fp]
+        close $fp
+        return $data
+    }
+
+    proc write_binary {path data} {
+        set fp [open $path w]
+        fconfigure $fp -translation binary
+        puts -nonewline $fp $data
+        close $fp
+    }
+
+    set server_path [tmpdir server.aof-binary]
+    set aof_path "$server_path/appendonly.aof"
+
+    start_server_aof [list dir $server_path aof-format binary] {
+        set client [redis [dict get $srv host] [dict get $srv port]]
+
+        test "Binary AOF: commands are appended as binary blocks" {
+            for {set j 0} {$j < 1000} {incr j} {
+                $client incr foo
+            }
+            $client set big [string repeat x 100000]
+            $client rpush list 3 1 2
+            $client sort list store sorted
+            $client multi
+            $client sadd set a b c
+            $client expire set 1000
+            $client exec
+            $client select 9
+            $client set bar "a\r\nb\x00c"
+            $client select 0
+            assert_equal \xab [string index [read_binary $aof_path] 0]
+            assert {[file size $aof_path] < 100000}
+        }
+
+        test "Binary AOF: commands are loaded back" {
+            $client debug loadaof
+            assert_equal 1000 [$client get foo]
+            assert_equal 100000 [$client strlen big]
+            assert_equal {1 2 3} [$client lrange sorted 0 -1]
+            assert_equal 3 [$client scard set]
+            set ttl [$client ttl set]
+            assert {$ttl > 900 && $ttl <= 1000}
+            $client select 9
+            assert_equal "a\r\nb\x00c" [$client get bar]
+            $client select 0
+        }
+
+        test "Binary AOF: RESP and binary commands can be mixed" {
+            $client config set aof-format resp
+            $client incr foo
+            $client config set aof-format binary
+            $client config set aof-binary-compression lz4
+            $client incr foo
+            $client config set aof-binary-compression no
+            $client incr foo
+            $client debug loadaof
+            $client get foo
+        } {1003}
+    }
+
+    test "Binary AOF: Utility should confirm the AOF is valid" {
+        set result [exec src/redis-check-aof $aof_path]
+        assert_match "*AOF is valid*" $result
+    }
+
+    test "Binary AOF: Utility should convert the AOF to RESP and back" {
+        set resp_path "$server_path/resp.aof"
+        set bin_path "$server_path/binary.aof"
+        exec src/redis-check-aof --convert resp $aof_path $resp_path
+        assert_equal * [string index [read_binary $resp_path] 0]
+        assert_equal -1 [string first \xab [read_binary $resp_path]]
+        exec src/redis-check-aof --convert binary $resp_path $bin_path
+        assert_equal \xab [string index [read_binary $bin_path] 0]
+        set result [exec src/redis-check-aof $bin_path]
+        assert_match "*AOF is valid*" $result
+        file rename -force $resp_path $aof_path
+    }
+
+    start_server_aof [list dir $server_path aof-load-threaded yes] {
+        test "Binary AOF: the AOF converted to RESP is loaded" {
+            set client [redis [dict get $srv host] [dict get $srv port]]
+            assert_equal 1003 [$client get foo]
+            assert_equal {1 2 3} [$client lrange sorted 0 -1]
+            $client select 9
+            $client get bar
+        } "a\r\nb\x00c"
+    }
+
+    ## Binary blocks are loaded or truncated as a whole.
+    create_aof {
+        for {set j 0} {$j < 10} {incr j} {
+            append_to_aof [formatCommand incr foo]
+        }
+    }
+    exec src/redis-check-aof --convert binary $aof_path $bin_path
+    set block [read_binary $bin_path]
+    write_binary $aof_path "[formatCommand set bar hello]$block[string range $block 0 end-5]"
+
+    foreach threaded {no yes} {
+        start_server_aof [list dir $server_path aof-load-truncated yes aof-load-threaded $threaded] {
+            test "Binary AOF: a truncated block is discarded (threaded: $threaded)" {
+                set client [redis [dict get $srv host] [dict get $srv port]]
+                assert_equal hello [$client get bar]
+                $client get foo
+            } {10}
+        }
+        write_binary $aof_path "[formatCommand set bar hello]$block[string range $block 0 end-5]"
+    }
+
+    test "Binary AOF: Utility should be able to fix a truncated block" {
+        catch {exec src/redis-check-aof $aof_path} result
+        assert_match "*not valid*" $result
+        set result [exec src/redis-check-aof --fix $aof_path << "y\n"]
+        assert_match "*Successfully truncated AOF*" $result
+        file size $aof_path
+    } [string length "[formatCommand set bar hello]$block"]
+
+    set corrupted [string replace $block end-1 end-1 \x00]
+    if {$corrupted eq $block} {
+        set corrupted [string replace $block end-1 end-1 \x01]
+    }
+    write_binary $aof_path "$block$corrupted"
+
+    foreach threaded {no yes} {
+        start_server_aof [list dir $server_path aof-load-truncated yes aof-load-threaded $threaded] {
+            test "Binary AOF: a corrupted block is an error (threaded: $threaded)" {
+                wait_for_condition 10 1000 {
+                    [string match "*Bad file format reading the append only file*" \
+                        [exec tail -n1 < [dict get $srv stdout]]]
+                } else {
+                    fail "expected error not found in the log"
+                }
+            }
+        }
+    }
+
+    test "Binary AOF: Utility should detect a corrupted block" {
+        catch {exec src/redis-check-aof $aof_path} result
+        assert_match "*Bad CRC64 of binary block*not valid*" $result
+        catch {exec src/redis-check-aof --convert resp $aof_path $resp_path} result
+        assert_match "*not valid*" $result
+        file exists $resp_path
+    } {0}
+
+    ## Timestamp annotations for point-in-time recovery.
+    set server_path [tmpdir server.aof-timestamp]
+    set aof_path "$server_path/appendonly.aof"
+
+    start_server_aof [list dir $server_path aof-timestamp-enabled yes] {
+        set client [redis [dict get $srv host] [dict get $srv port]]
+
+        test "AOF timestamps: commands are annotated with the time" {
+            $client set foo bar
+            $client incr counter
+            set content [read_binary $aof_path]
+            assert_match "#TS:*\r\n*" $content
+            regexp {#TS:(\d+)} $content -> ts
+            assert {abs($ts - [clock seconds]) < 5}
+        }
+
+        test "AOF timestamps: the annotated AOF is loaded" {
+            $client config set aof-format binary
+            $client incr counter
+            $client debug loadaof
+            $client config set aof-load-threaded yes
+            $client debug loadaof
+            $client config set aof-load-threaded no
+            list [$client get foo] [$client get counter]
+        } {bar 2}
+
+        test "AOF timestamps: the rewritten AOF starts with a timestamp" {
+            $client config set aof-format resp
+            $client bgrewriteaof
+            wait_aof_rewrite $client
+            $client incr counter
+            set content [read_binary $aof_path]
+            assert_match "#TS:*\r\n*" $content
+            $client debug loadaof
+            $client get counter
+        } {3}
+    }
+
+    create_aof {
+        append_to_aof "#TS:1000\r\n"
+        append_to_aof [formatCommand set foo 1]
+        append_to_aof "#TS:2000\r\n"
+        append_to_aof [formatCommand set foo 2]
+        append_to_aof [formatCommand multi]
+        append_to_aof [formatCommand set bar 1]
+        append_to_aof "#TS:3000\r\n"
+        append_to_aof [formatCommand set bar 2]
+        append_to_aof [formatCommand exec]
+        append_to_aof "#TS:4000\r\n"
+        append_to_aof [formatCommand set foo 4]
+    }
+
+    test "AOF timestamps: Utility should truncate the AOF to a timestamp" {
+        set result [exec src/redis-check-aof --truncate-to-timestamp 3500 $aof_path << "y\n"]
+        assert_match "*Successfully truncated AOF to timestamp 3500*" $result
+        set result [exec src/redis-check-aof --truncate-to-timestamp 3500 $aof_path]
+        assert_match "*AOF is valid*" $result
+        set result [exec src/redis-check-aof --truncate-to-timestamp 2500 $aof_path << "y\n"]
+        assert_match "*Successfully truncated AOF to timestamp 2500*" $result
+    }
+
+    start_server_aof [list dir $server_path aof-load-truncated no] {
+        test "AOF timestamps: the AOF truncated to a timestamp is loaded" {
+            set client [redis [dict get $srv host] [dict get $srv port]]
+            list [$client get foo] [$client exists bar]
+        } {2 0}
+    }
+
+    ## Parallel scan: all the corrupt ranges are reported, and the valid
+    ## commands after them can be salvaged.
+    set server_path [tmpdir server.aof-scan]
+    set aof_path "$server_path/appendonly.aof"
+    set salvaged_path "$server_path/salvaged.aof"
+
+    create_aof {
+        append_to_aof "#TS:1000\r\n"
+        for {set j 0} {$j < 30000} {incr j} {
+            append_to_aof [formatCommand set key:$j [string repeat x 100]]
+            if {$j == 10000} {
+                append_to_aof "*3\r\n\$3\r\nset\r\n\$3\r\nfoo"
+            } elseif {$j == 20000} {
+                append_to_aof [formatCommand multi]
+                append_to_aof [formatCommand set bar 1]
+                append_to_aof "garbage"
+                append_to_aof [formatCommand set bar 2]
+                append_to_aof [formatCommand exec]
+            }
+        }
+        append_to_aof [formatCommand multi]
+        append_to_aof [formatCommand set bar 3]
+    }
+
+    proc scan_ranges {result} {
+        regexp -all -inline -line {^0x.*$} $result
+    }
+
+    test "AOF scan: Utility should report all the corrupt ranges" {
+        catch {exec src/redis-check-aof --scan --threads 1 $aof_path} result
+        assert_match "*corrupt_ranges=3,*AOF is not valid*" $result
+        assert_match {*Expected \\r\\n*Expected prefix*Reached EOF before reading EXEC*} $result
+        set ranges [scan_ranges $result]
+        catch {exec src/redis-check-aof --scan --threads 4 $aof_path} result
+        assert_match "*chunks=3,*" $result
+        assert_equal $ranges [scan_ranges $result]
+    }
+
+    test "AOF scan: Utility should salvage the valid commands" {
+        set result [exec src/redis-check-aof --salvage --threads 4 $aof_path $salvaged_path]
+        assert_match "*AOF salvaged*" $result
+        exec src/redis-check-aof --scan $salvaged_path
+    } {*AOF is valid*}
+
+    start_server_aof [list dir $server_path appendfilename salvaged.aof aof-load-truncated no] {
+        test "AOF scan: the salvaged AOF is loaded" {
+            set client [redis [dict get $srv host] [dict get $srv port]]
+            wait_for_condition 50 100 {
+                [catch {$client ping}] == 0
+            } else {
+                fail "Loading the salvaged AOF is taking too much time."
+            }
+            list [$client dbsize] [$client exists bar] [$client exists key:29999]
+        } {30000 0 1}
+    }
+
+    create_aof {
+        append_to_aof [formatCommand select 1]
+        append_to_aof [formatCommand set foo 1]
+        append_to_aof "*0\r\n"
+        append_to_aof [formatCommand set bar 1]
+        append_to_aof [formatCommand set baz 1]
+    }
+
+    test "AOF scan: commands without arguments are corrupt" {
+        catch {exec src/redis-check-aof --scan $aof_path} result
+        assert_match "*Invalid number of arguments: 0*corrupt_ranges=1,*" $result
+    }
+
+    test "AOF scan: the DB is selected again after a corrupt range" {
+        set result [exec src/redis-check-aof --salvage $aof_path $salvaged_path]
+        assert_match "*Warning: 2 commands*salvaged into DB 1*" $result
+        exec src/redis-check-aof --scan $salvaged_path
+    } {*AOF is valid*}
+
+    start_server_aof [list dir $server_path appendfilename salvaged.aof aof-load-truncated no] {
+        test "AOF scan: the salvaged commands are loaded into the selected DB" {
+            set client [redis [dict get $srv host] [dict get $srv port]]
+            wait_for_condition 50 100 {
+                [catch {$client ping}] == 0
+            } else {
+                fail "Loading the salvaged AOF is taking too much time."
+            }
+            $client select 1
+            $client dbsize
+        } {3}
+    }
+
     start_server {overrides {appendonly {yes} appendfilename {appendonly.aof}}} {
         test {Redis should not try to convert DEL into EXPIREAT for EXPIRE -1} {
             r set x 10
@@ -96,3 +96,476 @@ start_server_and_kill_it [list "dir" $server_path] {
         }
     }
 }
+
+set server_path [tmpdir "server.rdb-load-threads-test"]
+exec cp tests/assets/encodings.rdb $server_path
+
+start_server [list overrides [list "dir" $server_path "dbfilename" "encodings.rdb" "rdb-load-threads" 4]] {
+    test {RDB encoding loading test with loading threads} {
+        r select 0
+        set csv [csvdump r]
+        r config set rdb-load-threads 0
+        r debug reload
+        assert_equal $csv [csvdump r]
+    }
+
+    test {RDB loading threads produce the same dataset as serial loading} {
+        r flushall
+        r config set hash-max-ziplist-entries 2
+        r config set zset-max-ziplist-entries 2
+        r config set set-max-intset-entries 2
+        r select 9
+        createComplexDataset r 10000
+        r select 10
+        createComplexDataset r 1000
+        r set mykey myvalue
+        r expire mykey 1000
+        set digest [r debug digest]
+        # Only chunked files are loaded by the threads.
+        r config set rdb-chunked yes
+        r config set rdb-load-threads 4
+        r debug reload
+        assert_equal $digest [r debug digest]
+        assert {[r ttl mykey] > 900}
+        r config set rdb-load-threads 1
+        r debug reload
+        assert_equal $digest [r debug digest]
+    }
+}
+
+set server_path [tmpdir "server.rdb-chunked-test"]
+
+start_server [list overrides [list "dir" $server_path "rdb-chunked" "yes"]] {
+    test {Chunked RDB save and reload produce the same dataset} {
+        r config set hash-max-ziplist-entries 2
+        r config set zset-max-ziplist-entries 2
+        r debug populate 50000
+        r select 9
+        createComplexDataset r 5000
+        r set mykey myvalue
+        r expire mykey 1000
+        set digest [r debug digest]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        assert {[r ttl mykey] > 900}
+        r config set rdb-load-threads 2
+        r debug reload
+        assert_equal $digest [r debug digest]
+        r config set rdbcompression no
+        r debug reload
+        assert_equal $digest [r debug digest]
+    }
+
+    test {Chunked RDB files use a dedicated RDB version} {
+        r save
+        set fd [open [file join $server_path dump.rdb] r]
+        fconfigure $fd -translation binary
+        set magic [read $fd 9]
+        close $fd
+        set magic
+    } {REDIS0008}
+}
+
+# Corrupt the payload of the first chunk: the chunk checksum should catch it
+# even when the RDB checksum is not verified.
+set fd [open [file join $server_path dump.rdb] r+]
+fconfigure $fd -translation binary
+seek $fd 4096
+puts -nonewline $fd "corrupted"
+close $fd
+
+start_server_and_kill_it [list "dir" $server_path "rdbchecksum" "no"] {
+    test {Server should not start if an RDB chunk is corrupted} {
+        wait_for_condition 50 100 {
+            [string match {*chunk CRC error*} \
+                [exec tail -n10 < [dict get $srv stdout]]]
+        } else {
+            fail "Server started even if RDB chunk was corrupted!"
+        }
+    }
+}
+
+start_server_and_kill_it [list "dir" $server_path "rdbchecksum" "no" "rdb-load-threads" 2] {
+    test {Server should not start if an RDB chunk is corrupted, loading threads} {
+        wait_for_condition 50 100 {
+            [string match {*chunk CRC error*} \
+                [exec tail -n10 < [dict get $srv stdout]]]
+        } else {
+            fail "Server started even if RDB chunk was corrupted!"
+        }
+    }
+}
+
+# Read an RDB length at the current position of 'fd'.
+proc read_rdb_len {fd} {
+    binary scan [read $fd 1] cu b
+    switch [expr {$b >> 6}] {
+        0 {return [expr {$b & 63}]}
+        1 {
+            binary scan [read $fd 1] cu b2
+            return [expr {(($b & 63) << 8) | $b2}]
+        }
+        2 {
+            if {$b == 0x80} {
+                binary scan [read $fd 4] Iu len
+            } else {
+                binary scan [read $fd 8] Wu len
+            }
+            return $len
+        }
+    }
+}
+
+set server_path [tmpdir "server.rdb-chunk-len-test"]
+
+start_server [list overrides [list "dir" $server_path "rdb-chunked" "yes"]] {
+    r debug populate 1000
+    r save
+}
+
+# Make the uncompressed length of the first chunk huge: the loader should
+# reject it before allocating the memory it claims. The first chunk offset
+# is found in the chunks index, located by the offset stored before the EOF
+# opcode and the checksum.
+set fd [open [file join $server_path dump.rdb] r+]
+fconfigure $fd -translation binary
+seek $fd -17 end
+binary scan [read $fd 8] w index_offset
+seek $fd [expr {$index_offset+1}]
+read_rdb_len $fd
+binary scan [read $fd 8] w chunk_offset
+seek $fd [expr {$chunk_offset+1}]
+for {set j 0} {$j < 5} {incr j} {read_rdb_len $fd}
+puts -nonewline $fd [binary format w 0x4000000000000000]
+close $fd
+
+start_server_and_kill_it [list "dir" $server_path "rdbchecksum" "no"] {
+    test {Server should not start if an RDB chunk length is corrupted} {
+        wait_for_condition 50 100 {
+            [string match {*Invalid RDB chunk length*} \
+                [exec tail -n10 < [dict get $srv stdout]]]
+        } else {
+            fail "Server started even if RDB chunk length was corrupted!"
+        }
+    }
+}
+
+set server_path [tmpdir "server.rdb-codec-test"]
+
+start_server [list overrides [list "dir" $server_path "rdb-compression-codec" "lz4"]] {
+    test {RDB save and reload with the lz4 compression codec} {
+        r debug populate 10000
+        r select 9
+        createComplexDataset r 5000
+        r set bigstring [string repeat "abcdefghij" 10000]
+        set digest [r debug digest]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        r config set rdb-chunked yes
+        r debug reload
+        assert_equal $digest [r debug digest]
+        r config set rdb-load-threads 2
+        r debug reload
+        assert_equal $digest [r debug digest]
+    }
+
+    test {RDB files compressed with lz4 use a dedicated RDB version} {
+        r config set rdb-chunked no
+        set versions {}
+        foreach codec {lz4 lzf} {
+            r config set rdb-compression-codec $codec
+            r save
+            set fd [open [file join $server_path dump.rdb] r]
+            fconfigure $fd -translation binary
+            lappend versions [read $fd 9]
+            close $fd
+        }
+        set versions
+    } {REDIS0008 REDIS0007}
+}
+
+set server_path [tmpdir "server.rdb-forkless-test"]
+
+start_server [list overrides [list "dir" $server_path "rdb-forkless-snapshot" "yes"]] {
+    test {Fork-less BGSAVE saves the dataset as it was when started} {
+        r config set save ""
+        r debug populate 100000
+        r select 10
+        createComplexDataset r 1000
+        r set flushed:key original
+        set digest [r debug digest]
+        r bgsave
+        # Flush a DB, and modify, delete and create keys while the snapshot
+        # is in progress, both keys already saved and keys not reached yet.
+        # The keys of the flushed DB are saved after the flush.
+        r flushdb
+        r set flushed:key modified
+        r select 9
+        set j 0
+        while {[s rdb_bgsave_in_progress]} {
+            for {set k 0} {$k < 100} {incr k; incr j} {
+                r set key:[randomInt 100000] modified
+                r del key:[randomInt 100000]
+                r set newkey:$j value
+            }
+        }
+        assert {[s rdb_forkless_preimages] > 0}
+        assert_equal ok [s rdb_last_bgsave_status]
+        set forkless_digest $digest
+    }
+}
+
+start_server [list overrides [list "dir" $server_path]] {
+    test {Fork-less BGSAVE RDB file is loaded correctly} {
+        assert_equal $forkless_digest [r debug digest]
+    }
+}
+
+start_server {} {
+    test {Saving children report their copy-on-write size} {
+        r debug populate 10000
+        r bgsave
+        waitForBgsave r
+        r bgrewriteaof
+        waitForBgrewriteaof r
+        # How many pages the children dirtied depends on timing: just check
+        # the sizes are reported.
+        foreach field {rdb_last_cow_size aof_last_cow_size} {
+            assert {[string is integer -strict [s $field]]}
+            assert {[s $field] >= 0}
+        }
+    }
+
+    test {BGSAVE with bgsave-minimize-cow} {
+        r config set bgsave-minimize-cow yes
+        r select 10
+        createComplexDataset r 1000 useexpire
+        r bgsave
+        createComplexDataset r 1000
+        waitForBgsave r
+        r config set bgsave-minimize-cow no
+        set digest [r debug digest]
+        r debug reload
+        assert_equal $digest [r debug digest]
+    }
+}
+
+set server_path [tmpdir "server.rdb-throttle-test"]
+
+start_server [list overrides [list "dir" $server_path "rdb-save-drop-cache" "yes"]] {
+    test {BGSAVE is throttled by rdb-save-max-rate} {
+        r select 10
+        createComplexDataset r 1000
+        r select 9
+        r debug populate 100000
+        r config set rdb-save-max-rate 1mb
+        set start [clock milliseconds]
+        r bgsave
+        waitForBgsave r
+        set elapsed [expr {[clock milliseconds]-$start}]
+        r config set rdb-save-max-rate 0
+        set size [file size [file join $server_path dump.rdb]]
+        assert_equal ok [s rdb_last_bgsave_status]
+        # Allow for the sleeps granularity and the cron period.
+        assert {$elapsed >= ($size*1000/(1024*1024))*0.8}
+        set throttled_digest [r debug digest]
+    }
+}
+
+start_server [list overrides [list "dir" $server_path]] {
+    test {Throttled BGSAVE RDB file is loaded correctly} {
+        assert_equal $throttled_digest [r debug digest]
+    }
+}
+
+start_server {overrides {"list-compress-depth" 1 "list-max-ziplist-size" -1 "rdb-list-compressed-nodes" yes}} {
+    test {Lists saved with rdb-list-compressed-nodes are reloaded correctly} {
+        for {set j 0} {$j < 20} {incr j} {
+            for {set i 0} {$i < 500} {incr i} {
+                r rpush biglist:$j "compressible value [expr {$i % 10}] ---------------"
+            }
+        }
+        r rpush smalllist a b c
+        set digest [r debug digest]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        assert_equal 500 [r llen biglist:3]
+        assert_equal quicklist [r object encoding biglist:3]
+    }
+
+    test {Lists saved with rdb-list-compressed-nodes with a different compress depth} {
+        r config set list-compress-depth 0
+        r debug reload
+        assert_equal $digest [r debug digest]
+        r config set list-compress-depth 3
+        r debug reload
+        assert_equal $digest [r debug digest]
+        assert_equal {compressible value 5 ---------------} [r lindex biglist:7 255]
+    }
+
+    test {Lists saved with rdb-list-compressed-nodes with loading threads} {
+        r config set rdb-load-threads 2
+        r debug reload
+        r config set rdb-load-threads 0
+        assert_equal $digest [r debug digest]
+    }
+
+    test {DUMP / RESTORE of lists with rdb-list-compressed-nodes} {
+        set dump [r dump biglist:5]
+        r del biglist:5
+        r restore biglist:5 0 $dump
+        assert_equal $digest [r debug digest]
+    }
+}
+
+# The CRC64 of the DUMP payloads, see crc64.c.
+proc crc64 {data} {
+    set crc 0
+    binary scan $data cu* bytes
+    foreach byte $bytes {
+        set crc [expr {$crc ^ $byte}]
+        for {set j 0} {$j < 8} {incr j} {
+            if {$crc & 1} {
+                set crc [expr {($crc >> 1) ^ 0x95ac9329ac4bc9b5}]
+            } else {
+                set crc [expr {$crc >> 1}]
+            }
+        }
+    }
+    return $crc
+}
+
+start_server {overrides {"list-compress-depth" 1 "list-max-ziplist-size" 2 "rdb-list-compressed-nodes" yes}} {
+    test {RESTORE rejects a compressed quicklist node with a wrong count} {
+        # Three nodes: the head and the tail are small ziplists saved as
+        # plain strings, the one in the middle is compressed.
+        r rpush mylist a b [string repeat x 100] [string repeat x 100] c d
+        set dump [r dump mylist]
+        # Type, number of nodes, then count, size and the 17 bytes of the
+        # ziplist of the head node: the count of the compressed node is at
+        # offset 22.
+        binary scan $dump cucucucucu type nodes count sz zllen
+        assert_equal {3 2 0 17} [list $nodes $count $sz $zllen]
+        binary scan $dump @22cu count
+        assert_equal 2 $count
+        set payload [string range $dump 0 end-8]
+        set payload [string replace $payload 22 22 [binary format cu 1]]
+        set crc [crc64 $payload]
+        set dump "$payload[binary format w $crc]"
+        catch {r restore mylist2 0 $dump} err
+        set err
+    } {*Bad data format*}
+
+    test {RESTORE rejects a plain quicklist node shorter than a ziplist} {
+        # One node of one entry, stored as the 3 bytes string "abc".
+        set payload [binary format cucucucucua3s 15 1 1 0 3 abc 8]
+        catch {r restore mylist3 0 "$payload[binary format w [crc64 $payload]]"} err
+        set err
+    } {*Bad data format*}
+}
+
+set server_path [tmpdir "server.rdb-delta-test"]
+
+start_server [list overrides [list "dir" $server_path "rdb-delta-snapshots" yes]] {
+    # Don't save a full RDB on shutdown.
+    r config set save ""
+
+    test {First BGSAVE with rdb-delta-snapshots saves a full RDB} {
+        createComplexDataset r 1000
+        r select 10
+        r debug populate 1000
+        r bgsave
+        waitForBgsave r
+        assert_equal ok [s rdb_last_bgsave_status]
+        assert_equal 0 [s rdb_delta_chain_len]
+        assert_equal 0 [s rdb_delta_tracked_keys]
+        file exists [file join $server_path dump.rdb.delta.1]
+    } {0}
+
+    test {BGSAVE with rdb-delta-snapshots saves only the modified keys} {
+        r set key:1 newvalue
+        r del key:2
+        r expire key:3 1000
+        r rpush newlist a b c
+        assert_equal 4 [s rdb_delta_tracked_keys]
+        r bgsave
+        waitForBgsave r
+        assert_equal ok [s rdb_last_bgsave_status]
+        assert_equal 1 [s rdb_delta_chain_len]
+        assert_equal 0 [s rdb_delta_tracked_keys]
+        set delta [file join $server_path dump.rdb.delta.1]
+        assert {[file size $delta] < [file size [file join $server_path dump.rdb]]}
+    }
+
+    test {Delta snapshots record the flushed DBs} {
+        r select 9
+        r flushdb
+        r set foo bar
+        r select 10
+        r incr counter
+        r bgsave
+        waitForBgsave r
+        assert_equal 2 [s rdb_delta_chain_len]
+        set digest [r debug digest]
+        file exists [file join $server_path dump.rdb.delta.2]
+    } {1}
+}
+
+start_server [list overrides [list "dir" $server_path "rdb-delta-snapshots" yes]] {
+    r config set save ""
+
+    test {Delta snapshots are loaded at startup after the RDB} {
+        assert_equal $digest [r debug digest]
+        assert_equal 2 [s rdb_delta_chain_len]
+    }
+
+    test {Delta snapshots are compacted after rdb-delta-max-chain deltas} {
+        r config set rdb-delta-max-chain 3
+        r select 10
+        r set key:10 foo
+        r bgsave
+        waitForBgsave r
+        assert_equal 3 [s rdb_delta_chain_len]
+        r set key:11 bar
+        r bgsave
+        waitForBgsave r
+        assert_equal 0 [s rdb_delta_chain_len]
+        set digest [r debug digest]
+        file exists [file join $server_path dump.rdb.delta.1]
+    } {0}
+}
+
+start_server [list overrides [list "dir" $server_path]] {
+    test {Compacted RDB is loaded correctly} {
+        assert_equal $digest [r debug digest]
+    }
+}
+
+start_server [list overrides [list "dir" $server_path "rdb-delta-snapshots" yes]] {
+    r config set save ""
+
+    test {Disabling delta snapshots removes the deltas on the next full save} {
+        set delta [file join $server_path dump.rdb.delta.1]
+        r select 10
+        r set key:12 foo
+        r bgsave
+        waitForBgsave r
+        r set key:13 bar
+        r bgsave
+        waitForBgsave r
+        assert {[file exists $delta]}
+        r config set rdb-delta-snapshots no
+        assert {[file exists $delta]}
+        r bgsave
+        waitForBgsave r
+        assert_equal ok [s rdb_last_bgsave_status]
+        set digest [r debug digest]
+        file exists $delta
+    } {0}
+}
+
+start_server [list overrides [list "dir" $server_path]] {
+    test {RDB saved after disabling delta snapshots is loaded correctly} {
+        assert_equal $digest [r debug digest]
+    }
+}
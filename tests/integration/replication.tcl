@@ -266,3 +266,153 @@ foreach dl {no yes} {
         }
     }
 }
+
+foreach mdl {no yes} {
+    foreach sdl {on-empty-db swapdb} {
+        start_server {tags {"repl"}} {
+            set master [srv 0 client]
+            $master config set repl-diskless-sync $mdl
+            $master config set repl-diskless-sync-delay 1
+            set master_host [srv 0 host]
+            set master_port [srv 0 port]
+            $master select 9
+            createComplexDataset $master 10000 useexpire
+            start_server {} {
+                set slave [srv 0 client]
+                $slave config set repl-diskless-load $sdl
+                # With swapdb the slave dataset is not required to be empty,
+                # add some old data the full sync is expected to replace.
+                if {$sdl eq {swapdb}} {
+                    $slave select 11
+                    $slave set oldkey oldvalue
+                    $slave select 9
+                    $slave set oldkey oldvalue
+                }
+
+                test "Slave loads the RDB from the socket, diskless=$mdl, diskless-load=$sdl" {
+                    $slave slaveof $master_host $master_port
+                    wait_for_condition 500 100 {
+                        [lindex [$slave role] 3] eq {connected}
+                    } else {
+                        fail "Slave still not connected after some time"
+                    }
+                    # Make sure the slave processed everything the master
+                    # sent after the RDB payload.
+                    $master set newkey newvalue
+                    wait_for_condition 500 100 {
+                        [$slave get newkey] eq {newvalue}
+                    } else {
+                        fail "Slave not receiving the replication stream"
+                    }
+                    assert_equal [$master debug digest] [$slave debug digest]
+                    $slave select 11
+                    assert_equal 0 [$slave dbsize]
+                    $slave select 9
+                }
+            }
+        }
+    }
+}
+
+start_server {tags {"repl"}} {
+    set master [srv 0 client]
+    $master config set repl-diskless-sync yes
+    $master config set repl-diskless-sync-delay 0
+    set master_host [srv 0 host]
+    set master_port [srv 0 port]
+    set master_pid [srv 0 pid]
+    $master debug populate 1000000
+    start_server {} {
+        set slave [srv 0 client]
+        $slave config set repl-diskless-load swapdb
+        $slave set oldkey oldvalue
+
+        test "Slave keeps its dataset if the load from the socket fails, diskless-load=swapdb" {
+            $slave slaveof $master_host $master_port
+            wait_for_condition 500 10 {
+                [s loading] eq 1
+            } else {
+                fail "Slave not loading the RDB from the socket"
+            }
+            # Kill the master in the middle of the transfer.
+            exec kill -9 $master_pid
+            wait_for_condition 500 100 {
+                [s loading] eq 0
+            } else {
+                fail "Slave still loading after the master was killed"
+            }
+            assert {[log_file_matches [srv 0 stdout] "*Restoring the old dataset*"]}
+            list [$slave dbsize] [$slave get oldkey]
+        } {1 oldvalue}
+    }
+}
+
+# A fake master that sends 'payload' as the RDB of a full resync, truncated
+# to the first 'len' bytes, and then closes the connection.
+proc fake_master_accept {chan host port} {
+    set ::fake_master_chan $chan
+}
+
+proc fake_master_serve {chan payload len} {
+    fconfigure $chan -translation binary -buffering none
+    while {[gets $chan line] >= 0} {
+        switch -- [string toupper [lindex [string trim $line] 0]] {
+            PING {puts -nonewline $chan "+PONG\r\n"}
+            REPLCONF {puts -nonewline $chan "+OK\r\n"}
+            PSYNC {
+                puts -nonewline $chan "+FULLRESYNC [string repeat a 40] 0\r\n"
+                puts -nonewline $chan "\$[string length $payload]\r\n"
+                puts -nonewline $chan [string range $payload 0 [expr {$len-1}]]
+                break
+            }
+        }
+    }
+    close $chan
+}
+
+start_server {tags {"repl"}} {
+    set slave [srv 0 client]
+
+    test "Slave survives a short read of the RDB checksum with load threads" {
+        # A chunked RDB, so that it is decoded by the load threads.
+        for {set j 0} {$j < 1000} {incr j} {
+            $slave rpush list:$j a b c $j
+        }
+        $slave config set rdb-chunked yes
+        $slave save
+        $slave config set rdb-chunked no
+        set fp [open [file join [lindex [$slave config get dir] 1] \
+                                [lindex [$slave config get dbfilename] 1]] r]
+        fconfigure $fp -translation binary
+        set payload [read $fp]
+        close $fp
+        $slave flushall
+        $slave set oldkey oldvalue
+
+        $slave config set repl-diskless-load swapdb
+        $slave config set rdb-load-threads 2
+        set port [find_available_port [expr {$::port+2000}]]
+        set listener [socket -server fake_master_accept $port]
+        set ::fake_master_chan {}
+        set timer [after 10000 {set ::fake_master_chan timeout}]
+        $slave slaveof 127.0.0.1 $port
+        vwait ::fake_master_chan
+        after cancel $timer
+        close $listener
+        if {$::fake_master_chan eq {timeout}} {
+            fail "Slave not connecting to the fake master"
+        }
+        # Cut the payload in the middle of the trailing 8 bytes checksum.
+        fake_master_serve $::fake_master_chan $payload \
+            [expr {[string length $payload]-4}]
+
+        wait_for_condition 500 10 {
+            [log_file_matches [srv 0 stdout] "*Short read or OOM loading DB from the stream*"]
+        } else {
+            fail "Slave did not fail loading the truncated RDB"
+        }
+        $slave slaveof no one
+        $slave config set rdb-load-threads 0
+        list [$slave ping] [$slave dbsize] [$slave get oldkey]
+    } {PONG 1 oldvalue}
+}
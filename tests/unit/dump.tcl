@@ -6,6 +6,23 @@ start_server {tags {"dump"}} {
         list [r exists foo] [r restore foo 0 $encoded] [r ttl foo] [r get foo]
     } {0 OK -1 bar}
 
+    test {DUMP / RESTORE with the lz4 compression codec} {
+        r config set rdb-compression-codec lz4
+        set value [string repeat "compressible value " 100]
+        r set foo $value
+        r rpush mylist $value $value
+        set encoded [r dump foo]
+        set encoded_list [r dump mylist]
+        r config set rdb-compression-codec lzf
+        r del foo mylist
+        r restore foo 0 $encoded
+        r restore mylist 0 $encoded_list
+        # The payload is marked with the RDB version that can read it.
+        list [expr {[string length $encoded] < 200}] \
+             [r get foo] [r lrange mylist 0 -1] \
+             [binary scan [string range $encoded end-9 end-8] s ver] $ver
+    } [list 1 [string repeat "compressible value " 100] [lrepeat 2 [string repeat "compressible value " 100]] 1 8]
+
     test {RESTORE can set an arbitrary expire to the materialized key} {
         r set foo bar
         set encoded [r dump foo]
@@ -142,3 +142,87 @@ start_server {tags {"maxmemory"}} {
         }
     }
 }
+
+start_server {tags {"maxmemory"}} {
+    test "Client memory is reported by CLIENT LIST and INFO" {
+        set mem [s clients_memory]
+        assert {$mem > 0}
+        assert_match {*tot-mem=*} [r client list]
+    }
+
+    test "maxmemory-clients disconnects the client using the most memory" {
+        set evicted [s evicted_clients]
+        set rd [redis_deferring_client]
+        $rd ping
+        assert_equal PONG [$rd read]
+        r config set maxmemory-clients 400kb
+        # Send an incomplete big argument: the query buffer grows but the
+        # command is never executed. The write may fail if the client is
+        # disconnected before all the data is sent.
+        catch {
+            $rd write "*3\r\n\$3\r\nset\r\n\$3\r\nkey\r\n\$1000000\r\n"
+            $rd write [string repeat x 500000]
+            $rd flush
+        }
+        wait_for_condition 50 100 {
+            [s evicted_clients] == $evicted+1
+        } else {
+            fail "Client not evicted"
+        }
+        assert {[s clients_memory] <= 400*1024}
+        # The other clients are still connected.
+        assert_equal PONG [r ping]
+        catch {$rd read} e
+        $rd close
+        r config set maxmemory-clients 0
+    }
+}
+
+start_server {tags {"maxmemory"}} {
+    test "CONFIG SET maxmemory-clients does not free the calling client" {
+        set evicted [s evicted_clients]
+        set rd [redis_deferring_client]
+        $rd config set maxmemory-clients 1
+        # Every client is evicted after the command is executed, possibly
+        # before the reply is sent, including the one used by 'r'.
+        catch {$rd read}
+        $rd close
+        # Restore the limit with a single command from a new connection,
+        # that is not evicted since the command is executed first.
+        set fd [socket [srv 0 host] [srv 0 port]]
+        fconfigure $fd -translation binary
+        puts -nonewline $fd "CONFIG SET maxmemory-clients 0\r\n"
+        flush $fd
+        set reply [gets $fd]
+        close $fd
+        reconnect
+        assert_match {+OK*} $reply
+        assert {[s evicted_clients] > $evicted}
+    }
+}
+
+start_server {tags {"maxmemory"}} {
+    test "maxmemory - LRU eviction picks the best candidate across DBs" {
+        r config set maxmemory 0
+        r config set maxmemory-policy allkeys-lru
+        r flushall
+        # Old keys in DB 9, recently accessed keys in DB 10.
+        for {set j 0} {$j < 1000} {incr j} {
+            r set old:$j [string repeat x 100]
+        }
+        after 2000
+        r select 10
+        for {set j 0} {$j < 1000} {incr j} {
+            r set new:$j [string repeat x 100]
+        }
+        set used [s used_memory]
+        r config set maxmemory [expr {$used-50000}]
+        r set trigger x
+        r config set maxmemory 0
+        set new_keys [r dbsize]
+        r select 9
+        set old_keys [r dbsize]
+        assert {$old_keys < 1000}
+        assert {$new_keys > 990}
+    }
+}
@@ -35,3 +35,144 @@ start_server {tags {"memefficiency"}} {
         }
     }
 }
+
+start_server {tags {"memefficiency"}} {
+    test {MEMORY USAGE of non existing key returns nil} {
+        r del nokey
+        r memory usage nokey
+    } {}
+
+    test {MEMORY USAGE of an expired key returns nil} {
+        r debug set-active-expire 0
+        r set expiring foo px 1
+        after 10
+        set usage [r memory usage expiring]
+        r debug set-active-expire 1
+        list $usage [r exists expiring]
+    } {{} 0}
+
+    test {MEMORY USAGE grows with the value size} {
+        r set small foo
+        r set big [string repeat x 10000]
+        set small [r memory usage small]
+        set big [r memory usage big]
+        assert {$small > 0 && $big > 10000 && $big > $small}
+    }
+
+    test {MEMORY USAGE works for every aggregated encoding} {
+        r del mylist myset myzset myhash
+        for {set j 0} {$j < 1000} {incr j} {
+            r rpush mylist $j
+            r sadd myset "element:$j"
+            r zadd myzset $j "element:$j"
+            r hset myhash "field:$j" $j
+        }
+        foreach key {mylist myset myzset myhash} {
+            set sampled [r memory usage $key]
+            set full [r memory usage $key samples 0]
+            assert {$sampled > 1000 && $full > 1000}
+        }
+    }
+
+    test {MEMORY USAGE with wrong SAMPLES argument} {
+        r set foo bar
+        catch {r memory usage foo samples -1} e
+        set e
+    } {*syntax*}
+
+    test {COMMAND GETKEYS reports the key of MEMORY USAGE} {
+        list [r command getkeys memory usage mykey samples 5] \
+             [r command getkeys memory stats]
+    } {mykey {}}
+
+    test {MEMORY STATS reports overhead and dataset} {
+        r flushall
+        r set foo bar
+        set stats [r memory stats]
+        assert_equal 1 [dict get $stats keys.count]
+        assert {[dict exists $stats db.9]}
+        assert {[dict get $stats total.allocated] >= [dict get $stats overhead.total]}
+    }
+}
+
+start_server {tags {"memefficiency"} overrides {small-objects-arena-size 16mb}} {
+    test {Small objects arena serves small objects} {
+        assert {[s small_objects_arena_allocated] > 0}
+        for {set j 0} {$j < 10000} {incr j} {
+            r set key:$j val:$j
+        }
+        r append key:1 [string repeat x 1000]
+        assert_equal [string length [r get key:1]] 1005
+        r debug reload
+        assert_equal [r dbsize] 10000
+        assert_equal [r get key:9999] val:9999
+        set used [s used_memory]
+        r flushall
+        assert {[s used_memory] < $used}
+    }
+
+    test {Small objects arena with the loading and AOF writer threads} {
+        r config set rdb-chunked yes
+        r config set rdb-load-threads 2
+        r config set aof-writer-thread yes
+        r config set aof-load-threaded yes
+        r config set appendonly yes
+        wait_for_condition 50 100 {
+            [s aof_rewrite_in_progress] == 0 && [s aof_enabled] == 1
+        } else {
+            fail "AOF rewrite not terminated"
+        }
+        for {set j 0} {$j < 1000} {incr j} {
+            r set key:$j val:$j
+            r hset hash:$j f v
+        }
+        r set a b
+        r debug reload
+        assert_equal [r dbsize] 2001
+        assert_equal [r get a] b
+        r debug loadaof
+        assert_equal [r dbsize] 2001
+        assert_equal [r hget hash:999 f] v
+    }
+}
+
+start_server {tags {"memefficiency"} overrides {intern-max-entries 100}} {
+    test {Repeated small values are interned} {
+        for {set j 0} {$j < 100} {incr j} {
+            r set key:$j true
+        }
+        assert {[r object refcount key:99] > 90}
+        assert {[s interned_strings] == 1}
+        assert {[s intern_hits] > 90}
+    }
+
+    test {Interned values are unshared when modified} {
+        r append key:0 "!"
+        assert_equal {true!} [r get key:0]
+        assert_equal {true} [r get key:1]
+    }
+
+    test {Values longer than intern-max-len are not interned} {
+        r config set intern-max-len 5
+        for {set j 0} {$j < 10} {incr j} {
+            r set long:$j "longvalue"
+        }
+        assert_equal 1 [r object refcount long:9]
+    }
+
+    test {Interning is disabled by maxmemory with LRU policy} {
+        r config set intern-max-len 32
+        r config set maxmemory 1073741824
+        r config set maxmemory-policy allkeys-lru
+        for {set j 0} {$j < 10} {incr j} {
+            r set lru:$j "enabled"
+        }
+        r config set maxmemory 0
+        assert_equal 1 [r object refcount lru:9]
+    }
+
+    test {intern-max-entries is capped} {
+        catch {r config set intern-max-entries 100000000000} e
+        set e
+    } {*ERR*}
+}
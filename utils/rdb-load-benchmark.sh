@@ -0,0 +1,67 @@
+#!/bin/bash
+#
+# Generate a big RDB file and compare the time needed to load it serially
+# with the time needed using rdb-load-threads.
+#
+# Usage: rdb-load-benchmark.sh <keys> <fields-per-key> [threads ...]
+#
+# Every key is a hash of <fields-per-key> fields with 100 bytes values, so
+# that it is saved (and loaded) with the hash table encoding, and decoding
+# it is real work. The file is saved in chunks (rdb-chunked), since only
+# chunked files are decoded by the loading threads, and without compression.
+# The default is to compare 0 (serial) with 2 and 4 threads, with a file of
+# about 1GB.
+
+KEYS=${1:-100000}
+FIELDS=${2:-100}
+shift 2
+THREADS=${@:-2 4}
+PORT=${PORT:-21500}
+DIR=${DIR:-/tmp/rdb-load-benchmark}
+SERVER=$(dirname $0)/../src/redis-server
+CLI=$(dirname $0)/../src/redis-cli
+
+wait_server() {
+    while ! $CLI -p $PORT ping 2>/dev/null | grep -q PONG; do
+        sleep 0.1
+    done
+}
+
+mkdir -p $DIR
+rm -f $DIR/dump.rdb $DIR/*.log
+
+echo "Generating $KEYS hashes of $FIELDS fields..."
+$SERVER --port $PORT --dir $DIR --save "" --rdbcompression no \
+    --rdb-chunked yes --logfile gen.log --daemonize yes
+wait_server
+BATCH=1000
+for ((j = 0; j < KEYS; j += BATCH)); do
+    $CLI -p $PORT eval "
+        local val = string.rep('v',96)
+        for k = ARGV[1], ARGV[1]+ARGV[2]-1 do
+            for f = 1, ARGV[3] do
+                redis.call('hset','key:'..k,'field:'..f,val..string.format('%04d',f))
+            end
+        end" 0 $j $BATCH $FIELDS > /dev/null
+done
+$CLI -p $PORT save > /dev/null
+$CLI -p $PORT shutdown nosave 2>/dev/null
+echo "RDB size: $(du -h $DIR/dump.rdb | cut -f1)"
+
+for threads in 0 $THREADS; do
+    # Read the file once, so that every run loads it from the page cache.
+    cat $DIR/dump.rdb > /dev/null
+    $SERVER --port $PORT --dir $DIR --save "" --rdb-load-threads $threads \
+        --logfile load-$threads.log --daemonize yes
+    wait_server
+    # CPU time of the main thread (user+system), mostly spent loading: it is
+    # the lower bound of the load time with enough cores for the threads.
+    PID=$($CLI -p $PORT info server | grep process_id | cut -d: -f2 | tr -d '\r')
+    CPU=$(awk -v hz=$(getconf CLK_TCK) '{printf "%.2f", ($14+$15)/hz}' \
+        /proc/$PID/task/$PID/stat)
+    echo "rdb-load-threads $threads:" \
+        $(grep -o "DB loaded from disk: .*" $DIR/load-$threads.log) \
+        "(main thread CPU: $CPU seconds)"
+    $CLI -p $PORT shutdown nosave 2>/dev/null
+    while $CLI -p $PORT ping > /dev/null 2>&1; do sleep 0.1; done
+done